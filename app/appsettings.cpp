@@ -15,6 +15,9 @@ AppSettings::AppSettings( QObject *parent ): QObject( parent )
   bool autoCenter = settings.value( "autoCenter", false ).toBool();
   int gpsTolerance = settings.value( "gpsTolerance", 10 ).toInt();
   int lineRecordingInterval = settings.value( "lineRecordingInterval", 3 ).toInt();
+  int syncConcurrency = settings.value( "syncConcurrency", 1 ).toInt();
+  int bandwidthLimit = settings.value( "bandwidthLimit", 0 ).toInt();
+  bool syncLogEnabled = settings.value( "syncLogEnabled", false ).toBool();
   settings.endGroup();
 
   setDefaultProject( path );
@@ -23,6 +26,9 @@ AppSettings::AppSettings( QObject *parent ): QObject( parent )
   setAutoCenterMapChecked( autoCenter );
   setGpsAccuracyTolerance( gpsTolerance );
   setLineRecordingInterval( lineRecordingInterval );
+  setSyncConcurrency( syncConcurrency );
+  setBandwidthLimit( bandwidthLimit );
+  setSyncLogEnabled( syncLogEnabled );
 }
 
 QString AppSettings::defaultLayer() const
@@ -163,3 +169,60 @@ void AppSettings::setLineRecordingInterval( int value )
     emit lineRecordingIntervalChanged();
   }
 }
+
+int AppSettings::syncConcurrency() const
+{
+  return mSyncConcurrency;
+}
+
+void AppSettings::setSyncConcurrency( int value )
+{
+  if ( mSyncConcurrency != value && value > 0 )
+  {
+    mSyncConcurrency = value;
+    QSettings settings;
+    settings.beginGroup( mGroupName );
+    settings.setValue( "syncConcurrency", value );
+    settings.endGroup();
+
+    emit syncConcurrencyChanged();
+  }
+}
+
+int AppSettings::bandwidthLimit() const
+{
+  return mBandwidthLimit;
+}
+
+void AppSettings::setBandwidthLimit( int value )
+{
+  if ( mBandwidthLimit != value && value >= 0 )
+  {
+    mBandwidthLimit = value;
+    QSettings settings;
+    settings.beginGroup( mGroupName );
+    settings.setValue( "bandwidthLimit", value );
+    settings.endGroup();
+
+    emit bandwidthLimitChanged();
+  }
+}
+
+bool AppSettings::syncLogEnabled() const
+{
+  return mSyncLogEnabled;
+}
+
+void AppSettings::setSyncLogEnabled( bool value )
+{
+  if ( mSyncLogEnabled != value )
+  {
+    mSyncLogEnabled = value;
+    QSettings settings;
+    settings.beginGroup( mGroupName );
+    settings.setValue( "syncLogEnabled", value );
+    settings.endGroup();
+
+    emit syncLogEnabledChanged();
+  }
+}
@@ -14,6 +14,9 @@ class AppSettings: public QObject
     Q_PROPERTY( bool autoCenterMapChecked READ autoCenterMapChecked WRITE setAutoCenterMapChecked NOTIFY autoCenterMapCheckedChanged )
     Q_PROPERTY( int lineRecordingInterval READ lineRecordingInterval WRITE setLineRecordingInterval NOTIFY lineRecordingIntervalChanged )
     Q_PROPERTY( int gpsAccuracyTolerance READ gpsAccuracyTolerance WRITE setGpsAccuracyTolerance NOTIFY gpsAccuracyToleranceChanged )
+    Q_PROPERTY( int syncConcurrency READ syncConcurrency WRITE setSyncConcurrency NOTIFY syncConcurrencyChanged )
+    Q_PROPERTY( int bandwidthLimit READ bandwidthLimit WRITE setBandwidthLimit NOTIFY bandwidthLimitChanged )
+    Q_PROPERTY( bool syncLogEnabled READ syncLogEnabled WRITE setSyncLogEnabled NOTIFY syncLogEnabledChanged )
 
   public:
     explicit AppSettings( QObject *parent = nullptr );
@@ -38,6 +41,15 @@ class AppSettings: public QObject
     int lineRecordingInterval() const;
     void setLineRecordingInterval( int lineRecordingInterval );
 
+    int syncConcurrency() const;
+    void setSyncConcurrency( int syncConcurrency );
+
+    int bandwidthLimit() const;
+    void setBandwidthLimit( int bandwidthLimit );
+
+    bool syncLogEnabled() const;
+    void setSyncLogEnabled( bool syncLogEnabled );
+
   signals:
     void defaultProjectChanged();
     void activeProjectChanged();
@@ -45,6 +57,9 @@ class AppSettings: public QObject
     void autoCenterMapCheckedChanged();
     void gpsAccuracyToleranceChanged();
     void lineRecordingIntervalChanged();
+    void syncConcurrencyChanged();
+    void bandwidthLimitChanged();
+    void syncLogEnabledChanged();
 
   private:
     // Projects path
@@ -57,6 +72,13 @@ class AppSettings: public QObject
     int mGpsAccuracyTolerance = -1;
     // Digitizing period in seconds
     int mLineRecordingInterval = 3;
+    // Max number of parallel requests when syncing a project, 1 (default) means requests run one at a time
+    // (large files are still resumed and patched by block deltas, see MerginApi::syncConcurrency)
+    int mSyncConcurrency = 1;
+    // Max KB/s used by sync, 0 means no limit
+    int mBandwidthLimit = 0;
+    // Telemetry of syncs is appended to a log in the app data dir
+    bool mSyncLogEnabled = false;
 
     // Projects path -> defaultLayer name
     QHash<QString, QString> mDefaultLayers;
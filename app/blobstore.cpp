@@ -0,0 +1,210 @@
+#include "blobstore.h"
+#include "checksumcache.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <linux/fs.h>
+#endif
+#ifdef Q_OS_DARWIN
+#include <sys/clonefile.h>
+#endif
+
+const QString BlobStore::STORE_DIR = QStringLiteral( ".blobs/" );
+
+BlobStore::BlobStore( const QString &dataDir )
+  : mDataDir( dataDir.endsWith( '/' ) ? dataDir : dataDir + '/' )
+{
+  load();
+}
+
+bool BlobStore::contains( const QString &checksum, qint64 size )
+{
+  auto it = mEntries.constFind( checksum );
+  if ( it == mEntries.constEnd() )
+    return false;
+
+  if ( it->size != size || !isValid( *it ) )
+  {
+    mEntries.remove( checksum );
+    mChanged = true;
+    return false;
+  }
+  return true;
+}
+
+bool BlobStore::link( const QString &checksum, qint64 size, const QString &targetPath )
+{
+  if ( !contains( checksum, size ) )
+    return false;
+
+  QFile::remove( targetPath );
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  Entry entry = mEntries.value( checksum );
+  if ( !cloneFile( mDataDir + entry.path, targetPath ) )
+    return false;
+  if ( entry.indexed - entry.mtime >= ChecksumCache::MTIME_GRANULARITY )
+    return true;
+
+  // the file may have been changed within the granularity of mtime after it was indexed
+  if ( ChecksumCache::fileChecksum( targetPath ) != checksum.toLatin1() )
+  {
+    QFile::remove( targetPath );
+    mEntries.remove( checksum );
+    mChanged = true;
+    return false;
+  }
+  if ( isValid( entry ) )
+  {
+    mEntries[checksum].indexed = now;
+    mChanged = true;
+  }
+  return true;
+}
+
+void BlobStore::add( const QString &checksum, const QString &filePath )
+{
+  if ( checksum.isEmpty() || contains( checksum, QFileInfo( filePath ).size() ) )
+    return;
+
+  QString relativePath = QDir( mDataDir ).relativeFilePath( filePath );
+  QFileInfo info( filePath );
+  if ( relativePath.startsWith( QStringLiteral( ".." ) ) || !info.exists() )
+    return;
+
+  Entry entry;
+  entry.path = relativePath;
+  entry.size = info.size();
+  entry.mtime = info.lastModified().toMSecsSinceEpoch();
+  entry.indexed = QDateTime::currentMSecsSinceEpoch();
+  mEntries.insert( checksum, entry );
+  mChanged = true;
+}
+
+void BlobStore::prune()
+{
+  for ( const QString &checksum : mEntries.keys() )
+  {
+    if ( !isValid( mEntries.value( checksum ) ) )
+    {
+      mEntries.remove( checksum );
+      mChanged = true;
+    }
+  }
+
+  // objects of older versions, project files hardlinked to them get their write permission back
+  QDirIterator it( mDataDir + STORE_DIR, QDir::Files, QDirIterator::Subdirectories );
+  while ( it.hasNext() )
+  {
+    QString path = it.next();
+    if ( it.fileInfo().dir().dirName() != it.fileName().left( 2 ) )
+      continue; // the index
+
+    QFile::setPermissions( path, QFile::permissions( path ) | QFileDevice::WriteOwner );
+    QFile::remove( path );
+  }
+}
+
+bool BlobStore::save()
+{
+  if ( !mChanged )
+    return true;
+
+  QJsonObject entries;
+  for ( auto it = mEntries.constBegin(); it != mEntries.constEnd(); ++it )
+  {
+    QJsonObject entryObject;
+    entryObject.insert( QStringLiteral( "path" ), it->path );
+    entryObject.insert( QStringLiteral( "size" ), static_cast<double>( it->size ) );
+    entryObject.insert( QStringLiteral( "mtime" ), static_cast<double>( it->mtime ) );
+    entryObject.insert( QStringLiteral( "indexed" ), static_cast<double>( it->indexed ) );
+    entries.insert( it.key(), entryObject );
+  }
+
+  QJsonObject index;
+  index.insert( QStringLiteral( "version" ), 1 );
+  index.insert( QStringLiteral( "entries" ), entries );
+
+  QString indexPath = mDataDir + STORE_DIR + QStringLiteral( "index.json" );
+  QDir().mkpath( mDataDir + STORE_DIR );
+  QSaveFile file( indexPath );
+  if ( !file.open( QIODevice::WriteOnly ) )
+  {
+    qDebug() << "Failed to write blob store index" << indexPath;
+    return false;
+  }
+  file.write( QJsonDocument( index ).toJson( QJsonDocument::Compact ) );
+  if ( !file.commit() )
+    return false;
+
+  mChanged = false;
+  return true;
+}
+
+bool BlobStore::cloneFile( const QString &sourcePath, const QString &targetPath )
+{
+#if defined( Q_OS_LINUX ) && defined( FICLONE )
+  int source = ::open( QFile::encodeName( sourcePath ).constData(), O_RDONLY | O_CLOEXEC );
+  int target = source >= 0 ? ::open( QFile::encodeName( targetPath ).constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) : -1;
+  bool cloned = target >= 0 && ::ioctl( target, FICLONE, source ) == 0;
+  if ( target >= 0 )
+    ::close( target );
+  if ( source >= 0 )
+    ::close( source );
+  if ( cloned )
+    return true;
+  QFile::remove( targetPath );
+#elif defined( Q_OS_DARWIN )
+  if ( ::clonefile( QFile::encodeName( sourcePath ).constData(), QFile::encodeName( targetPath ).constData(), 0 ) == 0 )
+    return true;
+#endif
+  return QFile::copy( sourcePath, targetPath );
+}
+
+bool BlobStore::isValid( const Entry &entry ) const
+{
+  QFileInfo info( mDataDir + entry.path );
+  return info.exists() && info.size() == entry.size && info.lastModified().toMSecsSinceEpoch() == entry.mtime;
+}
+
+void BlobStore::load()
+{
+  QFile file( mDataDir + STORE_DIR + QStringLiteral( "index.json" ) );
+  if ( !file.open( QIODevice::ReadOnly ) )
+    return;
+
+  QJsonObject index = QJsonDocument::fromJson( file.readAll() ).object();
+  if ( index.value( QStringLiteral( "version" ) ).toInt() != 1 )
+    return;
+
+  QJsonObject entries = index.value( QStringLiteral( "entries" ) ).toObject();
+  for ( auto it = entries.constBegin(); it != entries.constEnd(); ++it )
+  {
+    QJsonObject entryObject = it.value().toObject();
+    Entry entry;
+    entry.path = entryObject.value( QStringLiteral( "path" ) ).toString();
+    entry.size = static_cast<qint64>( entryObject.value( QStringLiteral( "size" ) ).toDouble() );
+    entry.mtime = static_cast<qint64>( entryObject.value( QStringLiteral( "mtime" ) ).toDouble() );
+    entry.indexed = static_cast<qint64>( entryObject.value( QStringLiteral( "indexed" ) ).toDouble() );
+    if ( entry.path.startsWith( STORE_DIR ) )
+    {
+      // object of an older version, removed by prune()
+      mChanged = true;
+      continue;
+    }
+    mEntries.insert( it.key(), entry );
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <QString>
+#include <QHash>
+
+/**
+ * Content-addressed index of files of all local projects keyed by their server checksum, so a file which is
+ * present locally in any project is cloned to another project instead of being downloaded again.
+ *
+ * Files are indexed where they are in their projects and never changed by the store: a clone is made by reflink
+ * where the file system supports it (the content is shared until either file is written), copied otherwise.
+ * Project files are not hardlinked, as an edit in place would change every project, nor made read-only.
+ * Each entry keeps size and modification time of its file, a changed file is dropped from the index. A file indexed
+ * within ChecksumCache::MTIME_GRANULARITY of its mtime may have changed since without a change of mtime, so its clone
+ * is hashed and compared with the checksum.
+ */
+class BlobStore
+{
+  public:
+    //! Loads the index of files in a data dir with projects
+    explicit BlobStore( const QString &dataDir );
+
+    //! Whether unchanged content with the checksum is available
+    bool contains( const QString &checksum, qint64 size );
+
+    //! Creates a file with the content of the checksum at targetPath by cloneFile(), returns false if the content is not available or has changed
+    bool link( const QString &checksum, qint64 size, const QString &targetPath );
+
+    //! Adds a file of a project with content of the checksum, files outside of the data dir are ignored
+    void add( const QString &checksum, const QString &filePath );
+
+    //! Removes entries of changed or deleted files and shared objects left by older versions
+    void prune();
+
+    //! Writes the index if it has been changed, returns false if it could not be written
+    bool save();
+
+    //! Clones a file by reflink if the file system supports it, copies it otherwise
+    static bool cloneFile( const QString &sourcePath, const QString &targetPath );
+
+  private:
+    struct Entry
+    {
+      QString path; // relative to the data dir
+      qint64 size = 0;
+      qint64 mtime = 0; // msecs since epoch
+      qint64 indexed = 0; // msecs since epoch when metadata have been read, before the content was known to be unchanged
+    };
+
+    bool isValid( const Entry &entry ) const;
+    void load();
+
+    QString mDataDir; // ends with '/'
+    QHash<QString, Entry> mEntries; // checksum -> file with the content
+    bool mChanged = false;
+
+    // Index of the store, older versions kept read-only objects hardlinked to project files here as well
+    static const QString STORE_DIR;
+};
+
+#endif // BLOBSTORE_H
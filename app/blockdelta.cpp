@@ -0,0 +1,396 @@
+#include "blockdelta.h"
+#include "sha1.h"
+
+#include <QFile>
+#include <QHash>
+#include <QIODevice>
+#include <QVector>
+#include <QtEndian>
+#include <cmath>
+#include <cstring>
+
+// Signature: "MSG1", block size (u32), file size (u64), then weak (u32) and strong checksum of each block.
+// Delta: "MDL1", block size (u32), then operations 'C' first block (u32) count (u32), 'L' size (u32) data
+// and 'E' size of the rebuilt file (u64). All numbers are little endian.
+
+namespace
+{
+  const char SIGNATURE_MAGIC[] = "MSG1";
+  const char DELTA_MAGIC[] = "MDL1";
+  const int HEADER_SIZE = 4 + 4 + 8;
+  const int FILTER_BITS = 20; // bits of a weak checksum indexing the filter of block lookup
+
+  //! Rolling checksum of rsync, it can be moved by one byte in constant time
+  class RollingChecksum
+  {
+    public:
+      void reset( const uchar *data, int size )
+      {
+        mA = 0;
+        mB = 0;
+        mSize = static_cast<quint32>( size );
+        for ( int i = 0; i < size; ++i )
+        {
+          mA += data[i];
+          mB += static_cast<quint32>( size - i ) * data[i];
+        }
+      }
+
+      void roll( uchar out, uchar in )
+      {
+        mA += in - static_cast<quint32>( out );
+        mB += mA - mSize * out;
+      }
+
+      quint32 value() const { return ( mA & 0xffff ) | ( mB << 16 ); }
+
+    private:
+      quint32 mA = 0;
+      quint32 mB = 0;
+      quint32 mSize = 0;
+  };
+
+  QByteArray strongChecksum( const uchar *data, int size, int checksumSize )
+  {
+    Sha1 hash;
+    hash.addData( reinterpret_cast<const char *>( data ), size );
+    return hash.result().left( checksumSize );
+  }
+
+  template<typename T> void writeNumber( QIODevice *device, T value )
+  {
+    uchar bytes[sizeof( T )];
+    qToLittleEndian( value, bytes );
+    device->write( reinterpret_cast<const char *>( bytes ), sizeof( T ) );
+  }
+
+  template<typename T> bool readNumber( QIODevice *device, T &value )
+  {
+    uchar bytes[sizeof( T )];
+    if ( device->read( reinterpret_cast<char *>( bytes ), sizeof( T ) ) != sizeof( T ) )
+      return false;
+    value = qFromLittleEndian<T>( bytes );
+    return true;
+  }
+
+  //! Writes delta operations, consecutive blocks are merged to a single copy operation
+  class DeltaWriter
+  {
+    public:
+      DeltaWriter( QIODevice *device, int blockSize, qint64 baseSize, int maxLiteralSize )
+        : mDevice( device )
+        , mBlockSize( blockSize )
+        , mBaseSize( baseSize )
+        , mMaxLiteralSize( maxLiteralSize )
+      {
+        mDevice->write( DELTA_MAGIC, 4 );
+        writeNumber<quint32>( mDevice, static_cast<quint32>( blockSize ) );
+      }
+
+      void copy( int block )
+      {
+        if ( mCopyCount > 0 && block == mCopyFirst + mCopyCount )
+        {
+          ++mCopyCount;
+        }
+        else
+        {
+          flushCopy();
+          mCopyFirst = block;
+          mCopyCount = 1;
+        }
+        mSize += qMin<qint64>( mBlockSize, mBaseSize - static_cast<qint64>( block ) * mBlockSize );
+      }
+
+      void literal( const char *data, int size )
+      {
+        if ( size <= 0 )
+          return;
+        flushCopy();
+        for ( int offset = 0; offset < size; offset += mMaxLiteralSize )
+        {
+          int literalSize = qMin( mMaxLiteralSize, size - offset );
+          mDevice->putChar( 'L' );
+          writeNumber<quint32>( mDevice, static_cast<quint32>( literalSize ) );
+          mDevice->write( data + offset, literalSize );
+          mSize += literalSize;
+        }
+      }
+
+      void finish()
+      {
+        flushCopy();
+        mDevice->putChar( 'E' );
+        writeNumber<quint64>( mDevice, static_cast<quint64>( mSize ) );
+      }
+
+    private:
+      void flushCopy()
+      {
+        if ( mCopyCount == 0 )
+          return;
+        mDevice->putChar( 'C' );
+        writeNumber<quint32>( mDevice, static_cast<quint32>( mCopyFirst ) );
+        writeNumber<quint32>( mDevice, static_cast<quint32>( mCopyCount ) );
+        mCopyCount = 0;
+      }
+
+      QIODevice *mDevice;
+      int mBlockSize;
+      qint64 mBaseSize;
+      int mMaxLiteralSize;
+      int mCopyFirst = 0;
+      int mCopyCount = 0;
+      qint64 mSize = 0; // size of the rebuilt file
+  };
+}
+
+const int BlockDelta::MIN_BLOCK_SIZE;
+const int BlockDelta::MAX_BLOCK_SIZE;
+
+int BlockDelta::blockSize( qint64 fileSize )
+{
+  int size = static_cast<int>( std::sqrt( static_cast<double>( fileSize ) ) );
+  size = ( size + 1023 ) & ~1023;
+  return qBound( MIN_BLOCK_SIZE, size, MAX_BLOCK_SIZE );
+}
+
+QByteArray BlockDelta::signature( const QString &filePath )
+{
+  QFile file( filePath );
+  if ( !file.open( QIODevice::ReadOnly ) )
+    return QByteArray();
+
+  qint64 fileSize = file.size();
+  int size = blockSize( fileSize );
+  qint64 blocksCount = ( fileSize + size - 1 ) / size;
+
+  QByteArray signature;
+  signature.reserve( static_cast<int>( HEADER_SIZE + blocksCount * ( 4 + STRONG_CHECKSUM_SIZE ) ) );
+  signature.append( SIGNATURE_MAGIC, 4 );
+  uchar header[12];
+  qToLittleEndian<quint32>( static_cast<quint32>( size ), header );
+  qToLittleEndian<quint64>( static_cast<quint64>( fileSize ), header + 4 );
+  signature.append( reinterpret_cast<const char *>( header ), sizeof( header ) );
+
+  // blocks are read in larger pieces of whole blocks
+  QByteArray buffer( READ_SIZE / size * size, Qt::Uninitialized );
+  qint64 hashedSize = 0;
+  while ( hashedSize < fileSize )
+  {
+    qint64 readSize = qMin<qint64>( buffer.size(), fileSize - hashedSize );
+    if ( file.read( buffer.data(), readSize ) != readSize )
+      return QByteArray();
+
+    const uchar *data = reinterpret_cast<const uchar *>( buffer.constData() );
+    for ( qint64 offset = 0; offset < readSize; offset += size )
+    {
+      int currentSize = static_cast<int>( qMin<qint64>( size, readSize - offset ) );
+      RollingChecksum weak;
+      weak.reset( data + offset, currentSize );
+      uchar weakBytes[4];
+      qToLittleEndian<quint32>( weak.value(), weakBytes );
+      signature.append( reinterpret_cast<const char *>( weakBytes ), 4 );
+      signature.append( strongChecksum( data + offset, currentSize, STRONG_CHECKSUM_SIZE ) );
+    }
+    hashedSize += readSize;
+  }
+  return signature;
+}
+
+bool BlockDelta::createDelta( const QString &filePath, const QByteArray &signature, QIODevice *delta )
+{
+  const int entrySize = 4 + STRONG_CHECKSUM_SIZE;
+  if ( signature.size() < HEADER_SIZE || memcmp( signature.constData(), SIGNATURE_MAGIC, 4 ) != 0 )
+    return false;
+
+  const uchar *header = reinterpret_cast<const uchar *>( signature.constData() ) + 4;
+  const int size = static_cast<int>( qFromLittleEndian<quint32>( header ) );
+  const qint64 baseSize = static_cast<qint64>( qFromLittleEndian<quint64>( header + 4 ) );
+  if ( size < MIN_BLOCK_SIZE || size > MAX_BLOCK_SIZE )
+    return false;
+  const int blocksCount = static_cast<int>( ( baseSize + size - 1 ) / size );
+  if ( signature.size() != HEADER_SIZE + blocksCount * entrySize )
+    return false;
+
+  QFile file( filePath );
+  if ( !file.open( QIODevice::ReadOnly ) )
+    return false;
+
+  // Lookup of blocks by weak checksum, the bit filter avoids most of hash table lookups for bytes which do not start a block.
+  // The last block is shorter unless the file size is a multiple of the block size, it can only match the end of the file.
+  const char *entries = signature.constData() + HEADER_SIZE;
+  auto weakChecksum = [entries, entrySize]( int block ) { return qFromLittleEndian<quint32>( reinterpret_cast<const uchar *>( entries + block * entrySize ) ); };
+  auto strongMatches = [entries, entrySize]( int block, const QByteArray & strong ) { return memcmp( entries + block * entrySize + 4, strong.constData(), STRONG_CHECKSUM_SIZE ) == 0; };
+  const int lastBlockSize = blocksCount > 0 ? static_cast<int>( baseSize - static_cast<qint64>( blocksCount - 1 ) * size ) : 0;
+  const int fullBlocksCount = lastBlockSize == size ? blocksCount : blocksCount - 1;
+
+  QHash<quint32, int> firstBlock;
+  QVector<int> nextBlock( blocksCount, -1 );
+  QVector<quint64> filter( ( 1 << FILTER_BITS ) / 64, 0 );
+  for ( int i = fullBlocksCount - 1; i >= 0; --i )
+  {
+    quint32 weak = weakChecksum( i );
+    nextBlock[i] = firstBlock.value( weak, -1 );
+    firstBlock.insert( weak, i );
+    quint32 bit = weak & ( ( 1 << FILTER_BITS ) - 1 );
+    filter[bit / 64] |= Q_UINT64_C( 1 ) << ( bit % 64 );
+  }
+
+  DeltaWriter writer( delta, size, baseSize, MAX_LITERAL_SIZE );
+  QByteArray buffer;
+  int pos = 0; // position of the current window in the buffer
+  int literalStart = 0; // beginning of data not matched to any block
+  bool atEnd = false;
+  RollingChecksum rolling;
+  bool rollingValid = false;
+  int expectedBlock = -1; // block following the last matched block
+
+  while ( true )
+  {
+    if ( buffer.size() - pos < size && !atEnd )
+    {
+      // only the current window is kept in the buffer
+      writer.literal( buffer.constData() + literalStart, pos - literalStart );
+      buffer.remove( 0, pos );
+      pos = 0;
+      literalStart = 0;
+      QByteArray data = file.read( READ_SIZE );
+      if ( data.isEmpty() )
+        atEnd = true;
+      buffer.append( data );
+      continue;
+    }
+    if ( buffer.size() - pos < size )
+      break;
+
+    const uchar *window = reinterpret_cast<const uchar *>( buffer.constData() ) + pos;
+    if ( !rollingValid )
+    {
+      rolling.reset( window, size );
+      rollingValid = true;
+    }
+
+    quint32 weak = rolling.value();
+    quint32 bit = weak & ( ( 1 << FILTER_BITS ) - 1 );
+    int match = -1;
+    if ( filter[bit / 64] & ( Q_UINT64_C( 1 ) << ( bit % 64 ) ) )
+    {
+      // strong checksum is computed only if the weak one matches
+      int candidate = firstBlock.value( weak, -1 );
+      if ( candidate >= 0 )
+      {
+        QByteArray strong = strongChecksum( window, size, STRONG_CHECKSUM_SIZE );
+        // the block following the previous match is tried first, so unchanged parts are copied by a single operation
+        if ( expectedBlock >= 0 && expectedBlock < fullBlocksCount && weakChecksum( expectedBlock ) == weak && strongMatches( expectedBlock, strong ) )
+        {
+          match = expectedBlock;
+        }
+        for ( int block = candidate; match < 0 && block >= 0; block = nextBlock[block] )
+        {
+          if ( strongMatches( block, strong ) )
+            match = block;
+        }
+      }
+    }
+
+    if ( match >= 0 )
+    {
+      writer.literal( buffer.constData() + literalStart, pos - literalStart );
+      writer.copy( match );
+      pos += size;
+      literalStart = pos;
+      rollingValid = false;
+      expectedBlock = match + 1;
+      continue;
+    }
+
+    if ( buffer.size() - pos > size )
+      rolling.roll( window[0], window[size] );
+    else
+      rollingValid = false; // more data need to be read first
+    ++pos;
+    if ( pos - literalStart >= MAX_LITERAL_SIZE )
+    {
+      writer.literal( buffer.constData() + literalStart, pos - literalStart );
+      literalStart = pos;
+    }
+  }
+
+  if ( file.error() != QFile::NoError )
+    return false;
+
+  // end of the file may match the shorter last block
+  int tailSize = buffer.size() - pos;
+  if ( tailSize > 0 && tailSize == lastBlockSize && lastBlockSize < size )
+  {
+    QByteArray strong = strongChecksum( reinterpret_cast<const uchar *>( buffer.constData() ) + pos, tailSize, STRONG_CHECKSUM_SIZE );
+    if ( strongMatches( blocksCount - 1, strong ) )
+    {
+      writer.literal( buffer.constData() + literalStart, pos - literalStart );
+      writer.copy( blocksCount - 1 );
+      literalStart = buffer.size();
+    }
+  }
+  writer.literal( buffer.constData() + literalStart, buffer.size() - literalStart );
+  writer.finish();
+  return true;
+}
+
+bool BlockDelta::applyDelta( const QString &basePath, const QString &deltaPath, const QString &outputPath )
+{
+  QFile base( basePath );
+  QFile delta( deltaPath );
+  QFile output( outputPath );
+  if ( !base.open( QIODevice::ReadOnly ) || !delta.open( QIODevice::ReadOnly ) || !output.open( QIODevice::WriteOnly ) )
+    return false;
+
+  quint32 size = 0;
+  if ( delta.read( 4 ) != QByteArray( DELTA_MAGIC, 4 ) || !readNumber( &delta, size ) || size < MIN_BLOCK_SIZE || size > MAX_BLOCK_SIZE )
+    return false;
+
+  const qint64 baseSize = base.size();
+  QByteArray buffer;
+  char operation;
+  while ( delta.getChar( &operation ) )
+  {
+    if ( operation == 'C' )
+    {
+      quint32 first = 0;
+      quint32 count = 0;
+      if ( !readNumber( &delta, first ) || !readNumber( &delta, count ) )
+        return false;
+
+      qint64 offset = static_cast<qint64>( first ) * size;
+      qint64 end = qMin<qint64>( baseSize, ( static_cast<qint64>( first ) + count ) * size );
+      if ( count == 0 || offset >= end || !base.seek( offset ) )
+        return false;
+      while ( offset < end )
+      {
+        buffer = base.read( qMin<qint64>( READ_SIZE, end - offset ) );
+        if ( buffer.isEmpty() || output.write( buffer ) != buffer.size() )
+          return false;
+        offset += buffer.size();
+      }
+    }
+    else if ( operation == 'L' )
+    {
+      quint32 literalSize = 0;
+      if ( !readNumber( &delta, literalSize ) || literalSize > MAX_LITERAL_SIZE )
+        return false;
+      buffer = delta.read( literalSize );
+      if ( buffer.size() != static_cast<int>( literalSize ) || output.write( buffer ) != buffer.size() )
+        return false;
+    }
+    else if ( operation == 'E' )
+    {
+      quint64 fileSize = 0;
+      return readNumber( &delta, fileSize ) && output.flush() && static_cast<quint64>( output.size() ) == fileSize;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  return false;
+}
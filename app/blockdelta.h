@@ -0,0 +1,38 @@
+#ifndef BLOCKDELTA_H
+#define BLOCKDELTA_H
+
+#include <QByteArray>
+#include <QString>
+
+class QIODevice;
+
+/**
+ * Delta transfer of large files in the way of rsync. The receiver sends a signature of its version of a file
+ * (a weak rolling checksum and a truncated SHA-1 of each block), the sender finds the blocks in its version
+ * at any offset and replies with a delta: references to the receiver's blocks and literal data of changed parts.
+ * The receiver rebuilds the file from its blocks and the delta and verifies the checksum of the whole file.
+ */
+class BlockDelta
+{
+  public:
+    //! Size of blocks of a signature of a file of given size, about square root of the size
+    static int blockSize( qint64 fileSize );
+
+    //! Returns signature of a file or an empty array if the file cannot be read
+    static QByteArray signature( const QString &filePath );
+
+    //! Writes delta of a file against a signature of another version of the file
+    static bool createDelta( const QString &filePath, const QByteArray &signature, QIODevice *delta );
+
+    //! Rebuilds a file from blocks of the base file and a delta, fails if the delta does not fit the base
+    static bool applyDelta( const QString &basePath, const QString &deltaPath, const QString &outputPath );
+
+  private:
+    static const int MIN_BLOCK_SIZE = 2048;
+    static const int MAX_BLOCK_SIZE = 128 * 1024;
+    static const int STRONG_CHECKSUM_SIZE = 8;
+    static const int READ_SIZE = 4 * 1024 * 1024;
+    static const int MAX_LITERAL_SIZE = 1024 * 1024;
+};
+
+#endif // BLOCKDELTA_H
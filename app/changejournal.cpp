@@ -0,0 +1,496 @@
+#include "changejournal.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QSocketNotifier>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#ifdef Q_OS_LINUX
+  // IN_MODIFY is needed as SQLite writes to a GeoPackage without closing it
+  const quint32 INOTIFY_MASK = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                               | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+  const int INOTIFY_BUFFER_SIZE = 64 * 1024;
+#endif
+}
+
+ChangeJournal::ChangeJournal( QObject *parent )
+  : QObject( parent )
+{
+#ifdef Q_OS_LINUX
+  mInotifyFd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+  if ( mInotifyFd >= 0 )
+  {
+    mInotifyNotifier.reset( new QSocketNotifier( mInotifyFd, QSocketNotifier::Read ) );
+    connect( mInotifyNotifier.get(), &QSocketNotifier::activated, this, &ChangeJournal::readInotifyEvents );
+  }
+  else
+  {
+    qDebug() << "inotify is not available, project dirs are watched by QFileSystemWatcher";
+  }
+#endif
+  connect( &mWatcher, &QFileSystemWatcher::directoryChanged, this, &ChangeJournal::onDirectoryChanged );
+  connect( &mWatcher, &QFileSystemWatcher::fileChanged, this, &ChangeJournal::onFileChanged );
+}
+
+ChangeJournal::~ChangeJournal()
+{
+#ifdef Q_OS_LINUX
+  mInotifyNotifier.reset();
+  if ( mInotifyFd >= 0 )
+    ::close( mInotifyFd );
+#endif
+}
+
+void ChangeJournal::setIgnoredSuffixes( const QSet<QString> &suffixes )
+{
+  mIgnoredSuffixes = suffixes;
+}
+
+bool ChangeJournal::usesInotify() const
+{
+  return mInotifyFd >= 0;
+}
+
+bool ChangeJournal::watch( const QString &projectDir )
+{
+  QString dir = normalizedDir( projectDir );
+  std::shared_ptr<Project> project = mProjects.value( dir );
+  if ( project && project->watched )
+    return true;
+
+  if ( !project )
+  {
+    project = std::make_shared<Project>();
+    project->dir = dir;
+    mProjects.insert( dir, project );
+  }
+  if ( !QFileInfo( dir ).isDir() )
+    return false;
+
+  // changes since the last scan may have been missed, the project is known only as it is now
+  removeWatches( *project, QString() );
+  project->changedFiles.clear();
+  project->pendingPaths.clear();
+  project->dirFiles.clear();
+  project->clean = false;
+  project->watched = true; // reset by scanDir() if a watch cannot be added
+  project->scanGeneration = ++mGeneration;
+  project->lastChange = project->scanGeneration;
+  project->lastModified = QFileInfo( dir ).lastModified().toMSecsSinceEpoch();
+  scanDir( *project, QString(), false );
+  return project->watched;
+}
+
+QDateTime ChangeJournal::lastModified( const QString &projectDir )
+{
+  QString dir = normalizedDir( projectDir );
+  readInotifyEvents();
+  watch( dir );
+  std::shared_ptr<Project> project = mProjects.value( dir );
+  if ( !QFileInfo( dir ).isDir() )
+    return QDateTime();
+
+  updateLastModified( *project );
+  return QDateTime::fromMSecsSinceEpoch( project->lastModified );
+}
+
+quint64 ChangeJournal::generation()
+{
+  readInotifyEvents();
+  return mGeneration;
+}
+
+bool ChangeJournal::changedFiles( const QString &projectDir, QSet<QString> &paths )
+{
+  // notifications of QFileSystemWatcher arrive asynchronously, a change made just now may not be known yet
+  if ( !usesInotify() )
+    return false;
+
+  // events of changes made up to now are queued already
+  readInotifyEvents();
+  QString dir = normalizedDir( projectDir );
+  if ( !watch( dir ) )
+    return false;
+
+  std::shared_ptr<Project> project = mProjects.value( dir );
+  if ( !project->clean )
+    return false;
+
+  paths.clear();
+  paths.reserve( project->changedFiles.size() );
+  for ( auto it = project->changedFiles.constBegin(); it != project->changedFiles.constEnd(); ++it )
+    paths << it.key();
+  return true;
+}
+
+void ChangeJournal::markClean( const QString &projectDir, quint64 generation )
+{
+  std::shared_ptr<Project> project = mProjects.value( normalizedDir( projectDir ) );
+  // changes lost before the generation would be forgotten
+  if ( !project || !project->watched || project->scanGeneration > generation )
+    return;
+
+  for ( auto it = project->changedFiles.begin(); it != project->changedFiles.end(); )
+  {
+    if ( it.value() <= generation )
+      it = project->changedFiles.erase( it );
+    else
+      ++it;
+  }
+  project->clean = true;
+}
+
+bool ChangeJournal::unchangedSince( const QString &projectDir, quint64 generation )
+{
+  QSet<QString> paths;
+  if ( !changedFiles( projectDir, paths ) )
+    return false;
+
+  return mProjects.value( normalizedDir( projectDir ) )->lastChange <= generation;
+}
+
+void ChangeJournal::readInotifyEvents()
+{
+#ifdef Q_OS_LINUX
+  if ( mInotifyFd < 0 )
+    return;
+
+  alignas( struct inotify_event ) char buffer[INOTIFY_BUFFER_SIZE];
+  for ( ;; )
+  {
+    ssize_t length = ::read( mInotifyFd, buffer, sizeof( buffer ) );
+    if ( length <= 0 )
+      break;
+
+    for ( ssize_t offset = 0; offset < length; )
+    {
+      const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>( buffer + offset );
+      offset += static_cast<ssize_t>( sizeof( struct inotify_event ) + event->len );
+      handleInotifyEvent( event->wd, event->mask, event->len > 0 ? QFile::decodeName( event->name ) : QString() );
+    }
+  }
+#endif
+}
+
+void ChangeJournal::handleInotifyEvent( int watchDescriptor, quint32 mask, const QString &name )
+{
+#ifdef Q_OS_LINUX
+  if ( mask & IN_Q_OVERFLOW )
+  {
+    qDebug() << "Change journal has lost events, project dirs will be scanned again";
+    for ( std::shared_ptr<Project> project : mProjects )
+      invalidate( *project );
+    return;
+  }
+
+  QString dirPath = mWatchDirs.value( watchDescriptor );
+  if ( dirPath.isEmpty() )
+    return;
+  if ( mask & IN_IGNORED )
+  {
+    // the dir has been removed or its watch has been removed
+    mWatchDirs.remove( watchDescriptor );
+    mWatchDescriptors.remove( dirPath );
+    return;
+  }
+
+  std::shared_ptr<Project> project = projectOf( dirPath );
+  if ( !project )
+    return;
+
+  QString relativeDir = dirPath.mid( project->dir.length() );
+  if ( mask & ( IN_DELETE_SELF | IN_MOVE_SELF ) )
+  {
+    // removal of a subdir is reported by its parent dir too
+    if ( relativeDir.isEmpty() )
+      invalidate( *project );
+    return;
+  }
+
+  QString path = relativeDir + name;
+  if ( name.isEmpty() || isIgnored( path ) )
+    return;
+
+  if ( mask & IN_ISDIR )
+  {
+    if ( mask & ( IN_CREATE | IN_MOVED_TO ) )
+    {
+      // files may have been added before the watch of the new dir
+      scanDir( *project, path + '/', true );
+    }
+    else if ( mask & IN_MOVED_FROM )
+    {
+      // files of the dir have been moved away without events of their own
+      removeWatches( *project, path + '/' );
+      project->clean = false;
+      project->lastChange = ++mGeneration;
+    }
+    project->pendingPaths.insert( relativeDir );
+  }
+  else
+  {
+    recordChange( *project, path );
+    if ( mask & ( IN_DELETE | IN_MOVED_FROM ) )
+      project->pendingPaths.insert( relativeDir );
+  }
+#else
+  Q_UNUSED( watchDescriptor )
+  Q_UNUSED( mask )
+  Q_UNUSED( name )
+#endif
+}
+
+void ChangeJournal::onDirectoryChanged( const QString &path )
+{
+  QString dirPath = normalizedDir( path );
+  std::shared_ptr<Project> project = projectOf( dirPath );
+  if ( !project )
+    return;
+
+  QString relativeDir = dirPath.mid( project->dir.length() );
+  if ( !QFileInfo( dirPath ).isDir() )
+  {
+    if ( relativeDir.isEmpty() )
+      invalidate( *project );
+    else
+      removeDirFiles( *project, relativeDir );
+    return;
+  }
+
+  // the watcher does not tell which entry has changed, the dir is compared with its last known state
+  QHash<QString, qint64> oldFiles = project->dirFiles.take( relativeDir );
+  QHash<QString, qint64> files;
+  QSet<QString> subdirs;
+  for ( const QFileInfo &info : QDir( dirPath ).entryInfoList( QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot ) )
+  {
+    QString entryPath = relativeDir + info.fileName();
+    if ( info.isDir() )
+    {
+      subdirs.insert( entryPath + '/' );
+      if ( !mWatchDescriptors.contains( project->dir + entryPath + '/' ) )
+        scanDir( *project, entryPath + '/', true );
+      continue;
+    }
+    if ( isIgnored( entryPath ) )
+      continue;
+
+    qint64 mtime = info.lastModified().toMSecsSinceEpoch();
+    files.insert( info.fileName(), mtime );
+    auto oldFile = oldFiles.find( info.fileName() );
+    bool changed = oldFile == oldFiles.end() || oldFile.value() != mtime;
+    if ( oldFile != oldFiles.end() )
+      oldFiles.erase( oldFile );
+    if ( changed )
+    {
+      recordChange( *project, entryPath );
+      if ( !mWatchDescriptors.contains( project->dir + entryPath ) && !addWatch( *project, entryPath ) )
+        project->watched = false;
+    }
+  }
+
+  project->dirFiles.insert( relativeDir, files );
+  for ( auto it = oldFiles.constBegin(); it != oldFiles.constEnd(); ++it )
+  {
+    recordChange( *project, relativeDir + it.key() );
+    mWatchDescriptors.remove( project->dir + relativeDir + it.key() );
+  }
+
+  // subdirs removed with their files
+  for ( const QString &knownDir : project->dirFiles.keys() )
+  {
+    int separator = knownDir.indexOf( '/', relativeDir.length() );
+    if ( knownDir.startsWith( relativeDir ) && separator == knownDir.length() - 1 && !subdirs.contains( knownDir ) )
+      removeDirFiles( *project, knownDir );
+  }
+
+  project->pendingPaths.insert( relativeDir );
+}
+
+void ChangeJournal::onFileChanged( const QString &path )
+{
+  std::shared_ptr<Project> project = projectOf( path );
+  if ( !project )
+    return;
+
+  QString relativePath = path.mid( project->dir.length() );
+  if ( isIgnored( relativePath ) )
+    return;
+
+  recordChange( *project, relativePath );
+  QFileInfo info( path );
+  QString relativeDir = relativePath.left( relativePath.lastIndexOf( '/' ) + 1 );
+  mWatchDescriptors.remove( path );
+  mWatcher.removePath( path );
+  if ( info.exists() )
+  {
+    // a file replaced by another one is not watched anymore
+    project->dirFiles[relativeDir].insert( info.fileName(), info.lastModified().toMSecsSinceEpoch() );
+    if ( !addWatch( *project, relativePath ) )
+      project->watched = false;
+  }
+  else
+  {
+    project->dirFiles[relativeDir].remove( info.fileName() );
+    project->pendingPaths.insert( relativeDir );
+  }
+}
+
+QString ChangeJournal::normalizedDir( const QString &path )
+{
+  return QDir::cleanPath( path ) + '/';
+}
+
+std::shared_ptr<ChangeJournal::Project> ChangeJournal::projectOf( const QString &path ) const
+{
+  for ( const std::shared_ptr<Project> &project : mProjects )
+  {
+    if ( path.startsWith( project->dir ) )
+      return project;
+  }
+  return nullptr;
+}
+
+bool ChangeJournal::isIgnored( const QString &relativePath ) const
+{
+  for ( const QStringRef &part : relativePath.splitRef( '/', QString::SkipEmptyParts ) )
+  {
+    if ( part.startsWith( '.' ) )
+      return true;
+  }
+  return mIgnoredSuffixes.contains( QFileInfo( relativePath ).suffix() );
+}
+
+void ChangeJournal::scanDir( Project &project, const QString &relativeDir, bool markChanged )
+{
+  if ( !addWatch( project, relativeDir ) )
+    project.watched = false;
+
+  // hidden files and dirs are skipped by the iterator
+  QDirIterator it( project.dir + relativeDir, QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories );
+  while ( it.hasNext() )
+  {
+    it.next();
+    QFileInfo info = it.fileInfo();
+    QString path = it.filePath().mid( project.dir.length() );
+    if ( info.isDir() )
+    {
+      if ( !info.isSymLink() && !addWatch( project, path + '/' ) )
+        project.watched = false;
+      continue;
+    }
+    if ( isIgnored( path ) )
+      continue;
+
+    qint64 mtime = info.lastModified().toMSecsSinceEpoch();
+    project.lastModified = qMax( project.lastModified, mtime );
+    if ( !usesInotify() )
+    {
+      project.dirFiles[path.left( path.lastIndexOf( '/' ) + 1 )].insert( info.fileName(), mtime );
+      if ( !addWatch( project, path ) )
+        project.watched = false;
+    }
+    if ( markChanged )
+      recordChange( project, path );
+  }
+}
+
+bool ChangeJournal::addWatch( Project &project, const QString &relativePath )
+{
+  QString path = project.dir + relativePath;
+  if ( mWatchDescriptors.contains( path ) )
+    return true;
+
+#ifdef Q_OS_LINUX
+  if ( usesInotify() )
+  {
+    int watchDescriptor = inotify_add_watch( mInotifyFd, QFile::encodeName( path ).constData(), INOTIFY_MASK );
+    if ( watchDescriptor < 0 )
+    {
+      qDebug() << "Failed to watch" << path << "- raise fs.inotify.max_user_watches if there are many project dirs";
+      return false;
+    }
+    mWatchDirs.insert( watchDescriptor, path );
+    mWatchDescriptors.insert( path, watchDescriptor );
+    return true;
+  }
+#endif
+
+  if ( !mWatcher.addPath( path ) )
+    return false;
+  if ( !project.dirFiles.contains( relativePath ) && relativePath.endsWith( '/' ) )
+    project.dirFiles.insert( relativePath, QHash<QString, qint64>() );
+  mWatchDescriptors.insert( path, 0 );
+  return true;
+}
+
+void ChangeJournal::removeWatches( Project &project, const QString &relativeDir )
+{
+  QString prefix = project.dir + relativeDir;
+  for ( auto it = mWatchDescriptors.begin(); it != mWatchDescriptors.end(); )
+  {
+    if ( !it.key().startsWith( prefix ) )
+    {
+      ++it;
+      continue;
+    }
+
+#ifdef Q_OS_LINUX
+    if ( it.value() > 0 )
+    {
+      inotify_rm_watch( mInotifyFd, it.value() );
+      mWatchDirs.remove( it.value() );
+    }
+#endif
+    if ( it.value() == 0 )
+      mWatcher.removePath( it.key() );
+    it = mWatchDescriptors.erase( it );
+  }
+}
+
+void ChangeJournal::removeDirFiles( Project &project, const QString &relativeDir )
+{
+  for ( const QString &knownDir : project.dirFiles.keys() )
+  {
+    if ( !knownDir.startsWith( relativeDir ) )
+      continue;
+
+    for ( const QString &name : project.dirFiles.take( knownDir ).keys() )
+      recordChange( project, knownDir + name );
+  }
+  removeWatches( project, relativeDir );
+  project.pendingPaths.insert( relativeDir.left( relativeDir.lastIndexOf( '/', -2 ) + 1 ) );
+}
+
+void ChangeJournal::recordChange( Project &project, const QString &relativePath )
+{
+  project.changedFiles.insert( relativePath, ++mGeneration );
+  project.lastChange = mGeneration;
+  project.pendingPaths.insert( relativePath );
+}
+
+void ChangeJournal::invalidate( Project &project )
+{
+  removeWatches( project, QString() );
+  project.watched = false;
+  project.clean = false;
+}
+
+void ChangeJournal::updateLastModified( Project &project )
+{
+  for ( const QString &path : project.pendingPaths )
+  {
+    QFileInfo info( project.dir + path );
+    if ( info.exists() )
+      project.lastModified = qMax( project.lastModified, info.lastModified().toMSecsSinceEpoch() );
+  }
+  project.pendingPaths.clear();
+}
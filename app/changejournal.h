@@ -0,0 +1,110 @@
+#ifndef CHANGEJOURNAL_H
+#define CHANGEJOURNAL_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <memory>
+
+class QSocketNotifier;
+
+/**
+ * Journal of changes of files in project dirs, so status of a project and its local changes are worked out
+ * from changed files only instead of walking all files. Project dir is scanned once when it starts to be watched,
+ * then changes are recorded from inotify events on Linux (and Android) or from QFileSystemWatcher elsewhere.
+ * Hidden files and dirs (e.g. the metadata folder) and files with ignored suffixes are not recorded.
+ * If events may have been lost (queue overflow, a watch could not be added, a dir has been removed with its files),
+ * the journal of the project is not trusted until it is marked clean again after a full scan.
+ */
+class ChangeJournal: public QObject
+{
+    Q_OBJECT
+  public:
+    explicit ChangeJournal( QObject *parent = nullptr );
+    ~ChangeJournal();
+
+    //! Files with these suffixes are not recorded, e.g. temporary files of SQLite
+    void setIgnoredSuffixes( const QSet<QString> &suffixes );
+
+    //! Whether changes are reported by inotify, QFileSystemWatcher is used otherwise
+    bool usesInotify() const;
+
+    //! Starts watching a project dir if it is not watched yet, returns false if it could not be watched completely
+    bool watch( const QString &projectDir );
+
+    //! Latest modification time of files of a project dir and of the dir itself, the dir starts to be watched if it is not yet
+    QDateTime lastModified( const QString &projectDir );
+
+    //! Current generation of changes, events queued up to now are recorded first. Pass it to markClean() when changes up to now have been processed
+    quint64 generation();
+
+    /**
+     * Returns true and relative paths of files added, modified or removed since markClean() if all changes have been recorded
+     * since then. Returns false if the project must be scanned whole, e.g. it has not been marked clean yet
+     * or changes are not watched by inotify.
+     */
+    bool changedFiles( const QString &projectDir, QSet<QString> &paths );
+
+    //! Forgets changes recorded up to given generation, later changes are kept
+    void markClean( const QString &projectDir, quint64 generation );
+
+    /**
+     * Returns true if no file of a project has changed since given generation, e.g. to reuse a result worked out
+     * from its files. Returns false if changes may not have been recorded, as changedFiles() does.
+     */
+    bool unchangedSince( const QString &projectDir, quint64 generation );
+
+  private slots:
+    void readInotifyEvents();
+    void onDirectoryChanged( const QString &path );
+    void onFileChanged( const QString &path );
+
+  private:
+    struct Project
+    {
+      QString dir; // absolute path ending with '/'
+      qint64 lastModified = 0; // msecs since epoch
+      QSet<QString> pendingPaths; // relative paths changed since lastModified has been updated
+      QHash<QString, quint64> changedFiles; // relative path -> generation of its last change
+      bool watched = false; // all dirs are watched and no change has been lost since the scan
+      bool clean = false; // changedFiles lists all changes since markClean()
+      quint64 scanGeneration = 0; // generation when the project has been scanned, changes before it are not known
+      quint64 lastChange = 0; // generation of the last change or scan, also of changes forgotten by markClean()
+      QHash<QString, QHash<QString, qint64>> dirFiles; // QFileSystemWatcher only: relative dir -> file name -> mtime
+    };
+
+    static QString normalizedDir( const QString &path );
+    //! Project which has a file or dir of given absolute path
+    std::shared_ptr<Project> projectOf( const QString &path ) const;
+    bool isIgnored( const QString &relativePath ) const;
+
+    //! Adds watches to a dir and its subdirs and records their files, as changed if markChanged is set
+    void scanDir( Project &project, const QString &relativeDir, bool markChanged );
+    //! Watches a dir (relative path ends with '/') or a file (QFileSystemWatcher only), returns false if the watch could not be added
+    bool addWatch( Project &project, const QString &relativePath );
+    //! Removes watches of a dir and all files and dirs in it
+    void removeWatches( Project &project, const QString &relativeDir );
+    void handleInotifyEvent( int watchDescriptor, quint32 mask, const QString &name );
+    //! QFileSystemWatcher only: records all known files of a removed dir and its subdirs as changed
+    void removeDirFiles( Project &project, const QString &relativeDir );
+    void recordChange( Project &project, const QString &relativePath );
+    //! Events may have been lost, changes of the project are not known anymore
+    void invalidate( Project &project );
+    void updateLastModified( Project &project );
+
+    QHash<QString, std::shared_ptr<Project>> mProjects; // dir -> project
+    QSet<QString> mIgnoredSuffixes;
+    quint64 mGeneration = 0;
+
+    int mInotifyFd = -1;
+    std::unique_ptr<QSocketNotifier> mInotifyNotifier;
+    QHash<int, QString> mWatchDirs; // inotify watch descriptor -> absolute dir path ending with '/'
+    QHash<QString, int> mWatchDescriptors; // watched absolute path -> inotify watch descriptor, 0 if watched by QFileSystemWatcher
+
+    QFileSystemWatcher mWatcher; // used if inotify is not available
+};
+
+#endif // CHANGEJOURNAL_H
@@ -0,0 +1,195 @@
+#include "checksumcache.h"
+#include "sha1.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+static quint64 fileInode( const QString &filePath )
+{
+#ifdef Q_OS_UNIX
+  struct stat buf;
+  if ( ::stat( QFile::encodeName( filePath ).constData(), &buf ) == 0 )
+    return static_cast<quint64>( buf.st_ino );
+#else
+  Q_UNUSED( filePath )
+#endif
+  return 0;
+}
+
+ChecksumCache::ChecksumCache( const QString &projectDir )
+  : mProjectDir( projectDir.endsWith( '/' ) ? projectDir : projectDir + '/' )
+{
+  load();
+}
+
+QString ChecksumCache::cacheFilePath( const QString &projectDir )
+{
+  return QDir( projectDir ).filePath( QStringLiteral( ".mergin/checksums.json" ) );
+}
+
+QByteArray ChecksumCache::fileChecksum( const QString &filePath )
+{
+  return Sha1::fileChecksum( filePath );
+}
+
+QByteArray ChecksumCache::checksum( const QString &path )
+{
+  QByteArray checksum;
+  if ( !cachedChecksum( path, checksum ) )
+  {
+    checksum = fileChecksum( mProjectDir + path );
+    setChecksum( path, checksum );
+  }
+  return checksum;
+}
+
+bool ChecksumCache::cachedChecksum( const QString &path, QByteArray &checksum )
+{
+  QString filePath = mProjectDir + path;
+  QFileInfo info( filePath );
+  if ( !info.exists() )
+  {
+    checksum.clear();
+    return true;
+  }
+
+  mRequested.insert( path );
+
+  Entry entry;
+  entry.size = info.size();
+  entry.mtime = info.lastModified().toMSecsSinceEpoch();
+  entry.inode = fileInode( filePath );
+  entry.hashed = QDateTime::currentMSecsSinceEpoch();
+
+  auto it = mEntries.constFind( path );
+  if ( it != mEntries.constEnd() && !it->checksum.isEmpty() && it->size == entry.size && it->mtime == entry.mtime
+       && it->inode == entry.inode && it->hashed - it->mtime >= MTIME_GRANULARITY )
+  {
+    checksum = it->checksum;
+    return true;
+  }
+
+  mPendingEntries.insert( path, entry );
+  return false;
+}
+
+void ChecksumCache::setChecksum( const QString &path, const QByteArray &checksum )
+{
+  Entry entry = mPendingEntries.take( path );
+  if ( checksum.isEmpty() || entry.hashed == 0 )
+  {
+    if ( mEntries.remove( path ) > 0 )
+      mChanged = true;
+    return;
+  }
+
+  entry.checksum = checksum;
+  mEntries.insert( path, entry );
+  mChanged = true;
+}
+
+void ChecksumCache::setUnhashed( const QString &path )
+{
+  Entry entry = mPendingEntries.take( path );
+  if ( entry.hashed == 0 )
+    return;
+
+  mEntries.insert( path, entry );
+  mChanged = true;
+}
+
+bool ChecksumCache::storedChecksum( const QString &path, QByteArray &checksum )
+{
+  auto it = mEntries.constFind( path );
+  if ( it == mEntries.constEnd() )
+    return false;
+
+  mRequested.insert( path );
+  checksum = it->checksum;
+  return true;
+}
+
+QStringList ChecksumCache::paths() const
+{
+  return mEntries.keys();
+}
+
+void ChecksumCache::load()
+{
+  QFile file( cacheFilePath( mProjectDir ) );
+  if ( !file.open( QIODevice::ReadOnly ) )
+    return;
+
+  QJsonObject files = QJsonDocument::fromJson( file.readAll() ).object().value( QStringLiteral( "files" ) ).toObject();
+  for ( auto it = files.constBegin(); it != files.constEnd(); ++it )
+  {
+    QJsonObject entryObject = it.value().toObject();
+    Entry entry;
+    entry.size = entryObject.value( QStringLiteral( "size" ) ).toVariant().toLongLong();
+    entry.mtime = entryObject.value( QStringLiteral( "mtime" ) ).toVariant().toLongLong();
+    entry.inode = entryObject.value( QStringLiteral( "inode" ) ).toVariant().toULongLong();
+    entry.hashed = entryObject.value( QStringLiteral( "hashed" ) ).toVariant().toLongLong();
+    entry.checksum = entryObject.value( QStringLiteral( "checksum" ) ).toString().toLatin1();
+    mEntries.insert( it.key(), entry );
+  }
+}
+
+bool ChecksumCache::save()
+{
+  for ( auto it = mEntries.begin(); it != mEntries.end(); )
+  {
+    if ( mRequested.contains( it.key() ) )
+    {
+      ++it;
+    }
+    else
+    {
+      it = mEntries.erase( it );
+      mChanged = true;
+    }
+  }
+
+  if ( !mChanged )
+    return true;
+
+  QJsonObject files;
+  for ( auto it = mEntries.constBegin(); it != mEntries.constEnd(); ++it )
+  {
+    QJsonObject entryObject;
+    entryObject.insert( QStringLiteral( "size" ), it->size );
+    entryObject.insert( QStringLiteral( "mtime" ), it->mtime );
+    entryObject.insert( QStringLiteral( "inode" ), static_cast<double>( it->inode ) );
+    entryObject.insert( QStringLiteral( "hashed" ), it->hashed );
+    entryObject.insert( QStringLiteral( "checksum" ), QString::fromLatin1( it->checksum ) );
+    files.insert( it.key(), entryObject );
+  }
+
+  QJsonObject cache;
+  cache.insert( QStringLiteral( "version" ), 1 );
+  cache.insert( QStringLiteral( "files" ), files );
+
+  QString filePath = cacheFilePath( mProjectDir );
+  QDir().mkpath( QFileInfo( filePath ).absolutePath() );
+  QSaveFile file( filePath );
+  if ( !file.open( QIODevice::WriteOnly ) )
+  {
+    qDebug() << "Failed to write checksum cache" << filePath;
+    return false;
+  }
+  file.write( QJsonDocument( cache ).toJson( QJsonDocument::Compact ) );
+  if ( !file.commit() )
+    return false;
+
+  mChanged = false;
+  return true;
+}
@@ -0,0 +1,82 @@
+#ifndef CHECKSUMCACHE_H
+#define CHECKSUMCACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+
+/**
+ * Persistent index of SHA-1 checksums of project files, stored in the project's metadata folder.
+ * Each entry keeps size, modification time and inode of the file when it was hashed, so a file
+ * is hashed again only when its metadata have changed. Files modified within MTIME_GRANULARITY
+ * of hashing are not trusted, as they may have been changed again without a change of mtime.
+ */
+class ChecksumCache
+{
+  public:
+    //! Loads the cache of a project, missing or corrupted cache file results in an empty cache
+    explicit ChecksumCache( const QString &projectDir );
+
+    //! Returns hex SHA-1 of a file given by a path relative to the project dir or empty array if the file cannot be read
+    QByteArray checksum( const QString &path );
+
+    /**
+     * Sets checksum to the cached value and returns true if the file has not been changed since it was hashed.
+     * Otherwise current metadata of the file are recorded and checksum computed afterwards is passed to setChecksum(),
+     * which allows hashing of files outside of the cache, e.g. in parallel threads.
+     */
+    bool cachedChecksum( const QString &path, QByteArray &checksum );
+
+    //! Stores checksum of a file for which cachedChecksum() has returned false
+    void setChecksum( const QString &path, const QByteArray &checksum );
+
+    /**
+     * Lists a file for which cachedChecksum() has returned false without its checksum, e.g. a file excluded from sync,
+     * so paths() covers all files of the project. The file is hashed once its checksum is requested.
+     */
+    void setUnhashed( const QString &path );
+
+    /**
+     * Sets checksum to the cached value without reading metadata of the file, for files known to be unchanged
+     * since they were hashed (see ChangeJournal). Returns false if the file is not in the cache, checksum is empty
+     * for files listed by setUnhashed().
+     */
+    bool storedChecksum( const QString &path, QByteArray &checksum );
+
+    //! Relative paths of all files in the cache
+    QStringList paths() const;
+
+    //! Writes the cache if it has been changed, returns false if it could not be written. Entries of files not requested since loading are dropped.
+    bool save();
+
+    //! Returns hex SHA-1 of a file computed from its content, see Sha1::fileChecksum()
+    static QByteArray fileChecksum( const QString &filePath );
+
+    //! Path of the cache file of a project
+    static QString cacheFilePath( const QString &projectDir );
+
+    //! Msecs after its mtime a file may still be changed without a change of mtime
+    static const qint64 MTIME_GRANULARITY = 2000;
+
+  private:
+    struct Entry
+    {
+      qint64 size = 0;
+      qint64 mtime = 0; // msecs since epoch
+      quint64 inode = 0; // 0 if not available on the platform
+      qint64 hashed = 0; // msecs since epoch when metadata have been read before hashing
+      QByteArray checksum;
+    };
+
+    void load();
+
+    QString mProjectDir;
+    QHash<QString, Entry> mEntries;
+    QHash<QString, Entry> mPendingEntries; // metadata of files being hashed
+    QSet<QString> mRequested;
+    bool mChanged = false;
+};
+
+#endif // CHECKSUMCACHE_H
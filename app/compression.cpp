@@ -0,0 +1,173 @@
+#include "compression.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+#include <QtEndian>
+#include <zlib.h>
+
+namespace
+{
+  // extensions of formats which compress their content, compressing them again does not pay off
+  const QSet<QString> COMPRESSED_EXTENSIONS = QSet<QString>()
+      << QStringLiteral( "jpg" ) << QStringLiteral( "jpeg" ) << QStringLiteral( "png" ) << QStringLiteral( "gif" )
+      << QStringLiteral( "webp" ) << QStringLiteral( "jp2" ) << QStringLiteral( "ecw" ) << QStringLiteral( "sid" )
+      << QStringLiteral( "zip" ) << QStringLiteral( "gz" ) << QStringLiteral( "tgz" ) << QStringLiteral( "bz2" )
+      << QStringLiteral( "xz" ) << QStringLiteral( "7z" ) << QStringLiteral( "rar" ) << QStringLiteral( "zst" )
+      << QStringLiteral( "qgz" ) << QStringLiteral( "kmz" ) << QStringLiteral( "docx" ) << QStringLiteral( "xlsx" )
+      << QStringLiteral( "odt" ) << QStringLiteral( "ods" ) << QStringLiteral( "pdf" ) << QStringLiteral( "mp3" )
+      << QStringLiteral( "mp4" ) << QStringLiteral( "m4a" ) << QStringLiteral( "mov" ) << QStringLiteral( "webm" );
+
+  const quint16 TIFF_COMPRESSION_TAG = 259;
+  const quint16 TIFF_SHORT_TYPE = 3;
+  const quint16 TIFF_NO_COMPRESSION = 1;
+  const int TIFF_MAX_ENTRIES = 4096;
+}
+
+bool Compression::isCompressible( const QString &filePath )
+{
+  QString suffix = QFileInfo( filePath ).suffix().toLower();
+  if ( COMPRESSED_EXTENSIONS.contains( suffix ) )
+    return false;
+  if ( suffix == QStringLiteral( "tif" ) || suffix == QStringLiteral( "tiff" ) )
+    return !isCompressedTiff( filePath );
+  return true;
+}
+
+bool Compression::isWorthIt( qint64 originalSize, qint64 compressedSize )
+{
+  return compressedSize * 100 <= originalSize * MAX_RATIO_PERCENT;
+}
+
+QByteArray Compression::deflate( const QByteArray &data, int level )
+{
+  uLongf size = compressBound( static_cast<uLong>( data.size() ) );
+  QByteArray output( static_cast<int>( size ), Qt::Uninitialized );
+  if ( compress2( reinterpret_cast<Bytef *>( output.data() ), &size, reinterpret_cast<const Bytef *>( data.constData() ),
+                  static_cast<uLong>( data.size() ), level ) != Z_OK )
+    return QByteArray();
+
+  output.resize( static_cast<int>( size ) );
+  return output;
+}
+
+bool Compression::inflate( const QByteArray &data, QByteArray &output )
+{
+  Inflater inflater;
+  return inflater.inflate( data, output ) && inflater.isFinished();
+}
+
+bool Compression::isCompressedTiff( const QString &filePath )
+{
+  // classic TIFF: byte order "II" or "MM", 42, offset of the first IFD (u32),
+  // IFD: number of entries (u16), entries of tag (u16), type (u16), count (u32) and value (u32)
+  QFile file( filePath );
+  if ( !file.open( QIODevice::ReadOnly ) )
+    return false;
+
+  QByteArray header = file.read( 8 );
+  bool littleEndian = header.startsWith( QByteArray( "II*\0", 4 ) );
+  if ( !littleEndian && !header.startsWith( QByteArray( "MM\0*", 4 ) ) )
+    return false; // BigTIFF or not a TIFF at all, compressibility is decided by the compressed size
+
+  auto read16 = [littleEndian]( const char *data )
+  {
+    return littleEndian ? qFromLittleEndian<quint16>( data ) : qFromBigEndian<quint16>( data );
+  };
+  auto read32 = [littleEndian]( const char *data )
+  {
+    return littleEndian ? qFromLittleEndian<quint32>( data ) : qFromBigEndian<quint32>( data );
+  };
+
+  if ( !file.seek( read32( header.constData() + 4 ) ) )
+    return false;
+  QByteArray count = file.read( 2 );
+  if ( count.size() != 2 )
+    return false;
+  int entriesCount = qMin<int>( read16( count.constData() ), TIFF_MAX_ENTRIES );
+  QByteArray entries = file.read( entriesCount * 12 );
+  for ( int i = 0; i + 12 <= entries.size(); i += 12 )
+  {
+    const char *entry = entries.constData() + i;
+    if ( read16( entry ) != TIFF_COMPRESSION_TAG )
+      continue;
+
+    quint32 value = read16( entry + 2 ) == TIFF_SHORT_TYPE ? read16( entry + 8 ) : read32( entry + 8 );
+    return value != TIFF_NO_COMPRESSION;
+  }
+  return false;
+}
+
+Inflater::Inflater()
+  : mStream( new z_stream_s() )
+{
+  // 32 added to window bits enables detection of zlib and gzip header
+  if ( inflateInit2( mStream.get(), MAX_WBITS + 32 ) != Z_OK )
+    mError = true;
+}
+
+Inflater::~Inflater()
+{
+  inflateEnd( mStream.get() );
+}
+
+void Inflater::addInput( const QByteArray &data )
+{
+  Q_ASSERT( mFinished || mError || mStream->avail_in == 0 );
+  mInput = data;
+  mStream->next_in = reinterpret_cast<Bytef *>( mInput.data() );
+  mStream->avail_in = static_cast<uInt>( mInput.size() );
+}
+
+bool Inflater::hasPendingData() const
+{
+  return !mFinished && !mError && ( mStream->avail_in > 0 || mOutputFull );
+}
+
+int Inflater::inflate( char *buffer, int capacity )
+{
+  if ( mError )
+    return -1;
+  if ( mFinished || capacity <= 0 )
+    return 0;
+
+  mStream->next_out = reinterpret_cast<Bytef *>( buffer );
+  mStream->avail_out = static_cast<uInt>( capacity );
+  int result = ::inflate( mStream.get(), Z_NO_FLUSH );
+  int written = capacity - static_cast<int>( mStream->avail_out );
+  if ( result == Z_STREAM_END )
+  {
+    mFinished = true;
+  }
+  else if ( result != Z_OK && ( result != Z_BUF_ERROR || written == 0 ) )
+  {
+    // Z_BUF_ERROR without any output means no progress is possible
+    mError = result != Z_BUF_ERROR || mStream->avail_in > 0;
+    mOutputFull = false;
+    return mError ? -1 : 0;
+  }
+
+  mOutputFull = mStream->avail_out == 0;
+  if ( mStream->avail_in == 0 )
+    mInput.clear();
+  return written;
+}
+
+bool Inflater::inflate( const QByteArray &data, QByteArray &output )
+{
+  addInput( data );
+  QByteArray buffer( BUFFER_SIZE, Qt::Uninitialized );
+  while ( hasPendingData() )
+  {
+    int size = inflate( buffer.data(), buffer.size() );
+    if ( size < 0 )
+      return false;
+    output.append( buffer.constData(), size );
+  }
+  return true;
+}
+
+bool Inflater::isFinished() const
+{
+  return mFinished;
+}
@@ -0,0 +1,77 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <QByteArray>
+#include <QString>
+#include <memory>
+
+struct z_stream_s;
+
+/**
+ * Compression of sync payloads with "deflate" and "gzip" content codings of HTTP (zlib).
+ * Request bodies are compressed whole as they are held in memory anyway, replies are decompressed
+ * as they arrive by Inflater. Files of formats which are compressed already are sent as they are.
+ */
+class Compression
+{
+  public:
+    //! Whether it makes sense to compress a file, false for formats with compressed content (JPEG, ZIP, compressed TIFF...)
+    static bool isCompressible( const QString &filePath );
+
+    //! Whether compressed data are small enough compared to the original to be sent compressed
+    static bool isWorthIt( qint64 originalSize, qint64 compressedSize );
+
+    //! Returns data compressed to zlib format of "deflate" content coding or an empty array on failure
+    static QByteArray deflate( const QByteArray &data, int level = DEFAULT_LEVEL );
+
+    //! Decompresses whole zlib or gzip data, fails if they are corrupted or truncated
+    static bool inflate( const QByteArray &data, QByteArray &output );
+
+    static const int DEFAULT_LEVEL = 6;
+
+  private:
+    //! Reads Compression tag of the first image of a TIFF file
+    static bool isCompressedTiff( const QString &filePath );
+
+    // compressed data must not be larger than this percentage of the original size
+    static const int MAX_RATIO_PERCENT = 90;
+};
+
+/**
+ * Streaming decompression of zlib or gzip data (recognized by their header). Compressed data are added
+ * as they arrive and decompressed to the caller's buffer, so neither of them is held whole in memory.
+ */
+class Inflater
+{
+  public:
+    Inflater();
+    ~Inflater();
+    Inflater( const Inflater & ) = delete;
+    Inflater &operator=( const Inflater & ) = delete;
+
+    //! Adds compressed data, data added previously must have been decompressed already (see hasPendingData)
+    void addInput( const QByteArray &data );
+
+    //! Whether inflate() would produce more data without adding input
+    bool hasPendingData() const;
+
+    //! Decompresses pending data to the buffer, returns number of bytes written or -1 if the data are corrupted
+    int inflate( char *buffer, int capacity );
+
+    //! Decompresses all given data and appends them to output
+    bool inflate( const QByteArray &data, QByteArray &output );
+
+    //! End of the compressed stream has been reached
+    bool isFinished() const;
+
+  private:
+    std::unique_ptr<z_stream_s> mStream;
+    QByteArray mInput;
+    bool mOutputFull = false; // last call has filled the whole buffer, there may be more data
+    bool mFinished = false;
+    bool mError = false;
+
+    static const int BUFFER_SIZE = 256 * 1024;
+};
+
+#endif // COMPRESSION_H
@@ -0,0 +1,232 @@
+#include "diskwriter.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QMetaObject>
+#include <QThread>
+#include <functional>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <linux/falloc.h>
+#endif
+
+namespace
+{
+  class WriterThread: public QThread
+  {
+    public:
+      explicit WriterThread( std::function<void()> loop )
+        : mLoop( loop )
+      {
+      }
+
+    protected:
+      void run() override
+      {
+        mLoop();
+      }
+
+    private:
+      std::function<void()> mLoop;
+  };
+}
+
+DiskWriter::DiskWriter()
+  : mThread( new WriterThread( [this] { run(); } ) )
+{
+  mThread->start();
+}
+
+DiskWriter::~DiskWriter()
+{
+  {
+    QMutexLocker locker( &mMutex );
+    mStopping = true;
+    mQueueChanged.wakeAll();
+  }
+  mThread->wait();
+}
+
+void DiskWriter::open( const QString &filePath, bool append, qint64 expectedSize )
+{
+  Operation operation;
+  operation.type = Operation::Open;
+  operation.filePath = filePath;
+  operation.append = append;
+  operation.expectedSize = expectedSize;
+  enqueue( operation );
+}
+
+bool DiskWriter::write( const QString &filePath, const QByteArray &data )
+{
+  {
+    QMutexLocker locker( &mMutex );
+    if ( mFailedFiles.contains( filePath ) )
+      return false;
+  }
+
+  Operation operation;
+  operation.type = Operation::Write;
+  operation.filePath = filePath;
+  operation.data = data;
+  enqueue( operation );
+  return true;
+}
+
+void DiskWriter::truncate( const QString &filePath )
+{
+  Operation operation;
+  operation.type = Operation::Truncate;
+  operation.filePath = filePath;
+  enqueue( operation );
+}
+
+void DiskWriter::close( const QString &filePath )
+{
+  Operation operation;
+  operation.type = Operation::Close;
+  operation.filePath = filePath;
+  enqueue( operation );
+}
+
+void DiskWriter::finish( const QStringList &filePaths, QObject *context, std::function<void( bool written )> finished )
+{
+  for ( const QString &filePath : filePaths )
+    close( filePath );
+
+  Operation operation;
+  operation.type = Operation::Finish;
+  operation.filePaths = filePaths;
+  operation.context = context;
+  operation.finished = finished;
+  enqueue( operation );
+}
+
+bool DiskWriter::isFull() const
+{
+  QMutexLocker locker( &mMutex );
+  return mQueuedBytes >= MAX_QUEUED_BYTES;
+}
+
+void DiskWriter::enqueue( const Operation &operation )
+{
+  QMutexLocker locker( &mMutex );
+  mQueue.enqueue( operation );
+  mQueuedBytes += operation.data.size();
+  mQueueChanged.wakeAll();
+}
+
+void DiskWriter::run()
+{
+  QMutexLocker locker( &mMutex );
+  while ( true )
+  {
+    while ( mQueue.isEmpty() && !mStopping )
+      mQueueChanged.wait( &mMutex );
+    if ( mQueue.isEmpty() )
+      break;
+
+    Operation operation = mQueue.dequeue();
+    if ( operation.type == Operation::Finish )
+    {
+      // operations on the files queued before have been executed, the queue is ordered
+      bool written = true;
+      for ( const QString &filePath : operation.filePaths )
+      {
+        if ( mFailedFiles.remove( filePath ) )
+          written = false;
+      }
+      std::function<void( bool )> finished = operation.finished;
+      if ( operation.context )
+        QMetaObject::invokeMethod( operation.context, [finished, written] { finished( written ); }, Qt::QueuedConnection );
+      continue;
+    }
+
+    locker.unlock();
+    bool executed = execute( operation );
+    locker.relock();
+
+    mQueuedBytes -= operation.data.size();
+    if ( !executed )
+      mFailedFiles.insert( operation.filePath );
+  }
+
+  // files which have not been finished
+  qDeleteAll( mOpenFiles );
+  mOpenFiles.clear();
+}
+
+bool DiskWriter::execute( const Operation &operation )
+{
+  QFile *file = mOpenFiles.value( operation.filePath );
+  switch ( operation.type )
+  {
+    case Operation::Open:
+    {
+      delete mOpenFiles.take( operation.filePath );
+      file = new QFile( operation.filePath );
+      // data arrive in large buffers, they are not copied to the buffer of the file
+      if ( !file->open( ( operation.append ? QIODevice::Append : QIODevice::WriteOnly ) | QIODevice::Unbuffered ) )
+      {
+        qDebug() << "Failed to open" << operation.filePath << "for writing:" << file->errorString();
+        delete file;
+        return false;
+      }
+      mOpenFiles.insert( operation.filePath, file );
+      if ( operation.expectedSize >= MIN_PREALLOCATED_SIZE )
+        preallocate( *file, operation.expectedSize );
+      return true;
+    }
+
+    case Operation::Write:
+      return file && file->write( operation.data ) == operation.data.size();
+
+    case Operation::Truncate:
+      return file && file->resize( 0 );
+
+    case Operation::Finish:
+      return true;
+
+    case Operation::Close:
+    {
+      if ( !file )
+        return true;
+
+      mOpenFiles.remove( operation.filePath );
+      bool synced = sync( *file );
+      file->close();
+      delete file;
+      if ( !synced )
+        qDebug() << "Failed to sync" << operation.filePath << "to the storage";
+      return synced;
+    }
+  }
+  return false;
+}
+
+void DiskWriter::preallocate( QFile &file, qint64 size )
+{
+#if defined( Q_OS_LINUX ) && defined( FALLOC_FL_KEEP_SIZE )
+  // size of the file is kept, so a partial file is resumed from the data which have been written
+  // (see MerginApi::resumableSize); file systems without support (e.g. FAT of SD cards) just fail
+  ::fallocate( file.handle(), FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>( size ) );
+#else
+  Q_UNUSED( file )
+  Q_UNUSED( size )
+#endif
+}
+
+bool DiskWriter::sync( QFile &file )
+{
+  if ( !file.flush() )
+    return false;
+#ifdef Q_OS_UNIX
+  return ::fsync( file.handle() ) == 0;
+#else
+  return true;
+#endif
+}
@@ -0,0 +1,113 @@
+#ifndef DISKWRITER_H
+#define DISKWRITER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QPointer>
+#include <QQueue>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QWaitCondition>
+#include <functional>
+#include <memory>
+
+class QFile;
+class QObject;
+class QThread;
+
+/**
+ * Writes received files in a dedicated thread, so slow storage (e.g. SD cards) blocks neither the GUI thread
+ * nor reading of replies, and parsing of a data stream overlaps with disk I/O.
+ *
+ * Operations are queued in order and refer to files by path. None of the methods waits for the storage:
+ * callers should postpone reading of replies while isFull(), the queue grows beyond MAX_QUEUED_BYTES otherwise,
+ * and completion of files is reported asynchronously by finish().
+ * Blocks of a file with known size are reserved when it is opened, so a large file is not fragmented,
+ * and the file is synced to the storage once when it is closed, not after each write.
+ * Errors are collected per file and reported by write() and finish().
+ */
+class DiskWriter
+{
+  public:
+    DiskWriter();
+    //! Completes queued operations and stops the thread
+    ~DiskWriter();
+
+    /**
+     * Opens a file for writing, its folder must exist. Content of an existing file is kept when appending,
+     * otherwise the file is truncated. Blocks for expectedSize bytes are reserved if the size is known.
+     */
+    void open( const QString &filePath, bool append, qint64 expectedSize = -1 );
+
+    /**
+     * Queues data to be written to an open file, data are shared with the queue, so they must not
+     * refer to a buffer which is reused (see QByteArray::fromRawData). Returns false if any previous
+     * operation on the file has failed.
+     */
+    bool write( const QString &filePath, const QByteArray &data );
+
+    //! Discards content of an open file written so far
+    void truncate( const QString &filePath );
+
+    //! Queues closing of a file, written data are synced to the storage
+    void close( const QString &filePath );
+
+    /**
+     * Queues closing of files which are still open and calls finished in the thread of context once queued operations
+     * on the files have completed, with false if any of them has failed. Errors of the files are forgotten then.
+     * Nothing is called if context is destroyed meanwhile.
+     */
+    void finish( const QStringList &filePaths, QObject *context, std::function<void( bool written )> finished );
+
+    //! Whether queued data have reached MAX_QUEUED_BYTES
+    bool isFull() const;
+
+    static const qint64 MAX_QUEUED_BYTES = 32 * 1024 * 1024;
+    //! Smaller files are not worth reserving their blocks
+    static const qint64 MIN_PREALLOCATED_SIZE = 1024 * 1024;
+
+  private:
+    struct Operation
+    {
+      enum Type
+      {
+        Open,
+        Write,
+        Truncate,
+        Close,
+        Finish // reports completion of operations queued before on filePaths
+      };
+
+      Type type = Write;
+      QString filePath;
+      QByteArray data;
+      bool append = false;
+      qint64 expectedSize = -1;
+      QStringList filePaths;
+      QPointer<QObject> context;
+      std::function<void( bool )> finished;
+    };
+
+    void enqueue( const Operation &operation );
+    //! Loop of the writer thread
+    void run();
+    //! Runs an operation in the writer thread, returns false if it has failed
+    bool execute( const Operation &operation );
+    static void preallocate( QFile &file, qint64 size );
+    static bool sync( QFile &file );
+
+    std::unique_ptr<QThread> mThread;
+    mutable QMutex mMutex;
+    QWaitCondition mQueueChanged; // an operation has been queued or the writer is stopping
+    QQueue<Operation> mQueue;
+    qint64 mQueuedBytes = 0;
+    QSet<QString> mFailedFiles;
+    bool mStopping = false;
+
+    // used by the writer thread only
+    QHash<QString, QFile *> mOpenFiles;
+};
+
+#endif // DISKWRITER_H
@@ -0,0 +1,108 @@
+#include "filehasher.h"
+#include "checksumcache.h"
+
+#include <QAtomicInt>
+#include <QFutureWatcher>
+#include <QThread>
+#include <QtConcurrent>
+#include <memory>
+
+namespace
+{
+  struct HashingJob
+  {
+    QStringList filePaths;
+    QVector<QByteArray> checksums;
+    QByteArray *results = nullptr; // data of checksums, written by workers
+    QAtomicInt next;
+    QAtomicInt done;
+    int runningWorkers = 0;
+    std::function<void( const QVector<QByteArray> & )> finished;
+    std::function<void( int, int )> progress;
+  };
+}
+
+const int FileHasher::MAX_THREADS;
+
+FileHasher::FileHasher( QObject *parent )
+  : QObject( parent )
+{
+  mPool.setMaxThreadCount( qBound( 1, QThread::idealThreadCount(), MAX_THREADS ) );
+}
+
+FileHasher::~FileHasher()
+{
+  mPool.waitForDone();
+}
+
+int FileHasher::maxThreadCount() const
+{
+  return mPool.maxThreadCount();
+}
+
+void FileHasher::setMaxThreadCount( int maxThreadCount )
+{
+  mPool.setMaxThreadCount( qMax( 1, maxThreadCount ) );
+}
+
+void FileHasher::hash( const QStringList &filePaths,
+                       std::function<void( const QVector<QByteArray> & )> finished,
+                       std::function<void( int, int )> progress )
+{
+  std::shared_ptr<HashingJob> job = std::make_shared<HashingJob>();
+  job->filePaths = filePaths;
+  job->checksums.resize( filePaths.size() );
+  job->results = job->checksums.data();
+  job->finished = finished;
+  job->progress = progress;
+
+  if ( filePaths.isEmpty() )
+  {
+    QMetaObject::invokeMethod( this, [job]() { job->finished( job->checksums ); }, Qt::QueuedConnection );
+    return;
+  }
+
+  const int total = filePaths.size();
+  const int progressStep = qMax( 1, total / 100 );
+  job->runningWorkers = qMin( mPool.maxThreadCount(), total );
+  for ( int i = 0; i < job->runningWorkers; ++i )
+  {
+    QFutureWatcher<void> *watcher = new QFutureWatcher<void>( this );
+    connect( watcher, &QFutureWatcher<void>::finished, this, [job, watcher, total]()
+    {
+      watcher->deleteLater();
+      if ( --job->runningWorkers > 0 )
+        return;
+
+      if ( job->progress )
+        job->progress( total, total );
+      job->finished( job->checksums );
+    } );
+
+    watcher->setFuture( QtConcurrent::run( &mPool, [this, job, total, progressStep]()
+    {
+      int index;
+      while ( ( index = job->next.fetchAndAddRelaxed( 1 ) ) < total )
+      {
+        job->results[index] = ChecksumCache::fileChecksum( job->filePaths.at( index ) );
+
+        int done = job->done.fetchAndAddRelaxed( 1 ) + 1;
+        if ( job->progress && done < total && done % progressStep == 0 )
+        {
+          QMetaObject::invokeMethod( this, [job, done, total]() { job->progress( done, total ); }, Qt::QueuedConnection );
+        }
+      }
+    } ) );
+  }
+}
+
+void FileHasher::run( std::function<void()> work, std::function<void()> finished )
+{
+  QFutureWatcher<void> *watcher = new QFutureWatcher<void>( this );
+  connect( watcher, &QFutureWatcher<void>::finished, this, [watcher, finished]()
+  {
+    watcher->deleteLater();
+    finished();
+  } );
+  watcher->setFuture( QtConcurrent::run( &mPool, work ) );
+}
@@ -0,0 +1,47 @@
+#ifndef FILEHASHER_H
+#define FILEHASHER_H
+
+#include <QObject>
+#include <QThreadPool>
+#include <QStringList>
+#include <QVector>
+#include <functional>
+
+/**
+ * Computes SHA-1 checksums of files in a dedicated thread pool, so hashing of a project uses all cores
+ * and does not block the GUI thread. Worker threads take files from a shared queue in order and store
+ * checksums at the index of the file, so results do not depend on scheduling of threads.
+ */
+class FileHasher: public QObject
+{
+    Q_OBJECT
+  public:
+    explicit FileHasher( QObject *parent = nullptr );
+    ~FileHasher();
+
+    int maxThreadCount() const;
+    //! Limits number of threads used for hashing, default is number of cores but at most MAX_THREADS
+    void setMaxThreadCount( int maxThreadCount );
+
+    /**
+     * Starts hashing of files given by absolute paths. Callbacks are called on the thread of this object,
+     * progress after each percent of files and finished with hex checksums in the same order as filePaths
+     * (empty array for a file which cannot be read).
+     */
+    void hash( const QStringList &filePaths,
+               std::function<void( const QVector<QByteArray> & )> finished,
+               std::function<void( int, int )> progress = std::function<void( int, int )>() );
+
+    /**
+     * Runs work in the thread pool and calls finished on the thread of this object when it is done.
+     * Used for listing and stat calls of files which precede their hashing.
+     */
+    void run( std::function<void()> work, std::function<void()> finished );
+
+  private:
+    QThreadPool mPool;
+
+    static const int MAX_THREADS = 8;
+};
+
+#endif // FILEHASHER_H
@@ -0,0 +1,1272 @@
+#include "geopackagediff.h"
+
+#include <QAtomicInt>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+#include "qgsgeometry.h"
+
+namespace
+{
+  //! Named QSQLITE connection removed when going out of scope
+  class Connection
+  {
+    public:
+      explicit Connection( const QString &dbPath )
+        : mName( QStringLiteral( "geopackagediff_%1" ).arg( sCounter.fetchAndAddRelaxed( 1 ) ) )
+      {
+        QSqlDatabase db = QSqlDatabase::addDatabase( QStringLiteral( "QSQLITE" ), mName );
+        db.setDatabaseName( dbPath );
+        mOpen = QFileInfo::exists( dbPath ) && db.open();
+      }
+
+      ~Connection()
+      {
+        {
+          QSqlDatabase db = QSqlDatabase::database( mName, false );
+          db.close();
+        }
+        QSqlDatabase::removeDatabase( mName );
+      }
+
+      bool isOpen() const { return mOpen; }
+      QSqlDatabase database() const { return QSqlDatabase::database( mName, false ); }
+
+    private:
+      QString mName;
+      bool mOpen = false;
+      static QAtomicInt sCounter;
+  };
+
+  QAtomicInt Connection::sCounter;
+
+  struct TableInfo
+  {
+    QStringList columns;
+    QStringList primaryKey; // in order of the key
+  };
+
+  bool fail( QString *error, const QString &message )
+  {
+    if ( error )
+      *error = message;
+    return false;
+  }
+
+  QString quoted( const QString &identifier )
+  {
+    return '"' + QString( identifier ).replace( '"', QStringLiteral( "\"\"" ) ) + '"';
+  }
+
+  QStringList prefixed( const QString &prefix, const QStringList &columns )
+  {
+    QStringList result;
+    for ( const QString &column : columns )
+      result << prefix + '.' + quoted( column );
+    return result;
+  }
+
+  //! Condition matching rows of tables aliased as "m" and "b" by primary key
+  QString primaryKeyJoin( const QStringList &primaryKey )
+  {
+    QStringList conditions;
+    for ( const QString &column : primaryKey )
+      conditions << QStringLiteral( "b.%1 = m.%1" ).arg( quoted( column ) );
+    return conditions.join( QStringLiteral( " AND " ) );
+  }
+
+  QStringList schema( QSqlDatabase &db, const QString &schemaName )
+  {
+    QStringList entries;
+    QSqlQuery query( db );
+    query.exec( QStringLiteral( "SELECT type, name, tbl_name, sql FROM %1.sqlite_master ORDER BY type, name" ).arg( schemaName ) );
+    while ( query.next() )
+    {
+      entries << QStringLiteral( "%1|%2|%3|%4" ).arg( query.value( 0 ).toString(), query.value( 1 ).toString(),
+                 query.value( 2 ).toString(), query.value( 3 ).toString() );
+    }
+    return entries;
+  }
+
+  QStringList userTables( QSqlDatabase &db )
+  {
+    QStringList tables;
+    QSqlQuery query( db );
+    query.exec( QStringLiteral( "SELECT name FROM main.sqlite_master WHERE type = 'table'"
+                                " AND name NOT LIKE 'sqlite\\_%' ESCAPE '\\'"
+                                " AND name NOT LIKE 'gpkg\\_%' ESCAPE '\\'"
+                                " AND name NOT LIKE 'rtree\\_%' ESCAPE '\\'"
+                                " AND sql NOT LIKE 'CREATE VIRTUAL%'"
+                                " ORDER BY name" ) );
+    while ( query.next() )
+      tables << query.value( 0 ).toString();
+    return tables;
+  }
+
+  TableInfo tableInfo( QSqlDatabase &db, const QString &table )
+  {
+    TableInfo info;
+    QMap<int, QString> primaryKey;
+    QSqlQuery query( db );
+    query.exec( QStringLiteral( "PRAGMA main.table_info(%1)" ).arg( quoted( table ) ) );
+    while ( query.next() )
+    {
+      QString column = query.value( 1 ).toString();
+      info.columns << column;
+      int pk = query.value( 5 ).toInt();
+      if ( pk > 0 )
+        primaryKey.insert( pk, column );
+    }
+    info.primaryKey = primaryKey.values();
+    return info;
+  }
+
+  //! Types of values in changesets of the SQLite session extension
+  enum ValueType
+  {
+    UndefinedValue = 0, // column not recorded by an update
+    IntegerValue = 1,
+    FloatValue = 2,
+    TextValue = 3,
+    BlobValue = 4,
+    NullValue = 5
+  };
+
+  //! Operations of changesets, values of SQLITE_INSERT, SQLITE_UPDATE and SQLITE_DELETE
+  enum Operation
+  {
+    InsertOperation = 18,
+    UpdateOperation = 23,
+    DeleteOperation = 9
+  };
+
+  /**
+   * Change of a row with values of all columns of the table. A value not recorded by an update is an invalid QVariant,
+   * SQL NULL is a null QVariant of a valid type. A changeset records the primary key and changed columns in old values
+   * of an update and changed columns in its new values, a comparison of databases records all of them.
+   */
+  struct RowChange
+  {
+    Operation operation = InsertOperation;
+    QVariantList oldValues; // update and delete
+    QVariantList newValues; // insert and update
+  };
+
+  struct TableChanges
+  {
+    QString name;
+    int columnsCount = 0;
+    QList<int> primaryKey; // indexes of columns in order of the key
+    QList<RowChange> rows; // deletes, updates and inserts in this order
+  };
+
+  ValueType valueType( const QVariant &value )
+  {
+    if ( !value.isValid() )
+      return UndefinedValue;
+    if ( value.isNull() )
+      return NullValue;
+
+    switch ( value.type() )
+    {
+      case QVariant::ByteArray:
+        return BlobValue;
+      case QVariant::Bool:
+      case QVariant::Int:
+      case QVariant::LongLong:
+      case QVariant::UInt:
+      case QVariant::ULongLong:
+        return IntegerValue;
+      case QVariant::Double:
+        return FloatValue;
+      default:
+        return TextValue;
+    }
+  }
+
+  //! Compares values by their SQLite storage class, unlike QVariant comparison which converts them
+  bool sameValue( const QVariant &a, const QVariant &b )
+  {
+    ValueType type = valueType( a );
+    if ( type != valueType( b ) )
+      return false;
+
+    switch ( type )
+    {
+      case IntegerValue:
+        return a.toLongLong() == b.toLongLong();
+      case FloatValue:
+        return a.toDouble() == b.toDouble();
+      case BlobValue:
+        return a.toByteArray() == b.toByteArray();
+      case TextValue:
+        return a.toString() == b.toString();
+      default:
+        return true;
+    }
+  }
+
+  bool sameValues( const QVariantList &a, const QVariantList &b )
+  {
+    if ( a.size() != b.size() )
+      return false;
+    for ( int i = 0; i < a.size(); ++i )
+    {
+      if ( !sameValue( a.at( i ), b.at( i ) ) )
+        return false;
+    }
+    return true;
+  }
+
+  //! Whether an update sets a column, the primary key is never changed by an update
+  bool isChanged( const TableChanges &table, const RowChange &row, int column )
+  {
+    return !table.primaryKey.contains( column ) && row.newValues.at( column ).isValid() && !sameValue( row.oldValues.at( column ), row.newValues.at( column ) );
+  }
+
+  //! Values identifying the row, the key of an inserted row is in its new values
+  const QVariantList &rowValues( const RowChange &row )
+  {
+    return row.operation == InsertOperation ? row.newValues : row.oldValues;
+  }
+
+  //! Varint of SQLite: groups of 7 bits from the most significant one with the high bit set in all but the last byte,
+  //! the 9th byte has all 8 bits
+  void appendVarint( QByteArray &data, quint64 value )
+  {
+    char bytes[9];
+    if ( value > Q_UINT64_C( 0x00ffffffffffffff ) )
+    {
+      bytes[8] = static_cast<char>( value & 0xff );
+      value >>= 8;
+      for ( int i = 7; i >= 0; --i )
+      {
+        bytes[i] = static_cast<char>( ( value & 0x7f ) | 0x80 );
+        value >>= 7;
+      }
+      data.append( bytes, 9 );
+      return;
+    }
+
+    int size = 0;
+    do
+    {
+      bytes[size++] = static_cast<char>( ( value & 0x7f ) | 0x80 );
+      value >>= 7;
+    }
+    while ( value );
+    bytes[0] = static_cast<char>( bytes[0] & 0x7f );
+    for ( int i = size - 1; i >= 0; --i )
+      data.append( bytes[i] );
+  }
+
+  bool readVarint( const QByteArray &data, int &pos, quint64 &value )
+  {
+    value = 0;
+    for ( int i = 0; i < 9; ++i )
+    {
+      if ( pos >= data.size() )
+        return false;
+      uchar byte = static_cast<uchar>( data.at( pos++ ) );
+      if ( i == 8 )
+      {
+        value = ( value << 8 ) | byte;
+        return true;
+      }
+      value = ( value << 7 ) | ( byte & 0x7f );
+      if ( !( byte & 0x80 ) )
+        return true;
+    }
+    return true;
+  }
+
+  void appendValue( QByteArray &data, const QVariant &value )
+  {
+    ValueType type = valueType( value );
+    data.append( static_cast<char>( type ) );
+    switch ( type )
+    {
+      case IntegerValue:
+      case FloatValue:
+      {
+        // 64-bit two's complement integer or IEEE 754 double, big-endian
+        quint64 bits;
+        if ( type == IntegerValue )
+        {
+          qint64 integer = value.toLongLong();
+          memcpy( &bits, &integer, 8 );
+        }
+        else
+        {
+          double number = value.toDouble();
+          memcpy( &bits, &number, 8 );
+        }
+        char bytes[8];
+        qToBigEndian( bits, bytes );
+        data.append( bytes, 8 );
+        break;
+      }
+      case TextValue:
+      case BlobValue:
+      {
+        QByteArray bytes = type == TextValue ? value.toString().toUtf8() : value.toByteArray();
+        appendVarint( data, static_cast<quint64>( bytes.size() ) );
+        data.append( bytes );
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  bool readValue( const QByteArray &data, int &pos, QVariant &value )
+  {
+    if ( pos >= data.size() )
+      return false;
+
+    int type = static_cast<uchar>( data.at( pos++ ) );
+    switch ( type )
+    {
+      case UndefinedValue:
+        value = QVariant();
+        return true;
+      case NullValue:
+        value = QVariant( QVariant::String );
+        return true;
+      case IntegerValue:
+      case FloatValue:
+      {
+        if ( data.size() - pos < 8 )
+          return false;
+        quint64 bits = qFromBigEndian<quint64>( data.constData() + pos );
+        pos += 8;
+        if ( type == IntegerValue )
+        {
+          qint64 integer;
+          memcpy( &integer, &bits, 8 );
+          value = static_cast<qlonglong>( integer );
+        }
+        else
+        {
+          double number;
+          memcpy( &number, &bits, 8 );
+          value = number;
+        }
+        return true;
+      }
+      case TextValue:
+      case BlobValue:
+      {
+        quint64 size;
+        if ( !readVarint( data, pos, size ) || size > static_cast<quint64>( data.size() - pos ) )
+          return false;
+        QByteArray bytes( data.constData() + pos, static_cast<int>( size ) );
+        pos += static_cast<int>( size );
+        value = type == TextValue ? QVariant( QString::fromUtf8( bytes ) ) : QVariant( bytes );
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+  void appendRecord( QByteArray &data, const QVariantList &values )
+  {
+    for ( const QVariant &value : values )
+      appendValue( data, value );
+  }
+
+  bool readRecord( const QByteArray &data, int &pos, int columnsCount, QVariantList &values )
+  {
+    values.clear();
+    for ( int i = 0; i < columnsCount; ++i )
+    {
+      QVariant value;
+      if ( !readValue( data, pos, value ) )
+        return false;
+      values << value;
+    }
+    return true;
+  }
+
+  //! Binary changeset of the SQLite session extension, see GeoPackageDiff
+  QByteArray encodeChangeset( const QList<TableChanges> &tables )
+  {
+    QByteArray data;
+    for ( const TableChanges &table : tables )
+    {
+      if ( table.rows.isEmpty() )
+        continue;
+
+      data.append( 'T' );
+      appendVarint( data, static_cast<quint64>( table.columnsCount ) );
+      for ( int i = 0; i < table.columnsCount; ++i )
+        data.append( static_cast<char>( table.primaryKey.indexOf( i ) + 1 ) ); // position in the primary key, 0 for other columns
+      data.append( table.name.toUtf8() );
+      data.append( '\0' );
+
+      for ( const RowChange &row : table.rows )
+      {
+        data.append( static_cast<char>( row.operation ) );
+        data.append( '\0' ); // not an indirect change
+        if ( row.operation != UpdateOperation )
+        {
+          appendRecord( data, rowValues( row ) );
+          continue;
+        }
+
+        QVariantList oldValues;
+        QVariantList newValues;
+        for ( int i = 0; i < table.columnsCount; ++i )
+        {
+          bool changed = isChanged( table, row, i );
+          oldValues << ( changed || table.primaryKey.contains( i ) ? row.oldValues.at( i ) : QVariant() );
+          newValues << ( changed ? row.newValues.at( i ) : QVariant() );
+        }
+        appendRecord( data, oldValues );
+        appendRecord( data, newValues );
+      }
+    }
+    return data;
+  }
+
+  bool decodeChangeset( const QByteArray &data, QList<TableChanges> &tables, QString *error )
+  {
+    int pos = 0;
+    while ( pos < data.size() )
+    {
+      if ( data.at( pos ) == 'T' )
+      {
+        ++pos;
+        TableChanges table;
+        quint64 columnsCount;
+        if ( !readVarint( data, pos, columnsCount ) || columnsCount == 0 || columnsCount > static_cast<quint64>( data.size() - pos ) )
+          return fail( error, QStringLiteral( "Invalid table header in changeset" ) );
+        table.columnsCount = static_cast<int>( columnsCount );
+
+        // primary key columns are ordered by their position in the key, or by column order if it is not recorded
+        QList<QPair<int, int>> keyColumns;
+        for ( int i = 0; i < table.columnsCount; ++i )
+        {
+          int position = static_cast<uchar>( data.at( pos++ ) );
+          if ( position > 0 )
+            keyColumns << qMakePair( position, i );
+        }
+        std::stable_sort( keyColumns.begin(), keyColumns.end(), []( const QPair<int, int> &a, const QPair<int, int> &b ) { return a.first < b.first; } );
+        for ( const QPair<int, int> &column : keyColumns )
+          table.primaryKey << column.second;
+
+        int nameEnd = data.indexOf( '\0', pos );
+        if ( nameEnd < 0 || table.primaryKey.isEmpty() )
+          return fail( error, QStringLiteral( "Invalid table header in changeset" ) );
+        table.name = QString::fromUtf8( data.constData() + pos, nameEnd - pos );
+        pos = nameEnd + 1;
+        tables << table;
+        continue;
+      }
+
+      if ( tables.isEmpty() || data.size() - pos < 2 )
+        return fail( error, QStringLiteral( "Invalid changeset" ) );
+
+      TableChanges &table = tables.last();
+      RowChange row;
+      int operation = static_cast<uchar>( data.at( pos ) );
+      pos += 2; // operation and indirect flag
+      bool ok;
+      switch ( operation )
+      {
+        case InsertOperation:
+          row.operation = InsertOperation;
+          ok = readRecord( data, pos, table.columnsCount, row.newValues );
+          break;
+        case UpdateOperation:
+          row.operation = UpdateOperation;
+          ok = readRecord( data, pos, table.columnsCount, row.oldValues ) && readRecord( data, pos, table.columnsCount, row.newValues );
+          break;
+        case DeleteOperation:
+          row.operation = DeleteOperation;
+          ok = readRecord( data, pos, table.columnsCount, row.oldValues );
+          break;
+        default:
+          ok = false; // e.g. a patchset
+      }
+      for ( int i = 0; ok && i < table.columnsCount; ++i )
+      {
+        // all values of inserted and deleted rows and the primary key of updated rows are recorded
+        if ( row.operation != UpdateOperation || table.primaryKey.contains( i ) )
+          ok = rowValues( row ).at( i ).isValid();
+      }
+      if ( !ok )
+        return fail( error, QStringLiteral( "Invalid change of table %1 in changeset" ).arg( table.name ) );
+      table.rows << row;
+    }
+    return true;
+  }
+
+  //! Value of a column of a query, SQL NULL as a null QVariant of a valid type
+  QVariant columnValue( const QSqlQuery &query, int column )
+  {
+    QVariant value = query.value( column );
+    return value.isValid() ? value : QVariant( QVariant::String );
+  }
+
+  QList<QVariantList> selectRows( QSqlDatabase &db, const QString &sql, int columnsCount, bool &ok )
+  {
+    QList<QVariantList> rows;
+    QSqlQuery query( db );
+    query.setForwardOnly( true );
+    ok = query.exec( sql );
+    while ( ok && query.next() )
+    {
+      QVariantList row;
+      for ( int i = 0; i < columnsCount; ++i )
+        row << columnValue( query, i );
+      rows << row;
+    }
+    return rows;
+  }
+
+  /**
+   * Reads bounding box of a GeoPackage geometry blob, from the envelope in its header if present.
+   * Returns false for null and empty geometries.
+   */
+  bool geometryExtent( const QByteArray &blob, double extent[4] )
+  {
+    if ( blob.size() < 8 || blob.at( 0 ) != 'G' || blob.at( 1 ) != 'P' )
+      return false;
+
+    uchar flags = static_cast<uchar>( blob.at( 3 ) );
+    if ( flags & 0x10 ) // empty geometry
+      return false;
+
+    bool littleEndian = flags & 0x01;
+    int envelopeType = ( flags >> 1 ) & 0x07;
+    static const int ENVELOPE_SIZES[] = { 0, 32, 48, 48, 64 };
+    if ( envelopeType > 4 )
+      return false;
+    int headerSize = 8 + ENVELOPE_SIZES[envelopeType];
+    if ( blob.size() < headerSize )
+      return false;
+
+    if ( envelopeType > 0 )
+    {
+      // minx, maxx, miny, maxy is also the order of columns of spatial index
+      for ( int i = 0; i < 4; ++i )
+      {
+        quint64 bits;
+        memcpy( &bits, blob.constData() + 8 + 8 * i, 8 );
+        bits = littleEndian ? qFromLittleEndian( bits ) : qFromBigEndian( bits );
+        memcpy( &extent[i], &bits, 8 );
+      }
+      return true;
+    }
+
+    QgsGeometry geometry;
+    geometry.fromWkb( blob.mid( headerSize ) );
+    if ( geometry.isNull() || geometry.isEmpty() )
+      return false;
+
+    QgsRectangle box = geometry.boundingBox();
+    extent[0] = box.xMinimum();
+    extent[1] = box.xMaximum();
+    extent[2] = box.yMinimum();
+    extent[3] = box.yMaximum();
+    return true;
+  }
+
+  //! Spatial index of a geometry column of a table
+  struct SpatialIndex
+  {
+    int geometryColumn = -1; // index in TableInfo::columns
+    QString rtreeTable;
+  };
+
+  QList<SpatialIndex> spatialIndexes( QSqlDatabase &db, const QString &table, const TableInfo &info )
+  {
+    QList<SpatialIndex> indexes;
+    QSqlQuery query( db );
+    query.prepare( QStringLiteral( "SELECT c.column_name FROM gpkg_geometry_columns AS c"
+                                   " JOIN sqlite_master AS s ON s.name = 'rtree_' || c.table_name || '_' || c.column_name"
+                                   " WHERE c.table_name = ?" ) );
+    query.addBindValue( table );
+    if ( !query.exec() )
+      return indexes; // not a GeoPackage
+
+    while ( query.next() )
+    {
+      SpatialIndex index;
+      QString column = query.value( 0 ).toString();
+      index.geometryColumn = info.columns.indexOf( column );
+      index.rtreeTable = QStringLiteral( "rtree_%1_%2" ).arg( table, column );
+      if ( index.geometryColumn >= 0 )
+        indexes << index;
+    }
+    return indexes;
+  }
+
+  bool exec( QSqlQuery &query, QString *error )
+  {
+    if ( query.exec() )
+      return true;
+    return fail( error, query.lastError().text() );
+  }
+
+  bool updateSpatialIndexes( QSqlDatabase &db, const QList<SpatialIndex> &indexes, const QVariant &id, const QVariantList *values, QString *error )
+  {
+    for ( const SpatialIndex &index : indexes )
+    {
+      // a geometry not set by an update keeps its entry
+      if ( values && !values->at( index.geometryColumn ).isValid() )
+        continue;
+
+      double extent[4];
+      QSqlQuery query( db );
+      if ( values && geometryExtent( values->at( index.geometryColumn ).toByteArray(), extent ) )
+      {
+        query.prepare( QStringLiteral( "INSERT OR REPLACE INTO %1 (id, minx, maxx, miny, maxy) VALUES (?, ?, ?, ?, ?)" ).arg( quoted( index.rtreeTable ) ) );
+        query.addBindValue( id );
+        for ( int i = 0; i < 4; ++i )
+          query.addBindValue( extent[i] );
+      }
+      else
+      {
+        query.prepare( QStringLiteral( "DELETE FROM %1 WHERE id = ?" ).arg( quoted( index.rtreeTable ) ) );
+        query.addBindValue( id );
+      }
+      if ( !exec( query, error ) )
+        return false;
+    }
+    return true;
+  }
+
+  bool applyTable( QSqlDatabase &db, const TableChanges &table, QString *error )
+  {
+    // changesets identify columns by their position
+    TableInfo info = tableInfo( db, table.name );
+    QList<int> primaryKey;
+    for ( const QString &column : info.primaryKey )
+      primaryKey << info.columns.indexOf( column );
+    QList<int> changesetKey = table.primaryKey;
+    std::sort( primaryKey.begin(), primaryKey.end() );
+    std::sort( changesetKey.begin(), changesetKey.end() );
+    if ( info.columns.isEmpty() || info.columns.size() != table.columnsCount || primaryKey != changesetKey )
+      return fail( error, QStringLiteral( "Table %1 does not match the changeset" ).arg( table.name ) );
+
+    QStringList primaryKeyConditions;
+    for ( int column : table.primaryKey )
+      primaryKeyConditions << quoted( info.columns.at( column ) ) + QStringLiteral( " = ?" );
+    QString where = primaryKeyConditions.join( QStringLiteral( " AND " ) );
+
+    // Triggers of spatial indexes call functions not available in plain SQLite, the indexes are updated here
+    QList<SpatialIndex> indexes = table.primaryKey.size() == 1 ? spatialIndexes( db, table.name, info ) : QList<SpatialIndex>();
+    QStringList triggers;
+    if ( !indexes.isEmpty() )
+    {
+      QSqlQuery query( db );
+      query.prepare( QStringLiteral( "SELECT name, sql FROM sqlite_master WHERE type = 'trigger' AND tbl_name = ? AND name LIKE 'rtree\\_%' ESCAPE '\\'" ) );
+      query.addBindValue( table.name );
+      if ( !exec( query, error ) )
+        return false;
+      QStringList triggerNames;
+      while ( query.next() )
+      {
+        triggerNames << query.value( 0 ).toString();
+        triggers << query.value( 1 ).toString();
+      }
+      for ( const QString &trigger : triggerNames )
+      {
+        QSqlQuery drop( db );
+        if ( !drop.exec( QStringLiteral( "DROP TRIGGER %1" ).arg( quoted( trigger ) ) ) )
+          return fail( error, drop.lastError().text() );
+      }
+    }
+
+    QStringList columnNames;
+    QStringList placeholders;
+    for ( const QString &column : info.columns )
+    {
+      columnNames << quoted( column );
+      placeholders << QStringLiteral( "?" );
+    }
+
+    for ( const RowChange &row : table.rows )
+    {
+      const QVariantList &values = rowValues( row );
+      QVariant id = values.at( table.primaryKey.first() );
+      QSqlQuery query( db );
+      if ( row.operation == DeleteOperation )
+      {
+        query.prepare( QStringLiteral( "DELETE FROM %1 WHERE %2" ).arg( quoted( table.name ), where ) );
+        for ( int column : table.primaryKey )
+          query.addBindValue( values.at( column ) );
+        if ( !exec( query, error ) )
+          return false;
+        if ( query.numRowsAffected() != 1 )
+          return fail( error, QStringLiteral( "Deleted row of table %1 does not exist" ).arg( table.name ) );
+        if ( !updateSpatialIndexes( db, indexes, id, nullptr, error ) )
+          return false;
+      }
+      else if ( row.operation == UpdateOperation )
+      {
+        QStringList assignments;
+        QVariantList newValues;
+        for ( int i = 0; i < table.columnsCount; ++i )
+        {
+          if ( isChanged( table, row, i ) )
+          {
+            assignments << quoted( info.columns.at( i ) ) + QStringLiteral( " = ?" );
+            newValues << row.newValues.at( i );
+          }
+        }
+        if ( assignments.isEmpty() )
+          continue;
+
+        query.prepare( QStringLiteral( "UPDATE %1 SET %2 WHERE %3" ).arg( quoted( table.name ), assignments.join( QStringLiteral( ", " ) ), where ) );
+        for ( const QVariant &value : newValues )
+          query.addBindValue( value );
+        for ( int column : table.primaryKey )
+          query.addBindValue( values.at( column ) );
+        if ( !exec( query, error ) )
+          return false;
+        if ( query.numRowsAffected() != 1 )
+          return fail( error, QStringLiteral( "Updated row of table %1 does not exist" ).arg( table.name ) );
+        if ( !updateSpatialIndexes( db, indexes, id, &row.newValues, error ) )
+          return false;
+      }
+      else
+      {
+        query.prepare( QStringLiteral( "INSERT INTO %1 (%2) VALUES (%3)" ).arg( quoted( table.name ), columnNames.join( QStringLiteral( ", " ) ), placeholders.join( QStringLiteral( ", " ) ) ) );
+        for ( const QVariant &value : values )
+          query.addBindValue( value );
+        if ( !exec( query, error ) || !updateSpatialIndexes( db, indexes, id, &values, error ) )
+          return false;
+      }
+    }
+
+    for ( const QString &trigger : triggers )
+    {
+      QSqlQuery create( db );
+      if ( !create.exec( trigger ) )
+        return fail( error, create.lastError().text() );
+    }
+    return true;
+  }
+
+  //! Lists changes of tables between base and modified database
+  bool compareDatabases( const QString &basePath, const QString &modifiedPath, QList<TableChanges> &tables, QString *error )
+  {
+    if ( !QFileInfo::exists( basePath ) )
+      return fail( error, QStringLiteral( "Base file %1 does not exist" ).arg( basePath ) );
+
+    Connection connection( modifiedPath );
+    if ( !connection.isOpen() )
+      return fail( error, QStringLiteral( "Cannot open %1" ).arg( modifiedPath ) );
+
+    QSqlDatabase db = connection.database();
+    QSqlQuery attach( db );
+    attach.prepare( QStringLiteral( "ATTACH DATABASE ? AS base" ) );
+    attach.addBindValue( basePath );
+    if ( !exec( attach, error ) )
+      return false;
+
+    if ( schema( db, QStringLiteral( "main" ) ) != schema( db, QStringLiteral( "base" ) ) )
+      return fail( error, QStringLiteral( "Schema of %1 has changed" ).arg( modifiedPath ) );
+
+    for ( const QString &table : userTables( db ) )
+    {
+      TableInfo info = tableInfo( db, table );
+      if ( info.primaryKey.isEmpty() )
+        return fail( error, QStringLiteral( "Table %1 has no primary key" ).arg( table ) );
+
+      TableChanges changes;
+      changes.name = table;
+      changes.columnsCount = info.columns.size();
+      for ( const QString &column : info.primaryKey )
+        changes.primaryKey << info.columns.indexOf( column );
+
+      QString mainColumns = prefixed( QStringLiteral( "m" ), info.columns ).join( QStringLiteral( ", " ) );
+      QString baseColumns = prefixed( QStringLiteral( "b" ), info.columns ).join( QStringLiteral( ", " ) );
+      QString mainKey = prefixed( QStringLiteral( "m" ), info.primaryKey ).join( QStringLiteral( ", " ) );
+      QString baseKey = prefixed( QStringLiteral( "b" ), info.primaryKey ).join( QStringLiteral( ", " ) );
+      QString join = primaryKeyJoin( info.primaryKey );
+      QString mainTable = QStringLiteral( "main.%1 AS m" ).arg( quoted( table ) );
+      QString baseTable = QStringLiteral( "base.%1 AS b" ).arg( quoted( table ) );
+
+      bool ok = true;
+      bool queryOk;
+      QList<QVariantList> deleted = selectRows( db, QStringLiteral( "SELECT %1 FROM %2 WHERE NOT EXISTS (SELECT 1 FROM %3 WHERE %4) ORDER BY %5" )
+                                    .arg( baseColumns, baseTable, mainTable, join, baseKey ), changes.columnsCount, queryOk );
+      ok &= queryOk;
+      for ( const QVariantList &values : deleted )
+      {
+        RowChange row;
+        row.operation = DeleteOperation;
+        row.oldValues = values;
+        changes.rows << row;
+      }
+
+      QStringList differences;
+      for ( const QString &column : info.columns )
+      {
+        if ( !info.primaryKey.contains( column ) )
+          differences << QStringLiteral( "m.%1 IS NOT b.%1" ).arg( quoted( column ) );
+      }
+      if ( !differences.isEmpty() )
+      {
+        QList<QVariantList> updated = selectRows( db, QStringLiteral( "SELECT %1, %2 FROM %3 JOIN %4 ON %5 WHERE %6 ORDER BY %7" )
+                                      .arg( mainColumns, baseColumns, mainTable, baseTable, join, differences.join( QStringLiteral( " OR " ) ), mainKey ),
+                                      2 * changes.columnsCount, queryOk );
+        ok &= queryOk;
+        for ( const QVariantList &values : updated )
+        {
+          RowChange row;
+          row.operation = UpdateOperation;
+          row.newValues = values.mid( 0, changes.columnsCount );
+          row.oldValues = values.mid( changes.columnsCount );
+          changes.rows << row;
+        }
+      }
+
+      QList<QVariantList> inserted = selectRows( db, QStringLiteral( "SELECT %1 FROM %2 WHERE NOT EXISTS (SELECT 1 FROM %3 WHERE %4) ORDER BY %5" )
+                                     .arg( mainColumns, mainTable, baseTable, join, mainKey ), changes.columnsCount, queryOk );
+      ok &= queryOk;
+      for ( const QVariantList &values : inserted )
+      {
+        RowChange row;
+        row.operation = InsertOperation;
+        row.newValues = values;
+        changes.rows << row;
+      }
+
+      if ( !ok )
+        return fail( error, QStringLiteral( "Failed to compare table %1" ).arg( table ) );
+      if ( !changes.rows.isEmpty() )
+        tables << changes;
+    }
+
+    QSqlQuery detach( db );
+    detach.exec( QStringLiteral( "DETACH DATABASE base" ) );
+    return true;
+  }
+
+  //! Applies changes of tables to a database in a single transaction
+  bool applyTables( const QString &dbPath, const QList<TableChanges> &tables, QString *error )
+  {
+    Connection connection( dbPath );
+    if ( !connection.isOpen() )
+      return fail( error, QStringLiteral( "Cannot open %1" ).arg( dbPath ) );
+
+    QSqlDatabase db = connection.database();
+    if ( !db.transaction() )
+      return fail( error, db.lastError().text() );
+
+    for ( const TableChanges &table : tables )
+    {
+      if ( !applyTable( db, table, error ) )
+      {
+        db.rollback();
+        return false;
+      }
+    }
+
+    if ( !db.commit() )
+    {
+      db.rollback();
+      return fail( error, db.lastError().text() );
+    }
+    return true;
+  }
+
+  QJsonValue toJson( const QVariant &value )
+  {
+    switch ( valueType( value ) )
+    {
+      case UndefinedValue:
+      case NullValue:
+        return QJsonValue( QJsonValue::Null );
+      case BlobValue:
+      {
+        QJsonObject blob;
+        blob.insert( QStringLiteral( "blob" ), QString::fromLatin1( value.toByteArray().toBase64() ) );
+        return blob;
+      }
+      case IntegerValue:
+      {
+        // integers which cannot be represented exactly by a double are stored as strings
+        qlonglong integer = value.toLongLong();
+        if ( qAbs( integer ) < ( 1LL << 53 ) )
+          return static_cast<double>( integer );
+        QJsonObject bigInteger;
+        bigInteger.insert( QStringLiteral( "int" ), QString::number( integer ) );
+        return bigInteger;
+      }
+      case FloatValue:
+        return value.toDouble();
+      default:
+        return value.toString();
+    }
+  }
+
+  QJsonArray toJson( const QVariantList &values )
+  {
+    QJsonArray array;
+    for ( const QVariant &value : values )
+      array.append( toJson( value ) );
+    return array;
+  }
+
+  //! Values of the primary key of a row
+  QVariantList rowKey( const TableChanges &table, const RowChange &row )
+  {
+    QVariantList key;
+    for ( int column : table.primaryKey )
+      key << rowValues( row ).at( column );
+    return key;
+  }
+
+  //! Primary key of a row usable in a hash
+  QByteArray keyString( const TableChanges &table, const RowChange &row )
+  {
+    QByteArray key;
+    appendRecord( key, rowKey( table, row ) );
+    return key;
+  }
+
+  //! Rows of changes of a table with given operation by their primary key
+  QHash<QByteArray, RowChange> rowsByKey( const TableChanges &table, Operation operation )
+  {
+    QHash<QByteArray, RowChange> result;
+    for ( const RowChange &row : table.rows )
+    {
+      if ( row.operation == operation )
+        result.insert( keyString( table, row ), row );
+    }
+    return result;
+  }
+
+  QJsonObject conflict( const TableChanges &table, const QString &type, const QVariantList &key, const QJsonValue &localRow, const QJsonValue &serverRow )
+  {
+    QJsonObject object;
+    object.insert( QStringLiteral( "table" ), table.name );
+    object.insert( QStringLiteral( "type" ), type );
+    object.insert( QStringLiteral( "key" ), toJson( key ) );
+    object.insert( QStringLiteral( "local" ), localRow );
+    object.insert( QStringLiteral( "server" ), serverRow );
+    return object;
+  }
+
+  //! The first integer primary key free in the database and among inserted rows
+  qint64 freeKey( const QString &dbPath, const TableChanges &table, int keyColumn )
+  {
+    qint64 maxKey = 0;
+    {
+      Connection connection( dbPath );
+      QSqlDatabase db = connection.database();
+      TableInfo info = tableInfo( db, table.name );
+      QSqlQuery query( db );
+      if ( connection.isOpen() && keyColumn < info.columns.size()
+           && query.exec( QStringLiteral( "SELECT MAX(%1) FROM %2" ).arg( quoted( info.columns.at( keyColumn ) ), quoted( table.name ) ) ) && query.next() )
+        maxKey = query.value( 0 ).toLongLong();
+    }
+    for ( const RowChange &row : table.rows )
+    {
+      if ( row.operation == InsertOperation )
+        maxKey = qMax( maxKey, row.newValues.at( keyColumn ).toLongLong() );
+    }
+    return maxKey + 1;
+  }
+
+  //! Column of a table referencing the integer primary key of a parent table
+  struct ForeignKey
+  {
+    QString table;
+    int column = -1;
+    QString parentTable;
+  };
+
+  //! Single column foreign keys of user tables which reference a single column primary key
+  QList<ForeignKey> foreignKeys( const QString &dbPath )
+  {
+    QList<ForeignKey> keys;
+    Connection connection( dbPath );
+    if ( !connection.isOpen() )
+      return keys;
+
+    QSqlDatabase db = connection.database();
+    for ( const QString &table : userTables( db ) )
+    {
+      TableInfo info = tableInfo( db, table );
+      QHash<int, int> keyColumns; // id of a foreign key -> its columns count
+      QHash<int, ForeignKey> tableKeys;
+      QSqlQuery query( db );
+      query.exec( QStringLiteral( "PRAGMA main.foreign_key_list(%1)" ).arg( quoted( table ) ) );
+      while ( query.next() )
+      {
+        int id = query.value( 0 ).toInt();
+        keyColumns[id]++;
+        QString parentTable = query.value( 2 ).toString();
+        QString parentColumn = query.value( 4 ).toString();
+        QStringList parentKey = tableInfo( db, parentTable ).primaryKey;
+        if ( parentKey.size() != 1 || ( !parentColumn.isEmpty() && parentColumn != parentKey.first() ) )
+          continue;
+
+        ForeignKey key;
+        key.table = table;
+        key.column = info.columns.indexOf( query.value( 3 ).toString() );
+        key.parentTable = parentTable;
+        tableKeys.insert( id, key );
+      }
+      for ( auto it = tableKeys.constBegin(); it != tableKeys.constEnd(); ++it )
+      {
+        if ( keyColumns.value( it.key() ) == 1 && it->column >= 0 )
+          keys << it.value();
+      }
+    }
+    return keys;
+  }
+
+  //! Local rows referencing rows which have got a new primary key refer to the new one
+  void updateReferences( TableChanges &table, const QList<ForeignKey> &references, const QHash<QString, QHash<qint64, qint64>> &newKeys )
+  {
+    for ( const ForeignKey &reference : references )
+    {
+      const QHash<qint64, qint64> keys = newKeys.value( reference.parentTable );
+      if ( reference.table != table.name || keys.isEmpty() )
+        continue;
+
+      for ( RowChange &row : table.rows )
+      {
+        // a value not set by an update is undefined, the primary key is never changed by an update
+        if ( row.operation == DeleteOperation || ( row.operation == UpdateOperation && table.primaryKey.contains( reference.column ) ) )
+          continue;
+        QVariant &value = row.newValues[reference.column];
+        if ( valueType( value ) == IntegerValue && keys.contains( value.toLongLong() ) )
+          value = static_cast<qlonglong>( keys.value( value.toLongLong() ) );
+      }
+    }
+  }
+
+  /**
+   * Rebases local changes of a table onto changes of the server, conflicting rows are added to conflicts.
+   * Updates of a row on both sides are merged column by column. Local values win where both sides have changed
+   * the same column or the row has been deleted on one side, so no edit of the field crew is lost and the server
+   * values are kept in the report. A local row which gets a new primary key is added to newKeys.
+   */
+  TableChanges rebaseTable( const TableChanges &localChanges, const TableChanges &serverChanges, const QString &mergedPath, QJsonArray &conflicts,
+                            QHash<qint64, qint64> &newKeys )
+  {
+    QHash<QByteArray, RowChange> serverInserted = rowsByKey( serverChanges, InsertOperation );
+    QHash<QByteArray, RowChange> serverUpdated = rowsByKey( serverChanges, UpdateOperation );
+    QHash<QByteArray, RowChange> serverDeleted = rowsByKey( serverChanges, DeleteOperation );
+
+    QList<RowChange> deleted;
+    QList<RowChange> updated;
+    QList<RowChange> inserted;
+    qint64 nextKey = -1;
+    for ( const RowChange &row : localChanges.rows )
+    {
+      QByteArray id = keyString( localChanges, row );
+      QVariantList key = rowKey( localChanges, row );
+      if ( row.operation == DeleteOperation )
+      {
+        if ( serverDeleted.contains( id ) )
+          continue;
+        if ( serverUpdated.contains( id ) )
+        {
+          // the edit of the server is kept rather than deleted
+          conflicts.append( conflict( localChanges, QStringLiteral( "delete_update" ), key, QJsonValue::Null, toJson( serverUpdated.value( id ).newValues ) ) );
+          continue;
+        }
+        deleted << row;
+      }
+      else if ( row.operation == UpdateOperation )
+      {
+        if ( serverUpdated.contains( id ) )
+        {
+          // only columns changed locally are set, a column changed on both sides to different values is a conflict
+          const RowChange &serverRow = serverUpdated[id];
+          RowChange merged = row;
+          bool changed = false;
+          bool conflicting = false;
+          for ( int i = 0; i < localChanges.columnsCount; ++i )
+          {
+            if ( localChanges.primaryKey.contains( i ) )
+              continue;
+            if ( !isChanged( localChanges, row, i ) || ( isChanged( serverChanges, serverRow, i ) && sameValue( serverRow.newValues.at( i ), row.newValues.at( i ) ) ) )
+            {
+              merged.newValues[i] = QVariant();
+              continue;
+            }
+            changed = true;
+            if ( isChanged( serverChanges, serverRow, i ) )
+              conflicting = true;
+          }
+          if ( conflicting )
+            conflicts.append( conflict( localChanges, QStringLiteral( "update_update" ), key, toJson( row.newValues ), toJson( serverRow.newValues ) ) );
+          if ( changed )
+            updated << merged;
+        }
+        else if ( serverDeleted.contains( id ) )
+        {
+          // the row deleted on the server is restored with the local edit
+          conflicts.append( conflict( localChanges, QStringLiteral( "update_delete" ), key, toJson( row.newValues ), QJsonValue::Null ) );
+          RowChange restored;
+          restored.operation = InsertOperation;
+          restored.newValues = row.newValues;
+          inserted << restored;
+        }
+        else
+        {
+          updated << row;
+        }
+      }
+      else
+      {
+        if ( !serverInserted.contains( id ) )
+        {
+          inserted << row;
+          continue;
+        }
+        const RowChange &serverRow = serverInserted[id];
+        if ( sameValues( serverRow.newValues, row.newValues ) )
+          continue;
+
+        int keyColumn = localChanges.primaryKey.first();
+        if ( localChanges.primaryKey.size() == 1 && valueType( row.newValues.at( keyColumn ) ) == IntegerValue )
+        {
+          // both sides have added a feature with the next free id, the local feature gets a new one
+          if ( nextKey < 0 )
+            nextKey = freeKey( mergedPath, localChanges, keyColumn );
+          RowChange rekeyed = row;
+          newKeys.insert( row.newValues.at( keyColumn ).toLongLong(), nextKey );
+          rekeyed.newValues[keyColumn] = static_cast<qlonglong>( nextKey++ );
+          inserted << rekeyed;
+          continue;
+        }
+
+        conflicts.append( conflict( localChanges, QStringLiteral( "insert_insert" ), key, toJson( row.newValues ), toJson( serverRow.newValues ) ) );
+        RowChange overwrite;
+        overwrite.operation = UpdateOperation;
+        overwrite.oldValues = serverRow.newValues;
+        overwrite.newValues = row.newValues;
+        updated << overwrite;
+      }
+    }
+
+    TableChanges tableChanges = localChanges;
+    tableChanges.rows = deleted + updated + inserted;
+    return tableChanges;
+  }
+}
+
+bool GeoPackageDiff::isGeoPackage( const QString &path )
+{
+  return path.endsWith( QStringLiteral( ".gpkg" ), Qt::CaseInsensitive );
+}
+
+bool GeoPackageDiff::createChangeset( const QString &basePath, const QString &modifiedPath, const QString &changesetPath, QString *error )
+{
+  QList<TableChanges> tables;
+  if ( !compareDatabases( basePath, modifiedPath, tables, error ) )
+    return false;
+
+  QSaveFile file( changesetPath );
+  if ( !file.open( QIODevice::WriteOnly ) )
+    return fail( error, QStringLiteral( "Cannot write %1" ).arg( changesetPath ) );
+  file.write( encodeChangeset( tables ) );
+  if ( !file.commit() )
+    return fail( error, QStringLiteral( "Cannot write %1" ).arg( changesetPath ) );
+  return true;
+}
+
+bool GeoPackageDiff::applyChangeset( const QString &dbPath, const QString &changesetPath, QString *error )
+{
+  QFile file( changesetPath );
+  if ( !file.open( QIODevice::ReadOnly ) )
+    return fail( error, QStringLiteral( "Cannot read %1" ).arg( changesetPath ) );
+  QByteArray data = file.readAll();
+  file.close();
+
+  QList<TableChanges> tables;
+  if ( !decodeChangeset( data, tables, error ) )
+    return false;
+  return applyTables( dbPath, tables, error );
+}
+
+bool GeoPackageDiff::copyDatabase( const QString &sourcePath, const QString &copyPath, QString *error )
+{
+  Connection connection( sourcePath );
+  if ( !connection.isOpen() )
+    return fail( error, QStringLiteral( "Cannot open %1" ).arg( sourcePath ) );
+
+  // all frames of the log are written to the database file and the log is emptied,
+  // it is a no-op returning (0, -1, -1) for a database in rollback journal mode
+  QSqlDatabase db = connection.database();
+  {
+    QSqlQuery checkpoint( db );
+    if ( !checkpoint.exec( QStringLiteral( "PRAGMA wal_checkpoint(TRUNCATE)" ) ) || !checkpoint.next() || checkpoint.value( 0 ).toInt() != 0 )
+      return fail( error, QStringLiteral( "Cannot checkpoint %1" ).arg( sourcePath ) );
+  }
+
+  // a reader keeps checkpoints of other connections from writing to the file (and writers in rollback journal mode),
+  // a write which has made it to the log before the read started would be missing in the file though
+  if ( !db.transaction() )
+    return fail( error, db.lastError().text() );
+  bool copied = false;
+  {
+    QSqlQuery read( db );
+    if ( read.exec( QStringLiteral( "SELECT COUNT(*) FROM sqlite_master" ) ) && read.next() && QFileInfo( sourcePath + QStringLiteral( "-wal" ) ).size() == 0 )
+    {
+      QFile::remove( copyPath );
+      copied = QFile::copy( sourcePath, copyPath );
+    }
+  }
+  db.rollback();
+  if ( !copied )
+    return fail( error, QStringLiteral( "Cannot copy %1" ).arg( sourcePath ) );
+  return true;
+}
+
+bool GeoPackageDiff::merge( const QString &basePath, const QString &localPath, const QString &serverPath, const QString &mergedPath, QJsonArray &conflicts, QString *error )
+{
+  QList<TableChanges> localTables;
+  QList<TableChanges> serverTables;
+  if ( !compareDatabases( basePath, localPath, localTables, error ) || !compareDatabases( basePath, serverPath, serverTables, error ) )
+    return false;
+
+  QHash<QString, TableChanges> serverChanges;
+  for ( const TableChanges &table : serverTables )
+    serverChanges.insert( table.name, table );
+
+  QFile::remove( mergedPath );
+  if ( !QFile::copy( serverPath, mergedPath ) )
+    return fail( error, QStringLiteral( "Cannot write %1" ).arg( mergedPath ) );
+
+  QList<TableChanges> mergedTables;
+  QHash<QString, QHash<qint64, qint64>> newKeys; // table -> key of a local row -> new key of the row
+  for ( const TableChanges &localChanges : localTables )
+    mergedTables << rebaseTable( localChanges, serverChanges.value( localChanges.name ), mergedPath, conflicts, newKeys[localChanges.name] );
+
+  // rows of any table may refer to a row which has got a new key
+  QList<ForeignKey> references = foreignKeys( localPath );
+  for ( TableChanges &table : mergedTables )
+    updateReferences( table, references, newKeys );
+
+  if ( !applyTables( mergedPath, mergedTables, error ) )
+  {
+    QFile::remove( mergedPath );
+    return false;
+  }
+  return true;
+}
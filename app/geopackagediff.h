@@ -0,0 +1,52 @@
+#ifndef GEOPACKAGEDIFF_H
+#define GEOPACKAGEDIFF_H
+
+#include <QJsonArray>
+#include <QString>
+
+/**
+ * Row-level changesets of GeoPackage (SQLite) files, so an edit of a few features is transferred
+ * instead of the whole file.
+ *
+ * A changeset is created by comparing the modified file with its base copy (the version last synchronized
+ * with the server) attached to the same connection. It is written in the binary changeset format of the SQLite
+ * session extension, as produced by sqlite3session_changeset() and read by sqlite3changeset_apply() or geodiff:
+ * inserted and deleted rows with all values, updated rows with the primary key and old and new values of changed
+ * columns, for each table with a primary key. GeoPackage metadata tables (gpkg_*) and spatial indexes are not part
+ * of changesets, spatial indexes are updated when a changeset is applied. Changesets cannot be created if
+ * schema of the database has changed, the whole file has to be transferred then.
+ *
+ * Concurrent edits of local and server version are merged row by row against their common base (see merge()).
+ */
+class GeoPackageDiff
+{
+  public:
+    static bool isGeoPackage( const QString &path );
+
+    //! Writes changes between base and modified database to changesetPath, returns false with error message on failure
+    static bool createChangeset( const QString &basePath, const QString &modifiedPath, const QString &changesetPath, QString *error = nullptr );
+
+    //! Applies changeset to a database in a single transaction, returns false with error message on failure
+    static bool applyChangeset( const QString &dbPath, const QString &changesetPath, QString *error = nullptr );
+
+    /**
+     * Copies a database including changes which are still in its write-ahead log. The log is checkpointed first and
+     * the file is copied within a read transaction, so other connections do not change it meanwhile. Fails if the log
+     * cannot be checkpointed or other connections write to it, rather than making an incomplete copy.
+     */
+    static bool copyDatabase( const QString &sourcePath, const QString &copyPath, QString *error = nullptr );
+
+    /**
+     * Three-way merge: local changes against base are applied to a copy of the server version written to mergedPath.
+     * Edits of different rows are merged, and so are edits of different columns of a row. A row inserted on both sides
+     * with the same integer primary key is added with a new key, local rows referencing it by a foreign key are
+     * updated to the new key. Where both sides have changed the same column of a row to different values or one side
+     * has deleted the row, local values win (a row deleted on the server is restored, a local deletion of a row edited
+     * on the server is dropped) and the row is reported in conflicts with its local and server values.
+     * Returns false with error message if the versions cannot be compared, e.g. when a schema has changed.
+     */
+    static bool merge( const QString &basePath, const QString &localPath, const QString &serverPath, const QString &mergedPath,
+                       QJsonArray &conflicts, QString *error = nullptr );
+};
+
+#endif // GEOPACKAGEDIFF_H
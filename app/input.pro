@@ -103,6 +103,9 @@ android {
     QT += androidextras
 }
 
+# zlib compresses sync payloads (see Compression)
+LIBS += -lz
+
 
 SOURCES += \
 main.cpp \
@@ -116,7 +119,27 @@ merginapi.cpp \
 merginprojectmodel.cpp \
 androidutils.cpp \
 inpututils.cpp \
-test/testmerginapi.cpp
+multipartparser.cpp \
+checksumcache.cpp \
+filehasher.cpp \
+sha1.cpp \
+geopackagediff.cpp \
+blockdelta.cpp \
+compression.cpp \
+syncscheduler.cpp \
+responsecache.cpp \
+changejournal.cpp \
+projectscache.cpp \
+transfercontroller.cpp \
+blobstore.cpp \
+syncstats.cpp \
+diskwriter.cpp \
+syncfilters.cpp \
+jsonreader.cpp \
+syncmanifest.cpp \
+test/testmerginapi.cpp \
+test/localmerginserver.cpp \
+test/benchmerginapi.cpp
 
 HEADERS += \
 projectsmodel.h \
@@ -129,7 +152,27 @@ merginapi.h \
 merginprojectmodel.h \
 androidutils.h \
 inpututils.h \
-test/testmerginapi.h
+multipartparser.h \
+checksumcache.h \
+filehasher.h \
+sha1.h \
+geopackagediff.h \
+blockdelta.h \
+compression.h \
+syncscheduler.h \
+responsecache.h \
+changejournal.h \
+projectscache.h \
+transfercontroller.h \
+blobstore.h \
+syncstats.h \
+diskwriter.h \
+syncfilters.h \
+jsonreader.h \
+syncmanifest.h \
+test/testmerginapi.h \
+test/localmerginserver.h \
+test/benchmerginapi.h
 
 RESOURCES += \
     img/pics.qrc \
@@ -0,0 +1,357 @@
+#include "jsonreader.h"
+
+#include <cstring>
+
+namespace
+{
+  //! Reads a number of decimal digits, returns -1 if any of them is not a digit
+  int readDigits( const char *text, int count )
+  {
+    int value = 0;
+    for ( int i = 0; i < count; ++i )
+    {
+      if ( text[i] < '0' || text[i] > '9' )
+        return -1;
+      value = value * 10 + ( text[i] - '0' );
+    }
+    return value;
+  }
+
+  bool isNumberCharacter( char c )
+  {
+    return ( c >= '0' && c <= '9' ) || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-';
+  }
+
+  int hexDigit( char c )
+  {
+    if ( c >= '0' && c <= '9' )
+      return c - '0';
+    if ( c >= 'a' && c <= 'f' )
+      return c - 'a' + 10;
+    if ( c >= 'A' && c <= 'F' )
+      return c - 'A' + 10;
+    return -1;
+  }
+}
+
+JsonReader::JsonReader( const QByteArray &data )
+  : mData( data.constData() )
+  , mSize( data.size() )
+{
+}
+
+JsonReader::Token JsonReader::next()
+{
+  mToken = readToken();
+  return mToken;
+}
+
+void JsonReader::skipValue()
+{
+  if ( mToken != BeginObject && mToken != BeginArray )
+    return;
+
+  int depth = 1;
+  while ( depth > 0 )
+  {
+    switch ( next() )
+    {
+      case BeginObject:
+      case BeginArray:
+        ++depth;
+        break;
+      case EndObject:
+      case EndArray:
+        --depth;
+        break;
+      case End:
+      case Error:
+        return;
+      default:
+        break;
+    }
+  }
+}
+
+QString JsonReader::string() const
+{
+  if ( !mEscaped )
+    return QString::fromUtf8( mValue, mValueSize );
+
+  QString result;
+  result.reserve( mValueSize );
+  const char *end = mValue + mValueSize;
+  const char *run = mValue; // characters without escapes are decoded at once
+  const char *p = mValue;
+  while ( p < end )
+  {
+    if ( *p != '\\' )
+    {
+      ++p;
+      continue;
+    }
+
+    result += QString::fromUtf8( run, static_cast<int>( p - run ) );
+    if ( ++p == end )
+      break;
+
+    switch ( *p )
+    {
+      case 'b':
+        result += QLatin1Char( '\b' );
+        break;
+      case 'f':
+        result += QLatin1Char( '\f' );
+        break;
+      case 'n':
+        result += QLatin1Char( '\n' );
+        break;
+      case 'r':
+        result += QLatin1Char( '\r' );
+        break;
+      case 't':
+        result += QLatin1Char( '\t' );
+        break;
+      case 'u':
+      {
+        // UTF-16 code unit, surrogate pairs are formed by two consecutive escapes
+        ushort unit = 0;
+        for ( int i = 1; i <= 4 && p + i < end; ++i )
+          unit = static_cast<ushort>( unit * 16 + qMax( hexDigit( p[i] ), 0 ) );
+        result += QChar( unit );
+        p = qMin( p + 4, end - 1 );
+        break;
+      }
+      default:
+        result += QLatin1Char( *p );
+        break;
+    }
+    run = ++p;
+  }
+  result += QString::fromUtf8( run, static_cast<int>( end - run ) );
+  return result;
+}
+
+double JsonReader::number() const
+{
+  return QByteArray::fromRawData( mValue, mValueSize ).toDouble();
+}
+
+QDateTime JsonReader::dateTime() const
+{
+  if ( mEscaped )
+    return QDateTime::fromString( string(), Qt::ISODateWithMs );
+  return parseDateTime( mValue, mValueSize );
+}
+
+QDateTime JsonReader::parseDateTime( const char *text, int size )
+{
+  auto parseGeneric = [text, size]
+  {
+    return QDateTime::fromString( QString::fromLatin1( text, size ), Qt::ISODateWithMs );
+  };
+
+  // YYYY-MM-DDTHH:MM:SS
+  if ( size < 19 || text[4] != '-' || text[7] != '-' || text[10] != 'T' || text[13] != ':' || text[16] != ':' )
+    return parseGeneric();
+
+  int year = readDigits( text, 4 );
+  int month = readDigits( text + 5, 2 );
+  int day = readDigits( text + 8, 2 );
+  int hour = readDigits( text + 11, 2 );
+  int minute = readDigits( text + 14, 2 );
+  int second = readDigits( text + 17, 2 );
+  if ( year < 0 || month < 0 || day < 0 || hour < 0 || minute < 0 || second < 0 )
+    return parseGeneric();
+
+  int pos = 19;
+  int msec = 0;
+  if ( pos < size && ( text[pos] == '.' || text[pos] == ',' ) )
+  {
+    int begin = ++pos;
+    while ( pos < size && text[pos] >= '0' && text[pos] <= '9' )
+      ++pos;
+    if ( pos == begin )
+      return parseGeneric();
+
+    // rounded from at most 4 digits like QDateTime::fromString, the server sends microseconds
+    static const double scales[] = { 1, 10, 100, 1000, 10000 };
+    int count = qMin( pos - begin, 4 );
+    double fraction = readDigits( text + begin, count ) / scales[count];
+    msec = qMin( qRound( fraction * 1000.0 ), 999 );
+  }
+
+  QDate date( year, month, day );
+  QTime time( hour, minute, second, msec );
+  if ( !date.isValid() || !time.isValid() )
+    return parseGeneric(); // e.g. 24:00:00 of the next day
+
+  if ( pos == size )
+    return QDateTime( date, time, Qt::LocalTime );
+  if ( text[pos] == 'Z' && pos + 1 == size )
+    return QDateTime( date, time, Qt::UTC );
+  if ( ( text[pos] == '+' || text[pos] == '-' ) && size - pos == 6 && text[pos + 3] == ':' )
+  {
+    int offsetHours = readDigits( text + pos + 1, 2 );
+    int offsetMinutes = readDigits( text + pos + 4, 2 );
+    if ( offsetHours >= 0 && offsetMinutes >= 0 )
+    {
+      int offset = ( offsetHours * 60 + offsetMinutes ) * 60;
+      return QDateTime( date, time, Qt::OffsetFromUTC, text[pos] == '-' ? -offset : offset );
+    }
+  }
+  return parseGeneric();
+}
+
+JsonReader::Token JsonReader::readToken()
+{
+  if ( mFailed )
+    return Error;
+
+  skipWhitespace();
+  if ( mAfterValue )
+  {
+    if ( mContainers.isEmpty() )
+      return mPos < mSize ? fail( QStringLiteral( "Unexpected data after the document at %1" ).arg( mPos ) ) : End;
+    if ( mPos >= mSize )
+      return fail( QStringLiteral( "Unexpected end of data" ) );
+
+    char c = mData[mPos];
+    char container = mContainers.at( mContainers.size() - 1 );
+    if ( ( c == '}' && container == '{' ) || ( c == ']' && container == '[' ) )
+    {
+      ++mPos;
+      mContainers.chop( 1 );
+      return c == '}' ? EndObject : EndArray;
+    }
+    if ( c != ',' )
+      return fail( QStringLiteral( "Expected ',' at %1" ).arg( mPos ) );
+
+    ++mPos;
+    mAfterValue = false;
+    mExpectKey = container == '{';
+    skipWhitespace();
+  }
+
+  if ( mPos >= mSize )
+    return fail( QStringLiteral( "Unexpected end of data" ) );
+
+  char c = mData[mPos];
+  if ( mJustOpened )
+  {
+    mJustOpened = false;
+    char container = mContainers.at( mContainers.size() - 1 );
+    if ( ( c == '}' && container == '{' ) || ( c == ']' && container == '[' ) )
+    {
+      ++mPos;
+      mContainers.chop( 1 );
+      mExpectKey = false;
+      mAfterValue = true;
+      return c == '}' ? EndObject : EndArray;
+    }
+  }
+
+  if ( mExpectKey )
+  {
+    if ( c != '"' || !readString() )
+      return fail( QStringLiteral( "Expected a key at %1" ).arg( mPos ) );
+    skipWhitespace();
+    if ( mPos >= mSize || mData[mPos] != ':' )
+      return fail( QStringLiteral( "Expected ':' at %1" ).arg( mPos ) );
+    ++mPos;
+    mExpectKey = false;
+    return Key;
+  }
+
+  return readValue( c );
+}
+
+JsonReader::Token JsonReader::readValue( char c )
+{
+  switch ( c )
+  {
+    case '{':
+    case '[':
+      ++mPos;
+      mContainers.append( c );
+      mJustOpened = true;
+      mExpectKey = c == '{';
+      return c == '{' ? BeginObject : BeginArray;
+
+    case '"':
+      if ( !readString() )
+        return fail( QStringLiteral( "Unterminated string" ) );
+      mAfterValue = true;
+      return String;
+
+    case 't':
+      return readLiteral( "true", True );
+    case 'f':
+      return readLiteral( "false", False );
+    case 'n':
+      return readLiteral( "null", Null );
+
+    default:
+      break;
+  }
+
+  if ( c != '-' && ( c < '0' || c > '9' ) )
+    return fail( QStringLiteral( "Unexpected character at %1" ).arg( mPos ) );
+
+  // the number is validated when its value is read
+  int begin = mPos++;
+  while ( mPos < mSize && isNumberCharacter( mData[mPos] ) )
+    ++mPos;
+  mValue = mData + begin;
+  mValueSize = mPos - begin;
+  mAfterValue = true;
+  return Number;
+}
+
+bool JsonReader::readString()
+{
+  int begin = ++mPos;
+  mEscaped = false;
+  while ( mPos < mSize )
+  {
+    char c = mData[mPos];
+    if ( c == '"' )
+    {
+      mValue = mData + begin;
+      mValueSize = mPos - begin;
+      ++mPos;
+      return true;
+    }
+    if ( c == '\\' )
+    {
+      mEscaped = true;
+      ++mPos;
+    }
+    ++mPos;
+  }
+  return false;
+}
+
+JsonReader::Token JsonReader::readLiteral( const char *literal, Token token )
+{
+  int length = static_cast<int>( std::strlen( literal ) );
+  if ( mSize - mPos < length || std::memcmp( mData + mPos, literal, length ) != 0 )
+    return fail( QStringLiteral( "Unexpected character at %1" ).arg( mPos ) );
+
+  mPos += length;
+  mAfterValue = true;
+  return token;
+}
+
+void JsonReader::skipWhitespace()
+{
+  while ( mPos < mSize && ( mData[mPos] == ' ' || mData[mPos] == '\n' || mData[mPos] == '\r' || mData[mPos] == '\t' ) )
+    ++mPos;
+}
+
+JsonReader::Token JsonReader::fail( const QString &error )
+{
+  mFailed = true;
+  mError = error;
+  return Error;
+}
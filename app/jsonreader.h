@@ -0,0 +1,94 @@
+#ifndef JSONREADER_H
+#define JSONREADER_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QString>
+
+/**
+ * Pull parser of JSON (RFC 8259) working on raw bytes, an alternative to QJsonDocument for large replies
+ * (lists of projects, project files) whose records are processed one by one.
+ *
+ * next() is called to get tokens in document order, values of the current token are read by string(), number()
+ * and dateTime() on demand, so only values which are used are decoded and no document tree is built.
+ * Values which are not needed are skipped with skipValue(). Malformed data make next() return Error
+ * from then on, records read so far are not guaranteed to be complete.
+ */
+class JsonReader
+{
+  public:
+    enum Token
+    {
+      BeginObject,
+      EndObject,
+      BeginArray,
+      EndArray,
+      Key, //!< name of an object member, see string(), its value follows
+      String,
+      Number,
+      True,
+      False,
+      Null,
+      End, //!< the whole document has been read
+      Error //!< data are malformed or truncated, see errorString()
+    };
+
+    //! Data must stay valid while they are read
+    explicit JsonReader( const QByteArray &data );
+
+    Token next();
+
+    //! Skips nested tokens if the current token begins an object or an array
+    void skipValue();
+
+    //! Decoded value of the current Key or String token
+    QString string() const;
+
+    /**
+     * Undecoded value of the current Key or String token without a copy, valid as long as the data,
+     * for fast comparisons of keys. Escape sequences are not resolved, see hasEscapes().
+     */
+    QByteArray rawString() const { return QByteArray::fromRawData( mValue, mValueSize ); }
+
+    bool hasEscapes() const { return mEscaped; }
+
+    //! Value of the current Number token
+    double number() const;
+
+    //! Value of the current String token parsed as ISO 8601 date and time, see parseDateTime()
+    QDateTime dateTime() const;
+
+    QString errorString() const { return mError; }
+
+    /**
+     * Parses ISO 8601 date and time like QDateTime::fromString( text, Qt::ISODateWithMs ). Timestamps
+     * of Mergin API ("YYYY-MM-DDTHH:MM:SS[.fff][Z|+HH:MM]") are parsed by fixed positions of their fields
+     * without allocations, other forms fall back to QDateTime::fromString.
+     */
+    static QDateTime parseDateTime( const char *text, int size );
+
+  private:
+    Token readToken();
+    Token readValue( char c );
+    bool readString();
+    Token readLiteral( const char *literal, Token token );
+    void skipWhitespace();
+    Token fail( const QString &error );
+
+    const char *mData;
+    int mSize;
+    int mPos = 0;
+    QByteArray mContainers; // '{' or '[' of nested objects and arrays
+    bool mExpectKey = false; // at the beginning of an object member
+    bool mAfterValue = false; // a value has been read, a separator or the end of its container follows
+    bool mJustOpened = false; // an object or an array has begun, it may end right away
+    bool mFailed = false;
+    Token mToken = End; // the last token returned by next()
+
+    const char *mValue = nullptr;
+    int mValueSize = 0;
+    bool mEscaped = false;
+    QString mError;
+};
+
+#endif // JSONREADER_H
@@ -26,6 +26,8 @@
 #include "merginprojectmodel.h"
 
 #include "test/testmerginapi.h"
+#include "test/benchmerginapi.h"
+#include "test/localmerginserver.h"
 
 #include "qgsquickutils.h"
 #include "qgsproject.h"
@@ -196,6 +198,7 @@ void initDeclarative()
   qmlRegisterUncreatableType<LayersModel>( "lc", 1, 0, "LayersModel", "" );
   qmlRegisterUncreatableType<Loader>( "lc", 1, 0, "Loader", "" );
   qmlRegisterUncreatableType<AppSettings>( "lc", 1, 0, "AppSettings", "" );
+  qmlRegisterUncreatableType<TransferController>( "lc", 1, 0, "TransferController", "" );
   qmlRegisterType<DigitizingController>( "lc", 1, 0, "DigitizingController" );
 }
 
@@ -220,9 +223,13 @@ int main( int argc, char *argv[] )
   QCoreApplication::setApplicationVersion( version );
 
   bool IS_TEST = false;
+  bool IS_BENCH = false;
+  bool IS_LOCAL_SERVER = false;
   for ( int i = 0; i < argc; ++i )
   {
     if ( std::string( argv[i] ) == "--test" ) IS_TEST = true;
+    if ( std::string( argv[i] ) == "--bench" ) IS_BENCH = true;
+    if ( std::string( argv[i] ) == "--local-server" ) IS_LOCAL_SERVER = true;
   }
   qDebug() << "Built with QGIS version " << VERSION_INT;
 
@@ -231,7 +238,7 @@ int main( int argc, char *argv[] )
   AndroidUtils::requirePermissions();
 #endif
   // Set/Get enviroment
-  QString dataDir = getDataDir( IS_TEST );
+  QString dataDir = getDataDir( IS_TEST || IS_BENCH );
   QString projectDir = dataDir + "/projects";
   setEnvironmentQgisPrefixPath();
 
@@ -242,7 +249,7 @@ int main( int argc, char *argv[] )
   AndroidUtils au;
   InputUtils iu;
   ProjectModel pm( projectDir );
-  if ( pm.rowCount() == 0 && !IS_TEST )
+  if ( pm.rowCount() == 0 && !IS_TEST && !IS_BENCH )
   {
     qDebug() << "Unable to find any QGIS project in the folder " << projectDir;
   }
@@ -263,6 +270,13 @@ int main( int argc, char *argv[] )
   QObject::connect( ma.get(), &MerginApi::listProjectsFinished, &mpm, &MerginProjectModel::resetProjects );
   QObject::connect( ma.get(), &MerginApi::reloadProject, &loader, &Loader::reloadProject );
   QObject::connect( &pm, &ProjectModel::projectDeleted, ma.get(), &MerginApi::projectDeleted );
+  ma->setSyncConcurrency( as.syncConcurrency() );
+  QObject::connect( &as, &AppSettings::syncConcurrencyChanged, ma.get(), [&ma, &as]() { ma->setSyncConcurrency( as.syncConcurrency() ); } );
+  ma->transferController()->setBandwidthLimit( as.bandwidthLimit() * 1024 );
+  QObject::connect( &as, &AppSettings::bandwidthLimitChanged, ma.get(), [&ma, &as]() { ma->transferController()->setBandwidthLimit( as.bandwidthLimit() * 1024 ); } );
+  QString syncLogFile = dataDir + "/syncLog.jsonl";
+  ma->setSyncLogFile( as.syncLogEnabled() ? syncLogFile : QString() );
+  QObject::connect( &as, &AppSettings::syncLogEnabledChanged, ma.get(), [&ma, &as, syncLogFile]() { ma->setSyncLogFile( as.syncLogEnabled() ? syncLogFile : QString() ); } );
 
   if ( IS_TEST )
   {
@@ -271,6 +285,30 @@ int main( int argc, char *argv[] )
     return 0;
   }
 
+  if ( IS_BENCH )
+  {
+    initTestDeclarative();
+    BenchMerginApi bench( ma.get() );
+    return 0;
+  }
+
+  if ( IS_LOCAL_SERVER )
+  {
+    // projects in the data dir are served to other instances of the app, e.g. to try sync offline
+    LocalMerginServer server( dataDir + "/local-server" );
+    QDir().mkpath( dataDir + "/local-server" );
+    server.setLatency( qgetenv( "LOCAL_SERVER_LATENCY" ).toInt() );
+    server.setBandwidthLimit( qgetenv( "LOCAL_SERVER_BANDWIDTH" ).toLongLong() );
+    server.setDropInterval( qgetenv( "LOCAL_SERVER_DROP_INTERVAL" ).toInt() );
+    if ( !server.listen( static_cast<quint16>( qgetenv( "LOCAL_SERVER_PORT" ).toUInt() ) ) )
+    {
+      qDebug() << "Unable to start local Mergin server";
+      return 1;
+    }
+    qDebug() << "Local Mergin server is running at" << server.url() << "with projects in" << dataDir + "/local-server";
+    return app.exec();
+  }
+
   // we ship our fonts because they do not need to be installed on the target platform
   QStringList fonts;
   fonts << ":/Lato-Regular.ttf"
@@ -303,6 +341,7 @@ int main( int argc, char *argv[] )
   engine.rootContext()->setContextProperty( "__mapThemesModel", &mtm );
   engine.rootContext()->setContextProperty( "__appSettings", &as );
   engine.rootContext()->setContextProperty( "__merginApi", ma.get() );
+  engine.rootContext()->setContextProperty( "__transferController", ma->transferController() );
   engine.rootContext()->setContextProperty( "__merginProjectsModel", &mpm );
 
 #ifdef ANDROID
@@ -1,4 +1,9 @@
 #include "merginapi.h"
+#include "checksumcache.h"
+#include "geopackagediff.h"
+#include "blockdelta.h"
+#include "jsonreader.h"
+#include "syncmanifest.h"
 
 #include <QtNetwork>
 #include <QJsonDocument>
@@ -8,16 +13,46 @@
 #include <QByteArray>
 #include <QSet>
 #include <QMessageBox>
+#include <QUuid>
+#include <QtConcurrent>
+#include <QFutureWatcher>
+#include <QPointer>
+#include <QSaveFile>
+#include <QTimer>
+#include <algorithm>
+
+QNetworkReply *MerginNetworkAccessManager::createRequest( Operation op, const QNetworkRequest &request, QIODevice *outgoingData )
+{
+  // HTTP/2 of Qt 5 ignores read buffer size of replies, file transfers rely on it to pause reading from the socket
+  if ( request.url().scheme() != QStringLiteral( "https" ) || request.attribute( FileTransferAttribute ).toBool() )
+    return QNetworkAccessManager::createRequest( op, request, outgoingData );
+
+  // HTTP/2 is negotiated with the server during the TLS handshake (ALPN)
+  QNetworkRequest http2Request( request );
+  http2Request.setAttribute( QNetworkRequest::Http2AllowedAttribute, true );
+  return QNetworkAccessManager::createRequest( op, http2Request, outgoingData );
+}
 
 MerginApi::MerginApi( const QString &dataDir, QObject *parent )
   : QObject( parent )
   , mDataDir( dataDir + '/' )
-  , mCacheFile( QStringLiteral( ".projectsCache.txt" ) )
+  , mCacheFile( QStringLiteral( ".projectsCache.bin" ) )
+  , mProjectsCache( mDataDir + mCacheFile )
+  , mResponseCache( mDataDir + QStringLiteral( ".responseCache" ) )
+  , mSyncFilters( mDataDir + QStringLiteral( ".syncFilters.json" ) )
+  , mBlobStore( mDataDir )
 {
   QObject::connect( this, &MerginApi::syncProjectFinished, this, &MerginApi::setUpdateToProject );
   QObject::connect( this, &MerginApi::merginProjectsChanged, this, &MerginApi::cacheProjects );
   QObject::connect( this, &MerginApi::authChanged, this, &MerginApi::saveAuthData );
   QObject::connect( this, &MerginApi::serverProjectDeleted, this, &MerginApi::projectDeleted );
+  QObject::connect( &mSyncScheduler, &SyncScheduler::jobStarted, this, &MerginApi::startSyncJob );
+  QObject::connect( &mSyncScheduler, &SyncScheduler::jobProgress, this, &MerginApi::updateBatchSync );
+  QObject::connect( &mSyncScheduler, &SyncScheduler::jobStateChanged, this, &MerginApi::updateBatchSync );
+  mChangeJournal.setIgnoredSuffixes( mIgnoreFiles );
+  migrateProjectsCache();
+  // replies are cached in a file per entry, older versions have kept them all in one file
+  QFile::remove( mDataDir + QStringLiteral( ".responseCache.json" ) );
 
   loadAuthData();
 }
@@ -41,12 +76,70 @@ void MerginApi::listProjects( const QString &filterTag )
   QUrl url( urlString );
   request.setUrl( url );
   request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
+  mResponseCache.prepareRequest( request, mUsername );
+
+  // listing known from the last time is shown right away, the request only checks whether it has changed
+  if ( loadCachedProjectList( url.toString() ) )
+  {
+    emit listProjectsFinished( mMerginProjects );
+  }
 
   QNetworkReply *reply = mManager.get( request );
   connect( reply, &QNetworkReply::finished, this, &MerginApi::listProjectsReplyFinished );
 }
 
 void MerginApi::downloadProject( const QString &projectName )
+{
+  if ( !scheduleSync( projectName, SyncJob::Download, SyncJob::Interactive ) )
+    emit syncProjectFinished( mDataDir + projectName, projectName, false );
+}
+
+void MerginApi::updateProject( const QString &projectName )
+{
+  if ( !scheduleSync( projectName, SyncJob::Update, SyncJob::Interactive ) )
+    emit syncProjectFinished( mDataDir + projectName, projectName, false );
+}
+
+void MerginApi::uploadProject( const QString &projectName )
+{
+  if ( isUpdatedOnServer( projectName ) && !mSyncScheduler.job( projectName ) )
+  {
+    QMessageBox msgBox;
+    msgBox.setText( QStringLiteral( "The project has been updated on the server in the meantime. Your files will be updated before upload." ) );
+    msgBox.setInformativeText( "Do you want to continue?" );
+    msgBox.setStandardButtons( QMessageBox::Ok | QMessageBox::Cancel );
+    msgBox.setDefaultButton( QMessageBox::Cancel );
+
+    if ( msgBox.exec() == QMessageBox::Cancel )
+    {
+      emit syncProjectFinished( mDataDir + projectName, projectName, false );
+      return;
+    }
+  }
+
+  if ( !scheduleSync( projectName, SyncJob::Upload, SyncJob::Interactive ) )
+    emit syncProjectFinished( mDataDir + projectName, projectName, false );
+}
+
+std::shared_ptr<SyncJob> MerginApi::scheduleSync( const QString &projectName, SyncJob::Type type, SyncJob::Priority priority )
+{
+  if ( !hasAuthData() )
+  {
+    emit authRequested();
+    return nullptr;
+  }
+
+  std::shared_ptr<SyncJob> job = mSyncScheduler.enqueue( projectName, type, priority );
+  if ( !job )
+  {
+    QString errorMsg = QStringLiteral( "Sync of %1 is already running." ).arg( projectName );
+    qDebug() << errorMsg;
+    emit networkErrorOccurred( errorMsg, QStringLiteral( "Mergin API error: syncProject" ) );
+  }
+  return job;
+}
+
+void MerginApi::syncProjects( const QStringList &projectNames )
 {
   if ( !hasAuthData() )
   {
@@ -54,88 +147,253 @@ void MerginApi::downloadProject( const QString &projectName )
     return;
   }
 
-  QByteArray token = generateToken();
-  QNetworkRequest request;
-  QUrl url( mApiRoot + QStringLiteral( "/v1/project/download/" ) + projectName );
+  // jobs may end as soon as they are queued, the batch is complete only when all of them have been added
+  mBatchSyncStarting = true;
+  for ( const QString &projectName : projectNames )
+  {
+    std::shared_ptr<SyncJob> job = mSyncScheduler.job( projectName );
+    if ( !job || job->state == SyncJob::Queued )
+    {
+      ProjectStatus status = NoVersion;
+      for ( std::shared_ptr<MerginProject> project : mMerginProjects )
+      {
+        if ( project->name == projectName )
+          status = project->status;
+      }
+      SyncJob::Type type = SyncJob::Update;
+      if ( status == Modified )
+        type = SyncJob::Upload;
+      else if ( status == NoVersion && !QFileInfo::exists( mDataDir + projectName ) )
+        type = SyncJob::Download;
+      job = mSyncScheduler.enqueue( projectName, type, SyncJob::Background );
+    }
+
+    // a running job of the project is awaited as part of the batch
+    if ( job && !mBatchJobs.contains( job ) )
+      mBatchJobs << job;
+  }
+  mBatchSyncStarting = false;
+  updateBatchSync();
+}
 
-  if ( mPendingRequests.contains( url ) )
+void MerginApi::updateBatchSync()
+{
+  if ( mBatchJobs.isEmpty() || mBatchSyncStarting )
+    return;
+
+  qint64 bytesDone = 0;
+  qint64 bytesTotal = 0;
+  int projectsFinished = 0;
+  QStringList failedProjects;
+  for ( const std::shared_ptr<SyncJob> &job : mBatchJobs )
   {
-    QString errorMsg = QStringLiteral( "Download request for %1 is already pending." ).arg( projectName );
-    qDebug() << errorMsg;
-    emit networkErrorOccurred( errorMsg, QStringLiteral( "Mergin API error: downloadProject" ) );
+    bytesDone += job->bytesDone;
+    bytesTotal += job->bytesTotal;
+    if ( job->state == SyncJob::Finished )
+      ++projectsFinished;
+    else if ( job->state == SyncJob::Failed || job->state == SyncJob::Cancelled )
+      failedProjects << job->projectName;
+  }
+  projectsFinished += failedProjects.size();
+  int projectsTotal = mBatchJobs.size();
+  emit batchSyncProgress( bytesDone, bytesTotal, projectsFinished, projectsTotal );
+
+  if ( projectsFinished == projectsTotal )
+  {
+    mBatchJobs.clear();
+    emit batchSyncFinished( failedProjects );
+  }
+}
+
+void MerginApi::cancelSync( const QString &projectName )
+{
+  if ( mSyncScheduler.cancel( projectName ) )
+  {
+    // the job has not been started yet
+    emit syncProjectFinished( mDataDir + projectName, projectName, false );
     return;
   }
 
-  request.setUrl( url );
-  request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
+  std::shared_ptr<SyncJob> job = mSyncScheduler.job( projectName );
+  if ( !job )
+    return;
 
-  QNetworkReply *reply = mManager.get( request );
-  mPendingRequests.insert( url, projectName );
-  connect( reply, &QNetworkReply::finished, this, &MerginApi::downloadProjectReplyFinished );
+  // tasks do not start further requests and aborted requests finish the job by their usual error handling,
+  // a step which is not waiting for a reply (e.g. hashing of files) finishes the job when it is done
+  qDebug() << "Cancelling sync of" << projectName;
+  std::shared_ptr<DownloadTask> downloadTask = mDownloadTasks.value( projectName );
+  if ( downloadTask && downloadTask->errorMessage.isEmpty() )
+    downloadTask->errorMessage = QStringLiteral( "Sync of %1 has been cancelled" ).arg( projectName );
+  std::shared_ptr<UploadTask> uploadTask = mUploadTasks.value( projectName );
+  if ( uploadTask && uploadTask->errorMessage.isEmpty() )
+    uploadTask->errorMessage = QStringLiteral( "Sync of %1 has been cancelled" ).arg( projectName );
+
+  QList<QNetworkReply *> replies = mProjectReplies.keys( projectName ) + mDownloadTaskReplies.keys( projectName ) + mUploadTaskReplies.keys( projectName );
+  for ( QNetworkReply *reply : replies )
+  {
+    reply->abort();
+  }
 }
 
-void MerginApi::updateProject( const QString &projectName )
+SyncScheduler *MerginApi::syncScheduler()
 {
+  return &mSyncScheduler;
+}
 
-  if ( !hasAuthData() )
+TransferController *MerginApi::transferController()
+{
+  return &mTransferController;
+}
+
+void MerginApi::startSyncJob( const QString &projectName )
+{
+  std::shared_ptr<SyncJob> job = mSyncScheduler.job( projectName );
+  if ( !job )
+    return;
+
+  static const QStringList typeNames = QStringList() << QStringLiteral( "download" ) << QStringLiteral( "update" ) << QStringLiteral( "upload" );
+  job->stats = std::make_shared<SyncStats>( projectName, typeNames.value( job->type ) );
+
+  switch ( job->type )
   {
-    emit authRequested();
+    case SyncJob::Download:
+    case SyncJob::Update:
+      // project info tells which files can be resumed or cloned from the blob store, a new project
+      // without such files is downloaded whole by a single request (see fetchChangedFiles)
+      requestProjectInfo( projectName, true );
+      break;
+
+    case SyncJob::Upload:
+      // the project is brought up to date first, local changes are uploaded when the update finishes (see finishSyncJob).
+      // A project with a manifest is updated if project info has another version (see uploadInfoReplyFinished),
+      // otherwise if the listing says so.
+      job->updateBeforeUpload = !SyncManifest( mDataDir + projectName ).isValid() && isUpdatedOnServer( projectName );
+      requestProjectInfo( projectName, job->updateBeforeUpload );
+      break;
+  }
+}
+
+void MerginApi::finishSyncJob( const QString &projectName, bool successfully )
+{
+  std::shared_ptr<SyncJob> job = mSyncScheduler.job( projectName );
+  if ( job && job->updateBeforeUpload && successfully && !job->cancelRequested )
+  {
+    job->updateBeforeUpload = false;
+    // the manifest has just been saved from the server version the project has been updated to
+    SyncManifest manifest( mDataDir + projectName );
+    if ( manifest.isValid() )
+      uploadToProjectInfo( projectName, manifest.data() );
+    else
+      requestProjectInfo( projectName, false );
     return;
   }
 
-  QByteArray token = generateToken();
-  QNetworkRequest request;
-  QUrl url( mApiRoot + QStringLiteral( "/v1/project/" ) + projectName );
+  mSyncedProjectInfo.remove( projectName );
 
-  request.setUrl( url );
-  request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
+  std::shared_ptr<SyncStats> stats = job ? job->stats : nullptr;
+  mSyncScheduler.finish( projectName, successfully );
+  if ( stats )
+    recordSyncStats( projectName, *stats, successfully );
+  emit syncProjectFinished( mDataDir + projectName, projectName, successfully );
+}
 
-  QNetworkReply *reply = mManager.get( request );
-  connect( reply, &QNetworkReply::finished, this, &MerginApi::updateInfoReplyFinished );
+std::shared_ptr<SyncStats> MerginApi::syncStats( const QString &projectName ) const
+{
+  std::shared_ptr<SyncJob> job = mSyncScheduler.job( projectName );
+  return job ? job->stats : nullptr;
+}
+
+void MerginApi::recordSyncStats( const QString &projectName, const SyncStats &stats, bool successfully )
+{
+  QJsonObject json = stats.toJson( successfully );
+  emit syncStatsRecorded( projectName, json );
+
+  if ( mSyncLogFile.isEmpty() )
+    return;
+
+  QFile file( mSyncLogFile );
+  if ( !file.open( QIODevice::WriteOnly | QIODevice::Append ) )
+  {
+    qDebug() << "Failed to write sync log" << mSyncLogFile;
+    return;
+  }
+  file.write( QJsonDocument( json ).toJson( QJsonDocument::Compact ) + '\n' );
+}
 
+bool MerginApi::isSyncCancelled( const QString &projectName ) const
+{
+  std::shared_ptr<SyncJob> job = mSyncScheduler.job( projectName );
+  return job && job->cancelRequested;
 }
 
-void MerginApi::uploadProject( const QString &projectName )
+bool MerginApi::isWaitingForUpload( const QString &projectName ) const
 {
+  std::shared_ptr<SyncJob> job = mSyncScheduler.job( projectName );
+  return job && job->updateBeforeUpload;
+}
 
-  bool onlyUpload = true;
+bool MerginApi::isUpdatedOnServer( const QString &projectName ) const
+{
   for ( std::shared_ptr<MerginProject> project : mMerginProjects )
   {
     if ( project->name == projectName )
     {
-      if ( project->updated < project->serverUpdated && project->serverUpdated > project->lastSync.toUTC() )
-      {
-        onlyUpload = false;
-      }
+      return project->updated < project->serverUpdated && project->serverUpdated > project->lastSync.toUTC();
     }
   }
+  return false;
+}
+
+void MerginApi::requestProjectInfo( const QString &projectName, bool forUpdate )
+{
+  QByteArray token = generateToken();
+  QNetworkRequest request;
+  QUrl url( mApiRoot + QStringLiteral( "/v1/project/" ) + projectName );
+
+  request.setUrl( url );
+  request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
+  mResponseCache.prepareRequest( request, mUsername );
 
-  if ( onlyUpload )
+  if ( std::shared_ptr<SyncStats> stats = syncStats( projectName ) )
   {
-    continueWithUpload( mDataDir + projectName, projectName, true );
+    stats->begin( SyncStats::ProjectInfo );
+    stats->addRequest();
   }
+
+  QNetworkReply *reply = mManager.get( request );
+  mProjectReplies.insert( reply, projectName );
+  if ( forUpdate )
+    connect( reply, &QNetworkReply::finished, this, &MerginApi::updateInfoReplyFinished );
   else
-  {
-    QMessageBox msgBox;
-    msgBox.setText( QStringLiteral( "The project has been updated on the server in the meantime. Your files will be updated before upload." ) );
-    msgBox.setInformativeText( "Do you want to continue?" );
-    msgBox.setStandardButtons( QMessageBox::Ok | QMessageBox::Cancel );
-    msgBox.setDefaultButton( QMessageBox::Cancel );
+    connect( reply, &QNetworkReply::finished, this, &MerginApi::uploadInfoReplyFinished );
+}
 
-    if ( msgBox.exec() == QMessageBox::Cancel )
-    {
-      emit syncProjectFinished( mDataDir + projectName, projectName, false );
-      return;
-    }
+void MerginApi::startProjectDownload( const QString &projectName )
+{
+  QByteArray token = generateToken();
+  QNetworkRequest request;
+  QUrl url( mApiRoot + QStringLiteral( "/v1/project/download/" ) + projectName );
+  request.setUrl( url );
+  request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
+  request.setRawHeader( "Accept-Encoding", ACCEPT_ENCODING );
+  request.setAttribute( MerginNetworkAccessManager::FileTransferAttribute, true );
 
-    mWaitingForUpload.insert( projectName );
-    updateProject( projectName );
-    connect( this, &MerginApi::syncProjectFinished, this, &MerginApi::continueWithUpload );
+  if ( std::shared_ptr<SyncStats> stats = syncStats( projectName ) )
+  {
+    stats->begin( SyncStats::Transfer );
+    stats->addRequest();
   }
+
+  QNetworkReply *reply = mManager.get( request );
+  mProjectReplies.insert( reply, projectName );
+  QDir( stagingDir( mDataDir + projectName ) ).removeRecursively();
+  startDataStream( reply, projectName );
+  connect( reply, &QNetworkReply::finished, this, &MerginApi::downloadProjectReplyFinished );
 }
 
 void MerginApi::authorize( const QString &username, const QString &password )
 {
+  mProjectListUrl.clear();
   mUsername = username;
   mPassword = password;
 
@@ -154,6 +412,8 @@ void MerginApi::clearAuth()
 {
   mUsername = "";
   mPassword = "";
+  mResponseCache.clear();
+  mProjectListUrl.clear();
   emit authChanged();
 }
 
@@ -185,7 +445,6 @@ void MerginApi::createProject( const QString &projectName )
   request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
   request.setRawHeader( "Content-Type", "application/json" );
   request.setRawHeader( "Accept", "application/json" );
-  mPendingRequests.insert( url, projectName );
 
   QJsonDocument jsonDoc;
   QJsonObject jsonObject;
@@ -195,6 +454,7 @@ void MerginApi::createProject( const QString &projectName )
   QByteArray json = jsonDoc.toJson( QJsonDocument::Compact );
 
   QNetworkReply *reply = mManager.post( request, json );
+  mProjectReplies.insert( reply, projectName );
   connect( reply, &QNetworkReply::finished, this, &MerginApi::createProjectFinished );
 }
 
@@ -211,371 +471,1685 @@ void MerginApi::deleteProject( const QString &projectName )
   QUrl url( mApiRoot + QStringLiteral( "/v1/project/" ) + projectName );
   request.setUrl( url );
   request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
-  mPendingRequests.insert( url, projectName );
   QNetworkReply *reply = mManager.deleteResource( request );
+  mProjectReplies.insert( reply, projectName );
   connect( reply, &QNetworkReply::finished, this, &MerginApi::deleteProjectFinished );
 }
 
-void MerginApi::downloadProjectFiles( const QString &projectName, const QByteArray &json )
+void MerginApi::downloadProjectFiles( const QString &projectName, const QList<MerginFile> &files )
 {
   if ( !hasAuthData() )
   {
     emit authRequested();
+    finishSyncJob( projectName, false );
     return;
   }
 
-  QByteArray token = generateToken();
-  QNetworkRequest request;
-  QUrl url( mApiRoot + QStringLiteral( "/v1/project/fetch/" ) + projectName );
-  request.setUrl( url );
-  request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
-  request.setRawHeader( "Content-Type", "application/json" );
-  request.setRawHeader( "Accept", "application/json" );
-  mPendingRequests.insert( url, projectName );
-
-  QNetworkReply *reply = mManager.post( request, json );
-  connect( reply, &QNetworkReply::finished, this, &MerginApi::downloadProjectReplyFinished );
-}
-
-void MerginApi::uploadProjectFiles( const QString &projectName, const QByteArray &json, const QList<MerginFile> &files )
-{
-  if ( !hasAuthData() )
+  std::shared_ptr<DownloadTask> task = std::make_shared<DownloadTask>();
+  task->projectDir = mDataDir + projectName;
+  for ( const MerginFile &file : files )
   {
-    emit networkErrorOccurred( QStringLiteral( "Auth token is invalid" ), QStringLiteral( "Mergin API error: fetchProject" ) );
-    return;
+    task->bytesTotal += file.size;
   }
 
-  QString projectPath = QString( mDataDir + projectName + "/" );
-  QHttpMultiPart *multiPart = new QHttpMultiPart( QHttpMultiPart::FormDataType );
+  // Large files first, so they do not delay the end of the download. Files smaller than the batch size
+  // are grouped to batches to avoid a request per each small file.
+  QList<MerginFile> sortedFiles = files;
+  std::sort( sortedFiles.begin(), sortedFiles.end(), []( const MerginFile & a, const MerginFile & b ) { return a.size > b.size; } );
+  qint64 batchSizeLimit = qBound( MIN_DOWNLOAD_BATCH_SIZE, task->bytesTotal / ( 2 * mSyncConcurrency ), MAX_DOWNLOAD_BATCH_SIZE );
 
-  QHttpPart textPart;
-  textPart.setHeader( QNetworkRequest::ContentDispositionHeader, QVariant( QStringLiteral( "form-data; name=\"changes\"" ) ) );
-  textPart.setBody( json );
-  multiPart->append( textPart );
+  QList<MerginFile> batch;
+  qint64 batchSize = 0;
+  for ( const MerginFile &file : sortedFiles )
+  {
+    if ( isRequestedAlone( task->projectDir, file, batchSizeLimit ) )
+    {
+      task->batches << ( QList<MerginFile>() << file );
+      continue;
+    }
 
-  for ( MerginFile file : files )
+    batch << file;
+    batchSize += file.size;
+    if ( batchSize >= batchSizeLimit )
+    {
+      task->batches << batch;
+      batch.clear();
+      batchSize = 0;
+    }
+  }
+  if ( !batch.isEmpty() )
   {
-    QHttpPart filePart;
-    filePart.setHeader( QNetworkRequest::ContentDispositionHeader, QStringLiteral( "form-data; name=\"%1\"; filename=\"%2\"" ).arg( file.path, file.path ) );
-    filePart.setHeader( QNetworkRequest::ContentTypeHeader, QVariant( QStringLiteral( "multipart/form-data" ) ) );
-    QFile *f = new QFile( projectPath + file.path );
-    f->open( QIODevice::ReadOnly );
-    filePart.setBodyDevice( f );
-    f->setParent( multiPart ); // we cannot delete the file now, so delete it with the multiPart
-    multiPart->append( filePart );
+    task->batches << batch;
   }
 
-  QByteArray token = generateToken();
-  QNetworkRequest request;
-  QUrl url( mApiRoot + "/v1/project/data_sync/" + projectName );
-  request.setUrl( url );
-  request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
-  mPendingRequests.insert( url, projectName );
+  // partial files of an interrupted download are resumed
+  removeStagedFiles( task->projectDir, true );
+  task->timer.start();
+  if ( std::shared_ptr<SyncStats> stats = syncStats( projectName ) )
+    stats->begin( SyncStats::Transfer );
+  mDownloadTasks.insert( projectName, task );
+  startDownloadRequests( projectName );
+}
+
+bool MerginApi::isRequestedAlone( const QString &projectDir, const MerginFile &file, qint64 batchSizeLimit )
+{
+  if ( file.size >= batchSizeLimit )
+    return true;
 
-  qDebug() << request.rawHeaderList();
+  // only changed blocks of a large file present locally may be transferred (see startDeltaDownload)
+  if ( file.diffPath.isEmpty() && file.size >= MIN_DELTA_FILE_SIZE && hasServerCapability( BlockDeltaCapability )
+       && QFileInfo( projectDir + '/' + file.path ).size() >= MIN_DELTA_FILE_SIZE )
+    return true;
 
-  QNetworkReply *reply = mManager.post( request, multiPart );
-  connect( reply, &QNetworkReply::finished, this, &MerginApi::uploadProjectReplyFinished );
+  // a partial file left by an interrupted download is resumed with Range request
+  bool complete = false;
+  return resumableSize( stagingDir( projectDir ) + file.path, file, complete ) > 0 || complete;
 }
 
-ProjectList MerginApi::updateMerginProjectList( const ProjectList &serverProjects )
+void MerginApi::startDownloadRequests( const QString &projectName )
 {
-  QHash<QString, std::shared_ptr<MerginProject>> projectUpdates;
-  for ( std::shared_ptr<MerginProject> project : mMerginProjects )
+  std::shared_ptr<DownloadTask> task = mDownloadTasks.value( projectName );
+  if ( !task )
+    return;
+
+  while ( task->errorMessage.isEmpty() && !task->batches.isEmpty() && task->runningRequests < mTransferController.concurrency() )
   {
-    QDir projectFolder( mDataDir + "/" + project->name );
-    if ( projectFolder.exists() )
+    QList<MerginFile> batch = task->batches.takeFirst();
+    std::shared_ptr<DataStreamState> state = std::make_shared<DataStreamState>();
+    state->projectDir = task->projectDir;
+    state->requestedFiles = batch;
+    state->stats = syncStats( projectName );
+
+    QByteArray token = generateToken();
+    QNetworkRequest request;
+    request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
+    request.setRawHeader( "Accept-Encoding", ACCEPT_ENCODING );
+    request.setAttribute( MerginNetworkAccessManager::FileTransferAttribute, true );
+    QNetworkReply *reply = nullptr;
+
+    if ( batch.size() == 1 )
+    {
+      // content of a single file is written directly to the staging folder,
+      // a partial file left by an interrupted download is resumed with Range request
+      const MerginFile &file = batch.first();
+      QString stagedFilePath = stagingDir( task->projectDir ) + file.path;
+      bool complete = false;
+      qint64 partialSize = resumableSize( stagedFilePath, file, complete );
+      if ( complete )
+      {
+        task->receivedFiles << file.path;
+        continue;
+      }
+
+      QString localFilePath = task->projectDir + '/' + file.path;
+      if ( partialSize == 0 && file.diffPath.isEmpty() && file.size >= MIN_DELTA_FILE_SIZE && !task->wholeFiles.contains( file.path )
+           && hasServerCapability( BlockDeltaCapability ) && QFileInfo( localFilePath ).size() >= MIN_DELTA_FILE_SIZE )
+      {
+        startDeltaDownload( projectName, task, file );
+        continue;
+      }
+
+      createPathIfNotExists( stagedFilePath );
+      state->singleFile = true;
+      if ( partialSize > 0 )
+      {
+        state->resumeOffset = partialSize;
+        request.setRawHeader( "Range", QByteArray( "bytes=" ) + QByteArray::number( partialSize ) + '-' );
+        // staged data are decompressed, so the range must refer to the uncompressed file
+        request.setRawHeader( "Accept-Encoding", "identity" );
+        qDebug() << "Resuming download of" << file.path << "from" << partialSize;
+      }
+      // a failure to open the file is reported when the reply has finished (see finishWrites)
+      openStreamFile( *state, stagedFilePath, partialSize > 0, file.size );
+      if ( partialSize == 0 )
+      {
+        writePartialFileState( stagedFilePath, file, false );
+      }
+      state->receivedFiles << file.path;
+
+      QUrl url( mApiRoot + QStringLiteral( "/v1/project/raw/" ) + projectName );
+      QUrlQuery query;
+      query.addQueryItem( QStringLiteral( "file" ), batch.first().path );
+      url.setQuery( query );
+      request.setUrl( url );
+      reply = mManager.get( request );
+    }
+    else
     {
-      projectUpdates.insert( project->name, project );
+      QJsonArray fileArray;
+      for ( const MerginFile &file : batch )
+      {
+        QJsonObject fileObject;
+        fileObject.insert( "path", file.path );
+        fileObject.insert( "checksum", file.checksum );
+        fileArray.append( fileObject );
+      }
+      QJsonDocument jsonDoc;
+      jsonDoc.setArray( fileArray );
+
+      request.setUrl( QUrl( mApiRoot + QStringLiteral( "/v1/project/fetch/" ) + projectName ) );
+      request.setRawHeader( "Content-Type", "application/json" );
+      request.setRawHeader( "Accept", "application/json" );
+      reply = mManager.post( request, jsonDoc.toJson( QJsonDocument::Compact ) );
     }
+
+    reply->setReadBufferSize( mTransferController.readBufferSize() );
+    mTransferController.track( reply );
+    if ( state->stats )
+      state->stats->addRequest();
+    mDataStreams.insert( reply, state );
+    mDownloadTaskReplies.insert( reply, projectName );
+    task->runningRequests++;
+    connect( reply, &QNetworkReply::readyRead, this, &MerginApi::downloadProjectReplyReadyRead );
+    connect( reply, &QNetworkReply::finished, this, &MerginApi::downloadBatchReplyFinished );
   }
 
-  for ( std::shared_ptr<MerginProject> project : serverProjects )
+  if ( task->runningRequests == 0 )
   {
-    if ( projectUpdates.contains( project->name ) )
+    mDownloadTasks.remove( projectName );
+    if ( task->errorMessage.isEmpty() )
     {
-      QDateTime localUpdate = projectUpdates.value( project->name ).get()->updated;
-      project->lastSync = projectUpdates.value( project->name ).get()->lastSync;
-      QDateTime lastModified = getLastModifiedFileDateTime( mDataDir + project->name );
-      project->updated = localUpdate;
-      project->status = getProjectStatus( project->updated, project->serverUpdated, project->lastSync, lastModified );
+      qDebug() << QStringLiteral( "Downloaded %1 bytes (%2 transferred, compression ratio %3) of %4 in %5 ms with up to %6 parallel requests" )
+               .arg( task->bytesReceived ).arg( task->bytesTransferred )
+               .arg( task->bytesTransferred > 0 ? static_cast<double>( task->bytesReceived ) / task->bytesTransferred : 1.0, 0, 'f', 2 )
+               .arg( projectName ).arg( task->timer.elapsed() ).arg( mSyncConcurrency );
+      reportDownloadProgress( projectName, *task, true );
     }
+    finishDownload( projectName, task->receivedFiles, task->errorMessage );
   }
-  return serverProjects;
 }
 
-void MerginApi::setUpdateToProject( const QString &projectDir, const QString &projectName, bool successfully )
+void MerginApi::startDeltaDownload( const QString &projectName, std::shared_ptr<DownloadTask> task, const MerginFile &file )
 {
-  Q_UNUSED( projectDir );
-  if ( !successfully ) return;
-
-  for ( std::shared_ptr<MerginProject> project : mMerginProjects )
+  // the signature is counted as a running request, so the task does not finish meanwhile
+  task->runningRequests++;
+  QFutureWatcher<QByteArray> *watcher = new QFutureWatcher<QByteArray>( this );
+  connect( watcher, &QFutureWatcher<QByteArray>::finished, this, [this, watcher, projectName, task, file]()
   {
-    if ( projectName == project->name )
+    watcher->deleteLater();
+    QByteArray signature = watcher->result();
+    QString stagedFilePath = stagingDir( task->projectDir ) + file.path;
+    std::shared_ptr<DataStreamState> state = std::make_shared<DataStreamState>();
+    state->projectDir = task->projectDir;
+    state->requestedFiles << file;
+    state->stats = syncStats( projectName );
+    state->singleFile = true;
+    state->deltaBasePath = task->projectDir + '/' + file.path;
+    createPathIfNotExists( stagedFilePath );
+
+    if ( !task->errorMessage.isEmpty() || signature.isEmpty() )
     {
-      project->updated = project->serverUpdated;
-      project->lastSync = QDateTime::currentDateTime();
-      emit merginProjectsChanged();
+      task->runningRequests--;
+      if ( task->errorMessage.isEmpty() )
+      {
+        task->wholeFiles << file.path;
+        task->batches.prepend( state->requestedFiles );
+      }
+      startDownloadRequests( projectName );
       return;
     }
-  }
+    // size of the delta is not known
+    openStreamFile( *state, stagedFilePath + DELTA_FILE_SUFFIX, false, -1 );
+
+    QUrl url( mApiRoot + QStringLiteral( "/v1/project/delta/" ) + projectName );
+    QUrlQuery query;
+    query.addQueryItem( QStringLiteral( "file" ), file.path );
+    url.setQuery( query );
+    QNetworkRequest request( url );
+    request.setRawHeader( "Authorization", QByteArray( "Basic " + generateToken() ) );
+    request.setRawHeader( "Content-Type", "application/octet-stream" );
+    request.setRawHeader( "Accept-Encoding", ACCEPT_ENCODING );
+    request.setAttribute( MerginNetworkAccessManager::FileTransferAttribute, true );
+
+    QNetworkReply *reply = mManager.post( request, signature );
+    reply->setReadBufferSize( mTransferController.readBufferSize() );
+    mTransferController.track( reply );
+    if ( state->stats )
+      state->stats->addRequest();
+    mDataStreams.insert( reply, state );
+    mDownloadTaskReplies.insert( reply, projectName );
+    connect( reply, &QNetworkReply::readyRead, this, &MerginApi::downloadProjectReplyReadyRead );
+    connect( reply, &QNetworkReply::finished, this, &MerginApi::downloadBatchReplyFinished );
+  } );
+  watcher->setFuture( QtConcurrent::run( &BlockDelta::signature, task->projectDir + '/' + file.path ) );
 }
 
-void MerginApi::deleteObsoleteFiles( const QString &projectPath )
+bool MerginApi::finishDeltaDownload( DownloadTask &task, DataStreamState &state, bool received )
 {
-  if ( !mObsoleteFiles.value( projectPath ).isEmpty() )
+  const MerginFile &file = state.requestedFiles.first();
+  QString stagedFilePath = stagingDir( state.projectDir ) + file.path;
+  QString deltaFilePath = state.activeFile;
+
+  // the file is rebuilt from blocks of the local file and received data, it has to match the server version
+  bool rebuilt = received && BlockDelta::applyDelta( state.deltaBasePath, deltaFilePath, stagedFilePath )
+                 && getChecksum( stagedFilePath ) == file.checksum.toLatin1();
+  QFile::remove( deltaFilePath );
+  if ( !rebuilt )
   {
-    for ( QString filename : mObsoleteFiles.value( projectPath ) )
-    {
-      QFile file( projectPath + filename );
-      file.remove();
-    }
-    mObsoleteFiles.remove( projectPath );
+    QFile::remove( stagedFilePath );
+    return false;
   }
+
+  writePartialFileState( stagedFilePath, file, true );
+  task.receivedFiles << file.path;
+  task.bytesTotal += state.bytesReceived - file.size;
+  qDebug() << QStringLiteral( "Received %1 bytes of delta of %2 (%3 bytes)" ).arg( state.bytesReceived ).arg( file.path ).arg( file.size );
+  return true;
 }
 
-void MerginApi::saveAuthData()
+void MerginApi::reportDownloadProgress( const QString &projectName, DownloadTask &task, bool force )
 {
-  QSettings settings;
-  settings.beginGroup( "Input/" );
-  settings.setValue( "username", mUsername );
-  settings.setValue( "password", mPassword );
-  settings.setValue( "apiRoot", mApiRoot );
-  settings.endGroup();
+  qint64 elapsed = task.timer.elapsed();
+  if ( !force && elapsed - task.lastProgressReport < 250 )
+    return;
+
+  task.lastProgressReport = elapsed;
+  double bytesPerSecond = elapsed > 0 ? task.bytesReceived * 1000.0 / elapsed : 0;
+  mSyncScheduler.setProgress( projectName, task.bytesReceived, task.bytesTotal );
+  emit downloadProgress( projectName, task.bytesReceived, task.bytesTotal, bytesPerSecond );
 }
 
-void MerginApi::createProjectFinished()
+void MerginApi::uploadProjectFiles( const QString &projectName, const QJsonObject &changes, const QList<MerginFile> &files )
 {
-  QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
-  Q_ASSERT( r );
-
-  if ( r->error() == QNetworkReply::NoError )
+  if ( !hasAuthData() )
   {
-    QString projectName = mPendingRequests.value( r->url() );
-    emit notify( QStringLiteral( "Project created" ) );
-    emit projectCreated( projectName );
+    emit networkErrorOccurred( QStringLiteral( "Auth token is invalid" ), QStringLiteral( "Mergin API error: fetchProject" ) );
+    finishSyncJob( projectName, false );
+    return;
   }
-  else
+
+  std::shared_ptr<UploadTask> task = std::make_shared<UploadTask>();
+  task->projectDir = mDataDir + projectName;
+  task->changes = changes;
+  task->compress = hasServerCapability( DeflateRequestsCapability );
+  for ( const MerginFile &file : files )
   {
-    qDebug() << r->errorString();
-    emit networkErrorOccurred( r->errorString(), QStringLiteral( "Mergin API error: createProject" ) );
+    task->bytesTotal += file.diffPath.isEmpty() ? file.size : file.diffSize;
   }
-  mPendingRequests.remove( r->url() );
-  r->deleteLater();
-}
 
-void MerginApi::deleteProjectFinished()
-{
+  // Continue with an interrupted transaction if local changes are still the same
+  bool push = hasServerCapability( PushCapability );
+  QFile stateFile( uploadStateFile( task->projectDir ) );
+  if ( push && stateFile.open( QIODevice::ReadOnly ) )
+  {
+    QJsonObject state = QJsonDocument::fromJson( stateFile.readLine() ).object();
+    QSet<QString> uploadedChunks;
+    while ( !stateFile.atEnd() )
+    {
+      QString chunkId = QString::fromLatin1( stateFile.readLine().trimmed() );
+      if ( !chunkId.isEmpty() )
+        uploadedChunks << chunkId;
+    }
+    stateFile.close();
+
+    QString transactionId = state.value( QStringLiteral( "transaction" ) ).toString();
+    QJsonObject savedChanges = state.value( QStringLiteral( "changes" ) ).toObject();
+    if ( !transactionId.isEmpty() && state.value( QStringLiteral( "localChanges" ) ).toObject() == changes )
+    {
+      qDebug() << "Resuming upload of" << projectName << "with" << uploadedChunks.size() << "uploaded chunks";
+      task->transactionId = transactionId;
+      task->changes = savedChanges;
+      task->uploadedChunks = uploadedChunks;
+    }
+    else
+    {
+      if ( !transactionId.isEmpty() )
+        cancelPushTransaction( transactionId );
+      stateFile.remove();
+    }
+  }
+
+  // Split files to chunks, new chunk ids are generated unless the transaction is resumed
+  for ( const QString &key : QStringList() << QStringLiteral( "added" ) << QStringLiteral( "updated" ) )
+  {
+    QJsonArray fileArray = task->changes.value( key ).toArray();
+    for ( int i = 0; i < fileArray.size(); ++i )
+    {
+      QJsonObject fileObject = fileArray.at( i ).toObject();
+      QString path = fileObject.value( QStringLiteral( "path" ) ).toString();
+      qint64 size = fileObject.value( QStringLiteral( "size" ) ).toVariant().toLongLong();
+
+      // chunks of a GeoPackage changeset are read from its file in the metadata folder
+      QJsonObject diff = fileObject.value( QStringLiteral( "diff" ) ).toObject();
+      if ( !diff.isEmpty() )
+      {
+        path = changesetFile( path, fileObject.value( QStringLiteral( "checksum" ) ).toString() );
+        size = diff.value( QStringLiteral( "size" ) ).toVariant().toLongLong();
+      }
+      if ( task->compress && !Compression::isCompressible( task->projectDir + '/' + path ) )
+        task->incompressibleFiles << path;
+
+      QJsonArray chunkIds = fileObject.value( QStringLiteral( "chunks" ) ).toArray();
+      if ( task->transactionId.isEmpty() )
+      {
+        chunkIds = QJsonArray();
+        int chunksCount = static_cast<int>( ( size + UPLOAD_CHUNK_SIZE - 1 ) / UPLOAD_CHUNK_SIZE );
+        for ( int j = 0; j < chunksCount; ++j )
+        {
+          chunkIds.append( QUuid::createUuid().toString().mid( 1, 36 ) );
+        }
+        fileObject.insert( QStringLiteral( "chunks" ), chunkIds );
+        fileArray.replace( i, fileObject );
+      }
+
+      for ( int j = 0; j < chunkIds.size(); ++j )
+      {
+        UploadChunk chunk;
+        chunk.id = chunkIds.at( j ).toString();
+        chunk.path = path;
+        chunk.offset = j * UPLOAD_CHUNK_SIZE;
+        chunk.size = qMin( UPLOAD_CHUNK_SIZE, size - chunk.offset );
+        if ( task->uploadedChunks.contains( chunk.id ) )
+          task->bytesSent += chunk.size;
+        else
+          task->chunks << chunk;
+      }
+    }
+    task->changes.insert( key, fileArray );
+  }
+
+  task->timer.start();
+  mUploadTasks.insert( projectName, task );
+  std::shared_ptr<SyncStats> stats = syncStats( projectName );
+  if ( stats )
+    stats->begin( SyncStats::Transfer );
+
+  if ( !push )
+  {
+    uploadProjectData( projectName, task );
+    return;
+  }
+
+  if ( !task->transactionId.isEmpty() )
+  {
+    startUploadRequests( projectName );
+    return;
+  }
+
+  QByteArray token = generateToken();
+  QNetworkRequest request;
+  QUrl url( mApiRoot + "/v1/project/push/" + projectName );
+  request.setUrl( url );
+  request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
+  request.setRawHeader( "Content-Type", "application/json" );
+
+  QJsonObject data;
+  data.insert( QStringLiteral( "changes" ), task->changes );
+  QJsonDocument jsonDoc;
+  jsonDoc.setObject( data );
+
+  QByteArray body = jsonDoc.toJson( QJsonDocument::Compact );
+  if ( task->compress )
+    compressRequestBody( request, body );
+  if ( stats )
+  {
+    stats->addRequest();
+    stats->addBytesSent( body.size() );
+  }
+  QNetworkReply *reply = mManager.post( request, body );
+  mUploadTaskReplies.insert( reply, projectName );
+  connect( reply, &QNetworkReply::finished, this, &MerginApi::pushStartReplyFinished );
+}
+
+void MerginApi::uploadProjectData( const QString &projectName, std::shared_ptr<UploadTask> task )
+{
+  // whole files are sent, changesets and chunks are known only to push transactions
+  QStringList paths;
+  task->bytesTotal = 0;
+  for ( const QString &key : QStringList() << QStringLiteral( "added" ) << QStringLiteral( "updated" ) )
+  {
+    QJsonArray fileArray = task->changes.value( key ).toArray();
+    for ( int i = 0; i < fileArray.size(); ++i )
+    {
+      QJsonObject fileObject = fileArray.at( i ).toObject();
+      fileObject.remove( QStringLiteral( "diff" ) );
+      fileObject.remove( QStringLiteral( "chunks" ) );
+      fileArray.replace( i, fileObject );
+      paths << fileObject.value( QStringLiteral( "path" ) ).toString();
+      task->bytesTotal += fileObject.value( QStringLiteral( "size" ) ).toVariant().toLongLong();
+    }
+    task->changes.insert( key, fileArray );
+  }
+
+  QHttpMultiPart *multiPart = new QHttpMultiPart( QHttpMultiPart::FormDataType );
+  QHttpPart textPart;
+  textPart.setHeader( QNetworkRequest::ContentDispositionHeader, QVariant( QStringLiteral( "form-data; name=\"changes\"" ) ) );
+  textPart.setBody( QJsonDocument( task->changes ).toJson( QJsonDocument::Compact ) );
+  multiPart->append( textPart );
+
+  for ( const QString &path : paths )
+  {
+    QFile *file = new QFile( task->projectDir + '/' + path, multiPart ); // deleted with the multiPart
+    if ( !file->open( QIODevice::ReadOnly ) )
+    {
+      delete multiPart;
+      finishUpload( projectName, QStringLiteral( "Failed to read file %1" ).arg( path ) );
+      return;
+    }
+    QHttpPart filePart;
+    filePart.setHeader( QNetworkRequest::ContentDispositionHeader, QStringLiteral( "form-data; name=\"%1\"; filename=\"%2\"" ).arg( path, path ) );
+    filePart.setHeader( QNetworkRequest::ContentTypeHeader, QVariant( QStringLiteral( "multipart/form-data" ) ) );
+    filePart.setBodyDevice( file );
+    multiPart->append( filePart );
+  }
+
+  QByteArray token = generateToken();
+  QNetworkRequest request;
+  QUrl url( mApiRoot + "/v1/project/data_sync/" + projectName );
+  request.setUrl( url );
+  request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
+  request.setAttribute( MerginNetworkAccessManager::FileTransferAttribute, true );
+  if ( std::shared_ptr<SyncStats> stats = syncStats( projectName ) )
+  {
+    stats->addRequest();
+    stats->addBytesSent( task->bytesTotal );
+  }
+
+  QNetworkReply *reply = mManager.post( request, multiPart );
+  multiPart->setParent( reply );
+  mUploadTaskReplies.insert( reply, projectName );
+  connect( reply, &QNetworkReply::uploadProgress, this, [this, projectName, task]( qint64 bytesSent, qint64 )
+  {
+    // sent bytes include the multipart envelope
+    task->bytesSent = qMin( bytesSent, task->bytesTotal );
+    reportUploadProgress( projectName, *task, false );
+  } );
+  connect( reply, &QNetworkReply::finished, this, &MerginApi::dataSyncReplyFinished );
+}
+
+void MerginApi::startUploadRequests( const QString &projectName )
+{
+  std::shared_ptr<UploadTask> task = mUploadTasks.value( projectName );
+  if ( !task )
+    return;
+
+  QByteArray token = generateToken();
+  std::shared_ptr<SyncStats> stats = syncStats( projectName );
+  while ( task->errorMessage.isEmpty() && !task->chunks.isEmpty() && task->runningRequests < mTransferController.concurrency() )
+  {
+    UploadChunk chunk = task->chunks.takeFirst();
+    QFile file( task->projectDir + '/' + chunk.path );
+    if ( !file.open( QIODevice::ReadOnly ) || !file.seek( chunk.offset ) )
+    {
+      task->errorMessage = QStringLiteral( "Failed to read file %1" ).arg( chunk.path );
+      break;
+    }
+    QByteArray data = file.read( chunk.size );
+    if ( data.size() != chunk.size )
+    {
+      task->errorMessage = QStringLiteral( "File %1 has been changed during upload" ).arg( chunk.path );
+      break;
+    }
+    if ( stats )
+      stats->addBytesRead( data.size() );
+
+    QNetworkRequest request;
+    QUrl url( mApiRoot + QStringLiteral( "/v1/project/push/chunk/%1/%2" ).arg( task->transactionId, chunk.id ) );
+    request.setUrl( url );
+    request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
+    request.setRawHeader( "Content-Type", "application/octet-stream" );
+    // the shaped body is read by the network stack as the bandwidth limit allows only over HTTP/1.1
+    request.setAttribute( MerginNetworkAccessManager::FileTransferAttribute, true );
+
+    // a file which does not compress well in its first chunk is sent uncompressed
+    if ( task->compress && !task->incompressibleFiles.contains( chunk.path ) && !compressRequestBody( request, data ) )
+      task->incompressibleFiles << chunk.path;
+    task->bytesTransferred += data.size();
+    if ( stats )
+    {
+      stats->addRequest();
+      stats->addBytesSent( data.size() );
+    }
+
+    QNetworkReply *reply = nullptr;
+    if ( mTransferController.bandwidthLimit() > 0 )
+    {
+      // body is read by the network stack as the bandwidth limit allows
+      QIODevice *body = mTransferController.shapedUploadData( data );
+      request.setHeader( QNetworkRequest::ContentLengthHeader, data.size() );
+      reply = mManager.post( request, body );
+      body->setParent( reply );
+    }
+    else
+    {
+      reply = mManager.post( request, data );
+    }
+    mTransferController.track( reply );
+    mUploadTaskReplies.insert( reply, projectName );
+    mUploadChunkReplies.insert( reply, chunk );
+    task->runningRequests++;
+    connect( reply, &QNetworkReply::finished, this, &MerginApi::pushChunkReplyFinished );
+  }
+
+  if ( task->runningRequests > 0 || task->finishing )
+    return;
+
+  if ( !task->errorMessage.isEmpty() )
+  {
+    finishUpload( projectName, task->errorMessage );
+    return;
+  }
+
+  if ( task->chunks.isEmpty() )
+  {
+    task->finishing = true;
+    reportUploadProgress( projectName, *task, true );
+
+    QNetworkRequest request;
+    QUrl url( mApiRoot + "/v1/project/push/finish/" + task->transactionId );
+    request.setUrl( url );
+    request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
+
+    if ( stats )
+      stats->addRequest();
+    QNetworkReply *reply = mManager.post( request, QByteArray() );
+    mUploadTaskReplies.insert( reply, projectName );
+    connect( reply, &QNetworkReply::finished, this, &MerginApi::pushFinishReplyFinished );
+  }
+}
+
+void MerginApi::reportUploadProgress( const QString &projectName, UploadTask &task, bool force )
+{
+  qint64 elapsed = task.timer.elapsed();
+  if ( !force && elapsed - task.lastProgressReport < 250 )
+    return;
+
+  task.lastProgressReport = elapsed;
+  double bytesPerSecond = elapsed > 0 ? task.bytesSent * 1000.0 / elapsed : 0;
+  mSyncScheduler.setProgress( projectName, task.bytesSent, task.bytesTotal );
+  emit uploadProgress( projectName, task.bytesSent, task.bytesTotal, bytesPerSecond );
+}
+
+void MerginApi::finishUpload( const QString &projectName, const QString &errorMessage )
+{
+  std::shared_ptr<UploadTask> task = mUploadTasks.take( projectName );
+  QString projectDir = mDataDir + projectName;
+  if ( std::shared_ptr<SyncStats> stats = syncStats( projectName ) )
+    stats->end( SyncStats::Transfer );
+  if ( errorMessage.isEmpty() )
+  {
+    QFile::remove( uploadStateFile( projectDir ) );
+    if ( task )
+    {
+      qDebug() << QStringLiteral( "Uploaded %1 bytes (%2 transferred, compression ratio %3) of %4 in %5 ms with up to %6 parallel requests" )
+               .arg( task->bytesSent ).arg( task->bytesTransferred )
+               .arg( task->bytesTransferred > 0 ? static_cast<double>( task->bytesSent ) / task->bytesTransferred : 1.0, 0, 'f', 2 )
+               .arg( projectName ).arg( task->timer.elapsed() ).arg( mSyncConcurrency );
+    }
+    finishSyncJob( projectName, true );
+    emit notify( QStringLiteral( "Upload successful" ) );
+  }
+  else
+  {
+    if ( task && task->transactionLost )
+    {
+      // the next upload starts a new transaction
+      QFile::remove( uploadStateFile( projectDir ) );
+    }
+    qDebug() << errorMessage;
+    bool cancelled = isSyncCancelled( projectName );
+    finishSyncJob( projectName, false );
+    if ( !cancelled )
+      emit networkErrorOccurred( errorMessage, QStringLiteral( "Mergin API error: uploadProject" ) );
+  }
+}
+
+bool MerginApi::compressRequestBody( QNetworkRequest &request, QByteArray &body )
+{
+  if ( body.size() < MIN_COMPRESSED_SIZE )
+    return false;
+
+  QByteArray compressed = Compression::deflate( body );
+  if ( compressed.isEmpty() || !Compression::isWorthIt( body.size(), compressed.size() ) )
+    return false;
+
+  request.setRawHeader( "Content-Encoding", "deflate" );
+  body = compressed;
+  return true;
+}
+
+void MerginApi::saveUploadState( const UploadTask &task )
+{
+  // The first line holds the transaction, ids of acknowledged chunks are appended as following lines
+  QString filePath = uploadStateFile( task.projectDir );
+  createPathIfNotExists( filePath );
+  QFile file( filePath );
+  if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+  {
+    qDebug() << "Failed to save upload state of" << task.projectDir;
+    return;
+  }
+
+  QJsonObject localChanges = task.changes;
+  for ( const QString &key : QStringList() << QStringLiteral( "added" ) << QStringLiteral( "updated" ) )
+  {
+    QJsonArray fileArray = localChanges.value( key ).toArray();
+    for ( int i = 0; i < fileArray.size(); ++i )
+    {
+      QJsonObject fileObject = fileArray.at( i ).toObject();
+      fileObject.remove( QStringLiteral( "chunks" ) );
+      fileArray.replace( i, fileObject );
+    }
+    if ( localChanges.contains( key ) )
+      localChanges.insert( key, fileArray );
+  }
+
+  QJsonObject state;
+  state.insert( QStringLiteral( "transaction" ), task.transactionId );
+  state.insert( QStringLiteral( "changes" ), task.changes );
+  state.insert( QStringLiteral( "localChanges" ), localChanges );
+  file.write( QJsonDocument( state ).toJson( QJsonDocument::Compact ) + '\n' );
+  for ( const QString &chunkId : task.uploadedChunks )
+  {
+    file.write( chunkId.toLatin1() + '\n' );
+  }
+  file.close();
+}
+
+void MerginApi::cancelPushTransaction( const QString &transactionId )
+{
+  QByteArray token = generateToken();
+  QNetworkRequest request;
+  QUrl url( mApiRoot + "/v1/project/push/cancel/" + transactionId );
+  request.setUrl( url );
+  request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
+
+  // result does not matter, server removes stale transactions anyway
+  QNetworkReply *reply = mManager.post( request, QByteArray() );
+  connect( reply, &QNetworkReply::finished, reply, &QNetworkReply::deleteLater );
+}
+
+QString MerginApi::uploadStateFile( const QString &projectDir ) const
+{
+  return projectDir + '/' + metadataDir() + QStringLiteral( "/upload.json" );
+}
+
+QString MerginApi::baseFile( const QString &projectDir, const QString &path ) const
+{
+  return projectDir + '/' + metadataDir() + QStringLiteral( "/base/" ) + path;
+}
+
+bool MerginApi::readBaseState( const QString &projectDir, const QString &path, QString &localChecksum, QString &serverChecksum ) const
+{
+  QString base = baseFile( projectDir, path );
+  QFile stateFile( base + BASE_STATE_SUFFIX );
+  if ( !QFile::exists( base ) || !stateFile.open( QIODevice::ReadOnly ) )
+    return false;
+
+  QJsonObject state = QJsonDocument::fromJson( stateFile.readAll() ).object();
+  localChecksum = state.value( QStringLiteral( "local" ) ).toString();
+  serverChecksum = state.value( QStringLiteral( "server" ) ).toString();
+  return !localChecksum.isEmpty() && !serverChecksum.isEmpty();
+}
+
+void MerginApi::updateBaseFile( const QString &projectDir, const QString &path, const QString &serverChecksum, const QString &sourcePath )
+{
+  QString base = baseFile( projectDir, path );
+  createPathIfNotExists( base );
+  QString error;
+  if ( !GeoPackageDiff::copyDatabase( sourcePath.isEmpty() ? projectDir + '/' + path : sourcePath, base, &error ) )
+  {
+    qDebug() << "Failed to save base of" << path << "-" << error;
+    removeBaseFile( projectDir, path );
+    return;
+  }
+
+  QString localChecksum = QString::fromLatin1( getChecksum( base ) );
+  QJsonObject state;
+  state.insert( QStringLiteral( "local" ), localChecksum );
+  state.insert( QStringLiteral( "server" ), serverChecksum.isEmpty() ? localChecksum : serverChecksum );
+
+  QFile stateFile( base + BASE_STATE_SUFFIX );
+  if ( stateFile.open( QIODevice::WriteOnly ) )
+  {
+    stateFile.write( QJsonDocument( state ).toJson( QJsonDocument::Compact ) );
+    stateFile.close();
+  }
+}
+
+void MerginApi::removeBaseFile( const QString &projectDir, const QString &path )
+{
+  QString base = baseFile( projectDir, path );
+  QFile::remove( base );
+  QFile::remove( base + BASE_STATE_SUFFIX );
+}
+
+QString MerginApi::changesetFile( const QString &path, const QString &checksum ) const
+{
+  return metadataDir() + QStringLiteral( "/diff/" ) + path + '-' + checksum.left( 16 );
+}
+
+bool MerginApi::applyDownloadedChangesets( const QString &projectName, QStringList &stagedFiles, QHash<QString, QString> &patchedFiles, QString &errorMessage )
+{
+  QString projectDir = mDataDir + projectName;
+  QString staging = stagingDir( projectDir );
+  const QHash<QString, MerginFile> diffs = mFetchedDiffs.value( projectName );
+  for ( auto it = diffs.constBegin(); it != diffs.constEnd(); ++it )
+  {
+    const MerginFile &file = it.value();
+    if ( !stagedFiles.removeOne( it.key() ) )
+      continue;
+
+    // changeset is applied to a copy in the staging folder, the project file is replaced only if it succeeds
+    QString stagedFilePath = staging + file.path;
+    QString error;
+    createPathIfNotExists( stagedFilePath );
+    QFile::remove( stagedFilePath );
+    if ( !QFile::copy( projectDir + '/' + file.path, stagedFilePath ) )
+    {
+      error = QStringLiteral( "Failed to copy the local file" );
+    }
+    else if ( GeoPackageDiff::applyChangeset( stagedFilePath, staging + it.key(), &error ) )
+    {
+      patchedFiles.insert( file.path, file.checksum );
+      continue;
+    }
+
+    // the next sync downloads the whole file
+    removeBaseFile( projectDir, file.path );
+    errorMessage = QStringLiteral( "Failed to apply changes of %1: %2" ).arg( file.path, error );
+    return false;
+  }
+  return true;
+}
+
+void MerginApi::updateUploadedBaseFiles( const UploadTask &task, const QByteArray &projectInfo )
+{
+  QHash<QString, QString> serverChecksums;
+  readProjectFiles( projectInfo, [&serverChecksums]( const MerginFile &file )
+  {
+    serverChecksums.insert( file.path, file.checksum );
+  } );
+
+  for ( const QString &key : QStringList() << QStringLiteral( "added" ) << QStringLiteral( "updated" ) << QStringLiteral( "removed" ) )
+  {
+    for ( const QJsonValue &fileValue : task.changes.value( key ).toArray() )
+    {
+      QJsonObject fileObject = fileValue.toObject();
+      QString path = fileObject.value( QStringLiteral( "path" ) ).toString();
+      if ( !GeoPackageDiff::isGeoPackage( path ) )
+        continue;
+
+      // a file changed during the upload has no base, so it is uploaded whole next time
+      QByteArray uploadedChecksum = fileObject.value( QStringLiteral( "checksum" ) ).toString().toLatin1();
+      if ( key != QStringLiteral( "removed" ) && serverChecksums.contains( path ) && getChecksum( task.projectDir + '/' + path ) == uploadedChecksum )
+        updateBaseFile( task.projectDir, path, serverChecksums.value( path ) );
+      else
+        removeBaseFile( task.projectDir, path );
+    }
+  }
+  QDir( task.projectDir + '/' + metadataDir() + QStringLiteral( "/diff" ) ).removeRecursively();
+}
+
+void MerginApi::mergeGeoPackages( const QString &projectDir, const QStringList &stagedFiles, std::function<void( const QStringList & )> finished )
+{
+  struct Merge
+  {
+    QString path;
+    QString basePath;
+    QString localFilePath;
+    QString stagedFilePath;
+    QString localState; // size and modification time of the local file and its write-ahead log when the merge started
+    bool merged = false;
+    QJsonArray conflicts;
+    QString error;
+  };
+  std::shared_ptr<QList<Merge>> merges = std::make_shared<QList<Merge>>();
+
+  // edits saved while the merge reads the local file would be lost when the merged file replaces it
+  auto localState = []( const QString &filePath )
+  {
+    QFileInfo file( filePath );
+    QFileInfo wal( filePath + QStringLiteral( "-wal" ) );
+    return QStringLiteral( "%1 %2 %3 %4" ).arg( file.size() ).arg( file.lastModified().toMSecsSinceEpoch() )
+           .arg( wal.size() ).arg( wal.exists() ? wal.lastModified().toMSecsSinceEpoch() : 0 );
+  };
+
+  QString staging = stagingDir( projectDir );
+  for ( const QString &path : stagedFiles )
+  {
+    Merge merge;
+    merge.path = path;
+    merge.basePath = baseFile( projectDir, path );
+    merge.localFilePath = projectDir + '/' + path;
+    merge.stagedFilePath = staging + path;
+    merge.localState = localState( merge.localFilePath );
+    QString baseLocalChecksum;
+    QString baseServerChecksum;
+    if ( GeoPackageDiff::isGeoPackage( path ) && QFile::exists( merge.localFilePath ) && readBaseState( projectDir, path, baseLocalChecksum, baseServerChecksum ) )
+      *merges << merge;
+  }
+  if ( merges->isEmpty() )
+  {
+    finished( QStringList() );
+    return;
+  }
+
+  // tables of large GeoPackages are compared in the thread pool of hashing, not in the GUI thread
+  QString mergedSuffix = MERGED_FILE_SUFFIX;
+  mFileHasher.run( [merges, mergedSuffix]()
+  {
+    for ( Merge &merge : *merges )
+      merge.merged = GeoPackageDiff::merge( merge.basePath, merge.localFilePath, merge.stagedFilePath, merge.stagedFilePath + mergedSuffix, merge.conflicts, &merge.error );
+  }, [this, projectDir, merges, finished, localState]()
+  {
+    QStringList mergedFiles;
+    for ( const Merge &merge : *merges )
+    {
+      const QString &path = merge.path;
+      if ( !merge.merged )
+      {
+        qDebug() << "Failed to merge" << path << "with the server version, a conflict copy is kept:" << merge.error;
+        continue;
+      }
+      if ( localState( merge.localFilePath ) != merge.localState )
+      {
+        // the merged file lacks the new edits, the local file is kept as a conflict copy instead
+        qDebug() << path << "has been changed during the merge with the server version, a conflict copy is kept";
+        QFile::remove( merge.stagedFilePath + MERGED_FILE_SUFFIX );
+        continue;
+      }
+
+      // the server version becomes the base, so the upload sends the local changes as a changeset
+      updateBaseFile( projectDir, path, QString(), merge.stagedFilePath );
+      QFile::remove( merge.stagedFilePath );
+      if ( !QFile::rename( merge.stagedFilePath + MERGED_FILE_SUFFIX, merge.stagedFilePath ) )
+      {
+        qDebug() << "Failed to stage merged" << path;
+        continue;
+      }
+      mergedFiles << path;
+      if ( merge.conflicts.isEmpty() )
+        continue;
+
+      int i = 0;
+      QString reportPath = merge.localFilePath + QStringLiteral( "_conflict_report" );
+      while ( QFile::exists( reportPath + QString::number( i ) + QStringLiteral( ".json" ) ) )
+        ++i;
+      QJsonObject report;
+      report.insert( QStringLiteral( "version" ), 1 );
+      report.insert( QStringLiteral( "file" ), path );
+      report.insert( QStringLiteral( "conflicts" ), merge.conflicts );
+      QSaveFile reportFile( reportPath + QString::number( i ) + QStringLiteral( ".json" ) );
+      if ( !reportFile.open( QIODevice::WriteOnly ) )
+      {
+        qDebug() << "Failed to write conflict report of" << path;
+        continue;
+      }
+      reportFile.write( QJsonDocument( report ).toJson() );
+      reportFile.commit();
+      qDebug() << "Merged" << path << "with" << merge.conflicts.size() << "conflicting rows";
+    }
+    finished( mergedFiles );
+  } );
+}
+
+bool MerginApi::loadCachedProjectList( const QString &url )
+{
+  if ( mProjectListUrl == url )
+    return true;
+
+  // e.g. after a restart, the last listing of the server is parsed once, later on only its validity is checked
+  QByteArray data = mResponseCache.data( url, mUsername );
+  if ( data.isEmpty() )
+    return false;
+
+  mMerginProjects = updateMerginProjectList( parseProjectsData( data, true ) );
+  mProjectListUrl = url;
+  return true;
+}
+
+ProjectList MerginApi::updateMerginProjectList( const ProjectList &serverProjects )
+{
+  QStringList modifiedProjects;
+  QHash<QString, std::shared_ptr<MerginProject>> projectUpdates;
+  for ( std::shared_ptr<MerginProject> project : mMerginProjects )
+  {
+    projectUpdates.insert( project->name, project );
+  }
+
+  for ( std::shared_ptr<MerginProject> project : serverProjects )
+  {
+    QDir projectFolder( mDataDir + "/" + project->name );
+    if ( !projectFolder.exists() )
+      continue;
+
+    // local state of projects not listed since the start is in the projects cache
+    ProjectsCache::Entry cached;
+    std::shared_ptr<MerginProject> localProject = projectUpdates.value( project->name );
+    if ( localProject )
+    {
+      cached.updated = localProject->updated;
+      cached.lastSync = localProject->lastSync;
+    }
+    else if ( !mProjectsCache.entry( project->name, cached ) )
+    {
+      continue;
+    }
+
+    QDateTime lastModified = getLastModifiedFileDateTime( mDataDir + project->name );
+    project->updated = cached.updated;
+    project->lastSync = cached.lastSync;
+    project->status = getProjectStatus( project->updated, project->serverUpdated, project->lastSync, lastModified );
+    if ( project->status != ProjectStatus::Modified )
+      continue;
+
+    // files found matching the last sync are not compared again until the journal records a change
+    auto unmodified = mUnmodifiedProjects.constFind( project->name );
+    if ( unmodified != mUnmodifiedProjects.constEnd() && mChangeJournal.unchangedSince( mDataDir + project->name, unmodified.value() ) )
+      project->status = getProjectStatus( project->updated, project->serverUpdated, project->lastSync, project->lastSync );
+    else
+      modifiedProjects << project->name;
+  }
+
+  // files saved since the last sync are compared with its manifest, statuses are corrected when done
+  if ( !modifiedProjects.isEmpty() )
+    refreshProjectStatuses( modifiedProjects );
+  return serverProjects;
+}
+
+void MerginApi::setUpdateToProject( const QString &projectDir, const QString &projectName, bool successfully )
+{
+  Q_UNUSED( projectDir );
+  if ( !successfully ) return;
+
+  for ( std::shared_ptr<MerginProject> project : mMerginProjects )
+  {
+    if ( projectName == project->name )
+    {
+      project->updated = project->serverUpdated;
+      project->lastSync = QDateTime::currentDateTime();
+      emit merginProjectsChanged();
+      return;
+    }
+  }
+}
+
+void MerginApi::deleteObsoleteFiles( const QString &projectName )
+{
+  std::shared_ptr<SyncJob> job = mSyncScheduler.job( projectName );
+  if ( !job )
+    return;
+
+  for ( const QString &filename : job->obsoleteFiles )
+  {
+    QFile::remove( mDataDir + projectName + '/' + filename );
+  }
+  job->obsoleteFiles.clear();
+}
+
+void MerginApi::saveAuthData()
+{
+  QSettings settings;
+  settings.beginGroup( "Input/" );
+  settings.setValue( "username", mUsername );
+  settings.setValue( "password", mPassword );
+  settings.setValue( "apiRoot", mApiRoot );
+  settings.endGroup();
+}
+
+void MerginApi::createProjectFinished()
+{
+  QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
+  Q_ASSERT( r );
+
+  QString projectName = mProjectReplies.take( r );
+  if ( r->error() == QNetworkReply::NoError )
+  {
+    emit notify( QStringLiteral( "Project created" ) );
+    emit projectCreated( projectName );
+  }
+  else
+  {
+    qDebug() << r->errorString();
+    emit networkErrorOccurred( r->errorString(), QStringLiteral( "Mergin API error: createProject" ) );
+  }
+  r->deleteLater();
+}
+
+void MerginApi::deleteProjectFinished()
+{
+  QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
+  Q_ASSERT( r );
+
+  QString projectName = mProjectReplies.take( r );
+  if ( r->error() == QNetworkReply::NoError )
+  {
+    emit notify( QStringLiteral( "Project deleted" ) );
+    emit serverProjectDeleted( projectName );
+  }
+  else
+  {
+    qDebug() << r->errorString();
+    emit networkErrorOccurred( r->errorString(), QStringLiteral( "Mergin API error: deleteProject" ) );
+  }
+  r->deleteLater();
+}
+
+void MerginApi::authorizeFinished()
+{
   QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
   Q_ASSERT( r );
 
   if ( r->error() == QNetworkReply::NoError )
   {
-    QString projectName = mPendingRequests.value( r->url() );
-    emit notify( QStringLiteral( "Project deleted" ) );
-    emit serverProjectDeleted( projectName );
+    emit authChanged();
+  }
+  else
+  {
+    qDebug() << r->errorString();
+    QVariant statusCode = r->attribute( QNetworkRequest::HttpStatusCodeAttribute );
+    int status = statusCode.toInt();
+    if ( status == 401 )
+    {
+      mUsername = QString();
+      mPassword = QString();
+
+      emit authFailed();
+      emit notify( QStringLiteral( "Authentication failed" ) );
+    }
+    else if ( status == 403 )
+    {
+      // Assuming auth was successful, endpoint is just FORBIDDEN for admin users.
+      emit authChanged();
+    }
+    else
+    {
+      emit networkErrorOccurred( r->errorString(), QStringLiteral( "Mergin API error: authorize" ) );
+    }
+  }
+  r->deleteLater();
+}
+
+void MerginApi::projectDeleted( const QString &projectName )
+{
+  // content of the project is not shared anymore
+  mBlobStore.prune();
+  mBlobStore.save();
+  mUnmodifiedProjects.remove( projectName );
+
+  for ( std::shared_ptr<MerginProject> project : mMerginProjects )
+  {
+    if ( project->name == projectName )
+    {
+      project->status = ProjectStatus::NoVersion;
+      project->lastSync = QDateTime();
+      project->updated = QDateTime();
+      emit merginProjectsChanged();
+    }
+  }
+}
+
+
+void MerginApi::loadAuthData()
+{
+  QSettings settings;
+  settings.beginGroup( QStringLiteral( "Input/" ) );
+  setApiRoot( settings.value( QStringLiteral( "apiRoot" ) ).toString() );
+  mUsername = settings.value( QStringLiteral( "username" ) ).toString();
+  mPassword = settings.value( QStringLiteral( "password" ) ).toString();
+}
+
+QString MerginApi::apiRoot() const
+{
+  return mApiRoot;
+}
+
+void MerginApi::setApiRoot( const QString &apiRoot )
+{
+  QSettings settings;
+  settings.beginGroup( QStringLiteral( "Input/" ) );
+  if ( apiRoot.isEmpty() )
+  {
+    mApiRoot = defaultApiRoot();
+  }
+  else
+  {
+    mApiRoot = apiRoot;
+  }
+  settings.setValue( QStringLiteral( "apiRoot" ), mApiRoot );
+  settings.endGroup();
+  emit apiRootChanged();
+}
+
+int MerginApi::syncConcurrency() const
+{
+  return mSyncConcurrency;
+}
+
+void MerginApi::setSyncConcurrency( int syncConcurrency )
+{
+  mSyncConcurrency = qMax( 1, syncConcurrency );
+  mTransferController.setMaxConcurrency( mSyncConcurrency );
+}
+
+QStringList MerginApi::syncFilter( const QString &projectName ) const
+{
+  return mSyncFilters.filter( projectName );
+}
+
+void MerginApi::setSyncFilter( const QString &projectName, const QStringList &patterns )
+{
+  mSyncFilters.setFilter( projectName, patterns );
+}
+
+void MerginApi::setSyncLogFile( const QString &syncLogFile )
+{
+  mSyncLogFile = syncLogFile;
+}
+
+QByteArray MerginApi::generateToken()
+{
+  QString concatenated = mUsername + ':' + mPassword;
+  return concatenated.toLocal8Bit().toBase64();
+}
+
+QString MerginApi::username() const
+{
+  return mUsername;
+}
+
+ProjectList MerginApi::projects()
+{
+  return mMerginProjects;
+}
+
+void MerginApi::listProjectsReplyFinished()
+{
+
+  QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
+  Q_ASSERT( r );
+
+  QString url = r->request().url().toString();
+  QByteArray data;
+  if ( r->error() == QNetworkReply::NoError && ResponseCache::isNotModified( r ) && loadCachedProjectList( url ) )
+  {
+    // listing has not changed, it is not parsed again, only statuses of local projects are refreshed
+    mMerginProjects = updateMerginProjectList( mMerginProjects );
+    emit merginProjectsChanged();
+  }
+  else if ( r->error() == QNetworkReply::NoError && mResponseCache.replyData( r, mUsername, data ) )
+  {
+    ProjectList serverProjects = parseProjectsData( data, true );
+    mMerginProjects = updateMerginProjectList( serverProjects );
+    mProjectListUrl = url;
+    emit merginProjectsChanged();
+  }
+  else
+  {
+    QString message = QStringLiteral( "Network API error: %1(): %2" ).arg( QStringLiteral( "listProjects" ), r->errorString() );
+    qDebug( "%s", message.toStdString().c_str() );
+    emit networkErrorOccurred( r->errorString(), QStringLiteral( "Mergin API error: listProjects" ) );
+
+    if ( r->errorString() == QLatin1String( "Host requires authentication" ) )
+    {
+      emit authRequested();
+      return;
+    }
+  }
+
+  r->deleteLater();
+  emit listProjectsFinished( mMerginProjects );
+}
+
+void MerginApi::downloadProjectReplyReadyRead()
+{
+  QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
+  Q_ASSERT( r );
+
+  readDownloadData( r );
+}
+
+void MerginApi::readDownloadData( QNetworkReply *r )
+{
+  std::shared_ptr<DataStreamState> state = mDataStreams.value( r );
+  if ( !state || state->throttled || r->error() != QNetworkReply::NoError )
+    return;
+
+  int delay = mTransferController.throttleDelay();
+  if ( delay == 0 && mDiskWriter.isFull() )
+  {
+    // the storage is slower than the network
+    delay = DISK_WRITER_WAIT;
+  }
+  if ( delay > 0 )
+  {
+    // data are left in the read buffer, the network stack stops reading from the socket when it is full
+    state->throttled = true;
+    QPointer<QNetworkReply> reply( r );
+    QTimer::singleShot( delay, this, [this, reply, state]
+    {
+      state->throttled = false;
+      if ( reply && mDataStreams.value( reply ) == state )
+        readDownloadData( reply );
+    } );
+    return;
+  }
+  r->setReadBufferSize( mTransferController.readBufferSize() );
+
+  qint64 bytesReceived = state->bytesReceived;
+  qint64 bytesTransferred = state->bytesTransferred;
+  if ( !handleDataStream( r, *state, false ) )
+  {
+    qDebug() << "Writing of downloaded data failed, aborting" << r->url();
+    r->abort();
+    return;
+  }
+  mTransferController.consume( state->bytesTransferred - bytesTransferred );
+
+  QString projectName = mDownloadTaskReplies.value( r );
+  std::shared_ptr<DownloadTask> task = mDownloadTasks.value( projectName );
+  if ( task )
+  {
+    task->bytesReceived += state->bytesReceived - bytesReceived;
+    task->bytesTransferred += state->bytesTransferred - bytesTransferred;
+    reportDownloadProgress( projectName, *task, false );
+  }
+}
+
+void MerginApi::downloadProjectReplyFinished()
+{
+
+  QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
+  Q_ASSERT( r );
+
+  QString projectName = mProjectReplies.take( r );
+  std::shared_ptr<DataStreamState> state = mDataStreams.take( r );
+  bool received = r->error() == QNetworkReply::NoError && state && handleDataStream( r, *state, true );
+  QString errorMsg = r->error() == QNetworkReply::NoError ? QStringLiteral( "Failed to write downloaded files" ) : r->errorString();
+  r->deleteLater();
+  if ( !state )
+  {
+    finishDownload( projectName, QStringList(), errorMsg );
+    return;
+  }
+
+  // the download is finished when the received files have been written
+  finishWrites( *state, [this, projectName, state, received, errorMsg]( bool written )
+  {
+    if ( received && written )
+      finishDownload( projectName, state->receivedFiles, QString() );
+    else
+      finishDownload( projectName, QStringList(), errorMsg );
+  } );
+}
+
+void MerginApi::downloadBatchReplyFinished()
+{
+  QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
+  Q_ASSERT( r );
+
+  QString projectName = mDownloadTaskReplies.take( r );
+  std::shared_ptr<DataStreamState> state = mDataStreams.take( r );
+  std::shared_ptr<DownloadTask> task = mDownloadTasks.value( projectName );
+  r->deleteLater();
+  if ( !task )
+    return;
+
+  // the request keeps running for the task until its files have been written
+  qint64 bytesReceived = state ? state->bytesReceived : 0;
+  qint64 bytesTransferred = state ? state->bytesTransferred : 0;
+  QNetworkReply::NetworkError error = r->error();
+  int statusCode = r->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt();
+
+  if ( state && !state->deltaBasePath.isEmpty() )
+  {
+    // any failure of a delta transfer falls back to download of the whole file
+    bool received = error == QNetworkReply::NoError && handleDataStream( r, *state, true );
+    if ( statusCode == 404 )
+    {
+      // server has announced deltas, but does not send them, other files are downloaded whole
+      qDebug() << "Server does not provide deltas of files";
+      removeServerCapability( BlockDeltaCapability );
+    }
+    finishWrites( *state, [this, projectName, state, task, received, bytesReceived, bytesTransferred]( bool written )
+    {
+      task->runningRequests--;
+      task->bytesReceived += state->bytesReceived - bytesReceived;
+      task->bytesTransferred += state->bytesTransferred - bytesTransferred;
+      mTransferController.consume( state->bytesTransferred - bytesTransferred );
+      if ( !finishDeltaDownload( *task, *state, received && written ) && task->errorMessage.isEmpty() )
+      {
+        qDebug() << "Delta transfer of" << state->requestedFiles.first().path << "failed, downloading the whole file";
+        task->wholeFiles << state->requestedFiles.first().path;
+        task->batches.prepend( state->requestedFiles );
+      }
+      startDownloadRequests( projectName );
+    } );
+    return;
+  }
+
+  QString errorMessage;
+  if ( error != QNetworkReply::NoError )
+  {
+    errorMessage = r->errorString();
+    if ( state && state->singleFile )
+    {
+      // keep data received before the connection has been lost
+      handleDataStream( r, *state, true );
+    }
+  }
+  else if ( !state || !handleDataStream( r, *state, true ) )
+  {
+    errorMessage = QStringLiteral( "Failed to write downloaded files" );
+  }
+
+  auto finishBatch = [this, projectName, state, task, error, statusCode, errorMessage, bytesReceived, bytesTransferred]( bool written )
+  {
+    task->runningRequests--;
+    QString batchError = errorMessage;
+    if ( !written && batchError.isEmpty() )
+      batchError = QStringLiteral( "Failed to write downloaded files" );
+
+    if ( batchError.isEmpty() && state->singleFile )
+    {
+      // whole file is verified as it may have been put together from several responses
+      const MerginFile &file = state->requestedFiles.first();
+      QString stagedFilePath = state->activeFile;
+      if ( !file.checksum.isEmpty() && getChecksum( stagedFilePath ) != file.checksum.toLatin1() )
+      {
+        batchError = QStringLiteral( "Checksum of downloaded file %1 does not match" ).arg( file.path );
+        QFile::remove( stagedFilePath );
+        QFile::remove( stagedFilePath + PARTIAL_FILE_STATE_SUFFIX );
+      }
+      else
+      {
+        writePartialFileState( stagedFilePath, file, true );
+      }
+    }
+
+    if ( state )
+    {
+      task->bytesReceived += state->bytesReceived - bytesReceived;
+      task->bytesTransferred += state->bytesTransferred - bytesTransferred;
+      mTransferController.consume( state->bytesTransferred - bytesTransferred );
+    }
+
+    if ( batchError.isEmpty() )
+    {
+      task->receivedFiles << state->receivedFiles;
+    }
+    else
+    {
+      if ( state && state->singleFile && statusCode == 416 )
+      {
+        // partial file cannot be resumed
+        QFile::remove( state->activeFile );
+        QFile::remove( state->activeFile + PARTIAL_FILE_STATE_SUFFIX );
+      }
+      else if ( state && state->singleFile && QFile::exists( state->activeFile ) )
+      {
+        writePartialFileState( state->activeFile, state->requestedFiles.first(), false );
+      }
+
+      QString retryKey = state ? state->requestedFiles.first().path : QString();
+      if ( task->errorMessage.isEmpty() && state && isRetryableError( error ) && task->retries.value( retryKey ) < MAX_DOWNLOAD_RETRIES )
+      {
+        // the request is sent again, a single file continues from the received part
+        task->retries[retryKey]++;
+        task->batches.prepend( state->requestedFiles );
+        if ( state->stats )
+          state->stats->addRetry();
+        qDebug() << "Retrying download of" << retryKey << "after error:" << batchError;
+      }
+      else if ( task->errorMessage.isEmpty() )
+      {
+        task->errorMessage = batchError;
+        // no need to continue with other requests of the project
+        for ( QNetworkReply *reply : mDownloadTaskReplies.keys( projectName ) )
+        {
+          reply->abort();
+        }
+      }
+    }
+
+    startDownloadRequests( projectName );
+  };
+
+  // staged files are verified, resumed or moved only when they have been written
+  if ( state )
+    finishWrites( *state, finishBatch );
+  else
+    finishBatch( true );
+}
+
+void MerginApi::finishDownload( const QString &projectName, const QStringList &stagedFiles, const QString &error )
+{
+  QString projectDir = mDataDir + projectName;
+  QString errorMessage = error;
+  QStringList files = stagedFiles;
+  QHash<QString, QString> patchedFiles;
+  QList<MerginFile> fetchedFiles = mFetchedFiles.take( projectName );
+  files << mStoredFiles.take( projectName );
+  std::shared_ptr<SyncStats> stats = syncStats( projectName );
+  if ( stats )
+    stats->end( SyncStats::Transfer );
+  if ( errorMessage.isEmpty() )
+  {
+    applyDownloadedChangesets( projectName, files, patchedFiles, errorMessage );
+  }
+  mFetchedDiffs.remove( projectName );
+
+  if ( errorMessage.isEmpty() )
+  {
+    bool waitingForUpload = isWaitingForUpload( projectName );
+    if ( !waitingForUpload )
+    {
+      moveDownloadedFiles( projectName, files, QStringList(), patchedFiles, fetchedFiles, false );
+      return;
+    }
+
+    mergeGeoPackages( projectDir, files, [this, projectName, files, patchedFiles, fetchedFiles]( const QStringList &mergedFiles )
+    {
+      QStringList stagedFiles = files;
+      for ( const QString &path : mergedFiles )
+        stagedFiles.removeOne( path );
+      moveDownloadedFiles( projectName, stagedFiles, mergedFiles, patchedFiles, fetchedFiles, true );
+    } );
   }
   else
   {
-    qDebug() << r->errorString();
-    emit networkErrorOccurred( r->errorString(), QStringLiteral( "Mergin API error: deleteProject" ) );
+    // partial files are kept, so the next sync can resume them
+    removeStagedFiles( projectDir, true );
+    qDebug() << errorMessage;
+    bool cancelled = isSyncCancelled( projectName );
+    finishSyncJob( projectName, false );
+    if ( !cancelled )
+      emit networkErrorOccurred( errorMessage, QStringLiteral( "Mergin API error: downloadProject" ) );
   }
-  mPendingRequests.remove( r->url() );
-  r->deleteLater();
 }
 
-void MerginApi::authorizeFinished()
+void MerginApi::moveDownloadedFiles( const QString &projectName, const QStringList &files, const QStringList &mergedFiles,
+                                     const QHash<QString, QString> &patchedFiles, const QList<MerginFile> &fetchedFiles, bool waitingForUpload )
 {
-  QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
-  Q_ASSERT( r );
-
-  if ( r->error() == QNetworkReply::NoError )
-  {
-    emit authChanged();
-  }
-  else
+  QString projectDir = mDataDir + projectName;
+  std::shared_ptr<SyncStats> stats = syncStats( projectName );
   {
-    qDebug() << r->errorString();
-    QVariant statusCode = r->attribute( QNetworkRequest::HttpStatusCodeAttribute );
-    int status = statusCode.toInt();
-    if ( status == 401 )
+    SyncPhaseScope scope( stats.get(), SyncStats::DiskWrite );
+    deleteObsoleteFiles( projectName );
+    moveStagedFiles( projectDir, files, !waitingForUpload );
+    // changesets are downloaded only for files without local changes
+    moveStagedFiles( projectDir, patchedFiles.keys(), true );
+    moveStagedFiles( projectDir, mergedFiles, true );
+    QDir( stagingDir( projectDir ) ).removeRecursively();
+
+    for ( const QString &path : files )
     {
-      mUsername = QString();
-      mPassword = QString();
-
-      emit authFailed();
-      emit notify( QStringLiteral( "Authentication failed" ) );
+      if ( GeoPackageDiff::isGeoPackage( path ) )
+        updateBaseFile( projectDir, path, QString() );
     }
-    else if ( status == 403 )
+    for ( auto it = patchedFiles.constBegin(); it != patchedFiles.constEnd(); ++it )
     {
-      // Assuming auth was successful, endpoint is just FORBIDDEN for admin users.
-      emit authChanged();
+      updateBaseFile( projectDir, it.key(), it.value() );
     }
-    else
+
+    // downloaded content is offered to other projects
+    QSet<QString> movedFiles;
+    movedFiles.reserve( files.size() );
+    for ( const QString &file : files )
+      movedFiles << file;
+    for ( const MerginFile &file : fetchedFiles )
     {
-      emit networkErrorOccurred( r->errorString(), QStringLiteral( "Mergin API error: authorize" ) );
+      if ( movedFiles.contains( file.path ) )
+        mBlobStore.add( file.checksum, projectDir + '/' + file.path );
     }
+    mBlobStore.save();
   }
-  r->deleteLater();
-}
 
-void MerginApi::projectDeleted( const QString &projectName )
-{
-  for ( std::shared_ptr<MerginProject> project : mMerginProjects )
+  // a whole project downloaded in a single request has no project info, its manifest is saved by the next sync
+  QByteArray projectInfo = mSyncedProjectInfo.take( projectName );
+  if ( !projectInfo.isEmpty() )
+    saveSyncManifest( projectName, projectInfo );
+
+  finishSyncJob( projectName, true );
+  if ( !waitingForUpload )
   {
-    if ( project->name == projectName )
-    {
-      project->status = ProjectStatus::NoVersion;
-      project->lastSync = QDateTime();
-      project->updated = QDateTime();
-      emit merginProjectsChanged();
-    }
+    emit reloadProject( projectDir );
+    emit notify( QStringLiteral( "Download successful" ) );
   }
 }
 
-
-void MerginApi::loadAuthData()
+void MerginApi::pushStartReplyFinished()
 {
-  QSettings settings;
-  settings.beginGroup( QStringLiteral( "Input/" ) );
-  setApiRoot( settings.value( QStringLiteral( "apiRoot" ) ).toString() );
-  mUsername = settings.value( QStringLiteral( "username" ) ).toString();
-  mPassword = settings.value( QStringLiteral( "password" ) ).toString();
-}
+  QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
+  Q_ASSERT( r );
 
-QString MerginApi::apiRoot() const
-{
-  return mApiRoot;
-}
+  QString projectName = mUploadTaskReplies.take( r );
+  std::shared_ptr<UploadTask> task = mUploadTasks.value( projectName );
+  r->deleteLater();
+  if ( !task )
+    return;
 
-void MerginApi::setApiRoot( const QString &apiRoot )
-{
-  QSettings settings;
-  settings.beginGroup( QStringLiteral( "Input/" ) );
-  if ( apiRoot.isEmpty() )
+  if ( r->error() != QNetworkReply::NoError )
   {
-    mApiRoot = defaultApiRoot();
+    if ( r->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt() == 404 && !isSyncCancelled( projectName ) )
+    {
+      // server has announced push transactions, but does not provide them
+      removeServerCapability( PushCapability );
+      uploadProjectData( projectName, task );
+      return;
+    }
+    finishUpload( projectName, r->errorString() );
+    return;
   }
-  else
+
+  QByteArray reply = r->readAll();
+  QJsonObject data = QJsonDocument::fromJson( reply ).object();
+  task->transactionId = data.value( QStringLiteral( "transaction" ) ).toString();
+  if ( task->transactionId.isEmpty() )
   {
-    mApiRoot = apiRoot;
+    // there are no files to upload, server has applied the changes already and sent the project info
+    updateUploadedBaseFiles( *task, reply );
+    saveSyncManifest( projectName, reply );
+    finishUpload( projectName, QString() );
+    return;
   }
-  settings.setValue( QStringLiteral( "apiRoot" ), mApiRoot );
-  settings.endGroup();
-  emit apiRootChanged();
-}
-
-QByteArray MerginApi::generateToken()
-{
-  QString concatenated = mUsername + ':' + mPassword;
-  return concatenated.toLocal8Bit().toBase64();
-}
-
-QString MerginApi::username() const
-{
-  return mUsername;
-}
 
-ProjectList MerginApi::projects()
-{
-  return mMerginProjects;
+  saveUploadState( *task );
+  startUploadRequests( projectName );
 }
 
-void MerginApi::listProjectsReplyFinished()
+void MerginApi::pushChunkReplyFinished()
 {
-
   QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
   Q_ASSERT( r );
 
+  QString projectName = mUploadTaskReplies.take( r );
+  UploadChunk chunk = mUploadChunkReplies.take( r );
+  std::shared_ptr<UploadTask> task = mUploadTasks.value( projectName );
+  r->deleteLater();
+  if ( !task )
+    return;
+
+  task->runningRequests--;
   if ( r->error() == QNetworkReply::NoError )
   {
+    task->uploadedChunks << chunk.id;
+    task->bytesSent += chunk.size;
 
-    if ( mMerginProjects.isEmpty() )
+    // acknowledged chunk is appended to the state, so it is not sent again if upload is interrupted
+    QFile stateFile( uploadStateFile( task->projectDir ) );
+    if ( stateFile.open( QIODevice::Append ) )
     {
-      QFile file( mDataDir + mCacheFile );
-      if ( file.open( QIODevice::ReadOnly ) )
-      {
-        QByteArray cachedData = file.readAll();
-        file.close();
-
-        mMerginProjects = parseProjectsData( cachedData );
-      }
+      stateFile.write( chunk.id.toLatin1() + '\n' );
+      stateFile.close();
     }
-
-
-    QByteArray data = r->readAll();
-    ProjectList serverProjects = parseProjectsData( data, true );
-    mMerginProjects = updateMerginProjectList( serverProjects );
-    emit merginProjectsChanged();
+    reportUploadProgress( projectName, *task, false );
   }
-  else
+  else if ( task->errorMessage.isEmpty() && isRetryableError( r->error() ) && task->retries.value( chunk.id ) < MAX_UPLOAD_RETRIES )
   {
-    QString message = QStringLiteral( "Network API error: %1(): %2" ).arg( QStringLiteral( "listProjects" ), r->errorString() );
-    qDebug( "%s", message.toStdString().c_str() );
-    emit networkErrorOccurred( r->errorString(), QStringLiteral( "Mergin API error: listProjects" ) );
+    task->retries[chunk.id]++;
+    task->chunks.prepend( chunk );
+    if ( std::shared_ptr<SyncStats> stats = syncStats( projectName ) )
+      stats->addRetry();
+    qDebug() << "Retrying upload of chunk" << chunk.id << "of" << chunk.path << "after error:" << r->errorString();
+  }
+  else if ( task->errorMessage.isEmpty() )
+  {
+    task->errorMessage = r->errorString();
+    if ( r->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt() == 404 )
+      task->transactionLost = true;
 
-    if ( r->errorString() == QLatin1String( "Host requires authentication" ) )
+    // no need to continue with other requests of the project
+    for ( QNetworkReply *reply : mUploadTaskReplies.keys( projectName ) )
     {
-      emit authRequested();
-      return;
+      reply->abort();
     }
   }
 
-  r->deleteLater();
-  emit listProjectsFinished( mMerginProjects );
+  startUploadRequests( projectName );
 }
 
-void MerginApi::downloadProjectReplyFinished()
+void MerginApi::pushFinishReplyFinished()
 {
-
   QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
   Q_ASSERT( r );
 
-  QString projectName = mPendingRequests.value( r->url() );
-  QString projectDir = mDataDir + projectName;
+  QString projectName = mUploadTaskReplies.take( r );
+  std::shared_ptr<UploadTask> task = mUploadTasks.value( projectName );
+  r->deleteLater();
+  if ( !task )
+    return;
+
   if ( r->error() == QNetworkReply::NoError )
   {
-    bool waitingForUpload = mWaitingForUpload.contains( projectName );
-
-    deleteObsoleteFiles( projectDir + "/" );
-    handleDataStream( r, projectDir, !waitingForUpload );
-    emit syncProjectFinished( projectDir, projectName );
-    if ( !waitingForUpload )
-    {
-      emit reloadProject( projectDir );
-      emit notify( QStringLiteral( "Download successful" ) );
-    }
+    QByteArray projectInfo = r->readAll();
+    updateUploadedBaseFiles( *task, projectInfo );
+    saveSyncManifest( projectName, projectInfo );
+    finishUpload( projectName, QString() );
   }
   else
   {
-    qDebug() << r->errorString();
-    emit syncProjectFinished( projectDir, projectName, false );
-    emit networkErrorOccurred( r->errorString(), QStringLiteral( "Mergin API error: downloadProject" ) );
+    if ( r->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt() == 404 )
+      task->transactionLost = true;
+    finishUpload( projectName, r->errorString() );
   }
-  mPendingRequests.remove( r->url() );
-  r->deleteLater();
 }
 
-void MerginApi::uploadProjectReplyFinished()
+void MerginApi::dataSyncReplyFinished()
 {
   QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
   Q_ASSERT( r );
 
-  QString projectName = mPendingRequests.value( r->url() );
-  QString projectDir = mDataDir + projectName;
+  QString projectName = mUploadTaskReplies.take( r );
+  std::shared_ptr<UploadTask> task = mUploadTasks.value( projectName );
+  r->deleteLater();
+  if ( !task )
+    return;
+
   if ( r->error() == QNetworkReply::NoError )
   {
-    emit syncProjectFinished( projectDir, projectName );
-    emit notify( QStringLiteral( "Upload successful" ) );
+    // without project info in the reply the manifest is removed and GeoPackages are uploaded whole next time
+    QByteArray projectInfo = r->readAll();
+    task->bytesSent = task->bytesTransferred = task->bytesTotal;
+    updateUploadedBaseFiles( *task, projectInfo );
+    saveSyncManifest( projectName, projectInfo );
+    finishUpload( projectName, QString() );
   }
   else
   {
-    qDebug() << r->errorString();
-    emit syncProjectFinished( projectDir, projectName, false );
-    emit networkErrorOccurred( r->errorString(), QStringLiteral( "Mergin API error: uploadProject" ) );
+    finishUpload( projectName, r->errorString() );
   }
-  mPendingRequests.remove( r->url() );
-  r->deleteLater();
 }
 
 void MerginApi::updateInfoReplyFinished()
@@ -583,46 +2157,209 @@ void MerginApi::updateInfoReplyFinished()
   QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
   Q_ASSERT( r );
 
-  QHash<QString, QList<MerginFile>> files = parseAndCompareProjectFiles( r, true );
+  QString projectName = mProjectReplies.take( r );
+  if ( std::shared_ptr<SyncStats> stats = syncStats( projectName ) )
+  {
+    stats->end( SyncStats::ProjectInfo );
+    stats->addBytesReceived( r->bytesAvailable() ); // not modified reply has no body
+  }
+  QByteArray data;
+  bool projectInfoReceived = r->error() == QNetworkReply::NoError && mResponseCache.replyData( r, mUsername, data );
+  r->deleteLater();
+  if ( !projectInfoReceived )
+  {
+    if ( !isSyncCancelled( projectName ) )
+      reportProjectInfoError( r );
+    finishSyncJob( projectName, false );
+    return;
+  }
+
+  updateServerCapabilities( r );
+  updateFromProjectInfo( projectName, data );
+}
 
-  QUrl url = r->url();
-  QStringList res = url.path().split( "/" );
-  QString projectName;
-  projectName = res.last();
-  QString projectPath = QString( mDataDir + projectName + "/" );
+void MerginApi::updateFromProjectInfo( const QString &projectName, const QByteArray &projectInfo )
+{
+  mSyncedProjectInfo.insert( projectName, projectInfo );
+  calculateChecksums( projectName, [this, projectName, projectInfo]( const QHash<QString, QByteArray> &localChecksums )
+  {
+    fetchChangedFiles( projectName, parseAndCompareProjectFiles( projectName, projectInfo, true, localChecksums ) );
+  } );
+}
 
-  r->deleteLater();
+void MerginApi::uploadToProjectInfo( const QString &projectName, const QByteArray &projectInfo )
+{
+  calculateChecksums( projectName, [this, projectName, projectInfo]( const QHash<QString, QByteArray> &localChecksums )
+  {
+    uploadChangedFiles( projectName, parseAndCompareProjectFiles( projectName, projectInfo, false, localChecksums ) );
+  } );
+}
 
-  QJsonDocument jsonDoc;
-  QJsonArray fileArray;
+void MerginApi::saveSyncManifest( const QString &projectName, const QByteArray &projectInfo )
+{
+  QString projectDir = mDataDir + projectName;
+  QString projectVersion;
+  QDateTime updated;
+  QList<SyncManifest::Entry> files;
+  bool valid = readProjectFiles( projectInfo, [&files]( const MerginFile &file )
+  {
+    SyncManifest::Entry entry;
+    entry.path = file.path;
+    entry.checksum = file.checksum;
+    entry.size = file.size;
+    files << entry;
+  }, &projectVersion, &updated );
+
+  // an outdated manifest would hide changes on both sides
+  if ( !valid || !SyncManifest::save( projectDir, projectVersion, updated, files ) )
+    QFile::remove( SyncManifest::manifestFilePath( projectDir ) );
+}
+
+bool MerginApi::localChanges( const QString &projectName, std::function<void( const QHash<QString, QList<MerginFile>> & )> callback )
+{
+  // checksums of a project being synced are not computed twice at once
+  SyncManifest manifest( mDataDir + projectName );
+  if ( !manifest.isValid() || mSyncScheduler.job( projectName ) )
+    return false;
+
+  QByteArray serverFiles = manifest.data();
+  calculateChecksums( projectName, [this, projectName, serverFiles, callback]( const QHash<QString, QByteArray> &localChecksums )
+  {
+    callback( parseAndCompareProjectFiles( projectName, serverFiles, false, localChecksums ) );
+  } );
+  return true;
+}
+
+void MerginApi::refreshProjectStatus( const QString &projectName )
+{
+  refreshProjectStatuses( QStringList() << projectName );
+}
+
+void MerginApi::refreshProjectStatuses( const QStringList &projectNames )
+{
+  // the batch holds a reference of its own until all checks have started
+  std::shared_ptr<int> pendingChecks = std::make_shared<int>( 1 );
+  std::shared_ptr<bool> statusChanged = std::make_shared<bool>( false );
+  std::function<void()> checkFinished = [this, pendingChecks, statusChanged]()
+  {
+    if ( --*pendingChecks == 0 && *statusChanged )
+      emit merginProjectsChanged();
+  };
+
+  for ( const QString &projectName : projectNames )
+  {
+    quint64 generation = mChangeJournal.generation();
+    ++*pendingChecks;
+    bool started = localChanges( projectName, [this, projectName, generation, statusChanged, checkFinished]( const QHash<QString, QList<MerginFile>> &changes )
+    {
+      bool modified = false;
+      for ( const QList<MerginFile> &files : changes )
+        modified = modified || !files.isEmpty();
+
+      if ( modified )
+        mUnmodifiedProjects.remove( projectName );
+      else
+        mUnmodifiedProjects.insert( projectName, generation );
+
+      for ( std::shared_ptr<MerginProject> project : mMerginProjects )
+      {
+        if ( project->name == projectName )
+        {
+          // files are not newer than the last sync unless their content has changed
+          ProjectStatus status = modified ? ProjectStatus::Modified : getProjectStatus( project->updated, project->serverUpdated, project->lastSync, project->lastSync );
+          *statusChanged = *statusChanged || status != project->status;
+          project->status = status;
+          break;
+        }
+      }
+      checkFinished();
+    } );
+    if ( !started )
+      --*pendingChecks;
+  }
+  checkFinished();
+}
+
+void MerginApi::fetchChangedFiles( const QString &projectName, const QHash<QString, QList<MerginFile>> &files )
+{
+  std::shared_ptr<SyncJob> job = mSyncScheduler.job( projectName );
+  if ( !job || job->cancelRequested )
+  {
+    finishSyncJob( projectName, false );
+    return;
+  }
+
+  QList<MerginFile> filesToFetch;
+  mFetchedDiffs.remove( projectName );
+  mFetchedFiles.remove( projectName );
+  mStoredFiles.remove( projectName );
   for ( QString key : files.keys() )
   {
     if ( key == QStringLiteral( "added" ) )
     {
       // no removal before upload
-      if ( mWaitingForUpload.contains( projectName ) ) continue;
+      if ( job->updateBeforeUpload ) continue;
 
-      QSet<QString> obsolateFiles;
+      job->obsoleteFiles.clear();
       for ( MerginFile file : files.value( key ) )
       {
-        obsolateFiles.insert( file.path );
+        job->obsoleteFiles.insert( file.path );
       }
-      mObsoleteFiles.insert( projectPath, obsolateFiles );
     }
     else
     {
       for ( MerginFile file : files.value( key ) )
       {
-        QJsonObject fileObject;
-        fileObject.insert( "path", file.path );
-        fileObject.insert( "checksum", file.checksum );
-        fileArray.append( fileObject );
+        if ( !file.diffPath.isEmpty() )
+        {
+          // only the changeset is downloaded, it is applied to the local file when the download finishes
+          mFetchedDiffs[projectName].insert( file.diffPath, file );
+          file.path = file.diffPath;
+          file.checksum = file.diffChecksum;
+          file.size = file.diffSize;
+        }
+        else if ( linkStoredFile( projectName, file ) )
+        {
+          // content is present locally in another project
+          mStoredFiles[projectName] << file.path;
+          continue;
+        }
+        else
+        {
+          mFetchedFiles[projectName] << file;
+        }
+
+        filesToFetch << file;
       }
     }
   }
 
-  jsonDoc.setArray( fileArray );
-  downloadProjectFiles( projectName, jsonDoc.toJson( QJsonDocument::Compact ) );
+  // without parallel requests, a new project which has neither large files nor files to resume or clone
+  // is downloaded whole by the plain single request, otherwise files are requested by the download task
+  bool wholeProject = job->type == SyncJob::Download && mSyncConcurrency == 1 && !mSyncFilters.hasFilter( projectName )
+                      && !mStoredFiles.contains( projectName ) && !mFetchedDiffs.contains( projectName );
+  for ( const MerginFile &file : filesToFetch )
+    wholeProject = wholeProject && !isRequestedAlone( mDataDir + projectName, file, MAX_DOWNLOAD_BATCH_SIZE );
+
+  if ( wholeProject )
+    startProjectDownload( projectName );
+  else
+    downloadProjectFiles( projectName, filesToFetch );
+}
+
+bool MerginApi::linkStoredFile( const QString &projectName, const MerginFile &file )
+{
+  if ( file.checksum.isEmpty() || !mBlobStore.contains( file.checksum, file.size ) )
+    return false;
+
+  // the staged file is complete, so it is kept and not downloaded again (see resumableSize)
+  QString stagedFilePath = stagingDir( mDataDir + projectName ) + file.path;
+  createPathIfNotExists( stagedFilePath );
+  if ( !mBlobStore.link( file.checksum, file.size, stagedFilePath ) )
+    return false;
+
+  writePartialFileState( stagedFilePath, file, true );
+  return true;
 }
 
 void MerginApi::uploadInfoReplyFinished()
@@ -630,27 +2367,133 @@ void MerginApi::uploadInfoReplyFinished()
   QNetworkReply *r = qobject_cast<QNetworkReply *>( sender() );
   Q_ASSERT( r );
 
-  QHash<QString, QList<MerginFile>> files = parseAndCompareProjectFiles( r, false );
-  QUrl url = r->url();
-  QStringList res = url.path().split( "/" );
-  QString projectName;
-  projectName = res.last();
-
+  QString projectName = mProjectReplies.take( r );
+  if ( std::shared_ptr<SyncStats> stats = syncStats( projectName ) )
+  {
+    stats->end( SyncStats::ProjectInfo );
+    stats->addBytesReceived( r->bytesAvailable() ); // not modified reply has no body
+  }
+  QByteArray data;
+  bool projectInfoReceived = r->error() == QNetworkReply::NoError && mResponseCache.replyData( r, mUsername, data );
   r->deleteLater();
+  if ( !projectInfoReceived )
+  {
+    if ( !isSyncCancelled( projectName ) )
+      reportProjectInfoError( r );
+    finishSyncJob( projectName, false );
+    return;
+  }
+
+  updateServerCapabilities( r );
+
+  // the project has changed on the server since its last sync, it is updated first
+  SyncManifest manifest( mDataDir + projectName );
+  std::shared_ptr<SyncJob> job = mSyncScheduler.job( projectName );
+  if ( job && manifest.isValid() )
+  {
+    QString projectVersion;
+    QDateTime updated;
+    readProjectFiles( data, []( const MerginFile & ) {}, &projectVersion, &updated );
+    if ( !manifest.isVersion( projectVersion, updated ) )
+    {
+      job->updateBeforeUpload = true;
+      updateFromProjectInfo( projectName, data );
+      return;
+    }
+  }
+
+  uploadToProjectInfo( projectName, data );
+}
+
+void MerginApi::updateServerCapabilities( QNetworkReply *r )
+{
+  // a not modified reply without a header keeps what has been recorded from it
+  bool notModified = ResponseCache::isNotModified( r );
+  int capabilities = mServerCapabilities.value( mApiRoot );
+  if ( !notModified || r->hasRawHeader( "X-Mergin-Capabilities" ) )
+  {
+    capabilities &= DeflateRequestsCapability;
+    for ( const QByteArray &capability : r->rawHeader( "X-Mergin-Capabilities" ).split( ',' ) )
+    {
+      QByteArray name = capability.trimmed().toLower();
+      if ( name == "geodiff" )
+        capabilities |= GeoDiffCapability;
+      else if ( name == "block-delta" )
+        capabilities |= BlockDeltaCapability;
+      else if ( name == "push" )
+        capabilities |= PushCapability;
+    }
+  }
+  if ( !notModified || r->hasRawHeader( "Accept-Encoding" ) )
+  {
+    // server lists content codings it accepts in request bodies (RFC 7694)
+    capabilities &= ~DeflateRequestsCapability;
+    if ( r->rawHeader( "Accept-Encoding" ).toLower().contains( "deflate" ) )
+      capabilities |= DeflateRequestsCapability;
+  }
+  mServerCapabilities.insert( mApiRoot, capabilities & ~mUnsupportedCapabilities.value( mApiRoot ) );
+}
+
+bool MerginApi::hasServerCapability( ServerCapability capability ) const
+{
+  return mServerCapabilities.value( mApiRoot ) & capability;
+}
+
+void MerginApi::removeServerCapability( ServerCapability capability )
+{
+  mUnsupportedCapabilities[mApiRoot] |= capability;
+  mServerCapabilities[mApiRoot] &= ~capability;
+}
+
+void MerginApi::uploadChangedFiles( const QString &projectName, const QHash<QString, QList<MerginFile>> &files )
+{
+  if ( isSyncCancelled( projectName ) )
+  {
+    finishSyncJob( projectName, false );
+    return;
+  }
 
-  QJsonDocument jsonDoc;
   QJsonObject changes;
+  QString projectDir = mDataDir + projectName;
 
   QList<MerginFile> filesToUpload;
   for ( QString key : files.keys() )
   {
+    // stable order, so changes of an interrupted upload can be compared with the current ones
+    QList<MerginFile> keyFiles = files.value( key );
+    std::sort( keyFiles.begin(), keyFiles.end(), []( const MerginFile & a, const MerginFile & b ) { return a.path < b.path; } );
+
     QJsonArray jsonArray;
-    for ( MerginFile file : files.value( key ) )
+    for ( MerginFile file : keyFiles )
     {
       QJsonObject fileObject;
       fileObject.insert( "path", file.path );
       fileObject.insert( "checksum", file.checksum );
       fileObject.insert( "size", file.size );
+
+      if ( !file.diffBase.isEmpty() && hasServerCapability( PushCapability ) )
+      {
+        // changes of a GeoPackage since the last sync are uploaded as a changeset unless its schema has changed
+        QString changeset = changesetFile( file.path, file.checksum );
+        QString error;
+        createPathIfNotExists( projectDir + '/' + changeset );
+        if ( GeoPackageDiff::createChangeset( baseFile( projectDir, file.path ), projectDir + '/' + file.path, projectDir + '/' + changeset, &error ) )
+        {
+          file.diffPath = changeset;
+          file.diffChecksum = QString::fromLatin1( getChecksum( projectDir + '/' + changeset ) );
+          file.diffSize = QFileInfo( projectDir + '/' + changeset ).size();
+
+          QJsonObject diff;
+          diff.insert( QStringLiteral( "checksum" ), file.diffChecksum );
+          diff.insert( QStringLiteral( "size" ), file.diffSize );
+          diff.insert( QStringLiteral( "base" ), file.diffBase );
+          fileObject.insert( QStringLiteral( "diff" ), diff );
+        }
+        else
+        {
+          qDebug() << "Uploading whole file" << file.path << "-" << error;
+        }
+      }
       jsonArray.append( fileObject );
 
       if ( key != QStringLiteral( "removed" ) )
@@ -661,354 +2504,803 @@ void MerginApi::uploadInfoReplyFinished()
     changes.insert( key, jsonArray );
   }
 
-  jsonDoc.setObject( changes );
-  uploadProjectFiles( projectName, jsonDoc.toJson( QJsonDocument::Compact ), filesToUpload );
+  uploadProjectFiles( projectName, changes, filesToUpload );
 }
 
-QHash<QString, QList<MerginFile>> MerginApi::parseAndCompareProjectFiles( QNetworkReply *r, bool isForUpdate )
+QHash<QString, QList<MerginFile>> MerginApi::parseAndCompareProjectFiles( const QString &projectName, const QByteArray &data, bool isForUpdate,
+    const QHash<QString, QByteArray> &localChecksums )
 {
+  SyncPhaseScope scope( syncStats( projectName ).get(), SyncStats::Diffing );
   QList<MerginFile> added;
   QList<MerginFile> updatedFiles;
   QList<MerginFile> renamed;
   QList<MerginFile> removed;
 
   QHash<QString, QList<MerginFile>> files;
-
-  QUrl url = r->url();
-  QStringList res = url.path().split( '/' );
-  QString projectName;
-  projectName = res.last();
   QString projectPath = QString( mDataDir + projectName + '/' );
 
-  if ( r->error() == QNetworkReply::NoError )
+  // an update followed by an upload fetches only files changed on the server since the last sync (see SyncManifest),
+  // files changed or deleted only locally are kept for the upload instead of being replaced by the server version
+  QHash<QString, QString> syncedChecksums;
+  if ( isForUpdate && isWaitingForUpload( projectName ) )
   {
-    QByteArray data = r->readAll();
-    QJsonDocument doc = QJsonDocument::fromJson( data );
-    if ( doc.isObject() )
-    {
-      QJsonObject docObj = doc.object();
-      QString updated = docObj.value( QStringLiteral( "updated" ) ).toString();
-      auto it = docObj.constFind( QStringLiteral( "files" ) );
-      QJsonValue v = *it;
-      Q_ASSERT( v.isArray() );
-      QJsonArray vArray = v.toArray();
-
-      QSet<QString> localFiles = listFiles( projectPath );
-      for ( auto it = vArray.constBegin(); it != vArray.constEnd(); ++it )
+    readProjectFiles( SyncManifest( projectPath ).data(), [&syncedChecksums]( const MerginFile &file )
+    {
+      syncedChecksums.insert( file.path, file.checksum );
+    } );
+  }
+
+  // changesets of GeoPackages are transferred only if the server has announced it handles them
+  bool geoDiff = hasServerCapability( GeoDiffCapability );
+
+  // server files are compared as they are read, project info of a large project is not built as a document tree
+  QSet<QString> localFiles;
+  localFiles.reserve( localChecksums.size() );
+  for ( auto it = localChecksums.constBegin(); it != localChecksums.constEnd(); ++it )
+    localFiles << it.key();
+  bool valid = readProjectFiles( data, [&]( const MerginFile &serverFile )
+  {
+    const QString &path = serverFile.path;
+    const QString &serverChecksum = serverFile.checksum;
+    if ( !mSyncFilters.isIncluded( projectName, path ) )
+    {
+      // excluded by selective sync, neither missing locally nor added
+      localFiles.remove( path );
+      return;
+    }
+    qint64 serverSize = serverFile.size;
+    bool unchangedOnServer = syncedChecksums.contains( path ) && syncedChecksums.value( path ) == serverChecksum;
+    QByteArray localChecksumBytes = localChecksums.value( path );
+    QString localChecksum = QString::fromLatin1( localChecksumBytes.data(), localChecksumBytes.size() );
+    QFileInfo info( projectPath + path );
+    QString baseLocalChecksum;
+    QString baseServerChecksum;
+    bool hasBase = GeoPackageDiff::isGeoPackage( path ) && readBaseState( mDataDir + projectName, path, baseLocalChecksum, baseServerChecksum );
+
+    // removed
+    if ( localChecksum.isEmpty() )
+    {
+      if ( unchangedOnServer )
+        return;
+
+      MerginFile file;
+      file.checksum = serverChecksum;
+      file.path = path;
+      file.size = isForUpdate ? serverSize : info.size();
+      removed.append( file );
+    }
+    // updated GeoPackage, changes on each side are detected against the last synchronized version
+    else if ( hasBase )
+    {
+      bool localChanged = localChecksum != baseLocalChecksum;
+      bool serverChanged = serverChecksum != baseServerChecksum;
+      if ( isForUpdate ? serverChanged : localChanged )
       {
-        QJsonObject projectInfoMap = it->toObject();
-        QString serverChecksum = projectInfoMap.value( QStringLiteral( "checksum" ) ).toString();
-        QString path = projectInfoMap.value( QStringLiteral( "path" ) ).toString();
-        QByteArray localChecksumBytes = getChecksum( projectPath + path );
-        QString localChecksum = QString::fromLatin1( localChecksumBytes.data(), localChecksumBytes.size() );
-        QFileInfo info( projectPath + path );
-
-        // removed
-        if ( localChecksum.isEmpty() )
+        MerginFile file;
+        file.path = path;
+        if ( isForUpdate )
         {
-          MerginFile file;
           file.checksum = serverChecksum;
-          file.path = path;
-          file.size = info.size();
-          removed.append( file );
-        }
-        // updated
-        else if ( serverChecksum != localChecksum )
-        {
-          MerginFile file;
-          // if updated file is required from server, it has to have server checksum
-          // if updated file is going to be upload, it has to have local checksum
-          if ( isForUpdate )
+          file.size = serverSize;
+          if ( geoDiff && !localChanged && !serverFile.diffPath.isEmpty() && serverFile.diffBase == baseServerChecksum )
           {
-            file.checksum = serverChecksum;
-          }
-          else
-          {
-            file.checksum = localChecksum;
+            file.diffPath = serverFile.diffPath;
+            file.diffChecksum = serverFile.diffChecksum;
+            file.diffSize = serverFile.diffSize;
+            file.diffBase = baseServerChecksum;
           }
+        }
+        else
+        {
+          file.checksum = localChecksum;
           file.size = info.size();
-          file.path = path;
-          updatedFiles.append( file );
+          if ( geoDiff && !serverChanged )
+            file.diffBase = baseServerChecksum;
         }
-
-        localFiles.remove( path );
+        updatedFiles.append( file );
       }
-
-      // Rest of localFiles are newly added
-      for ( QString p : localFiles )
+    }
+    // updated
+    else if ( serverChecksum != localChecksum && !unchangedOnServer )
+    {
+      MerginFile file;
+      // if updated file is required from server, it has to have server checksum
+      // if updated file is going to be upload, it has to have local checksum
+      if ( isForUpdate )
+      {
+        file.checksum = serverChecksum;
+        file.size = serverSize;
+      }
+      else
       {
-        MerginFile file;
-        QByteArray localChecksumBytes = getChecksum( projectPath + p );
-        QString localChecksum = QString::fromLatin1( localChecksumBytes.data(), localChecksumBytes.size() );
         file.checksum = localChecksum;
-        file.path = p;
-        QFileInfo info( projectPath + p );
         file.size = info.size();
-        added.append( file );
       }
+      file.path = path;
+      updatedFiles.append( file );
     }
 
-    files.insert( QStringLiteral( "added" ), added );
-    files.insert( QStringLiteral( "updated" ), updatedFiles );
-    files.insert( QStringLiteral( "removed" ), removed );
-    files.insert( QStringLiteral( "renamed" ), renamed );
+    localFiles.remove( path );
+  } );
+
+  if ( valid )
+  {
+    // Rest of localFiles are newly added
+    for ( QString p : localFiles )
+    {
+      if ( !mSyncFilters.isIncluded( projectName, p ) )
+        continue;
+
+      MerginFile file;
+      QByteArray localChecksumBytes = localChecksums.value( p );
+      QString localChecksum = QString::fromLatin1( localChecksumBytes.data(), localChecksumBytes.size() );
+      file.checksum = localChecksum;
+      file.path = p;
+      QFileInfo info( projectPath + p );
+      file.size = info.size();
+      added.append( file );
+    }
   }
   else
   {
-    QString message = QStringLiteral( "Network API error: %1(): %2" ).arg( QStringLiteral( "listProjects" ), r->errorString() );
-    qDebug( "%s", message.toStdString().c_str() );
-    emit networkErrorOccurred( r->errorString(), QStringLiteral( "Mergin API error: projectInfo" ) );
+    // malformed project info, nothing is transferred or removed
+    updatedFiles.clear();
+    removed.clear();
   }
+
+  files.insert( QStringLiteral( "added" ), added );
+  files.insert( QStringLiteral( "updated" ), updatedFiles );
+  files.insert( QStringLiteral( "removed" ), removed );
+  files.insert( QStringLiteral( "renamed" ), renamed );
   return files;
 }
 
-ProjectList MerginApi::parseProjectsData( const QByteArray &data, bool dataFromServer )
+void MerginApi::calculateChecksums( const QString &projectName, std::function<void( const QHash<QString, QByteArray> & )> callback )
 {
-  ProjectList result;
+  QString projectPath = mDataDir + projectName + '/';
 
-  QJsonDocument doc = QJsonDocument::fromJson( data );
-  if ( doc.isArray() )
+  // if the journal has recorded all changes since the checksums were cached, other files are neither listed nor read.
+  // The generation is taken first, so changes which the journal reads after it are not marked clean when done.
+  quint64 journalGeneration = mChangeJournal.generation();
+  QSet<QString> changedFiles;
+  bool journalComplete = mChangeJournal.changedFiles( projectPath, changedFiles );
+
+  // files are listed and compared with the cache in the thread pool, only files changed since the last sync are hashed
+  struct Scan
+  {
+    std::shared_ptr<ChecksumCache> cache;
+    QHash<QString, QByteArray> checksums;
+    QStringList outdatedFiles;
+    QStringList filePaths;
+  };
+  std::shared_ptr<Scan> scan = std::make_shared<Scan>();
+  SyncFilters filters = mSyncFilters;
+  QSet<QString> ignoredSuffixes = mIgnoreFiles;
+
+  QElapsedTimer timer;
+  timer.start();
+  std::shared_ptr<SyncStats> stats = syncStats( projectName );
+  if ( stats )
+    stats->begin( SyncStats::Hashing );
+  mFileHasher.run( [scan, projectName, projectPath, changedFiles, journalComplete, filters, ignoredSuffixes]()
   {
-    QJsonArray vArray = doc.array();
+    scan->cache = std::make_shared<ChecksumCache>( projectPath );
+    QSet<QString> paths = changedFiles;
+    if ( journalComplete )
+    {
+      for ( const QString &path : scan->cache->paths() )
+        paths << path;
+    }
+    else
+    {
+      paths = listFiles( projectPath, ignoredSuffixes );
+    }
 
-    for ( auto it = vArray.constBegin(); it != vArray.constEnd(); ++it )
+    for ( const QString &path : paths )
+    {
+      QByteArray checksum;
+      if ( !filters.isIncluded( projectName, path ) )
+      {
+        // files excluded by selective sync are not hashed, but listed, so the cache covers all files of the project
+        bool unchanged = journalComplete && !changedFiles.contains( path ) && scan->cache->storedChecksum( path, checksum );
+        if ( !unchanged && !scan->cache->cachedChecksum( path, checksum ) )
+          scan->cache->setUnhashed( path );
+      }
+      else if ( journalComplete && !changedFiles.contains( path ) && scan->cache->storedChecksum( path, checksum )
+                && !checksum.isEmpty() )
+      {
+        scan->checksums.insert( path, checksum );
+      }
+      else if ( scan->cache->cachedChecksum( path, checksum ) )
+      {
+        // changed file may have been removed
+        if ( !checksum.isEmpty() )
+          scan->checksums.insert( path, checksum );
+      }
+      else
+      {
+        scan->outdatedFiles << path;
+        scan->filePaths << projectPath + path;
+      }
+    }
+  },
+  [this, scan, projectName, projectPath, journalGeneration, timer, stats, callback]()
+  {
+    mFileHasher.hash( scan->filePaths, [this, scan, projectName, projectPath, journalGeneration, timer, stats, callback]( const QVector<QByteArray> &results )
     {
-      QJsonObject projectMap = it->toObject();
-      MerginProject p;
-      p.name = projectMap.value( QStringLiteral( "name" ) ).toString();
-      QJsonValue tags = projectMap.value( QStringLiteral( "tags" ) );
-      if ( tags.isArray() )
+      // the cache must list all files, so the journal can rely on it from now on
+      std::shared_ptr<ChecksumCache> cache = scan->cache;
+      const QStringList &outdatedFiles = scan->outdatedFiles;
+      QHash<QString, QByteArray> &checksums = scan->checksums;
+      bool cacheComplete = true;
+      qint64 bytesHashed = 0;
+      for ( int i = 0; i < outdatedFiles.size(); ++i )
       {
-        for ( QJsonValueRef tag : tags.toArray() )
+        cache->setChecksum( outdatedFiles.at( i ), results.at( i ) );
+        if ( !results.at( i ).isEmpty() )
         {
-          p.tags.append( tag.toString() );
+          checksums.insert( outdatedFiles.at( i ), results.at( i ) );
+          if ( stats )
+            bytesHashed += QFileInfo( projectPath + outdatedFiles.at( i ) ).size();
         }
-        tags.toArray().toVariantList();
+        else if ( QFileInfo::exists( projectPath + outdatedFiles.at( i ) ) )
+          cacheComplete = false;
+      }
+      if ( stats )
+      {
+        stats->end( SyncStats::Hashing );
+        stats->addBytesRead( bytesHashed );
       }
-      p.created = QDateTime::fromString( projectMap.value( QStringLiteral( "created" ) ).toString(), Qt::ISODateWithMs ).toUTC();
-      QDateTime updated = QDateTime::fromString( projectMap.value( QStringLiteral( "updated" ) ).toString(), Qt::ISODateWithMs ).toUTC();
+      if ( cache->save() && cacheComplete )
+        mChangeJournal.markClean( projectPath, journalGeneration );
+      qDebug() << QStringLiteral( "Hashed %1 of %2 files of %3 in %4 ms" )
+               .arg( outdatedFiles.size() ).arg( checksums.size() ).arg( projectName ).arg( timer.elapsed() );
+      callback( checksums );
+    },
+    [this, projectName]( int filesHashed, int filesTotal )
+    {
+      emit hashingProgress( projectName, filesHashed, filesTotal );
+    } );
+  } );
+}
+
+void MerginApi::reportProjectInfoError( QNetworkReply *r )
+{
+  QString message = QStringLiteral( "Network API error: %1(): %2" ).arg( QStringLiteral( "projectInfo" ), r->errorString() );
+  qDebug( "%s", message.toStdString().c_str() );
+  emit networkErrorOccurred( r->errorString(), QStringLiteral( "Mergin API error: projectInfo" ) );
+}
+
+ProjectList MerginApi::parseProjectsData( const QByteArray &data, bool dataFromServer )
+{
+  ProjectList result;
+  bool valid = readProjects( data, dataFromServer, [&result]( const MerginProject &project )
+  {
+    result << std::make_shared<MerginProject>( project );
+  } );
+  return valid ? result : ProjectList();
+}
+
+bool MerginApi::readProjects( const QByteArray &data, bool dataFromServer, std::function<void( const MerginProject & )> callback )
+{
+  JsonReader reader( data );
+  if ( reader.next() != JsonReader::BeginArray )
+    return false;
+
+  for ( JsonReader::Token token = reader.next(); token != JsonReader::EndArray; token = reader.next() )
+  {
+    if ( token == JsonReader::Error )
+      break;
+    if ( token != JsonReader::BeginObject )
+    {
+      reader.skipValue();
+      continue;
+    }
 
-      if ( dataFromServer )
+    MerginProject p;
+    QDateTime updated;
+    while ( reader.next() == JsonReader::Key )
+    {
+      const QByteArray key = reader.rawString();
+      const JsonReader::Token value = reader.next();
+      if ( key == "name" && value == JsonReader::String )
+        p.name = reader.string();
+      else if ( key == "tags" && value == JsonReader::BeginArray )
       {
-        if ( !updated.isValid() )
+        for ( JsonReader::Token tag = reader.next(); tag != JsonReader::EndArray && tag != JsonReader::Error; tag = reader.next() )
         {
-          updated = p.created;
+          p.tags.append( tag == JsonReader::String ? reader.string() : QString() );
+          reader.skipValue();
         }
-        p.serverUpdated = updated;
       }
+      else if ( key == "created" && value == JsonReader::String )
+        p.created = reader.dateTime().toUTC();
+      else if ( key == "updated" && value == JsonReader::String )
+        updated = reader.dateTime().toUTC();
+      else if ( key == "lastSync" && value == JsonReader::String && !dataFromServer )
+        p.lastSync = reader.dateTime();
       else
+        reader.skipValue();
+    }
+
+    if ( dataFromServer )
+    {
+      if ( !updated.isValid() )
       {
-        p.lastSync = QDateTime::fromString( projectMap.value( QStringLiteral( "lastSync" ) ).toString(), Qt::ISODateWithMs );
-        p.updated = updated;
+        updated = p.created;
       }
-      result << std::make_shared<MerginProject>( p );
+      p.serverUpdated = updated;
+    }
+    else
+    {
+      p.updated = updated;
     }
+    callback( p );
   }
-  return result;
-}
 
-bool MerginApi::cacheProjectsData( const QByteArray &data )
-{
-  QFile file( mDataDir + mCacheFile );
-  createPathIfNotExists( mDataDir + mCacheFile );
-  if ( !file.open( QIODevice::WriteOnly ) )
+  if ( reader.next() != JsonReader::End )
   {
+    qDebug() << "Failed to parse list of projects:" << reader.errorString();
     return false;
   }
+  return true;
+}
 
-  file.write( data );
-  file.close();
+bool MerginApi::readProjectFiles( const QByteArray &data, std::function<void( const MerginFile & )> callback,
+                                  QString *projectVersion, QDateTime *updated )
+{
+  JsonReader reader( data );
+  if ( reader.next() != JsonReader::BeginObject )
+    return false;
+
+  while ( reader.next() == JsonReader::Key )
+  {
+    const QByteArray key = reader.rawString();
+    const JsonReader::Token value = reader.next();
+    if ( key == "version" && value == JsonReader::String && projectVersion )
+    {
+      *projectVersion = reader.string();
+      continue;
+    }
+    if ( key == "updated" && value == JsonReader::String && updated )
+    {
+      *updated = reader.dateTime();
+      continue;
+    }
+    if ( key != "files" || value != JsonReader::BeginArray )
+    {
+      reader.skipValue();
+      continue;
+    }
+
+    for ( JsonReader::Token token = reader.next(); token != JsonReader::EndArray && token != JsonReader::Error; token = reader.next() )
+    {
+      if ( token != JsonReader::BeginObject )
+      {
+        reader.skipValue();
+        continue;
+      }
+
+      MerginFile file;
+      file.size = 0;
+      while ( reader.next() == JsonReader::Key )
+      {
+        const QByteArray key = reader.rawString();
+        const JsonReader::Token value = reader.next();
+        if ( key == "path" && value == JsonReader::String )
+          file.path = reader.string();
+        else if ( key == "checksum" && value == JsonReader::String )
+          file.checksum = reader.string();
+        else if ( key == "size" && value == JsonReader::Number )
+          file.size = static_cast<qint64>( reader.number() );
+        else if ( key == "diff" && value == JsonReader::BeginObject )
+        {
+          while ( reader.next() == JsonReader::Key )
+          {
+            const QByteArray diffKey = reader.rawString();
+            const JsonReader::Token diffValue = reader.next();
+            if ( diffKey == "path" && diffValue == JsonReader::String )
+              file.diffPath = reader.string();
+            else if ( diffKey == "checksum" && diffValue == JsonReader::String )
+              file.diffChecksum = reader.string();
+            else if ( diffKey == "size" && diffValue == JsonReader::Number )
+              file.diffSize = static_cast<qint64>( reader.number() );
+            else if ( diffKey == "base" && diffValue == JsonReader::String )
+              file.diffBase = reader.string();
+            else
+              reader.skipValue();
+          }
+        }
+        else
+          reader.skipValue();
+      }
+      callback( file );
+    }
+  }
 
+  if ( reader.next() != JsonReader::End )
+  {
+    qDebug() << "Failed to parse project files:" << reader.errorString();
+    return false;
+  }
   return true;
 }
 
 void MerginApi::cacheProjects()
 {
-  QJsonDocument doc;
-  QJsonArray array;
+  QList<ProjectsCache::Entry> entries;
   for ( std::shared_ptr<MerginProject> p : mMerginProjects )
   {
-    QJsonObject projectMap;
-    projectMap.insert( QStringLiteral( "created" ), p->created.toString( Qt::ISODateWithMs ) );
-    projectMap.insert( QStringLiteral( "updated" ), p->updated.toString( Qt::ISODateWithMs ) );
-    projectMap.insert( QStringLiteral( "lastSync" ), p->lastSync.toString( Qt::ISODateWithMs ) );
-    projectMap.insert( QStringLiteral( "name" ), p->name );
-    QJsonArray tags;
-    projectMap.insert( QStringLiteral( "tags" ), tags.fromStringList( p->tags ) );
-
     QDir projectFolder( mDataDir + '/' + p->name );
     if ( projectFolder.exists() )
     {
-      array.append( projectMap );
+      ProjectsCache::Entry entry;
+      entry.name = p->name;
+      entry.updated = p->updated;
+      entry.lastSync = p->lastSync;
+      entries << entry;
     }
   }
-  doc.setArray( array );
-  cacheProjectsData( doc.toJson() );
+  // only changed projects are written, after a while
+  mProjectsCache.update( entries );
 }
 
-void MerginApi::continueWithUpload( const QString &projectDir, const QString &projectName, bool successfully )
+void MerginApi::migrateProjectsCache()
 {
-  Q_UNUSED( projectDir )
-
-  disconnect( this, &MerginApi::syncProjectFinished, this, &MerginApi::continueWithUpload );
-  mWaitingForUpload.remove( projectName );
-  if ( !hasAuthData() )
-  {
-    emit networkErrorOccurred( QStringLiteral( "Auth data is invalid" ), QStringLiteral( "Mergin API error: projectInfo" ) );
-  }
+  // JSON cache of older versions
+  QFile file( mDataDir + QStringLiteral( ".projectsCache.txt" ) );
+  if ( !file.open( QIODevice::ReadOnly ) )
+    return;
 
-  if ( !successfully )
+  if ( mProjectsCache.count() == 0 )
   {
-    return;
+    QList<ProjectsCache::Entry> entries;
+    for ( std::shared_ptr<MerginProject> p : parseProjectsData( file.readAll() ) )
+    {
+      ProjectsCache::Entry entry;
+      entry.name = p->name;
+      entry.updated = p->updated;
+      entry.lastSync = p->lastSync;
+      entries << entry;
+    }
+    mProjectsCache.update( entries );
   }
+  file.close();
 
-  QByteArray token = generateToken();
-  QNetworkRequest request;
-  QUrl url( mApiRoot + QStringLiteral( "/v1/project/" ) + projectName );
-
-  request.setUrl( url );
-  request.setRawHeader( "Authorization", QByteArray( "Basic " + token ) );
+  if ( mProjectsCache.flush() )
+    file.remove();
+}
 
-  QNetworkReply *reply = mManager.get( request );
-  connect( reply, &QNetworkReply::finished, this, &MerginApi::uploadInfoReplyFinished );
+void MerginApi::startDataStream( QNetworkReply *reply, const QString &projectName )
+{
+  std::shared_ptr<DataStreamState> state = std::make_shared<DataStreamState>();
+  state->projectDir = mDataDir + projectName;
+  state->stats = syncStats( projectName );
+  mDataStreams.insert( reply, state );
+
+  // Data are parsed and written to disk as they arrive, the read buffer cap makes
+  // the network stack stop reading from the socket until we consume the buffer
+  reply->setReadBufferSize( mTransferController.readBufferSize() );
+  mTransferController.track( reply );
+  connect( reply, &QNetworkReply::readyRead, this, &MerginApi::downloadProjectReplyReadyRead );
 }
 
-void MerginApi::handleDataStream( QNetworkReply *r, const QString &projectDir, bool overwrite )
+bool MerginApi::handleDataStream( QNetworkReply *r, DataStreamState &state, bool finished )
 {
-  // Read content type from reply's header
-  QByteArray contentType;
-  QString contentTypeString;
-  QList<QByteArray> headerList = r->rawHeaderList();
-  QString headString;
-  foreach ( QByteArray head, headerList )
-  {
-    headString = QString::fromLatin1( head.data(), head.size() );
-    if ( headString == QStringLiteral( "Content-Type" ) )
-    {
-      contentType = r->rawHeader( head );
-      contentTypeString = QString::fromLatin1( contentType.data(), contentType.size() );
-    }
-  }
+  SyncPhaseScope scope( state.stats.get(), SyncStats::Parsing );
+  qint64 bytesTransferred = state.bytesTransferred;
+  bool handled = parseDataStream( r, state, finished );
+  if ( state.stats )
+    state.stats->addBytesReceived( state.bytesTransferred - bytesTransferred );
+  return handled;
+}
 
-  // Read boundary hash from content types
-  QString boundary;
-  QRegularExpression re;
-  re.setPattern( QStringLiteral( "[^;]+; boundary=(?<boundary>.+)" ) );
-  QRegularExpressionMatch match = re.match( contentTypeString );
-  if ( match.hasMatch() )
+bool MerginApi::parseDataStream( QNetworkReply *r, DataStreamState &state, bool finished )
+{
+  if ( !state.encodingChecked && r->attribute( QNetworkRequest::HttpStatusCodeAttribute ).isValid() )
   {
-    boundary = match.captured( "boundary" );
+    // network stack decompresses replies by itself unless the request sets Accept-Encoding,
+    // we do it here to keep track of transferred bytes and to decompress by pieces
+    state.encodingChecked = true;
+    QByteArray encoding = r->rawHeader( "Content-Encoding" ).trimmed().toLower();
+    if ( !r->request().rawHeader( "Accept-Encoding" ).isEmpty() && ( encoding == "gzip" || encoding == "deflate" ) )
+      state.inflater.reset( new Inflater );
   }
 
-  // Depends on boundary size itself + special chars which number may vary
-  int boundarySize = boundary.length() + 8;
-  QRegularExpression boundaryPattern( QStringLiteral( "(\r\n)?--" ) + boundary + QStringLiteral( "\r\n" ) );
-  QRegularExpression headerPattern( QStringLiteral( "Content-Disposition: form-data; name=\"(?P<name>[^'\"]+)\"(; filename=\"(?P<filename>[^\"]+)\")?\r\n(Content-Type: (?P<content_type>.+))?\r\n" ) );
-  QRegularExpression endPattern( QStringLiteral( "(\r\n)?--" ) + boundary +  QStringLiteral( "--\r\n" ) );
-
-  QByteArray data;
-  QString dataString;
-  QString activeFilePath;
-  QFile activeFile;
-
-  while ( true )
+  if ( state.singleFile )
   {
-    QByteArray chunk = r->read( CHUNK_SIZE );
-    if ( chunk.isEmpty() )
+    if ( !state.statusChecked && r->attribute( QNetworkRequest::HttpStatusCodeAttribute ).isValid() )
     {
-      // End of stream - write rest of data to active file
-      if ( !activeFile.fileName().isEmpty() )
+      state.statusChecked = true;
+      int status = r->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt();
+      if ( state.resumeOffset > 0 && status == 206 )
       {
-        QRegularExpressionMatch endMatch = endPattern.match( data );
-        int tillIndex = data.indexOf( endMatch.captured( 0 ) );
-        saveFile( data.left( tillIndex ), activeFile, true );
+        // Content-Range: bytes <first>-<last>/<size>
+        QByteArray contentRange = r->rawHeader( "Content-Range" );
+        QByteArray firstByte = contentRange.mid( 6 ).split( '-' ).first().trimmed();
+        if ( !contentRange.startsWith( "bytes " ) || firstByte.toLongLong() != state.resumeOffset )
+        {
+          qDebug() << "Unexpected Content-Range of resumed download:" << contentRange;
+          return false;
+        }
+      }
+      else if ( state.resumeOffset > 0 && status == 200 )
+      {
+        // server has ignored Range header and sends the whole file
+        mDiskWriter.truncate( state.activeFile );
+        state.resumeOffset = 0;
       }
-      return;
     }
 
-    data = data.append( chunk );
-    dataString = QString::fromLatin1( data.data(), data.size() );
-    QRegularExpressionMatch boundaryMatch = boundaryPattern.match( dataString );
+    // at most read buffer size bytes are available (see TransferController::readBufferSize), file transfers
+    // are not multiplexed over HTTP/2 which would ignore it (see MerginNetworkAccessManager)
+    QByteArray data = r->readAll();
+    state.bytesTransferred += data.size();
+
+    int status = r->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt();
+    if ( status != 200 && status != 206 )
+    {
+      // body of an error reply is not content of the file
+      state.bytesReceived += data.size();
+      return true;
+    }
 
-    while ( boundaryMatch.hasMatch() )
+    if ( state.inflater )
     {
-      if ( !activeFile.fileName().isEmpty() )
+      // a reply which has been interrupted is resumed uncompressed, otherwise the stream must be complete
+      QByteArray content;
+      bool decompressed = state.inflater->inflate( data, content );
+      if ( !decompressed || ( finished && r->error() == QNetworkReply::NoError && !state.inflater->isFinished() ) )
       {
-        int tillIndex = data.indexOf( boundaryMatch.captured( 0 ) );
-        saveFile( data.left( tillIndex ), activeFile, true );
+        qDebug() << "Received corrupted compressed data";
+        return false;
       }
+      data = content;
+    }
+    state.bytesReceived += data.size();
+    return saveFile( data, state );
+  }
 
-      // delete previously written data with next boundary part
-      int tillIndex = data.indexOf( boundaryMatch.captured( 0 ) ) + boundaryMatch.captured( 0 ).length();
-      data = data.remove( 0, tillIndex );
-      dataString = QString::fromLatin1( data.data(), data.size() );
+  if ( !state.parser )
+  {
+    QByteArray boundary = MultipartParser::boundaryFromContentType( r->rawHeader( "Content-Type" ) );
+    if ( boundary.isEmpty() )
+    {
+      qDebug() << "Missing multipart boundary in reply";
+      return false;
+    }
+    state.parser.reset( new MultipartParser( boundary, DOWNLOAD_BUFFER_SIZE ) );
+  }
+  MultipartParser &parser = *state.parser;
 
-      QRegularExpressionMatch headerMatch = headerPattern.match( dataString );
-      if ( !headerMatch.hasMatch() )
-      {
-        qDebug() << "Received corrupted header";
-        data = data + r->read( CHUNK_SIZE );
-        dataString = QString::fromLatin1( data.data(), data.size() );
-      }
-      headerMatch = headerPattern.match( dataString );
-      data = data.remove( 0, headerMatch.captured( 0 ).length() );
-      dataString = QString::fromLatin1( data.data(), data.size() );
-      QString filename = headerMatch.captured( QStringLiteral( "filename" ) );
-
-      activeFilePath = projectDir + '/' + filename;
-      activeFile.setFileName( activeFilePath );
-      if ( activeFile.exists() )
-      {
-        if ( overwrite )
+  while ( true )
+  {
+    switch ( parser.next() )
+    {
+      case MultipartParser::NeedMoreData:
+        if ( state.inflater && state.inflater->hasPendingData() )
+        {
+          // decompress directly to parser's buffer
+          int size = state.inflater->inflate( parser.writeBuffer(), parser.writeCapacity() );
+          if ( size < 0 )
+          {
+            qDebug() << "Received corrupted compressed data";
+            return false;
+          }
+          parser.commitWrite( size );
+          state.bytesReceived += size;
+        }
+        else if ( r->bytesAvailable() > 0 && state.inflater )
+        {
+          QByteArray data = r->read( DOWNLOAD_BUFFER_SIZE );
+          state.bytesTransferred += data.size();
+          state.inflater->addInput( data );
+        }
+        else if ( r->bytesAvailable() > 0 )
+        {
+          // read from reply directly to parser's buffer
+          qint64 size = r->read( parser.writeBuffer(), parser.writeCapacity() );
+          if ( size < 0 )
+            return false;
+          parser.commitWrite( static_cast<int>( size ) );
+          state.bytesReceived += size;
+          state.bytesTransferred += size;
+        }
+        else if ( finished )
         {
-          // Remove file if want to override
-          activeFile.remove();
+          if ( state.inflater && !state.inflater->isFinished() )
+          {
+            qDebug() << "Compressed data stream is truncated";
+            return false;
+          }
+          parser.finish();
         }
         else
         {
-          int i = 0;
-          QString newPath =  activeFilePath + QStringLiteral( "_conflict_copy" );
-          while ( QFile::exists( newPath + QString::number( i ) ) )
-            ++i;
-          if ( !QFile::copy( activeFilePath, newPath + QString::number( i ) ) )
+          return true;
+        }
+        break;
+
+      case MultipartParser::PartBegin:
+        if ( !parser.filename().isEmpty() )
+        {
+          QString stagedFilePath = stagingDir( state.projectDir ) + parser.filename();
+          qint64 expectedSize = -1;
+          for ( const MerginFile &file : state.requestedFiles )
           {
-            qDebug() << activeFilePath << " will be overwritten";
+            if ( file.path == parser.filename() )
+              expectedSize = file.size;
           }
-          activeFile.remove();
+          createPathIfNotExists( stagedFilePath );
+          openStreamFile( state, stagedFilePath, false, expectedSize );
+          state.receivedFiles << parser.filename();
         }
-      }
-      else
+        break;
+
+      case MultipartParser::PartData:
+        if ( !state.activeFile.isEmpty() )
+        {
+          // buffer of the parser is reused, the queued data must be a copy
+          if ( !saveFile( QByteArray( parser.data(), parser.dataSize() ), state ) )
+            return false;
+        }
+        break;
+
+      case MultipartParser::PartEnd:
+        if ( !state.activeFile.isEmpty() )
+        {
+          // the file is synced in the writer thread while the next parts are parsed
+          mDiskWriter.close( state.activeFile );
+          state.activeFile.clear();
+        }
+        break;
+
+      case MultipartParser::Finished:
+        return true;
+
+      case MultipartParser::Error:
+        qDebug() << "Received corrupted data stream:" << parser.errorString();
+        return false;
+    }
+  }
+}
+
+void MerginApi::moveStagedFiles( const QString &projectDir, const QStringList &stagedFiles, bool overwrite )
+{
+  QString staging = stagingDir( projectDir );
+  for ( const QString &filename : stagedFiles )
+  {
+    QString activeFilePath = projectDir + '/' + filename;
+    if ( QFile::exists( activeFilePath ) )
+    {
+      if ( !overwrite )
       {
-        createPathIfNotExists( activeFilePath );
+        int i = 0;
+        QString newPath =  activeFilePath + QStringLiteral( "_conflict_copy" );
+        while ( QFile::exists( newPath + QString::number( i ) ) )
+          ++i;
+        if ( !QFile::rename( activeFilePath, newPath + QString::number( i ) ) )
+        {
+          qDebug() << activeFilePath << " will be overwritten";
+        }
       }
-
-      boundaryMatch = boundaryPattern.match( dataString );
+      // Remove file if want to override
+      QFile::remove( activeFilePath );
+    }
+    else
+    {
+      createPathIfNotExists( activeFilePath );
     }
 
-    // Write rest of chunk to file
-    if ( !activeFile.fileName().isEmpty() )
+    if ( !QFile::rename( staging + filename, activeFilePath ) )
     {
-      saveFile( data.left( data.size() - boundarySize ), activeFile, false );
+      qDebug() << "Moving of downloaded file failed:" << activeFilePath;
     }
-    data = data.remove( 0, data.size() - boundarySize );
   }
 }
 
-bool MerginApi::saveFile( const QByteArray &data, QFile &file, bool closeFile )
+qint64 MerginApi::resumableSize( const QString &stagedFilePath, const MerginFile &file, bool &complete )
+{
+  complete = false;
+  QFile stateFile( stagedFilePath + PARTIAL_FILE_STATE_SUFFIX );
+  QFileInfo stagedFileInfo( stagedFilePath );
+  if ( !stagedFileInfo.exists() || !stateFile.open( QIODevice::ReadOnly ) )
+    return 0;
+
+  QJsonObject partialState = QJsonDocument::fromJson( stateFile.readAll() ).object();
+  if ( file.checksum.isEmpty() || partialState.value( QStringLiteral( "checksum" ) ).toString() != file.checksum )
+  {
+    // server version of the file has changed since
+    return 0;
+  }
+
+  complete = partialState.value( QStringLiteral( "complete" ) ).toBool() && stagedFileInfo.size() == file.size;
+  // size of the file is used rather than "received", data written before a crash are on disk
+  return stagedFileInfo.size() < file.size || complete ? stagedFileInfo.size() : 0;
+}
+
+void MerginApi::writePartialFileState( const QString &stagedFilePath, const MerginFile &file, bool complete )
+{
+  QJsonObject partialState;
+  partialState.insert( QStringLiteral( "checksum" ), file.checksum );
+  partialState.insert( QStringLiteral( "size" ), file.size );
+  partialState.insert( QStringLiteral( "received" ), QFileInfo( stagedFilePath ).size() );
+  partialState.insert( QStringLiteral( "complete" ), complete );
+
+  QFile stateFile( stagedFilePath + PARTIAL_FILE_STATE_SUFFIX );
+  if ( stateFile.open( QIODevice::WriteOnly ) )
+  {
+    stateFile.write( QJsonDocument( partialState ).toJson( QJsonDocument::Compact ) );
+    stateFile.close();
+  }
+}
+
+void MerginApi::removeStagedFiles( const QString &projectDir, bool keepPartialFiles )
 {
-  if ( !file.isOpen() )
+  QString staging = stagingDir( projectDir );
+  if ( !keepPartialFiles )
+  {
+    QDir( staging ).removeRecursively();
+    return;
+  }
+
+  // remove all files except those with a partial file state
+  QDirIterator it( staging, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories );
+  while ( it.hasNext() )
   {
-    if ( !file.open( QIODevice::Append ) )
+    QString path = it.next();
+    bool isStateFile = path.endsWith( PARTIAL_FILE_STATE_SUFFIX );
+    QString pairedPath = isStateFile ? path.left( path.length() - PARTIAL_FILE_STATE_SUFFIX.length() ) : path + PARTIAL_FILE_STATE_SUFFIX;
+    if ( !QFile::exists( pairedPath ) )
     {
-      return false;
+      QFile::remove( path );
     }
   }
+}
 
-  file.write( data );
-  if ( closeFile )
-    file.close();
+bool MerginApi::isRetryableError( QNetworkReply::NetworkError error )
+{
+  switch ( error )
+  {
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::NetworkSessionFailedError:
+    case QNetworkReply::UnknownNetworkError:
+    case QNetworkReply::InternalServerError:
+    case QNetworkReply::ServiceUnavailableError:
+      return true;
+    default:
+      return false;
+  }
+}
 
-  return true;
+QString MerginApi::stagingDir( const QString &projectDir ) const
+{
+  return projectDir + '/' + metadataDir() + QStringLiteral( "/download/" );
+}
+
+void MerginApi::openStreamFile( DataStreamState &state, const QString &filePath, bool append, qint64 expectedSize )
+{
+  mDiskWriter.open( filePath, append, expectedSize );
+  state.activeFile = filePath;
+  state.writtenFiles << filePath;
+}
+
+bool MerginApi::saveFile( const QByteArray &data, DataStreamState &state )
+{
+  // the data are only queued unless the queue is full
+  SyncPhaseScope scope( state.stats.get(), SyncStats::DiskWrite );
+  if ( state.stats )
+    state.stats->addBytesWritten( data.size() );
+
+  return mDiskWriter.write( state.activeFile, data );
+}
+
+void MerginApi::finishWrites( DataStreamState &state, std::function<void( bool written )> finished )
+{
+  mDiskWriter.finish( state.writtenFiles, this, finished );
+  state.writtenFiles.clear();
 }
 
 void MerginApi::createPathIfNotExists( const QString &filePath )
@@ -1047,49 +3339,22 @@ ProjectStatus MerginApi::getProjectStatus( const QDateTime &localUpdated, const
 
 QDateTime MerginApi::getLastModifiedFileDateTime( const QString &path )
 {
-  QDateTime lastModified = QFileInfo( path ).lastModified();
-  QDirIterator it( path, QStringList() << QStringLiteral( "*" ), QDir::Files, QDirIterator::Subdirectories );
-  while ( it.hasNext() )
-  {
-    it.next();
-    if ( !mIgnoreFiles.contains( it.fileInfo().suffix() ) )
-    {
-      if ( it.fileInfo().lastModified() > lastModified )
-      {
-        lastModified = it.fileInfo().lastModified();
-      }
-    }
-  }
-  return lastModified;
+  return mChangeJournal.lastModified( path );
 }
 
 QByteArray MerginApi::getChecksum( const QString &filePath )
 {
-  QFile f( filePath );
-  if ( f.open( QFile::ReadOnly ) )
-  {
-    QCryptographicHash hash( QCryptographicHash::Sha1 );
-    QByteArray chunk = f.read( CHUNK_SIZE );
-    while ( !chunk.isEmpty() )
-    {
-      hash.addData( chunk );
-      chunk = f.read( CHUNK_SIZE );
-    }
-    f.close();
-    return hash.result().toHex();
-  }
-
-  return QByteArray();
+  return ChecksumCache::fileChecksum( filePath );
 }
 
-QSet<QString> MerginApi::listFiles( const QString &path )
+QSet<QString> MerginApi::listFiles( const QString &path, const QSet<QString> &ignoredSuffixes )
 {
   QSet<QString> files;
   QDirIterator it( path, QStringList() << QStringLiteral( "*" ), QDir::Files, QDirIterator::Subdirectories );
   while ( it.hasNext() )
   {
     it.next();
-    if ( !mIgnoreFiles.contains( it.fileInfo().suffix() ) )
+    if ( !ignoredSuffixes.contains( it.fileInfo().suffix() ) )
     {
       files << it.filePath().replace( path, "" );
     }
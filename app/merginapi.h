@@ -3,9 +3,26 @@
 
 #include <QObject>
 #include <QNetworkAccessManager>
+#include <QNetworkReply>
 #include <QEventLoop>
 #include <memory>
+#include <functional>
 #include <QFile>
+#include <QElapsedTimer>
+#include <QJsonObject>
+
+#include "multipartparser.h"
+#include "filehasher.h"
+#include "compression.h"
+#include "syncscheduler.h"
+#include "responsecache.h"
+#include "changejournal.h"
+#include "projectscache.h"
+#include "transfercontroller.h"
+#include "blobstore.h"
+#include "syncstats.h"
+#include "diskwriter.h"
+#include "syncfilters.h"
 
 enum ProjectStatus
 {
@@ -35,11 +52,116 @@ struct MerginFile
   QString path;
   QString checksum;
   qint64 size;
+  // GeoPackage changeset transferred instead of the whole file (see GeoPackageDiff), it applies to the server
+  // version with diffBase checksum. Path of a downloaded changeset is given by the server, an uploaded one is local.
+  // Changesets are used only with a server which has announced it handles them (see MerginApi::ServerCapability).
+  QString diffPath;
+  QString diffChecksum;
+  qint64 diffSize = 0;
+  QString diffBase;
 };
 
+/**
+ * State of a multipart download which is parsed incrementally as the data arrive.
+ * Received files are written to a staging folder first and moved to the project
+ * folder only when the whole reply has been received successfully.
+ */
+struct DataStreamState
+{
+  QString projectDir;
+  QList<MerginFile> requestedFiles;
+  bool singleFile = false; // reply content is a single file written to activeFile, not a multipart stream
+  qint64 resumeOffset = 0; // size of a partial single file requested with Range header
+  QString deltaBasePath; // single file is received as a delta against this local file, see BlockDelta
+  bool statusChecked = false;
+  bool encodingChecked = false;
+  std::unique_ptr<Inflater> inflater; // set when the reply content is compressed
+  bool throttled = false; // reading is postponed to keep the bandwidth limit
+  std::unique_ptr<MultipartParser> parser; // created when the first data arrive
+  QString activeFile; // path of the staged file being written, a single file keeps it when the stream ends
+  QStringList writtenFiles; // files opened in MerginApi::mDiskWriter, completion of their writes is reported by finishWrites()
+  QStringList receivedFiles; // relative paths of files in the staging folder
+  qint64 bytesReceived = 0; // decompressed content
+  qint64 bytesTransferred = 0; // content as it has been received, possibly compressed
+  std::shared_ptr<SyncStats> stats; // of the sync job the stream belongs to, may be null
+};
+
+/**
+ * Download of project files split to several requests which run in parallel (see downloadProjectFilesParallel).
+ * Large files are downloaded one per request, small files are fetched in batches.
+ */
+struct DownloadTask
+{
+  QString projectDir;
+  QList<QList<MerginFile>> batches; // batches waiting for a request
+  int runningRequests = 0;
+  QString errorMessage; // set when any of requests has failed
+  QHash<QString, int> retries; // path of the first file of a batch -> number of retried requests
+  QStringList receivedFiles; // relative paths of files in the staging folder
+  QSet<QString> wholeFiles; // files downloaded whole after their delta transfer has failed
+  qint64 bytesReceived = 0;
+  qint64 bytesTransferred = 0; // received bytes before decompression
+  qint64 bytesTotal = 0;
+  QElapsedTimer timer;
+  qint64 lastProgressReport = 0; // msecs since start
+};
+
+//! Part of a file sent in one request of a chunked upload
+struct UploadChunk
+{
+  QString id;
+  QString path;
+  qint64 offset = 0;
+  qint64 size = 0;
+};
+
+/**
+ * Upload of project changes as a push transaction: the changes with ids of file chunks are sent first,
+ * then the chunks (several in parallel), each acknowledged by the server, and finally the transaction is finished.
+ * The transaction is stored in the project's metadata folder, so an interrupted upload continues from acknowledged chunks.
+ */
+struct UploadTask
+{
+  QString projectDir;
+  QJsonObject changes; // added/updated files contain ids of their chunks
+  QString transactionId;
+  QList<UploadChunk> chunks; // chunks waiting for a request
+  QSet<QString> uploadedChunks; // ids of chunks acknowledged by the server
+  int runningRequests = 0;
+  bool finishing = false; // all chunks have been uploaded and the transaction is being finished
+  bool transactionLost = false; // server does not know the transaction anymore, it cannot be resumed
+  QString errorMessage; // set when any of requests has failed
+  QHash<QString, int> retries; // chunk id -> number of retried requests
+  bool compress = false; // server accepts request bodies with deflate content coding
+  QSet<QString> incompressibleFiles; // chunks of these files are sent uncompressed
+  qint64 bytesSent = 0;
+  qint64 bytesTransferred = 0; // sent bytes after compression
+  qint64 bytesTotal = 0;
+  QElapsedTimer timer;
+  qint64 lastProgressReport = 0; // msecs since start
+};
 
 typedef QList<std::shared_ptr<MerginProject>> ProjectList;
 
+/**
+ * Network access manager which allows HTTP/2 for HTTPS API requests (listing, project info, push start and finish),
+ * so they are multiplexed over one connection to the server instead of each opening a connection with its own
+ * TLS handshake. Servers without HTTP/2 support are used over HTTP/1.1 as before.
+ *
+ * Requests transferring file content are marked by FileTransferAttribute and stay on HTTP/1.1: HTTP/2 of Qt 5
+ * ignores QNetworkReply::setReadBufferSize(), so the bandwidth limit of TransferController and the pause
+ * of reading while DiskWriter is full would not hold back the socket, and received data would pile up in memory.
+ */
+class MerginNetworkAccessManager: public QNetworkAccessManager
+{
+  public:
+    //! Marks a request transferring file content, it is not sent over HTTP/2
+    static const QNetworkRequest::Attribute FileTransferAttribute = QNetworkRequest::User;
+
+  protected:
+    QNetworkReply *createRequest( Operation op, const QNetworkRequest &request, QIODevice *outgoingData = nullptr ) override;
+};
+
 class MerginApi: public QObject
 {
     Q_OBJECT
@@ -51,16 +173,20 @@ class MerginApi: public QObject
 
     /**
      * Sends non-blocking GET request to the server to listProjects. On listProjectsReplyFinished,
-     * when a response is received, parses project json, writes it to a cache text file and sets mMerginProjects.
+     * when a response is received, parses project json, sets mMerginProjects and stores local state of downloaded projects to ProjectsCache.
      * Eventually emits listProjectsFinished on which ProjectPanel (qml component) updates content.
+     * If the listing has been received before, listProjectsFinished is emitted with it right away and the request
+     * is conditional (ETag/If-Modified-Since), the server replies without a body and nothing is parsed if it has not changed.
      * If listing has been successful, updates cached merginProjects list.
      * @param withFilter If true, applies "input" tag in request.
      */
     Q_INVOKABLE void listProjects( const QString &filterTag = QStringLiteral( "input_use" ) );
 
     /**
-     * Sends non-blocking GET request to the server to download a project with a given name. On downloadProjectReplyFinished,
-     * when a response is received, parses data-stream and creates files. Eventually emits syncProjectFinished on which
+     * Sends non-blocking GET request to the server to download a project with a given name. Data-stream is parsed
+     * on downloadProjectReplyReadyRead as it arrives and files are written to a staging folder, so memory usage does not
+     * depend on project size. Files of at least MAX_DOWNLOAD_BATCH_SIZE and files left partial by an interrupted download are requested
+     * one by one instead, so they can be resumed. On downloadProjectReplyFinished, files are moved to the project folder. Eventually emits syncProjectFinished on which
      * MerginProjectModel updates status of the project item. On syncProjectFinished, ProjectModel adds the project item to the project list.
      * If download has been successful, updates cached merginProjects list.
      * Emits also notify signal with a message for the GUI.
@@ -71,7 +197,10 @@ class MerginApi: public QObject
     /**
      * Sends non-blocking POST request to the server to update a project with a given name. On downloadProjectReplyFinished,
      * when a response is received, parses data-stream to files and rewrites local files with them. Extra files which don't match server
-     * files are removed. Eventually emits syncProjectFinished on which MerginProjectModel updates status of the project item.
+     * files are removed. Changed files are downloaded in batches, large and partially downloaded files by resumable requests of their own,
+     * if syncConcurrency is greater than 1 by parallel requests. downloadProgress reports aggregated throughput. Then only changed blocks of large files present locally are transferred if the server
+     * announces it (see BlockDelta), and replies are requested compressed and decompressed as they arrive (see Compression). Local files are compared by checksums computed in a thread pool
+     * (see hashingProgress). Eventually emits syncProjectFinished on which MerginProjectModel updates status of the project item.
      * If update has been successful, updates cached merginProjects list.
      * Emits also notify signal with a message for the GUI.
      * @param projectName Name of project to update.
@@ -80,13 +209,47 @@ class MerginApi: public QObject
 
     /**
      * Sends non-blocking POST request to the server to upload changes in a project with a given name.
-     * Firstly updateProject is triggered to fetch new changes. If it was successful, sends update post request with list of local changes
-     * and modified/newly added files in JSON. Eventually emits syncProjectFinished on which MerginProjectModel updates status of the project item.
+     * Firstly updateProject is triggered to fetch new changes. If it was successful, starts a push transaction with list of local changes
+     * in JSON and uploads modified/newly added files in chunks of UPLOAD_CHUNK_SIZE, up to syncConcurrency requests in parallel.
+     * If the upload is interrupted, the next upload of the same changes sends only chunks which have not been acknowledged yet.
+     * Chunks are compressed if the server accepts it, except chunks of files which are compressed already.
+     * A server which does not announce push transactions (see PushCapability) receives all files in one data_sync request.
+     * Eventually emits syncProjectFinished on which MerginProjectModel updates status of the project item.
      * Emits also notify signal with a message for the GUI.
      * @param projectName Name of project to upload.
      */
     Q_INVOKABLE void uploadProject( const QString &projectName );
 
+    /**
+     * Queues a sync job of a project (see SyncScheduler), downloadProject, updateProject and uploadProject
+     * queue interactive jobs. Several projects are synced at once, up to SyncScheduler::maxRunningJobs,
+     * but a project has only one job. Returns nullptr if the job of the project is running already or there is no auth data,
+     * downloadProject, updateProject and uploadProject emit syncProjectFinished as unsuccessful then.
+     */
+    std::shared_ptr<SyncJob> scheduleSync( const QString &projectName, SyncJob::Type type, SyncJob::Priority priority );
+
+    /**
+     * Cancels sync of a project. A queued job is removed, requests of a running job are aborted. In both cases
+     * syncProjectFinished is emitted as unsuccessful, partial files and uploaded chunks are kept for the next sync.
+     */
+    Q_INVOKABLE void cancelSync( const QString &projectName );
+
+    /**
+     * Syncs projects as one batch: a local project with changes is uploaded, other ones are updated and projects
+     * which have not been downloaded yet are downloaded. Jobs are queued with background priority and run concurrently
+     * up to SyncScheduler::maxRunningJobs. Their metadata requests (listing, project info, push start and finish) share
+     * one HTTP/2 connection if the server supports it, file transfers stay on HTTP/1.1 (see MerginNetworkAccessManager).
+     * Progress of each project is reported by SyncScheduler::jobProgress, overall progress by batchSyncProgress.
+     * Projects added while a batch is running join it. Emits batchSyncFinished when jobs of all projects have ended.
+     */
+    Q_INVOKABLE void syncProjects( const QStringList &projectNames );
+
+    //! Queue of sync jobs, provides state and progress of each of them
+    SyncScheduler *syncScheduler();
+
+    //! Adapts number of parallel requests to the network, enforces bandwidth limit and provides transfer rates
+    TransferController *transferController();
+
     /**
     * Currently no auth service is used, only "username:password" is encoded and asign to mToken.
     * @param username
@@ -108,9 +271,67 @@ class MerginApi: public QObject
     QString apiRoot() const;
     void setApiRoot( const QString &apiRoot );
 
+    /**
+     * Max number of parallel requests used to download files of a project. If it is 1 (default), requests run one
+     * at a time and a new project of small files is downloaded by a single request. Also max number of chunks uploaded
+     * in parallel. The number of requests actually used is adapted to the network by TransferController up to this limit,
+     * so it is not adapted at the default.
+     */
+    int syncConcurrency() const;
+    void setSyncConcurrency( int syncConcurrency );
+
+    //! File to which telemetry of each finished sync is appended as a JSON line, empty path disables the log
+    void setSyncLogFile( const QString &syncLogFile );
+
+    /**
+     * Patterns of files synced in a project (see SyncFilters), empty if all files are synced. Excluded files
+     * are not downloaded, local ones are not uploaded, and none of them is removed on either side.
+     */
+    Q_INVOKABLE QStringList syncFilter( const QString &projectName ) const;
+    //! Sets patterns of files synced in a project, they apply from the next sync
+    Q_INVOKABLE void setSyncFilter( const QString &projectName, const QStringList &patterns );
+
+    /**
+     * Compares local files of a project with the manifest of its last sync (see SyncManifest) without any request,
+     * only files changed since they were hashed are read. The callback gets added, updated and removed files
+     * like the change list of an upload. Returns false, and the callback is not called, if the project has
+     * no manifest or its sync is running.
+     */
+    bool localChanges( const QString &projectName, std::function<void( const QHash<QString, QList<MerginFile>> & )> callback );
+
+    /**
+     * Sets the status of a listed project by content of its files instead of their modification times: a project whose
+     * files have been saved without changes is not modified (see localChanges). Emits merginProjectsChanged when done
+     * if the status has changed.
+     */
+    Q_INVOKABLE void refreshProjectStatus( const QString &projectName );
+
+    /**
+     * Reads a list of projects (of the server if dataFromServer, of the local cache otherwise) by JsonReader
+     * and passes each project to the callback as soon as it has been read. Returns false if data are malformed.
+     */
+    static bool readProjects( const QByteArray &data, bool dataFromServer, std::function<void( const MerginProject & )> callback );
+
+    /**
+     * Reads files of project info by JsonReader and passes each file to the callback as soon as it has been read,
+     * a changeset of a GeoPackage offered by the server is read to its diff fields. Version of the project and its time
+     * are read too if requested. Returns false if data are malformed.
+     */
+    static bool readProjectFiles( const QByteArray &data, std::function<void( const MerginFile & )> callback,
+                                  QString *projectVersion = nullptr, QDateTime *updated = nullptr );
+
   signals:
     void listProjectsFinished( const ProjectList &merginProjects );
     void syncProjectFinished( const QString &projectDir, const QString &projectName, bool successfully = true );
+    void downloadProgress( const QString &projectName, qint64 bytesReceived, qint64 bytesTotal, double bytesPerSecond );
+    void uploadProgress( const QString &projectName, qint64 bytesSent, qint64 bytesTotal, double bytesPerSecond );
+    void hashingProgress( const QString &projectName, int filesHashed, int filesTotal );
+    //! Bytes transferred by all jobs of a batch sync and numbers of its ended and all jobs, see syncProjects
+    void batchSyncProgress( qint64 bytesDone, qint64 bytesTotal, int projectsFinished, int projectsTotal );
+    //! All jobs of a batch sync have ended, failedProjects have failed or have been cancelled
+    void batchSyncFinished( const QStringList &failedProjects );
+    //! Telemetry of a finished sync job, see SyncStats::toJson
+    void syncStatsRecorded( const QString &projectName, const QJsonObject &stats );
     void reloadProject( const QString &projectDir );
     void networkErrorOccurred( const QString &message, const QString &additionalInfo );
     void notify( const QString &message );
@@ -127,12 +348,18 @@ class MerginApi: public QObject
 
   private slots:
     void listProjectsReplyFinished();
+    void downloadProjectReplyReadyRead();
     void downloadProjectReplyFinished(); // download + update
-    void uploadProjectReplyFinished();
+    void downloadBatchReplyFinished(); // parallel update
+    void pushStartReplyFinished(); // upload
+    void pushChunkReplyFinished(); // upload
+    void pushFinishReplyFinished(); // upload
+    void dataSyncReplyFinished(); // upload to a server without push transactions
     void updateInfoReplyFinished();
     void uploadInfoReplyFinished();
     void cacheProjects();
-    void continueWithUpload( const QString &projectDir, const QString &projectName, bool successfully = true );
+    void startSyncJob( const QString &projectName );
+    void updateBatchSync();
     void setUpdateToProject( const QString &projectDir, const QString &projectName, bool successfully );
     void saveAuthData();
     void createProjectFinished();
@@ -142,36 +369,218 @@ class MerginApi: public QObject
 
   private:
     ProjectList parseProjectsData( const QByteArray &data, bool dataFromServer = false );
-    bool cacheProjectsData( const QByteArray &data );
-    void handleDataStream( QNetworkReply *r, const QString &projectDir, bool overwrite );
-    bool saveFile( const QByteArray &data, QFile &file, bool closeFile );
+    //! Moves local state of projects from the JSON cache file of older versions to ProjectsCache
+    void migrateProjectsCache();
+    void startDataStream( QNetworkReply *reply, const QString &projectName );
+    //! Handles data available in a download reply unless reading is postponed by the bandwidth limit
+    void readDownloadData( QNetworkReply *r );
+    //! Parses received data of a stream, bytes received and time spent are added to stats of the sync
+    bool handleDataStream( QNetworkReply *r, DataStreamState &state, bool finished );
+    bool parseDataStream( QNetworkReply *r, DataStreamState &state, bool finished );
+    qint64 resumableSize( const QString &stagedFilePath, const MerginFile &file, bool &complete );
+    void writePartialFileState( const QString &stagedFilePath, const MerginFile &file, bool complete );
+    void removeStagedFiles( const QString &projectDir, bool keepPartialFiles );
+    static bool isRetryableError( QNetworkReply::NetworkError error );
+    void moveStagedFiles( const QString &projectDir, const QStringList &stagedFiles, bool overwrite );
+    QString stagingDir( const QString &projectDir ) const;
+    //! Opens a staged file of a stream in mDiskWriter, blocks are reserved for the expected size if known
+    void openStreamFile( DataStreamState &state, const QString &filePath, bool append, qint64 expectedSize );
+    //! Queues data to be written to the active file of a stream, bytes written are added to stats of the sync
+    bool saveFile( const QByteArray &data, DataStreamState &state );
+    /**
+     * Calls finished once received files of a stream have been written and closed, with false if any write has failed.
+     * The GUI thread does not wait for the storage, finished is called from the event loop (see DiskWriter::finish()).
+     */
+    void finishWrites( DataStreamState &state, std::function<void( bool written )> finished );
     void createPathIfNotExists( const QString &filePath );
     ProjectStatus getProjectStatus( const QDateTime &localUpdated, const QDateTime &updated, const QDateTime &lastSync, const QDateTime &lastMod );
     QDateTime getLastModifiedFileDateTime( const QString &path );
     QByteArray getChecksum( const QString &filePath );
-    QSet<QString> listFiles( const QString &projectPath );
-    void downloadProjectFiles( const QString &projectName, const QByteArray &json );
-    void uploadProjectFiles( const QString &projectName, const QByteArray &json, const QList<MerginFile> &files );
-    QHash<QString, QList<MerginFile>> parseAndCompareProjectFiles( QNetworkReply *r, bool isForUpdate );
+    //! Lists files of a project dir recursively by paths relative to it, called from a worker thread of FileHasher
+    static QSet<QString> listFiles( const QString &projectPath, const QSet<QString> &ignoredSuffixes );
+    //! Downloads files by a task of batches, up to syncConcurrency requests run in parallel
+    void downloadProjectFiles( const QString &projectName, const QList<MerginFile> &files );
+    /**
+     * Whether a file is downloaded by a request of its own instead of in a batch of files: it is not smaller
+     * than the batch size limit, it has been partially downloaded or a block delta of it may be requested. Such requests
+     * are resumed with Range requests.
+     */
+    bool isRequestedAlone( const QString &projectDir, const MerginFile &file, qint64 batchSizeLimit );
+    void startDownloadRequests( const QString &projectName );
+
+    /**
+     * Downloads only changed blocks of a file which exists locally: signature of the local file is computed
+     * in a thread, the server replies with a delta and the file is rebuilt in the staging folder.
+     * Used only with a server announcing BlockDeltaCapability, a not found reply turns the capability off for the API root.
+     */
+    void startDeltaDownload( const QString &projectName, std::shared_ptr<DownloadTask> task, const MerginFile &file );
+    bool finishDeltaDownload( DownloadTask &task, DataStreamState &state, bool received );
+    void reportDownloadProgress( const QString &projectName, DownloadTask &task, bool force );
+    void finishDownload( const QString &projectName, const QStringList &stagedFiles, const QString &errorMessage );
+    //! Moves downloaded files from the staging folder to the project, updates bases of GeoPackages and finishes the sync job
+    void moveDownloadedFiles( const QString &projectName, const QStringList &files, const QStringList &mergedFiles,
+                              const QHash<QString, QString> &patchedFiles, const QList<MerginFile> &fetchedFiles, bool waitingForUpload );
+    void uploadProjectFiles( const QString &projectName, const QJsonObject &changes, const QList<MerginFile> &files );
+    //! Uploads whole files of the task in one multipart data_sync request, used with a server without PushCapability
+    void uploadProjectData( const QString &projectName, std::shared_ptr<UploadTask> task );
+    void startUploadRequests( const QString &projectName );
+    void reportUploadProgress( const QString &projectName, UploadTask &task, bool force );
+    void finishUpload( const QString &projectName, const QString &errorMessage );
+    //! Compresses body of a request with deflate content coding unless it is small or incompressible, returns true if compressed
+    bool compressRequestBody( QNetworkRequest &request, QByteArray &body );
+    void saveUploadState( const UploadTask &task );
+    void cancelPushTransaction( const QString &transactionId );
+    QString uploadStateFile( const QString &projectDir ) const;
+
+    //! Optional features a server announces in project info replies, by X-Mergin-Capabilities header unless noted otherwise
+    enum ServerCapability
+    {
+      GeoDiffCapability = 0x01, // "geodiff": changesets of GeoPackages are accepted in pushes and offered in project info
+      BlockDeltaCapability = 0x02, // "block-delta": delta endpoint sends changed files as BlockDelta against a signature
+      DeflateRequestsCapability = 0x04, // deflate listed in Accept-Encoding header: compressed request bodies are accepted (RFC 7694)
+      PushCapability = 0x08, // "push": uploads are resumable transactions of chunks (push, push/chunk, push/finish), data_sync otherwise
+    };
+    /**
+     * Records features announced by the server of the API root, a not modified reply without a header keeps the features it announces.
+     * Features the server has failed to provide although announced (see removeServerCapability()) stay off.
+     */
+    void updateServerCapabilities( QNetworkReply *r );
+    bool hasServerCapability( ServerCapability capability ) const;
+    //! Turns off a feature the server of the API root does not provide, e.g. its endpoint is not found
+    void removeServerCapability( ServerCapability capability );
+
+    /**
+     * Copy of a GeoPackage as it was last synchronized is kept in the metadata folder together with its checksum
+     * and checksum of the server version. They differ when changes have been transferred as a changeset, because
+     * applying a changeset does not produce the same file. The copy is the base of changesets of local changes.
+     */
+    QString baseFile( const QString &projectDir, const QString &path ) const;
+    bool readBaseState( const QString &projectDir, const QString &path, QString &localChecksum, QString &serverChecksum ) const;
+    //! Saves the current local file (or sourcePath if given) as the base, empty serverChecksum means the server has the same file
+    void updateBaseFile( const QString &projectDir, const QString &path, const QString &serverChecksum, const QString &sourcePath = QString() );
+    void removeBaseFile( const QString &projectDir, const QString &path );
+    //! Relative path of a changeset of local changes of a GeoPackage
+    QString changesetFile( const QString &path, const QString &checksum ) const;
+    //! Applies downloaded changesets to copies of project files in the staging folder, patchedFiles maps their paths to server checksums
+    bool applyDownloadedChangesets( const QString &projectName, QStringList &stagedFiles, QHash<QString, QString> &patchedFiles, QString &errorMessage );
+    void updateUploadedBaseFiles( const UploadTask &task, const QByteArray &projectInfo );
+    /**
+     * Merges local changes of GeoPackages into their staged server versions (see GeoPackageDiff::merge) before an upload,
+     * so they are not moved aside as conflict copies. Merges run in the thread pool of mFileHasher, finished gets
+     * the merged files of stagedFiles. Their base is the server version and rows edited on both sides are listed
+     * in a conflict report next to the file. A file changed locally while it has been merged is not in mergedFiles,
+     * it is kept as a conflict copy like a file which cannot be merged.
+     */
+    void mergeGeoPackages( const QString &projectDir, const QStringList &stagedFiles, std::function<void( const QStringList &mergedFiles )> finished );
+    QHash<QString, QList<MerginFile>> parseAndCompareProjectFiles( const QString &projectName, const QByteArray &data, bool isForUpdate,
+        const QHash<QString, QByteArray> &localChecksums );
+
+    /**
+     * Computes checksums of local files of a project (path relative to the project dir -> hex SHA-1) by FileHasher
+     * and calls callback with them. Checksums of files which have not changed since the last sync are taken from ChecksumCache.
+     * Once the cache is complete, only files recorded by ChangeJournal are checked. Files are listed and compared with the cache
+     * in the thread pool of FileHasher too, the GUI thread does not access the disk.
+     */
+    void calculateChecksums( const QString &projectName, std::function<void( const QHash<QString, QByteArray> & )> callback );
+    void fetchChangedFiles( const QString &projectName, const QHash<QString, QList<MerginFile>> &files );
+    //! Clones a file present in BlobStore to the staging folder instead of downloading it, returns false if the content is not available
+    bool linkStoredFile( const QString &projectName, const MerginFile &file );
+    void uploadChangedFiles( const QString &projectName, const QHash<QString, QList<MerginFile>> &files );
+    //! Compares local files with project info and downloads changed files, the manifest is saved from the project info when done
+    void updateFromProjectInfo( const QString &projectName, const QByteArray &projectInfo );
+    //! Compares local files with project info or a manifest and uploads local changes
+    void uploadToProjectInfo( const QString &projectName, const QByteArray &projectInfo );
+    //! Replaces SyncManifest of a project by files and version of project info, a manifest which cannot be updated is removed
+    void saveSyncManifest( const QString &projectName, const QByteArray &projectInfo );
+    void reportProjectInfoError( QNetworkReply *r );
     ProjectList updateMerginProjectList( const ProjectList &serverProjects );
+    //! Refreshes statuses of projects as refreshProjectStatus() does, merginProjectsChanged is emitted once when all are done
+    void refreshProjectStatuses( const QStringList &projectNames );
+    //! Sets mMerginProjects to the cached listing of a URL, parsing it only if it is not the current one. Returns false if there is none.
+    bool loadCachedProjectList( const QString &url );
     void deleteObsoleteFiles( const QString &projectName );
+    void requestProjectInfo( const QString &projectName, bool forUpdate );
+    void startProjectDownload( const QString &projectName );
+    //! Ends the sync job of a project and emits syncProjectFinished, an upload continues if it has been updating the project
+    void finishSyncJob( const QString &projectName, bool successfully );
+    bool isSyncCancelled( const QString &projectName ) const;
+    //! Telemetry of the sync job of a project, nullptr if the project is not being synced
+    std::shared_ptr<SyncStats> syncStats( const QString &projectName ) const;
+    //! Emits syncStatsRecorded and appends the stats to the sync log
+    void recordSyncStats( const QString &projectName, const SyncStats &stats, bool successfully );
+    bool isWaitingForUpload( const QString &projectName ) const;
+    //! Project has a newer version on the server than the local one
+    bool isUpdatedOnServer( const QString &projectName ) const;
     QByteArray generateToken();
     void loadAuthData();
     static QString defaultApiRoot() { return "https://public.cloudmergin.com/"; }
+    static QString metadataDir() { return QStringLiteral( ".mergin" ); } // hidden folder in a project dir, skipped by listFiles
 
-    QNetworkAccessManager mManager;
+    MerginNetworkAccessManager mManager;
     QString mApiRoot;
     ProjectList mMerginProjects;
     QString mDataDir; // dir with all projects
     QString mCacheFile;
+    ProjectsCache mProjectsCache; // local state of downloaded projects between runs
+    ResponseCache mResponseCache; // replies of listing and project info requests, validated by conditional requests
+    SyncFilters mSyncFilters; // files synced in projects with selective sync
+    QString mProjectListUrl; // listing request whose reply mMerginProjects has been parsed from
     QString mUsername;
     QString mPassword;
-    QHash<QUrl, QString>mPendingRequests;
-    QSet<QString> mWaitingForUpload;
-    QHash<QString, QSet<QString>> mObsoleteFiles;
+    SyncScheduler mSyncScheduler;
+    QList<std::shared_ptr<SyncJob>> mBatchJobs; // jobs of the running batch sync, see syncProjects
+    bool mBatchSyncStarting = false;
+    QHash<QNetworkReply *, QString> mProjectReplies; // reply of a request for a whole project (info, download, create...) -> project name
+    QHash<QNetworkReply *, std::shared_ptr<DataStreamState>> mDataStreams;
+    QHash<QString, std::shared_ptr<DownloadTask>> mDownloadTasks; // project name -> parallel download
+    QHash<QNetworkReply *, QString> mDownloadTaskReplies; // reply of a parallel download -> project name
+    QHash<QString, std::shared_ptr<UploadTask>> mUploadTasks; // project name -> chunked upload
+    QHash<QNetworkReply *, QString> mUploadTaskReplies; // reply of a push request -> project name
+    QHash<QNetworkReply *, UploadChunk> mUploadChunkReplies;
+    QHash<QString, QHash<QString, MerginFile>> mFetchedDiffs; // project name -> path of a changeset -> updated file
+    QHash<QString, QList<MerginFile>> mFetchedFiles; // project name -> whole files being downloaded, added to mBlobStore when received
+    QHash<QString, QStringList> mStoredFiles; // project name -> files cloned to the staging folder from mBlobStore
+    QHash<QString, QByteArray> mSyncedProjectInfo; // project name -> project info an update is syncing to, see saveSyncManifest
+    BlobStore mBlobStore; // content of files of all local projects, so a file present locally is not downloaded again
+    int mSyncConcurrency = 1;
+    QString mSyncLogFile;
+    TransferController mTransferController;
+    QHash<QString, int> mServerCapabilities; // API root -> ServerCapability flags announced by its server
+    QHash<QString, int> mUnsupportedCapabilities; // API root -> ServerCapability flags announced by its server, but not provided
+    FileHasher mFileHasher;
+    DiskWriter mDiskWriter; // received files are written in its thread
+    ChangeJournal mChangeJournal; // changed files of local projects, for their status and checksums
+    QHash<QString, quint64> mUnmodifiedProjects; // project name -> generation of mChangeJournal when its files have matched the last sync
     QSet<QString> mIgnoreFiles = QSet<QString>() << "gpkg-shm" << "gpkg-wal" << "qgs~" << "qgz~";
 
     const int CHUNK_SIZE = 65536;
+    // Max size of a read from a reply, replies' read buffers are sized by TransferController
+    const int DOWNLOAD_BUFFER_SIZE = 16 * CHUNK_SIZE;
+    // Delay of reading from replies while the queue of mDiskWriter is full, msecs
+    const int DISK_WRITER_WAIT = 10;
+    // Limits of a batch of small files fetched in one request of a parallel download
+    const qint64 MIN_DOWNLOAD_BATCH_SIZE = 256 * 1024;
+    const qint64 MAX_DOWNLOAD_BATCH_SIZE = 10 * 1024 * 1024;
+    // Number of attempts to resume an interrupted request of a parallel download
+    const int MAX_DOWNLOAD_RETRIES = 3;
+    // Smaller files are always downloaded whole, their signature would not save much
+    const qint64 MIN_DELTA_FILE_SIZE = 1024 * 1024;
+    // Suffix of a delta of a file in the staging folder
+    const QString DELTA_FILE_SUFFIX = QStringLiteral( ".mergin-delta" );
+    // Suffix of a result of a merge of a GeoPackage in the staging folder
+    const QString MERGED_FILE_SUFFIX = QStringLiteral( ".mergin-merged" );
+    // Suffix of a file in the staging folder with state of a partially downloaded file
+    const QString PARTIAL_FILE_STATE_SUFFIX = QStringLiteral( ".mergin-part" );
+    // Size of a file chunk sent in one request of an upload
+    const qint64 UPLOAD_CHUNK_SIZE = 10 * 1024 * 1024;
+    // Number of attempts to send a chunk again after a network error
+    const int MAX_UPLOAD_RETRIES = 3;
+    // Suffix of a file with checksums of a GeoPackage base copy
+    const QString BASE_STATE_SUFFIX = QStringLiteral( ".mergin-base" );
+    // Content codings of replies decompressed by MerginApi
+    const QByteArray ACCEPT_ENCODING = "gzip, deflate";
+    // Smaller request bodies are not worth compressing
+    const int MIN_COMPRESSED_SIZE = 1024;
 };
 
 #endif // MERGINAPI_H
@@ -0,0 +1,274 @@
+#include "multipartparser.h"
+
+#include <QList>
+#include <cstring>
+
+MultipartParser::MultipartParser( const QByteArray &boundary, int bufferSize )
+  : mDelimiter( QByteArray( "\r\n--" ) + boundary )
+{
+  mBuffer.resize( qMax( bufferSize, 2 * MAX_HEADER_SIZE + mDelimiter.size() ) );
+
+  // The first delimiter does not have to be preceded by CRLF, pretend it is
+  mBuffer[0] = '\r';
+  mBuffer[1] = '\n';
+  mWritePos = 2;
+}
+
+QByteArray MultipartParser::boundaryFromContentType( const QByteArray &contentType )
+{
+  int index = contentType.indexOf( "boundary=" );
+  if ( index < 0 )
+    return QByteArray();
+
+  QByteArray boundary = contentType.mid( index + 9 );
+  int end = boundary.indexOf( ';' );
+  if ( end >= 0 )
+    boundary = boundary.left( end );
+  boundary = boundary.trimmed();
+  if ( boundary.size() >= 2 && boundary.startsWith( '"' ) && boundary.endsWith( '"' ) )
+    boundary = boundary.mid( 1, boundary.size() - 2 );
+  return boundary;
+}
+
+char *MultipartParser::writeBuffer()
+{
+  return mBuffer.data() + mWritePos;
+}
+
+int MultipartParser::writeCapacity() const
+{
+  return mBuffer.size() - mWritePos;
+}
+
+void MultipartParser::commitWrite( int size )
+{
+  Q_ASSERT( size >= 0 && size <= writeCapacity() );
+  mWritePos += size;
+}
+
+int MultipartParser::write( const char *data, int size )
+{
+  int copySize = qMin( size, writeCapacity() );
+  memcpy( writeBuffer(), data, copySize );
+  commitWrite( copySize );
+  return copySize;
+}
+
+void MultipartParser::finish()
+{
+  mFinishing = true;
+}
+
+MultipartParser::Event MultipartParser::next()
+{
+  const char *buffer = mBuffer.constData();
+  mData = nullptr;
+  mDataSize = 0;
+
+  while ( true )
+  {
+    switch ( mState )
+    {
+      case Preamble:
+      case Body:
+      {
+        int index = findDelimiter();
+        if ( index >= 0 )
+        {
+          if ( mState == Body && index > mReadPos )
+          {
+            mData = buffer + mReadPos;
+            mDataSize = index - mReadPos;
+            mReadPos = index;
+            return PartData;
+          }
+
+          mReadPos = index + mDelimiter.size();
+          bool partEnded = mState == Body;
+          mState = Delimiter;
+          if ( partEnded )
+            return PartEnd;
+          continue;
+        }
+
+        if ( mFinishing )
+          return fail( QStringLiteral( "Unexpected end of multipart data" ) );
+
+        // Delimiter is not present, but its beginning may be at the end of the buffer
+        int safeEnd = mWritePos - mDelimiter.size() + 1;
+        if ( safeEnd > mReadPos )
+        {
+          int readPos = mReadPos;
+          mReadPos = safeEnd;
+          if ( mState == Body )
+          {
+            mData = buffer + readPos;
+            mDataSize = safeEnd - readPos;
+            return PartData;
+          }
+        }
+        return needMoreData();
+      }
+
+      case Delimiter:
+      {
+        if ( mWritePos - mReadPos < 2 )
+        {
+          if ( mFinishing )
+            return fail( QStringLiteral( "Unexpected end of multipart data" ) );
+          return needMoreData();
+        }
+
+        const char *p = buffer + mReadPos;
+        mReadPos += 2;
+        if ( p[0] == '-' && p[1] == '-' )
+        {
+          mState = Epilogue;
+          continue;
+        }
+        if ( p[0] != '\r' || p[1] != '\n' )
+          return fail( QStringLiteral( "Malformed multipart delimiter" ) );
+
+        mState = Headers;
+        continue;
+      }
+
+      case Headers:
+      {
+        const char *begin = buffer + mReadPos;
+        int available = mWritePos - mReadPos;
+        const char *end = nullptr;
+
+        if ( available >= 2 && begin[0] == '\r' && begin[1] == '\n' )
+        {
+          // part without headers
+          end = begin;
+        }
+        else
+        {
+          for ( const char *p = begin; p + 4 <= begin + available; ++p )
+          {
+            p = static_cast<const char *>( memchr( p, '\r', begin + available - p - 3 ) );
+            if ( !p )
+              break;
+            if ( memcmp( p, "\r\n\r\n", 4 ) == 0 )
+            {
+              end = p + 2;
+              break;
+            }
+          }
+        }
+
+        if ( !end )
+        {
+          if ( available > MAX_HEADER_SIZE )
+            return fail( QStringLiteral( "Multipart header is too long" ) );
+          if ( mFinishing )
+            return fail( QStringLiteral( "Unexpected end of multipart data" ) );
+          return needMoreData();
+        }
+
+        parseHeaders( begin, end );
+        mReadPos = end - buffer + 2;
+        mState = Body;
+        return PartBegin;
+      }
+
+      case Epilogue:
+        mReadPos = mWritePos;
+        needMoreData();
+        return Finished;
+
+      case Failed:
+        return Error;
+    }
+  }
+}
+
+int MultipartParser::findDelimiter() const
+{
+  const char *buffer = mBuffer.constData();
+  const char *end = buffer + mWritePos;
+  const char *delimiter = mDelimiter.constData();
+  const int delimiterSize = mDelimiter.size();
+
+  const char *p = buffer + mReadPos;
+  while ( end - p >= delimiterSize )
+  {
+    p = static_cast<const char *>( memchr( p, delimiter[0], end - p - delimiterSize + 1 ) );
+    if ( !p )
+      return -1;
+    if ( memcmp( p, delimiter, delimiterSize ) == 0 )
+      return p - buffer;
+    ++p;
+  }
+  return -1;
+}
+
+void MultipartParser::parseHeaders( const char *begin, const char *end )
+{
+  mName.clear();
+  mFilename.clear();
+
+  // end points to CRLF terminating the last header line
+  QList<QByteArray> lines = QByteArray( begin, end - begin ).split( '\n' );
+  for ( QByteArray line : lines )
+  {
+    int colon = line.indexOf( ':' );
+    if ( colon < 0 )
+      continue;
+    if ( line.left( colon ).trimmed().toLower() != "content-disposition" )
+      continue;
+
+    // split parameters by semicolons outside of quoted values
+    QByteArray value = line.mid( colon + 1 );
+    QList<QByteArray> params;
+    bool quoted = false;
+    int start = 0;
+    for ( int i = 0; i < value.size(); ++i )
+    {
+      if ( value.at( i ) == '"' )
+        quoted = !quoted;
+      else if ( value.at( i ) == ';' && !quoted )
+      {
+        params << value.mid( start, i - start );
+        start = i + 1;
+      }
+    }
+    params << value.mid( start );
+
+    for ( QByteArray param : params )
+    {
+      int eq = param.indexOf( '=' );
+      if ( eq < 0 )
+        continue;
+      QByteArray key = param.left( eq ).trimmed().toLower();
+      QByteArray paramValue = param.mid( eq + 1 ).trimmed();
+      if ( paramValue.size() >= 2 && paramValue.startsWith( '"' ) && paramValue.endsWith( '"' ) )
+        paramValue = paramValue.mid( 1, paramValue.size() - 2 );
+
+      if ( key == "name" )
+        mName = QString::fromUtf8( paramValue );
+      else if ( key == "filename" )
+        mFilename = QString::fromUtf8( paramValue );
+    }
+  }
+}
+
+MultipartParser::Event MultipartParser::needMoreData()
+{
+  // Move the unconsumed tail to the beginning of the buffer
+  int remaining = mWritePos - mReadPos;
+  if ( mReadPos > 0 && remaining > 0 )
+    memmove( mBuffer.data(), mBuffer.constData() + mReadPos, remaining );
+  mReadPos = 0;
+  mWritePos = remaining;
+  return NeedMoreData;
+}
+
+MultipartParser::Event MultipartParser::fail( const QString &error )
+{
+  mState = Failed;
+  mError = error;
+  return Error;
+}
@@ -0,0 +1,84 @@
+#ifndef MULTIPARTPARSER_H
+#define MULTIPARTPARSER_H
+
+#include <QByteArray>
+#include <QString>
+
+/**
+ * Streaming parser of multipart/form-data content (RFC 2046) working on raw bytes.
+ *
+ * Data are written straight into parser's buffer (writeBuffer(), writeCapacity(), commitWrite())
+ * and next() is called until it returns NeedMoreData. Data of parts are returned as pointers to the buffer,
+ * valid until the next call of next() or commitWrite(). The buffer is allocated once, delimiter is searched
+ * with memchr and only the unconsumed tail (shorter than a delimiter or a header block) is moved
+ * to the buffer start, so parsing cost per byte does not depend on size of parts or of the whole stream.
+ */
+class MultipartParser
+{
+  public:
+    enum Event
+    {
+      NeedMoreData, //!< all buffered data have been consumed, write more data or call finish()
+      PartBegin, //!< headers of a part have been parsed, see name() and filename()
+      PartData, //!< data of the current part are available, see data() and dataSize()
+      PartEnd, //!< current part is complete
+      Finished, //!< closing delimiter has been reached
+      Error //!< data are malformed or truncated, see errorString()
+    };
+
+    explicit MultipartParser( const QByteArray &boundary, int bufferSize = 1024 * 1024 );
+
+    //! Returns boundary parameter of a multipart Content-Type header value or empty array
+    static QByteArray boundaryFromContentType( const QByteArray &contentType );
+
+    char *writeBuffer();
+    int writeCapacity() const;
+    void commitWrite( int size );
+
+    //! Copies as much data as fits to the buffer, returns number of copied bytes
+    int write( const char *data, int size );
+
+    //! Marks the end of input, next() then returns Finished or Error instead of NeedMoreData
+    void finish();
+
+    Event next();
+
+    QString name() const { return mName; }
+    QString filename() const { return mFilename; }
+    const char *data() const { return mData; }
+    int dataSize() const { return mDataSize; }
+    QString errorString() const { return mError; }
+
+  private:
+    enum State
+    {
+      Preamble,
+      Delimiter, // delimiter has been read, followed by CRLF or "--" of the closing delimiter
+      Headers,
+      Body,
+      Epilogue,
+      Failed
+    };
+
+    int findDelimiter() const;
+    void parseHeaders( const char *begin, const char *end );
+    Event needMoreData();
+    Event fail( const QString &error );
+
+    QByteArray mDelimiter; // CRLF + "--" + boundary
+    QByteArray mBuffer;
+    int mReadPos = 0;
+    int mWritePos = 0;
+    bool mFinishing = false;
+    State mState = Preamble;
+
+    QString mName;
+    QString mFilename;
+    QString mError;
+    const char *mData = nullptr;
+    int mDataSize = 0;
+
+    static const int MAX_HEADER_SIZE = 8192;
+};
+
+#endif // MULTIPARTPARSER_H
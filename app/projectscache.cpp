@@ -0,0 +1,263 @@
+#include "projectscache.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtEndian>
+#include <cstring>
+
+ProjectsCache::ProjectsCache( const QString &filePath, QObject *parent )
+  : QObject( parent )
+  , mFile( filePath )
+{
+  mWriteTimer.setSingleShot( true );
+  mWriteTimer.setInterval( WRITE_DELAY );
+  connect( &mWriteTimer, &QTimer::timeout, this, [this] { flush(); } );
+  load();
+}
+
+ProjectsCache::~ProjectsCache()
+{
+  flush();
+}
+
+bool ProjectsCache::entry( const QString &projectName, Entry &entry ) const
+{
+  auto it = mRecords.constFind( projectName.toUtf8() );
+  if ( it == mRecords.constEnd() )
+    return false;
+
+  entry.name = projectName;
+  entry.updated = it->updated == INVALID_TIME ? QDateTime() : QDateTime::fromMSecsSinceEpoch( it->updated, Qt::UTC );
+  entry.lastSync = it->lastSync == INVALID_TIME ? QDateTime() : QDateTime::fromMSecsSinceEpoch( it->lastSync );
+  return true;
+}
+
+int ProjectsCache::count() const
+{
+  return mRecords.size();
+}
+
+void ProjectsCache::update( const QList<Entry> &entries )
+{
+  QSet<QByteArray> names;
+  for ( const Entry &entry : entries )
+  {
+    QByteArray name = entry.name.toUtf8();
+    names.insert( name );
+    qint64 updated = entry.updated.isValid() ? entry.updated.toMSecsSinceEpoch() : INVALID_TIME;
+    qint64 lastSync = entry.lastSync.isValid() ? entry.lastSync.toMSecsSinceEpoch() : INVALID_TIME;
+
+    auto it = mRecords.find( name );
+    if ( it == mRecords.end() )
+    {
+      Record record;
+      record.updated = updated;
+      record.lastSync = lastSync;
+      mRecords.insert( name, record );
+      mChanged.insert( name );
+    }
+    else if ( it->updated != updated || it->lastSync != lastSync )
+    {
+      it->updated = updated;
+      it->lastSync = lastSync;
+      mChanged.insert( it.key() );
+    }
+  }
+
+  for ( auto it = mRecords.begin(); it != mRecords.end(); )
+  {
+    if ( names.contains( it.key() ) )
+    {
+      ++it;
+      continue;
+    }
+
+    if ( it->offset > 0 )
+      mRemovedRecords << qMakePair( it->offset, it->size );
+    mChanged.remove( it.key() );
+    it = mRecords.erase( it );
+  }
+
+  if ( ( !mChanged.isEmpty() || !mRemovedRecords.isEmpty() ) && !mWriteTimer.isActive() )
+    mWriteTimer.start();
+}
+
+bool ProjectsCache::flush()
+{
+  mWriteTimer.stop();
+  if ( mChanged.isEmpty() && mRemovedRecords.isEmpty() )
+    return true;
+
+  // a new file or one with too much free space is written whole
+  qint64 removedBytes = 0;
+  for ( const QPair<qint64, quint32> &record : mRemovedRecords )
+    removedBytes += record.second;
+  qint64 freeBytes = mFreeBytes + removedBytes;
+  if ( !mFile.isOpen() || ( freeBytes > MAX_FREE_BYTES && freeBytes > mEnd - HEADER_SIZE - freeBytes ) )
+    return compact();
+
+  if ( mFile.size() > mEnd && !mFile.resize( mEnd ) )
+    return false;
+
+  for ( const QPair<qint64, quint32> &record : mRemovedRecords )
+  {
+    uchar nameSize[4];
+    qToLittleEndian<quint32>( 0, nameSize );
+    if ( !mFile.seek( record.first + 4 ) || mFile.write( reinterpret_cast<const char *>( nameSize ), 4 ) != 4 )
+      return false;
+    mFreeRecords << record;
+  }
+  mFreeBytes = freeBytes;
+  mRemovedRecords.clear();
+
+  for ( const QByteArray &name : mChanged )
+  {
+    Record &record = mRecords.find( name ).value();
+    QByteArray data;
+    if ( record.offset > 0 )
+    {
+      // only times of a known project change
+      data.resize( 16 );
+      qToLittleEndian<qint64>( record.updated, data.data() );
+      qToLittleEndian<qint64>( record.lastSync, data.data() + 8 );
+      if ( !mFile.seek( record.offset + 8 ) || mFile.write( data ) != data.size() )
+        return false;
+      continue;
+    }
+
+    record.size = recordSize( name );
+    for ( int i = 0; i < mFreeRecords.size(); ++i )
+    {
+      if ( mFreeRecords.at( i ).second >= record.size )
+      {
+        record.offset = mFreeRecords.at( i ).first;
+        record.size = mFreeRecords.at( i ).second;
+        mFreeBytes -= record.size;
+        mFreeRecords.removeAt( i );
+        break;
+      }
+    }
+    if ( record.offset == 0 )
+    {
+      record.offset = mEnd;
+      mEnd += record.size;
+    }
+
+    data.fill( 0, static_cast<int>( record.size ) );
+    qToLittleEndian<quint32>( record.size, data.data() );
+    qToLittleEndian<quint32>( static_cast<quint32>( name.size() ), data.data() + 4 );
+    qToLittleEndian<qint64>( record.updated, data.data() + 8 );
+    qToLittleEndian<qint64>( record.lastSync, data.data() + 16 );
+    memcpy( data.data() + RECORD_HEADER_SIZE, name.constData(), static_cast<size_t>( name.size() ) );
+    if ( !mFile.seek( record.offset ) || mFile.write( data ) != data.size() )
+      return false;
+  }
+  mChanged.clear();
+  return mFile.flush();
+}
+
+void ProjectsCache::load()
+{
+  if ( !mFile.exists() || !mFile.open( QIODevice::ReadWrite ) )
+    return;
+
+  qint64 fileSize = mFile.size();
+  mMap = fileSize >= HEADER_SIZE ? mFile.map( 0, fileSize ) : nullptr;
+  if ( !mMap || qFromLittleEndian<quint32>( mMap ) != MAGIC || qFromLittleEndian<quint32>( mMap + 4 ) != VERSION )
+  {
+    // written by another version, it is replaced by the first write
+    qDebug() << "Ignoring projects cache" << mFile.fileName();
+    if ( mMap )
+      mFile.unmap( mMap );
+    mMap = nullptr;
+    mFile.close();
+    return;
+  }
+
+  mRecords.reserve( static_cast<int>( fileSize / ( RECORD_HEADER_SIZE + RECORD_ALIGNMENT ) ) );
+  qint64 offset = HEADER_SIZE;
+  while ( offset + RECORD_HEADER_SIZE <= fileSize )
+  {
+    const uchar *data = mMap + offset;
+    quint32 size = qFromLittleEndian<quint32>( data );
+    quint32 nameSize = qFromLittleEndian<quint32>( data + 4 );
+    if ( size < RECORD_HEADER_SIZE || size % RECORD_ALIGNMENT != 0 || offset + size > fileSize || nameSize > size - RECORD_HEADER_SIZE )
+    {
+      // interrupted write, the rest of the file is dropped by the next write
+      qDebug() << "Projects cache" << mFile.fileName() << "is corrupted at" << offset;
+      break;
+    }
+
+    if ( nameSize == 0 )
+    {
+      mFreeRecords << qMakePair( offset, size );
+      mFreeBytes += size;
+    }
+    else
+    {
+      Record record;
+      record.offset = offset;
+      record.size = size;
+      record.updated = qFromLittleEndian<qint64>( data + 8 );
+      record.lastSync = qFromLittleEndian<qint64>( data + 16 );
+      // name is not copied, the map is kept as long as the cache exists
+      mRecords.insert( QByteArray::fromRawData( reinterpret_cast<const char *>( data + RECORD_HEADER_SIZE ), static_cast<int>( nameSize ) ), record );
+    }
+    offset += size;
+  }
+  mEnd = offset;
+}
+
+bool ProjectsCache::compact()
+{
+  QByteArray data( HEADER_SIZE, 0 );
+  qToLittleEndian<quint32>( MAGIC, data.data() );
+  qToLittleEndian<quint32>( VERSION, data.data() + 4 );
+
+  // names are copied, so the old map can be released
+  QHash<QByteArray, Record> records;
+  records.reserve( mRecords.size() );
+  for ( auto it = mRecords.constBegin(); it != mRecords.constEnd(); ++it )
+  {
+    QByteArray name( it.key().constData(), it.key().size() );
+    Record record = it.value();
+    record.offset = data.size();
+    record.size = recordSize( name );
+    data.append( QByteArray( static_cast<int>( record.size ), 0 ) );
+    char *recordData = data.data() + record.offset;
+    qToLittleEndian<quint32>( record.size, recordData );
+    qToLittleEndian<quint32>( static_cast<quint32>( name.size() ), recordData + 4 );
+    qToLittleEndian<qint64>( record.updated, recordData + 8 );
+    qToLittleEndian<qint64>( record.lastSync, recordData + 16 );
+    memcpy( recordData + RECORD_HEADER_SIZE, name.constData(), static_cast<size_t>( name.size() ) );
+    records.insert( name, record );
+  }
+
+  QDir().mkpath( QFileInfo( mFile.fileName() ).absolutePath() );
+  QSaveFile file( mFile.fileName() );
+  if ( !file.open( QIODevice::WriteOnly ) || file.write( data ) != data.size() || !file.commit() )
+  {
+    qDebug() << "Failed to write projects cache" << mFile.fileName();
+    return false;
+  }
+
+  mChanged.clear();
+  mRemovedRecords.clear();
+  mFreeRecords.clear();
+  mFreeBytes = 0;
+  mEnd = data.size();
+  mRecords = records;
+  if ( mMap )
+    mFile.unmap( mMap );
+  mMap = nullptr;
+  mFile.close();
+  return mFile.open( QIODevice::ReadWrite );
+}
+
+quint32 ProjectsCache::recordSize( const QByteArray &name )
+{
+  int size = RECORD_HEADER_SIZE + name.size();
+  return static_cast<quint32>( ( size + RECORD_ALIGNMENT - 1 ) / RECORD_ALIGNMENT * RECORD_ALIGNMENT );
+}
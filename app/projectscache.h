@@ -0,0 +1,90 @@
+#ifndef PROJECTSCACHE_H
+#define PROJECTSCACHE_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <QTimer>
+#include <limits>
+
+/**
+ * Local state of downloaded projects (version of local files and time of the last sync) kept between runs.
+ * The file is binary and memory mapped when it is loaded, only an index of project names pointing to the map is built,
+ * so loading is cheap even with thousands of projects.
+ * Changes are written with a delay, each project to its own record, so a change of a project does not rewrite the file.
+ *
+ * File format (little endian): header of MAGIC and VERSION (u32 each), records follow. A record consists of its size
+ * including padding (u32), size of the project name (u32, 0 for a free record), local version (i64) and last sync (i64)
+ * as msecs since epoch (INVALID_TIME if not set) and UTF-8 project name padded to a multiple of RECORD_ALIGNMENT.
+ */
+class ProjectsCache: public QObject
+{
+    Q_OBJECT
+  public:
+    struct Entry
+    {
+      QString name;
+      QDateTime updated; // local version of project files
+      QDateTime lastSync;
+    };
+
+    //! Loads the cache, missing file or a file of another version results in an empty cache
+    explicit ProjectsCache( const QString &filePath, QObject *parent = nullptr );
+    //! Writes pending changes
+    ~ProjectsCache();
+
+    //! Returns false if there is no entry of the project
+    bool entry( const QString &projectName, Entry &entry ) const;
+
+    int count() const;
+
+    /**
+     * Makes the cache contain given projects only. Changed, added and removed projects are written
+     * after WRITE_DELAY, several changes in a row result in a single write.
+     */
+    void update( const QList<Entry> &entries );
+
+    //! Writes pending changes now, returns false on failure
+    bool flush();
+
+  private:
+    struct Record
+    {
+      qint64 offset = 0; // in the file, 0 if the record has not been written yet
+      quint32 size = 0;
+      qint64 updated = INVALID_TIME;
+      qint64 lastSync = INVALID_TIME;
+    };
+
+    void load();
+    //! Rewrites the whole file without free records
+    bool compact();
+    static quint32 recordSize( const QByteArray &name );
+
+    QFile mFile;
+    uchar *mMap = nullptr; // names in mRecords keys of records loaded at startup point here
+    QHash<QByteArray, Record> mRecords; // UTF-8 project name -> record
+    QSet<QByteArray> mChanged; // names of records to be written
+    QList<QPair<qint64, quint32>> mFreeRecords; // offset and size of records of removed projects
+    QList<QPair<qint64, quint32>> mRemovedRecords; // records to be marked free by the next write
+    qint64 mFreeBytes = 0;
+    qint64 mEnd = 0; // end of the last valid record
+    QTimer mWriteTimer;
+
+    static const quint32 MAGIC = 0x4650434d; // "MCPF"
+    static const quint32 VERSION = 1;
+    static const int HEADER_SIZE = 8;
+    static const int RECORD_HEADER_SIZE = 24;
+    static const int RECORD_ALIGNMENT = 8;
+    static const qint64 INVALID_TIME = std::numeric_limits<qint64>::min();
+    static const int WRITE_DELAY = 1000; // msecs
+    // File is compacted when free records take more space than this and more than the used ones
+    static const qint64 MAX_FREE_BYTES = 64 * 1024;
+};
+
+#endif // PROJECTSCACHE_H
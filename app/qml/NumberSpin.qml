@@ -9,6 +9,7 @@ Item {
     property string suffix
     property int maxValue: 99
     property int minValue: 0
+    property int step: 1
 
     Image {
         id: imageDecrease
@@ -21,7 +22,7 @@ Item {
 
         MouseArea {
             anchors.fill: parent
-            onClicked: if (minValue <= root.value - 1) root.value -=1
+            onClicked: if (minValue <= root.value - step) root.value -= step
         }
     }
 
@@ -56,7 +57,7 @@ Item {
 
         MouseArea {
             anchors.fill: parent
-            onClicked: if (maxValue >= root.value + 1) root.value +=1
+            onClicked: if (maxValue >= root.value + step) root.value += step
         }
     }
 
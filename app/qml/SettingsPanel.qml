@@ -76,6 +76,55 @@ Popup {
                 }
             }
 
+            PanelItem {
+                height: settingsPanel.rowHeight
+                width: parent.width
+                text: qsTr("Parallel downloads")
+
+                NumberSpin {
+                    id: spinSyncConcurrency
+                    value: __appSettings.syncConcurrency
+                    minValue: 1
+                    maxValue: 16
+                    onValueChanged: __appSettings.syncConcurrency = spinSyncConcurrency.value
+                    height: InputStyle.fontPixelSizeNormal
+                    anchors.verticalCenter: parent.verticalCenter
+                    width: height * 6
+                    anchors.right: parent.right
+                    anchors.rightMargin: InputStyle.panelMargin
+                }
+            }
+
+            PanelItem {
+                height: settingsPanel.rowHeight
+                width: parent.width
+                text: qsTr("Bandwidth limit (0 = none)")
+
+                NumberSpin {
+                    id: spinBandwidthLimit
+                    value: __appSettings.bandwidthLimit
+                    minValue: 0
+                    maxValue: 10240
+                    step: 64
+                    suffix: " KB/s"
+                    onValueChanged: __appSettings.bandwidthLimit = spinBandwidthLimit.value
+                    height: InputStyle.fontPixelSizeNormal
+                    anchors.verticalCenter: parent.verticalCenter
+                    width: height * 8
+                    anchors.right: parent.right
+                    anchors.rightMargin: InputStyle.panelMargin
+                }
+            }
+
+            PanelItem {
+                color: InputStyle.clrPanelMain
+                text: qsTr("Transfer rate")
+                text2: qsTr("%1 KB/s down, %2 KB/s up, %3 parallel")
+                         .arg(Math.round(__transferController.downloadRate / 1024))
+                         .arg(Math.round(__transferController.uploadRate / 1024))
+                         .arg(__transferController.concurrency)
+            }
+
              // Header "GPS"
             PanelItem {
                 color: InputStyle.panelBackgroundLight
@@ -0,0 +1,157 @@
+#include "responsecache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+
+ResponseCache::ResponseCache( const QString &dirPath )
+  : mDirPath( dirPath )
+{
+  load();
+}
+
+void ResponseCache::prepareRequest( QNetworkRequest &request, const QString &username ) const
+{
+  auto it = mEntries.constFind( key( request.url().toString(), username ) );
+  if ( it == mEntries.constEnd() )
+    return;
+
+  if ( !it->etag.isEmpty() )
+    request.setRawHeader( "If-None-Match", it->etag );
+  if ( !it->lastModified.isEmpty() )
+    request.setRawHeader( "If-Modified-Since", it->lastModified );
+}
+
+bool ResponseCache::replyData( QNetworkReply *reply, const QString &username, QByteArray &data )
+{
+  QString entryKey = key( reply->request().url().toString(), username );
+  if ( isNotModified( reply ) )
+    return mEntries.contains( entryKey ) && readData( entryKey, data );
+
+  data = reply->readAll();
+  Entry entry;
+  entry.etag = reply->rawHeader( "ETag" );
+  entry.lastModified = reply->rawHeader( "Last-Modified" );
+  if ( entry.etag.isEmpty() && entry.lastModified.isEmpty() )
+  {
+    // the reply cannot be validated, an older one must not be offered anymore
+    remove( entryKey );
+    return true;
+  }
+
+  entry.stored = QDateTime::currentMSecsSinceEpoch();
+  save( entryKey, entry, data );
+  return true;
+}
+
+bool ResponseCache::isNotModified( QNetworkReply *reply )
+{
+  return reply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt() == 304;
+}
+
+QByteArray ResponseCache::data( const QString &url, const QString &username ) const
+{
+  QString entryKey = key( url, username );
+  QByteArray data;
+  if ( mEntries.contains( entryKey ) )
+    readData( entryKey, data );
+  return data;
+}
+
+void ResponseCache::clear()
+{
+  mEntries.clear();
+  QDir( mDirPath ).removeRecursively();
+}
+
+QString ResponseCache::key( const QString &url, const QString &username )
+{
+  return username + ' ' + url;
+}
+
+QString ResponseCache::entryFilePath( const QString &entryKey ) const
+{
+  return mDirPath + '/' + QString::fromLatin1( QCryptographicHash::hash( entryKey.toUtf8(), QCryptographicHash::Sha1 ).toHex() );
+}
+
+void ResponseCache::load()
+{
+  QDir dir( mDirPath );
+  for ( const QString &fileName : dir.entryList( QDir::Files ) )
+  {
+    QFile file( dir.filePath( fileName ) );
+    if ( !file.open( QIODevice::ReadOnly ) )
+      continue;
+
+    QJsonObject header = QJsonDocument::fromJson( file.readLine() ).object();
+    QString entryKey = header.value( QStringLiteral( "key" ) ).toString();
+    if ( header.value( QStringLiteral( "version" ) ).toInt() != 1 || entryFilePath( entryKey ) != file.fileName() )
+      continue;
+
+    Entry entry;
+    entry.etag = header.value( QStringLiteral( "etag" ) ).toString().toLatin1();
+    entry.lastModified = header.value( QStringLiteral( "lastModified" ) ).toString().toLatin1();
+    entry.stored = static_cast<qint64>( header.value( QStringLiteral( "stored" ) ).toDouble() );
+    mEntries.insert( entryKey, entry );
+  }
+}
+
+bool ResponseCache::readData( const QString &entryKey, QByteArray &data ) const
+{
+  QFile file( entryFilePath( entryKey ) );
+  if ( !file.open( QIODevice::ReadOnly ) )
+    return false;
+
+  QJsonObject header = QJsonDocument::fromJson( file.readLine() ).object();
+  if ( header.value( QStringLiteral( "key" ) ).toString() != entryKey )
+    return false;
+
+  data = file.readAll();
+  return true;
+}
+
+void ResponseCache::save( const QString &entryKey, const Entry &entry, const QByteArray &data )
+{
+  mEntries.insert( entryKey, entry );
+  while ( mEntries.size() > MAX_ENTRIES )
+  {
+    auto oldest = mEntries.begin();
+    for ( auto it = mEntries.begin(); it != mEntries.end(); ++it )
+    {
+      if ( it->stored < oldest->stored )
+        oldest = it;
+    }
+    remove( oldest.key() );
+  }
+
+  QJsonObject header;
+  header.insert( QStringLiteral( "version" ), 1 );
+  header.insert( QStringLiteral( "key" ), entryKey );
+  header.insert( QStringLiteral( "etag" ), QString::fromLatin1( entry.etag ) );
+  header.insert( QStringLiteral( "lastModified" ), QString::fromLatin1( entry.lastModified ) );
+  header.insert( QStringLiteral( "stored" ), static_cast<double>( entry.stored ) );
+
+  QDir().mkpath( mDirPath );
+  QSaveFile file( entryFilePath( entryKey ) );
+  if ( !file.open( QIODevice::WriteOnly ) )
+  {
+    qDebug() << "Failed to write response cache entry" << file.fileName();
+    return;
+  }
+  file.write( QJsonDocument( header ).toJson( QJsonDocument::Compact ) + '\n' );
+  file.write( data );
+  file.commit();
+}
+
+void ResponseCache::remove( const QString &entryKey )
+{
+  if ( mEntries.remove( entryKey ) )
+    QFile::remove( entryFilePath( entryKey ) );
+}
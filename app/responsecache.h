@@ -0,0 +1,69 @@
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+
+class QNetworkRequest;
+class QNetworkReply;
+
+/**
+ * Persistent cache of replies of metadata endpoints (project listing and project info) validated by
+ * ETag and Last-Modified headers. Requests are made conditional on the cached reply, the server answers
+ * 304 Not Modified without a body if it is still valid. Only requests prepared by prepareRequest()
+ * are cached, so downloads of project files never end up in the cache.
+ * Entries are kept per user, replies of one user are never offered for requests of another one.
+ *
+ * Each entry is stored in its own file of the cache directory, named by SHA-1 of its key, so storing a reply
+ * does not rewrite other ones. The file starts with a line of compact JSON with the key and validators ("version": 1),
+ * the raw body follows. Only the first lines are read on load, bodies are read when a 304 reply needs them.
+ */
+class ResponseCache
+{
+  public:
+    //! Loads validators of entries stored in a directory, missing or corrupted files are skipped
+    explicit ResponseCache( const QString &dirPath );
+
+    //! Adds If-None-Match and If-Modified-Since headers of the cached reply of the request's URL
+    void prepareRequest( QNetworkRequest &request, const QString &username ) const;
+
+    /**
+     * Returns body of a finished reply of a request prepared by prepareRequest(). A 200 reply with validators
+     * is stored, the cached body is returned for a 304 reply. Returns false if a 304 reply has no cached body.
+     */
+    bool replyData( QNetworkReply *reply, const QString &username, QByteArray &data );
+
+    //! Whether a reply has been answered by 304 Not Modified
+    static bool isNotModified( QNetworkReply *reply );
+
+    //! Cached body of a URL or empty array if there is none
+    QByteArray data( const QString &url, const QString &username ) const;
+
+    //! Removes all entries, e.g. when the user logs out
+    void clear();
+
+  private:
+    struct Entry
+    {
+      QByteArray etag;
+      QByteArray lastModified; // HTTP date as sent by the server
+      qint64 stored = 0; // msecs since epoch
+    };
+
+    static QString key( const QString &url, const QString &username );
+    QString entryFilePath( const QString &entryKey ) const;
+    void load();
+    //! Reads body of an entry from its file, returns false if the file is missing or corrupted
+    bool readData( const QString &entryKey, QByteArray &data ) const;
+    void save( const QString &entryKey, const Entry &entry, const QByteArray &data );
+    void remove( const QString &entryKey );
+
+    QString mDirPath;
+    QHash<QString, Entry> mEntries;
+
+    // Least recently stored entries are dropped above this count, e.g. infos of projects deleted meanwhile
+    static const int MAX_ENTRIES = 256;
+};
+
+#endif // RESPONSECACHE_H
@@ -0,0 +1,321 @@
+#include "sha1.h"
+
+#include <QFile>
+#include <QtEndian>
+#include <cstring>
+
+#if defined( Q_PROCESSOR_X86_64 ) && defined( Q_CC_GNU )
+#define SHA1_HAVE_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+  inline quint32 rotateLeft( quint32 value, int bits )
+  {
+    return ( value << bits ) | ( value >> ( 32 - bits ) );
+  }
+
+  void compressGeneric( quint32 *state, const uchar *data, qint64 blocks )
+  {
+    quint32 w[80];
+    for ( ; blocks > 0; --blocks, data += 64 )
+    {
+      for ( int i = 0; i < 16; ++i )
+        w[i] = qFromBigEndian<quint32>( data + 4 * i );
+      for ( int i = 16; i < 80; ++i )
+        w[i] = rotateLeft( w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1 );
+
+      quint32 a = state[0];
+      quint32 b = state[1];
+      quint32 c = state[2];
+      quint32 d = state[3];
+      quint32 e = state[4];
+
+      // separate loops without branches let the compiler unroll them
+#define SHA1_ROUND( f, k, i ) \
+  { \
+    quint32 temp = rotateLeft( a, 5 ) + ( f ) + e + k + w[i]; \
+    e = d; \
+    d = c; \
+    c = rotateLeft( b, 30 ); \
+    b = a; \
+    a = temp; \
+  }
+      for ( int i = 0; i < 20; ++i )
+        SHA1_ROUND( d ^ ( b & ( c ^ d ) ), 0x5A827999, i )
+      for ( int i = 20; i < 40; ++i )
+        SHA1_ROUND( b ^ c ^ d, 0x6ED9EBA1, i )
+      for ( int i = 40; i < 60; ++i )
+        SHA1_ROUND( ( b & c ) | ( d & ( b | c ) ), 0x8F1BBCDC, i )
+      for ( int i = 60; i < 80; ++i )
+        SHA1_ROUND( b ^ c ^ d, 0xCA62C1D6, i )
+#undef SHA1_ROUND
+
+      state[0] += a;
+      state[1] += b;
+      state[2] += c;
+      state[3] += d;
+      state[4] += e;
+    }
+  }
+
+#ifdef SHA1_HAVE_SHANI
+  bool cpuSupportsShaNi()
+  {
+    unsigned int eax, ebx, ecx, edx;
+    if ( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) )
+      return false;
+    bool ssse3 = ecx & bit_SSSE3;
+    bool sse41 = ecx & bit_SSE4_1;
+
+    if ( __get_cpuid_max( 0, nullptr ) < 7 )
+      return false;
+    __cpuid_count( 7, 0, eax, ebx, ecx, edx );
+    bool sha = ebx & ( 1 << 29 );
+
+    return ssse3 && sse41 && sha;
+  }
+
+  // Four rounds use one message vector, which is expanded by sha1msg1/sha1msg2 for following rounds
+  __attribute__( ( target( "sha,sse4.1" ) ) )
+  void compressShaNi( quint32 *state, const uchar *data, qint64 blocks )
+  {
+    const __m128i mask = _mm_set_epi64x( 0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL );
+
+    __m128i abcd = _mm_loadu_si128( reinterpret_cast<const __m128i *>( state ) );
+    __m128i e0 = _mm_set_epi32( static_cast<int>( state[4] ), 0, 0, 0 );
+    abcd = _mm_shuffle_epi32( abcd, 0x1B );
+
+    for ( ; blocks > 0; --blocks, data += 64 )
+    {
+      __m128i abcdSave = abcd;
+      __m128i e0Save = e0;
+      __m128i e1;
+
+      // rounds 0-3
+      __m128i msg0 = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i *>( data ) ), mask );
+      e0 = _mm_add_epi32( e0, msg0 );
+      e1 = abcd;
+      abcd = _mm_sha1rnds4_epu32( abcd, e0, 0 );
+
+      // rounds 4-7
+      __m128i msg1 = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i *>( data + 16 ) ), mask );
+      e1 = _mm_sha1nexte_epu32( e1, msg1 );
+      e0 = abcd;
+      abcd = _mm_sha1rnds4_epu32( abcd, e1, 0 );
+      msg0 = _mm_sha1msg1_epu32( msg0, msg1 );
+
+      // rounds 8-11
+      __m128i msg2 = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i *>( data + 32 ) ), mask );
+      e0 = _mm_sha1nexte_epu32( e0, msg2 );
+      e1 = abcd;
+      abcd = _mm_sha1rnds4_epu32( abcd, e0, 0 );
+      msg1 = _mm_sha1msg1_epu32( msg1, msg2 );
+      msg0 = _mm_xor_si128( msg0, msg2 );
+
+      // rounds 12-15
+      __m128i msg3 = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i *>( data + 48 ) ), mask );
+      e1 = _mm_sha1nexte_epu32( e1, msg3 );
+      e0 = abcd;
+      msg0 = _mm_sha1msg2_epu32( msg0, msg3 );
+      abcd = _mm_sha1rnds4_epu32( abcd, e1, 0 );
+      msg2 = _mm_sha1msg1_epu32( msg2, msg3 );
+      msg1 = _mm_xor_si128( msg1, msg3 );
+
+#define SHA1_ROUNDS_4( eNext, eCur, msgCur, msgNext, msgNext2, msgNext3, func ) \
+  eNext = _mm_sha1nexte_epu32( eNext, msgCur ); \
+  eCur = abcd; \
+  msgNext = _mm_sha1msg2_epu32( msgNext, msgCur ); \
+  abcd = _mm_sha1rnds4_epu32( abcd, eNext, func ); \
+  msgNext3 = _mm_sha1msg1_epu32( msgNext3, msgCur ); \
+  msgNext2 = _mm_xor_si128( msgNext2, msgCur );
+
+      // rounds 16-67
+      SHA1_ROUNDS_4( e0, e1, msg0, msg1, msg2, msg3, 0 )
+      SHA1_ROUNDS_4( e1, e0, msg1, msg2, msg3, msg0, 1 )
+      SHA1_ROUNDS_4( e0, e1, msg2, msg3, msg0, msg1, 1 )
+      SHA1_ROUNDS_4( e1, e0, msg3, msg0, msg1, msg2, 1 )
+      SHA1_ROUNDS_4( e0, e1, msg0, msg1, msg2, msg3, 1 )
+      SHA1_ROUNDS_4( e1, e0, msg1, msg2, msg3, msg0, 1 )
+      SHA1_ROUNDS_4( e0, e1, msg2, msg3, msg0, msg1, 2 )
+      SHA1_ROUNDS_4( e1, e0, msg3, msg0, msg1, msg2, 2 )
+      SHA1_ROUNDS_4( e0, e1, msg0, msg1, msg2, msg3, 2 )
+      SHA1_ROUNDS_4( e1, e0, msg1, msg2, msg3, msg0, 2 )
+      SHA1_ROUNDS_4( e0, e1, msg2, msg3, msg0, msg1, 2 )
+      SHA1_ROUNDS_4( e1, e0, msg3, msg0, msg1, msg2, 3 )
+      SHA1_ROUNDS_4( e0, e1, msg0, msg1, msg2, msg3, 3 )
+#undef SHA1_ROUNDS_4
+
+      // rounds 68-71
+      e1 = _mm_sha1nexte_epu32( e1, msg1 );
+      e0 = abcd;
+      msg2 = _mm_sha1msg2_epu32( msg2, msg1 );
+      abcd = _mm_sha1rnds4_epu32( abcd, e1, 3 );
+      msg3 = _mm_xor_si128( msg3, msg1 );
+
+      // rounds 72-75
+      e0 = _mm_sha1nexte_epu32( e0, msg2 );
+      e1 = abcd;
+      msg3 = _mm_sha1msg2_epu32( msg3, msg2 );
+      abcd = _mm_sha1rnds4_epu32( abcd, e0, 3 );
+
+      // rounds 76-79
+      e1 = _mm_sha1nexte_epu32( e1, msg3 );
+      e0 = abcd;
+      abcd = _mm_sha1rnds4_epu32( abcd, e1, 3 );
+
+      e0 = _mm_sha1nexte_epu32( e0, e0Save );
+      abcd = _mm_add_epi32( abcd, abcdSave );
+    }
+
+    abcd = _mm_shuffle_epi32( abcd, 0x1B );
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( state ), abcd );
+    state[4] = static_cast<quint32>( _mm_extract_epi32( e0, 3 ) );
+  }
+#endif
+}
+
+const qint64 Sha1::MAP_WINDOW_SIZE;
+const int Sha1::CHUNK_SIZE;
+
+Sha1::Backend Sha1::bestBackend()
+{
+  static const Backend backend = isSupported( ShaNi ) ? ShaNi : Generic;
+  return backend;
+}
+
+bool Sha1::isSupported( Backend backend )
+{
+  switch ( backend )
+  {
+    case Generic:
+      return true;
+    case ShaNi:
+#ifdef SHA1_HAVE_SHANI
+      return cpuSupportsShaNi();
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+QString Sha1::backendName( Backend backend )
+{
+  switch ( backend )
+  {
+    case Generic:
+      return QStringLiteral( "generic" );
+    case ShaNi:
+      return QStringLiteral( "SHA-NI" );
+  }
+  return QString();
+}
+
+Sha1::Sha1( Backend backend )
+  : mCompress( compressGeneric )
+{
+#ifdef SHA1_HAVE_SHANI
+  if ( backend == ShaNi && isSupported( ShaNi ) )
+    mCompress = compressShaNi;
+#else
+  Q_UNUSED( backend )
+#endif
+
+  mState[0] = 0x67452301;
+  mState[1] = 0xEFCDAB89;
+  mState[2] = 0x98BADCFE;
+  mState[3] = 0x10325476;
+  mState[4] = 0xC3D2E1F0;
+}
+
+void Sha1::addData( const char *data, qint64 size )
+{
+  const uchar *p = reinterpret_cast<const uchar *>( data );
+  mLength += static_cast<quint64>( size );
+
+  if ( mBufferSize > 0 )
+  {
+    int copySize = static_cast<int>( qMin<qint64>( size, 64 - mBufferSize ) );
+    memcpy( mBuffer + mBufferSize, p, copySize );
+    mBufferSize += copySize;
+    p += copySize;
+    size -= copySize;
+    if ( mBufferSize < 64 )
+      return;
+    mCompress( mState, mBuffer, 1 );
+    mBufferSize = 0;
+  }
+
+  // whole blocks are hashed directly from the input
+  qint64 blocks = size / 64;
+  if ( blocks > 0 )
+  {
+    mCompress( mState, p, blocks );
+    p += blocks * 64;
+    size -= blocks * 64;
+  }
+
+  memcpy( mBuffer, p, static_cast<size_t>( size ) );
+  mBufferSize = static_cast<int>( size );
+}
+
+QByteArray Sha1::result()
+{
+  quint64 bitLength = mLength * 8;
+  uchar padding[72] = { 0x80 };
+  int paddingSize = mBufferSize < 56 ? 56 - mBufferSize : 120 - mBufferSize;
+  addData( reinterpret_cast<const char *>( padding ), paddingSize );
+
+  uchar length[8];
+  qToBigEndian<quint64>( bitLength, length );
+  addData( reinterpret_cast<const char *>( length ), 8 );
+  Q_ASSERT( mBufferSize == 0 );
+
+  QByteArray digest( 20, Qt::Uninitialized );
+  for ( int i = 0; i < 5; ++i )
+    qToBigEndian<quint32>( mState[i], reinterpret_cast<uchar *>( digest.data() ) + 4 * i );
+  return digest;
+}
+
+QByteArray Sha1::fileChecksum( const QString &filePath )
+{
+  QFile f( filePath );
+  if ( !f.open( QFile::ReadOnly ) )
+    return QByteArray();
+
+  Sha1 hash;
+  const qint64 size = f.size();
+  qint64 offset = 0;
+
+  // mapping by windows limits use of address space for large files
+  while ( offset < size )
+  {
+    qint64 windowSize = qMin( MAP_WINDOW_SIZE, size - offset );
+    uchar *data = f.map( offset, windowSize );
+    if ( !data )
+      break;
+    hash.addData( reinterpret_cast<const char *>( data ), windowSize );
+    f.unmap( data );
+    offset += windowSize;
+  }
+
+  // files which cannot be mapped (e.g. on some virtual file systems) are read
+  if ( offset < size )
+  {
+    if ( !f.seek( offset ) )
+      return QByteArray();
+
+    QByteArray buffer( CHUNK_SIZE, Qt::Uninitialized );
+    qint64 readSize;
+    while ( ( readSize = f.read( buffer.data(), buffer.size() ) ) > 0 )
+    {
+      hash.addData( buffer.constData(), readSize );
+    }
+  }
+
+  f.close();
+  return hash.result().toHex();
+}
@@ -0,0 +1,49 @@
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <QByteArray>
+#include <QString>
+
+/**
+ * SHA-1 hash with a backend chosen at runtime: SHA extensions of x86-64 CPUs (SHA-NI) when available,
+ * otherwise portable C++ implementation. Produces the same digest as QCryptographicHash::Sha1.
+ */
+class Sha1
+{
+  public:
+    enum Backend
+    {
+      Generic,
+      ShaNi
+    };
+
+    //! Backend used by default, the fastest one supported by the CPU
+    static Backend bestBackend();
+    static bool isSupported( Backend backend );
+    static QString backendName( Backend backend );
+
+    explicit Sha1( Backend backend = bestBackend() );
+
+    void addData( const char *data, qint64 size );
+    void addData( const QByteArray &data ) { addData( data.constData(), data.size() ); }
+
+    //! Returns raw 20 bytes digest, no data may be added afterwards
+    QByteArray result();
+
+    //! Returns hex SHA-1 of a file, the file is memory mapped by windows of MAP_WINDOW_SIZE
+    static QByteArray fileChecksum( const QString &filePath );
+
+  private:
+    typedef void ( *CompressFunction )( quint32 *state, const uchar *data, qint64 blocks );
+
+    CompressFunction mCompress;
+    quint32 mState[5];
+    quint64 mLength = 0; // bytes added so far
+    uchar mBuffer[64];
+    int mBufferSize = 0;
+
+    static const qint64 MAP_WINDOW_SIZE = 64 * 1024 * 1024;
+    static const int CHUNK_SIZE = 65536;
+};
+
+#endif // SHA1_H
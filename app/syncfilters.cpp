@@ -0,0 +1,128 @@
+#include "syncfilters.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+SyncFilters::SyncFilters( const QString &filePath )
+  : mFilePath( filePath )
+{
+  load();
+}
+
+QStringList SyncFilters::filter( const QString &projectName ) const
+{
+  return mFilters.value( projectName ).patterns;
+}
+
+void SyncFilters::setFilter( const QString &projectName, const QStringList &patterns )
+{
+  QStringList validPatterns;
+  for ( const QString &pattern : patterns )
+  {
+    QString trimmed = pattern.trimmed();
+    if ( !trimmed.isEmpty() && !validPatterns.contains( trimmed ) )
+      validPatterns << trimmed;
+  }
+
+  if ( validPatterns.isEmpty() )
+    mFilters.remove( projectName );
+  else
+    mFilters.insert( projectName, compile( validPatterns ) );
+  save();
+}
+
+bool SyncFilters::hasFilter( const QString &projectName ) const
+{
+  return mFilters.contains( projectName );
+}
+
+bool SyncFilters::isIncluded( const QString &projectName, const QString &path ) const
+{
+  auto it = mFilters.constFind( projectName );
+  if ( it == mFilters.constEnd() )
+    return true;
+
+  QString suffix = QFileInfo( path ).suffix().toLower();
+  if ( suffix == QStringLiteral( "qgs" ) || suffix == QStringLiteral( "qgz" ) )
+    return true;
+
+  for ( int i = 0; i < it->patterns.size(); ++i )
+  {
+    if ( matches( it->patterns.at( i ), it->wildcards.at( i ), path ) )
+      return true;
+  }
+  return false;
+}
+
+SyncFilters::Filter SyncFilters::compile( const QStringList &patterns )
+{
+  Filter filter;
+  filter.patterns = patterns;
+  for ( const QString &pattern : patterns )
+  {
+    bool hasWildcard = pattern.contains( '*' ) || pattern.contains( '?' ) || pattern.contains( '[' );
+    filter.wildcards << ( hasWildcard ? QRegExp( pattern, Qt::CaseInsensitive, QRegExp::WildcardUnix ) : QRegExp() );
+  }
+  return filter;
+}
+
+bool SyncFilters::matches( const QString &pattern, const QRegExp &wildcard, const QString &path )
+{
+  if ( !wildcard.isEmpty() )
+  {
+    // QRegExp keeps state of the last match, a copy is matched so copies of filters can be used by other threads
+    QRegExp matcher( wildcard );
+    return matcher.exactMatch( pattern.contains( '/' ) ? path : path.mid( path.lastIndexOf( '/' ) + 1 ) );
+  }
+
+  if ( pattern.endsWith( '/' ) )
+    return path.startsWith( pattern, Qt::CaseInsensitive );
+
+  return path.compare( pattern, Qt::CaseInsensitive ) == 0 || path.startsWith( pattern + '/', Qt::CaseInsensitive );
+}
+
+bool SyncFilters::save()
+{
+  QJsonObject projects;
+  for ( auto it = mFilters.constBegin(); it != mFilters.constEnd(); ++it )
+    projects.insert( it.key(), QJsonArray::fromStringList( it->patterns ) );
+
+  QJsonObject filters;
+  filters.insert( QStringLiteral( "version" ), 1 );
+  filters.insert( QStringLiteral( "projects" ), projects );
+
+  QSaveFile file( mFilePath );
+  if ( !file.open( QIODevice::WriteOnly ) )
+  {
+    qDebug() << "Failed to write sync filters" << mFilePath;
+    return false;
+  }
+  file.write( QJsonDocument( filters ).toJson( QJsonDocument::Compact ) );
+  return file.commit();
+}
+
+void SyncFilters::load()
+{
+  QFile file( mFilePath );
+  if ( !file.open( QIODevice::ReadOnly ) )
+    return;
+
+  QJsonObject filters = QJsonDocument::fromJson( file.readAll() ).object();
+  if ( filters.value( QStringLiteral( "version" ) ).toInt() != 1 )
+    return;
+
+  QJsonObject projects = filters.value( QStringLiteral( "projects" ) ).toObject();
+  for ( auto it = projects.constBegin(); it != projects.constEnd(); ++it )
+  {
+    QStringList patterns;
+    for ( const QJsonValue &pattern : it.value().toArray() )
+      patterns << pattern.toString();
+    if ( !patterns.isEmpty() )
+      mFilters.insert( it.key(), compile( patterns ) );
+  }
+}
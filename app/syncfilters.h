@@ -0,0 +1,54 @@
+#ifndef SYNCFILTERS_H
+#define SYNCFILTERS_H
+
+#include <QHash>
+#include <QRegExp>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * Selective sync: per-project lists of patterns of files which are synced, other files of the project are neither
+ * downloaded, uploaded nor removed on either side. A project without a filter syncs all files. QGIS project files
+ * are always synced, so the project can be opened. Filters are kept in a JSON file in the data dir.
+ *
+ * A pattern ending with '/' selects a folder, a pattern with wildcards (*, ?, [...]) matches the whole path
+ * if it contains '/', otherwise the file name (e.g. "*.gpkg" selects all GeoPackages, i.e. layers),
+ * any other pattern selects a file or a folder of that path. Patterns match case-insensitively, as file names
+ * of the project may have been created on a platform with a case-insensitive file system.
+ * A copy of the filters may be read by another thread, e.g. when files of a project are listed.
+ */
+class SyncFilters
+{
+  public:
+    //! Loads filters from a file
+    explicit SyncFilters( const QString &filePath );
+
+    //! Patterns of files synced in a project, empty if all files are synced
+    QStringList filter( const QString &projectName ) const;
+
+    //! Sets patterns of files synced in a project and saves the filters, empty list syncs all files again
+    void setFilter( const QString &projectName, const QStringList &patterns );
+
+    bool hasFilter( const QString &projectName ) const;
+
+    //! Whether a file given by path relative to the project dir is synced
+    bool isIncluded( const QString &projectName, const QString &path ) const;
+
+  private:
+    struct Filter
+    {
+      QStringList patterns;
+      QVector<QRegExp> wildcards; // compiled patterns with wildcards, empty for other patterns
+    };
+
+    static Filter compile( const QStringList &patterns );
+    static bool matches( const QString &pattern, const QRegExp &wildcard, const QString &path );
+    bool save();
+    void load();
+
+    QString mFilePath;
+    QHash<QString, Filter> mFilters; // project name -> filter
+};
+
+#endif // SYNCFILTERS_H
@@ -0,0 +1,85 @@
+#include "syncmanifest.h"
+#include "jsonreader.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+SyncManifest::SyncManifest( const QString &projectDir )
+{
+  QFile file( manifestFilePath( projectDir ) );
+  if ( !file.open( QIODevice::ReadOnly ) )
+    return;
+
+  mData = file.readAll();
+  JsonReader reader( mData );
+  if ( reader.next() != JsonReader::BeginObject )
+    return;
+
+  int version = 0;
+  while ( reader.next() == JsonReader::Key )
+  {
+    const QByteArray key = reader.rawString();
+    const JsonReader::Token value = reader.next();
+    if ( key == "version" && value == JsonReader::Number )
+      version = static_cast<int>( reader.number() );
+    else if ( key == "projectVersion" && value == JsonReader::String )
+      mProjectVersion = reader.string();
+    else if ( key == "updated" && value == JsonReader::String )
+      mUpdated = reader.dateTime();
+    else
+      reader.skipValue();
+  }
+  mValid = version == 1 && reader.next() == JsonReader::End;
+  if ( !mValid )
+    mData.clear();
+}
+
+bool SyncManifest::isVersion( const QString &projectVersion, const QDateTime &updated ) const
+{
+  if ( !mValid )
+    return false;
+  if ( !mProjectVersion.isEmpty() || !projectVersion.isEmpty() )
+    return mProjectVersion == projectVersion;
+  return mUpdated.isValid() && mUpdated == updated;
+}
+
+bool SyncManifest::save( const QString &projectDir, const QString &projectVersion, const QDateTime &updated, const QList<Entry> &files )
+{
+  QJsonArray filesArray;
+  for ( const Entry &entry : files )
+  {
+    QJsonObject fileObject;
+    fileObject.insert( QStringLiteral( "path" ), entry.path );
+    fileObject.insert( QStringLiteral( "checksum" ), entry.checksum );
+    fileObject.insert( QStringLiteral( "size" ), static_cast<double>( entry.size ) );
+    filesArray.append( fileObject );
+  }
+
+  QJsonObject manifest;
+  manifest.insert( QStringLiteral( "version" ), 1 );
+  manifest.insert( QStringLiteral( "projectVersion" ), projectVersion );
+  manifest.insert( QStringLiteral( "updated" ), updated.toUTC().toString( Qt::ISODateWithMs ) );
+  manifest.insert( QStringLiteral( "files" ), filesArray );
+
+  QString filePath = manifestFilePath( projectDir );
+  QDir().mkpath( QFileInfo( filePath ).absolutePath() );
+  QSaveFile file( filePath );
+  if ( !file.open( QIODevice::WriteOnly ) )
+  {
+    qDebug() << "Failed to write sync manifest" << filePath;
+    return false;
+  }
+  file.write( QJsonDocument( manifest ).toJson( QJsonDocument::Compact ) );
+  return file.commit();
+}
+
+QString SyncManifest::manifestFilePath( const QString &projectDir )
+{
+  return QDir( projectDir ).filePath( QStringLiteral( ".mergin/manifest.json" ) );
+}
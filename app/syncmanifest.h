@@ -0,0 +1,57 @@
+#ifndef SYNCMANIFEST_H
+#define SYNCMANIFEST_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QList>
+#include <QString>
+
+/**
+ * Snapshot of the server version a local copy of a project has been synced from: version of the project and path,
+ * checksum and size of its server files, stored in the project's metadata folder after each successful sync.
+ * Local files are compared with it instead of the server listing, so local changes are found without any request
+ * and the server is asked only whether its version is still the same.
+ *
+ * The manifest is written in the format of project info (see MerginApi::readProjectFiles), with "version" being
+ * the version of the file format and "projectVersion" the version of the project given by the server, if any.
+ */
+class SyncManifest
+{
+  public:
+    struct Entry
+    {
+      QString path;
+      QString checksum;
+      qint64 size = 0;
+    };
+
+    //! Loads the manifest of a project, missing or corrupted file results in an invalid manifest
+    explicit SyncManifest( const QString &projectDir );
+
+    bool isValid() const { return mValid; }
+    QString projectVersion() const { return mProjectVersion; }
+    //! Time of the server version
+    QDateTime updated() const { return mUpdated; }
+
+    //! Content of the manifest file, files are read from it by MerginApi::readProjectFiles
+    QByteArray data() const { return mData; }
+
+    /**
+     * Whether the server version is the one the manifest has been saved from. Versions given by the server
+     * are compared if there are any, times of versions otherwise.
+     */
+    bool isVersion( const QString &projectVersion, const QDateTime &updated ) const;
+
+    //! Replaces the manifest of a project, returns false on failure
+    static bool save( const QString &projectDir, const QString &projectVersion, const QDateTime &updated, const QList<Entry> &files );
+
+    static QString manifestFilePath( const QString &projectDir );
+
+  private:
+    bool mValid = false;
+    QString mProjectVersion;
+    QDateTime mUpdated;
+    QByteArray mData;
+};
+
+#endif // SYNCMANIFEST_H
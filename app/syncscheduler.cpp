@@ -0,0 +1,137 @@
+#include "syncscheduler.h"
+
+#include <QTimer>
+
+SyncScheduler::SyncScheduler( QObject *parent )
+  : QObject( parent )
+{
+}
+
+int SyncScheduler::maxRunningJobs() const
+{
+  return mMaxRunningJobs;
+}
+
+void SyncScheduler::setMaxRunningJobs( int maxRunningJobs )
+{
+  mMaxRunningJobs = qMax( 1, maxRunningJobs );
+  startJobs();
+}
+
+std::shared_ptr<SyncJob> SyncScheduler::enqueue( const QString &projectName, SyncJob::Type type, SyncJob::Priority priority )
+{
+  if ( mRunning.contains( projectName ) )
+    return nullptr;
+
+  std::shared_ptr<SyncJob> job = SyncScheduler::job( projectName );
+  if ( job )
+  {
+    // a queued job is merged with the new request
+    mQueue.removeOne( job );
+    job->priority = qMax( job->priority, priority );
+    if ( type == SyncJob::Upload || job->type == SyncJob::Download )
+      job->type = type;
+  }
+  else
+  {
+    job = std::make_shared<SyncJob>();
+    job->id = mNextId++;
+    job->projectName = projectName;
+    job->type = type;
+    job->priority = priority;
+  }
+
+  // behind jobs of the same or higher priority
+  int index = 0;
+  while ( index < mQueue.size() && mQueue.at( index )->priority >= job->priority )
+    ++index;
+  mQueue.insert( index, job );
+  emit jobStateChanged( projectName, SyncJob::Queued );
+
+  startJobs();
+  return job;
+}
+
+std::shared_ptr<SyncJob> SyncScheduler::job( const QString &projectName ) const
+{
+  if ( mRunning.contains( projectName ) )
+    return mRunning.value( projectName );
+
+  for ( const std::shared_ptr<SyncJob> &job : mQueue )
+  {
+    if ( job->projectName == projectName )
+      return job;
+  }
+  return nullptr;
+}
+
+QList<std::shared_ptr<SyncJob>> SyncScheduler::jobs() const
+{
+  return mRunning.values() + mQueue;
+}
+
+bool SyncScheduler::cancel( const QString &projectName )
+{
+  std::shared_ptr<SyncJob> job = SyncScheduler::job( projectName );
+  if ( !job )
+    return false;
+
+  if ( job->state == SyncJob::Running )
+  {
+    job->cancelRequested = true;
+    return false;
+  }
+
+  mQueue.removeOne( job );
+  setState( *job, SyncJob::Cancelled );
+  return true;
+}
+
+void SyncScheduler::setProgress( const QString &projectName, qint64 bytesDone, qint64 bytesTotal )
+{
+  std::shared_ptr<SyncJob> job = mRunning.value( projectName );
+  if ( !job )
+    return;
+
+  job->bytesDone = bytesDone;
+  job->bytesTotal = bytesTotal;
+  emit jobProgress( projectName, bytesDone, bytesTotal );
+}
+
+void SyncScheduler::finish( const QString &projectName, bool successfully )
+{
+  std::shared_ptr<SyncJob> job = mRunning.take( projectName );
+  if ( !job )
+    return;
+
+  if ( job->cancelRequested )
+    setState( *job, SyncJob::Cancelled );
+  else
+    setState( *job, successfully ? SyncJob::Finished : SyncJob::Failed );
+
+  // the runner may be still in the middle of handling of the finished job
+  QTimer::singleShot( 0, this, &SyncScheduler::startJobs );
+}
+
+void SyncScheduler::startJobs()
+{
+  // a job may be finished as soon as it is started, the outer call continues then
+  if ( mStartingJobs )
+    return;
+
+  mStartingJobs = true;
+  while ( !mQueue.isEmpty() && mRunning.size() < mMaxRunningJobs )
+  {
+    std::shared_ptr<SyncJob> job = mQueue.takeFirst();
+    mRunning.insert( job->projectName, job );
+    setState( *job, SyncJob::Running );
+    emit jobStarted( job->projectName );
+  }
+  mStartingJobs = false;
+}
+
+void SyncScheduler::setState( SyncJob &job, SyncJob::State state )
+{
+  job.state = state;
+  emit jobStateChanged( job.projectName, state );
+}
@@ -0,0 +1,113 @@
+#ifndef SYNCSCHEDULER_H
+#define SYNCSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <memory>
+
+class SyncStats;
+
+/**
+ * Sync operation of a project. A project has at most one job queued or running, which keeps
+ * all state of the operation, so syncs of several projects running at once do not mix up.
+ */
+struct SyncJob
+{
+  enum Type
+  {
+    Download, // whole project in a single request
+    Update,
+    Upload // preceded by an update if the project has changed on the server, see updateBeforeUpload
+  };
+
+  enum State
+  {
+    Queued,
+    Running,
+    Finished,
+    Failed,
+    Cancelled
+  };
+
+  enum Priority
+  {
+    Background, // e.g. periodic sync, runs when no interactive job is waiting
+    Interactive // requested by the user
+  };
+
+  int id = 0;
+  QString projectName;
+  Type type = Update;
+  Priority priority = Interactive;
+  State state = Queued;
+  bool updateBeforeUpload = false; // upload job is updating the project, the upload continues when it is done
+  bool cancelRequested = false; // running requests are aborted, no further step is started
+  QSet<QString> obsoleteFiles; // files removed on the server, deleted locally when the update succeeds
+  qint64 bytesDone = 0;
+  qint64 bytesTotal = 0;
+  std::shared_ptr<SyncStats> stats; // telemetry of the running job, see MerginApi::syncStatsRecorded
+};
+
+/**
+ * Queue of sync jobs of projects. Jobs are started in order of priority and then of their requests,
+ * at most maxRunningJobs at once. MerginApi runs the started job (see jobStarted) and reports
+ * its progress and end here, the scheduler starts next jobs then.
+ */
+class SyncScheduler: public QObject
+{
+    Q_OBJECT
+  public:
+    explicit SyncScheduler( QObject *parent = nullptr );
+
+    int maxRunningJobs() const;
+    //! Limits number of jobs running at once, each of them may use several requests (see MerginApi::syncConcurrency)
+    void setMaxRunningJobs( int maxRunningJobs );
+
+    /**
+     * Queues a job and starts it if the limit of running jobs allows it. If the project has a queued job already,
+     * the job is reused: its priority is raised and an update is turned to an upload. Returns nullptr
+     * if the project has a running job.
+     */
+    std::shared_ptr<SyncJob> enqueue( const QString &projectName, SyncJob::Type type, SyncJob::Priority priority );
+
+    //! Queued or running job of a project, nullptr if there is none
+    std::shared_ptr<SyncJob> job( const QString &projectName ) const;
+
+    //! All queued and running jobs, running first
+    QList<std::shared_ptr<SyncJob>> jobs() const;
+
+    /**
+     * Removes a queued job and returns true. A running job is only marked by cancelRequested,
+     * it is up to the runner to stop it and to call finish().
+     */
+    bool cancel( const QString &projectName );
+
+    //! Updates progress of a running job
+    void setProgress( const QString &projectName, qint64 bytesDone, qint64 bytesTotal );
+
+    //! Ends a running job, cancelled if cancellation has been requested, next jobs are started afterwards
+    void finish( const QString &projectName, bool successfully );
+
+  signals:
+    //! Job of the project has been started, the runner should start its requests
+    void jobStarted( const QString &projectName );
+    void jobStateChanged( const QString &projectName, SyncJob::State state );
+    void jobProgress( const QString &projectName, qint64 bytesDone, qint64 bytesTotal );
+
+  private:
+    void startJobs();
+    void setState( SyncJob &job, SyncJob::State state );
+
+    QList<std::shared_ptr<SyncJob>> mQueue; // ordered by priority, FIFO within a priority
+    QHash<QString, std::shared_ptr<SyncJob>> mRunning; // project name -> job
+    int mMaxRunningJobs = DEFAULT_MAX_RUNNING_JOBS;
+    int mNextId = 1;
+    bool mStartingJobs = false;
+
+    static const int DEFAULT_MAX_RUNNING_JOBS = 3;
+};
+
+#endif // SYNCSCHEDULER_H
@@ -0,0 +1,192 @@
+#include "syncstats.h"
+
+#include <QSysInfo>
+
+#ifdef Q_OS_UNIX
+#include <time.h>
+#endif
+
+SyncStats::SyncStats( const QString &projectName, const QString &type )
+  : mProjectName( projectName )
+  , mType( type )
+  , mStarted( QDateTime::currentDateTimeUtc() )
+{
+  mTimer.start();
+}
+
+void SyncStats::enter( Phase phase )
+{
+  switchPhase();
+  mPhaseStack.append( phase );
+  mPhases[phase].count++;
+}
+
+void SyncStats::leave()
+{
+  if ( mPhaseStack.isEmpty() )
+    return;
+
+  switchPhase();
+  mPhaseStack.removeLast();
+}
+
+void SyncStats::begin( Phase phase )
+{
+  PhaseTime &time = mPhases[phase];
+  if ( time.beginWall >= 0 )
+    return;
+
+  time.beginWall = mTimer.nsecsElapsed();
+  time.beginCpu = processCpuNsecs();
+  time.count++;
+}
+
+void SyncStats::end( Phase phase )
+{
+  PhaseTime &time = mPhases[phase];
+  if ( time.beginWall < 0 )
+    return;
+
+  time.wallNsecs += mTimer.nsecsElapsed() - time.beginWall;
+  time.cpuNsecs += processCpuNsecs() - time.beginCpu;
+  time.beginWall = -1;
+}
+
+void SyncStats::addRequest()
+{
+  mRequests++;
+}
+
+void SyncStats::addRetry()
+{
+  mRetries++;
+}
+
+void SyncStats::addBytesReceived( qint64 bytes )
+{
+  mBytesReceived += bytes;
+}
+
+void SyncStats::addBytesSent( qint64 bytes )
+{
+  mBytesSent += bytes;
+}
+
+void SyncStats::addBytesRead( qint64 bytes )
+{
+  mBytesRead += bytes;
+}
+
+void SyncStats::addBytesWritten( qint64 bytes )
+{
+  mBytesWritten += bytes;
+}
+
+QJsonObject SyncStats::toJson( bool successful ) const
+{
+  QJsonObject phases;
+  for ( int i = 0; i < PhaseCount; ++i )
+  {
+    const PhaseTime &time = mPhases[i];
+    qint64 wallNsecs = time.wallNsecs;
+    qint64 cpuNsecs = time.cpuNsecs;
+    if ( time.beginWall >= 0 )
+    {
+      // the sync has ended while waiting, e.g. it has been cancelled
+      wallNsecs += mTimer.nsecsElapsed() - time.beginWall;
+      cpuNsecs += processCpuNsecs() - time.beginCpu;
+    }
+
+    QJsonObject phase;
+    phase.insert( QStringLiteral( "wall" ), wallNsecs / 1e6 );
+    phase.insert( QStringLiteral( "cpu" ), cpuNsecs / 1e6 );
+    phase.insert( QStringLiteral( "count" ), time.count );
+    phases.insert( phaseName( static_cast<Phase>( i ) ), phase );
+  }
+
+  QJsonObject stats;
+  stats.insert( QStringLiteral( "project" ), mProjectName );
+  stats.insert( QStringLiteral( "type" ), mType );
+  stats.insert( QStringLiteral( "started" ), mStarted.toString( Qt::ISODateWithMs ) );
+  stats.insert( QStringLiteral( "successful" ), successful );
+  stats.insert( QStringLiteral( "wall" ), mTimer.nsecsElapsed() / 1e6 );
+  stats.insert( QStringLiteral( "phases" ), phases );
+  stats.insert( QStringLiteral( "requests" ), mRequests );
+  stats.insert( QStringLiteral( "retries" ), mRetries );
+  stats.insert( QStringLiteral( "bytesReceived" ), static_cast<double>( mBytesReceived ) );
+  stats.insert( QStringLiteral( "bytesSent" ), static_cast<double>( mBytesSent ) );
+  stats.insert( QStringLiteral( "bytesRead" ), static_cast<double>( mBytesRead ) );
+  stats.insert( QStringLiteral( "bytesWritten" ), static_cast<double>( mBytesWritten ) );
+  // syncs of different devices are compared
+  stats.insert( QStringLiteral( "device" ), QSysInfo::prettyProductName() + ' ' + QSysInfo::currentCpuArchitecture() );
+  return stats;
+}
+
+QString SyncStats::phaseName( Phase phase )
+{
+  switch ( phase )
+  {
+    case ProjectInfo:
+      return QStringLiteral( "projectInfo" );
+    case Hashing:
+      return QStringLiteral( "hashing" );
+    case Diffing:
+      return QStringLiteral( "diffing" );
+    case Transfer:
+      return QStringLiteral( "transfer" );
+    case Parsing:
+      return QStringLiteral( "parsing" );
+    case DiskWrite:
+      return QStringLiteral( "diskWrite" );
+    case PhaseCount:
+      break;
+  }
+  return QString();
+}
+
+void SyncStats::switchPhase()
+{
+  qint64 wall = mTimer.nsecsElapsed();
+  qint64 cpu = threadCpuNsecs();
+  if ( !mPhaseStack.isEmpty() )
+  {
+    PhaseTime &time = mPhases[mPhaseStack.last()];
+    time.wallNsecs += wall - mSwitchWall;
+    time.cpuNsecs += cpu - mSwitchCpu;
+  }
+  mSwitchWall = wall;
+  mSwitchCpu = cpu;
+}
+
+qint64 SyncStats::threadCpuNsecs()
+{
+#if defined( Q_OS_UNIX ) && defined( CLOCK_THREAD_CPUTIME_ID )
+  struct timespec time;
+  if ( ::clock_gettime( CLOCK_THREAD_CPUTIME_ID, &time ) == 0 )
+    return static_cast<qint64>( time.tv_sec ) * 1000000000 + time.tv_nsec;
+#endif
+  return 0;
+}
+
+qint64 SyncStats::processCpuNsecs()
+{
+#if defined( Q_OS_UNIX ) && defined( CLOCK_PROCESS_CPUTIME_ID )
+  struct timespec time;
+  if ( ::clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &time ) == 0 )
+    return static_cast<qint64>( time.tv_sec ) * 1000000000 + time.tv_nsec;
+#endif
+  return 0;
+}
+
+SyncPhaseScope::SyncPhaseScope( SyncStats *stats, SyncStats::Phase phase )
+  : mStats( stats )
+{
+  if ( mStats )
+    mStats->enter( phase );
+}
+
+SyncPhaseScope::~SyncPhaseScope()
+{
+  if ( mStats )
+    mStats->leave();
+}
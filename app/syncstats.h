@@ -0,0 +1,96 @@
+#ifndef SYNCSTATS_H
+#define SYNCSTATS_H
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+
+/**
+ * Telemetry of a sync of a project: wall and CPU time of its phases, bytes transferred over the network
+ * and read from / written to disk, numbers of requests and retries. It is reported by MerginApi::syncStatsRecorded
+ * when the sync job ends and optionally appended to a JSONL log (see MerginApi::setSyncLogFile).
+ *
+ * Synchronous phases (diffing, parsing, disk writes) are timed exclusively with enter() / leave(): when a phase
+ * is entered within another one, time of the outer phase is paused, CPU time is that of the main thread.
+ * Asynchronous phases (project info request, hashing in a thread pool, transfer) are timed from begin() to end(),
+ * they overlap with other phases and syncs of other projects, so their CPU time is that of the whole process.
+ */
+class SyncStats
+{
+  public:
+    enum Phase
+    {
+      ProjectInfo, // request for the list of project files
+      Hashing, // checksums of local files
+      Diffing, // comparison of local and server files
+      Transfer, // from the first to the last request of a download or an upload
+      Parsing, // received data stream, except writes of the received files
+      DiskWrite, // queueing of received files in DiskWriter, moves of staged files and base copies of GeoPackages
+      PhaseCount
+    };
+
+    SyncStats( const QString &projectName, const QString &type );
+
+    void enter( Phase phase );
+    void leave();
+
+    void begin( Phase phase );
+    void end( Phase phase );
+
+    void addRequest();
+    void addRetry();
+    void addBytesReceived( qint64 bytes );
+    void addBytesSent( qint64 bytes );
+    void addBytesRead( qint64 bytes );
+    void addBytesWritten( qint64 bytes );
+
+    //! Structured record of the sync, all times are in msecs
+    QJsonObject toJson( bool successful ) const;
+
+    static QString phaseName( Phase phase );
+
+  private:
+    struct PhaseTime
+    {
+      qint64 wallNsecs = 0;
+      qint64 cpuNsecs = 0;
+      int count = 0;
+      qint64 beginWall = -1; // asynchronous phase which is running, -1 otherwise
+      qint64 beginCpu = 0;
+    };
+
+    //! Adds time since the last switch of synchronous phases to the current one
+    void switchPhase();
+    static qint64 threadCpuNsecs();
+    static qint64 processCpuNsecs();
+
+    QString mProjectName;
+    QString mType;
+    QDateTime mStarted;
+    QElapsedTimer mTimer;
+    PhaseTime mPhases[PhaseCount];
+    QVector<Phase> mPhaseStack; // entered synchronous phases
+    qint64 mSwitchWall = 0;
+    qint64 mSwitchCpu = 0;
+    int mRequests = 0;
+    int mRetries = 0;
+    qint64 mBytesReceived = 0;
+    qint64 mBytesSent = 0;
+    qint64 mBytesRead = 0;
+    qint64 mBytesWritten = 0;
+};
+
+//! Times a synchronous phase of a sync in a scope, stats may be null
+class SyncPhaseScope
+{
+  public:
+    SyncPhaseScope( SyncStats *stats, SyncStats::Phase phase );
+    ~SyncPhaseScope();
+
+  private:
+    SyncStats *mStats;
+};
+
+#endif // SYNCSTATS_H
@@ -0,0 +1,764 @@
+#include <QtCore/QObject>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QCryptographicHash>
+#include <QSignalSpy>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <cstring>
+#include <cstdlib>
+
+#include "benchmerginapi.h"
+#include "multipartparser.h"
+#include "filehasher.h"
+#include "sha1.h"
+#include "blockdelta.h"
+#include "localmerginserver.h"
+#include "projectscache.h"
+#include "jsonreader.h"
+
+namespace
+{
+  /**
+   * Generates multipart stream of given number of parts with pseudo-random content
+   * without holding the whole stream in memory.
+   */
+  class SyntheticMultipartStream
+  {
+    public:
+      SyntheticMultipartStream( const QByteArray &boundary, qint64 partSize, int partsCount )
+        : mPartSize( partSize )
+        , mPartsCount( partsCount )
+      {
+        mHeader = "--" + boundary + "\r\nContent-Disposition: form-data; name=\"file\"; filename=\"file.bin\"\r\n\r\n";
+        mTrailer = "\r\n";
+        mEnd = "--" + boundary + "--\r\n";
+
+        qsrand( 1 );
+        mBlock.resize( 1024 * 1024 );
+        for ( int i = 0; i < mBlock.size(); ++i )
+          mBlock[i] = static_cast<char>( qrand() % 256 );
+      }
+
+      int read( char *data, int maxSize )
+      {
+        int written = 0;
+        while ( written < maxSize && mPart <= mPartsCount )
+        {
+          if ( mPart == mPartsCount )
+          {
+            written += copy( mEnd, data + written, maxSize - written );
+            if ( mOffset == mEnd.size() )
+              ++mPart;
+            continue;
+          }
+
+          qint64 partLength = mHeader.size() + mPartSize + mTrailer.size();
+          if ( mOffset < mHeader.size() )
+          {
+            written += copy( mHeader, data + written, maxSize - written );
+          }
+          else if ( mOffset < mHeader.size() + mPartSize )
+          {
+            qint64 bodyOffset = mOffset - mHeader.size();
+            int blockOffset = static_cast<int>( bodyOffset % mBlock.size() );
+            int size = static_cast<int>( qMin<qint64>( qMin<qint64>( maxSize - written, mBlock.size() - blockOffset ), mPartSize - bodyOffset ) );
+            memcpy( data + written, mBlock.constData() + blockOffset, size );
+            written += size;
+            mOffset += size;
+          }
+          else
+          {
+            QByteArray trailer = mTrailer;
+            qint64 trailerOffset = mOffset - mHeader.size() - mPartSize;
+            int size = static_cast<int>( qMin<qint64>( maxSize - written, trailer.size() - trailerOffset ) );
+            memcpy( data + written, trailer.constData() + trailerOffset, size );
+            written += size;
+            mOffset += size;
+          }
+
+          if ( mOffset == partLength )
+          {
+            mOffset = 0;
+            ++mPart;
+          }
+        }
+        return written;
+      }
+
+    private:
+      int copy( const QByteArray &source, char *data, int maxSize )
+      {
+        int size = static_cast<int>( qMin<qint64>( maxSize, source.size() - mOffset ) );
+        memcpy( data, source.constData() + mOffset, size );
+        mOffset += size;
+        return size;
+      }
+
+      QByteArray mHeader;
+      QByteArray mTrailer;
+      QByteArray mEnd;
+      QByteArray mBlock;
+      qint64 mPartSize;
+      int mPartsCount;
+      int mPart = 0;
+      qint64 mOffset = 0;
+  };
+}
+
+BenchMerginApi::BenchMerginApi( MerginApi *api, QObject *parent )
+  : QObject( parent )
+  , mApi( api )
+{
+  benchMultipartParser();
+  benchHashing();
+  benchSha1();
+  benchDeltaTransfer();
+  benchProjectsCache();
+  benchJsonParsing();
+  benchSyncThroughput();
+
+  qDebug() << "BenchMerginApi - ALL BENCHMARKS FINISHED";
+}
+
+void BenchMerginApi::benchMultipartParser()
+{
+  qDebug() << "BenchMerginApi::benchMultipartParser START";
+
+  // parts from 1 KB to 4 GB, small parts are repeated to get at least 64 MB stream
+  const qint64 minStreamSize = 64 * 1024 * 1024;
+  const qint64 maxPartSize = maxSize( "BENCH_MAX_PART_SIZE", 4LL * 1024 * 1024 * 1024 );
+  const QByteArray boundary( "3d6b6a416f9b5f6a3c8b1e2d4f5a6b7c" );
+
+  for ( qint64 partSize = 1024; partSize <= maxPartSize; partSize *= 4 )
+  {
+    int partsCount = static_cast<int>( qMax<qint64>( 1, minStreamSize / partSize ) );
+    SyntheticMultipartStream stream( boundary, partSize, partsCount );
+    MultipartParser parser( boundary );
+
+    qint64 parsedBytes = 0;
+    int parsedParts = 0;
+    bool finished = false;
+    QElapsedTimer timer;
+    timer.start();
+    while ( !finished )
+    {
+      switch ( parser.next() )
+      {
+        case MultipartParser::NeedMoreData:
+        {
+          int size = stream.read( parser.writeBuffer(), parser.writeCapacity() );
+          if ( size == 0 )
+            parser.finish();
+          parser.commitWrite( size );
+          break;
+        }
+        case MultipartParser::PartData:
+          parsedBytes += parser.dataSize();
+          break;
+        case MultipartParser::PartEnd:
+          ++parsedParts;
+          break;
+        case MultipartParser::PartBegin:
+          break;
+        case MultipartParser::Finished:
+        case MultipartParser::Error:
+          finished = true;
+          break;
+      }
+    }
+    qint64 nsecs = qMax<qint64>( 1, timer.nsecsElapsed() );
+
+    if ( parsedBytes != partSize * partsCount || parsedParts != partsCount )
+    {
+      qDebug() << "BenchMerginApi::benchMultipartParser FAILED: parsed" << parsedBytes << "bytes in" << parsedParts << "parts";
+      return;
+    }
+
+    qDebug() << QStringLiteral( "part size %1 B, parts %2: %3 MB/s, %4 ns/B" )
+             .arg( partSize )
+             .arg( partsCount )
+             .arg( parsedBytes * 1000.0 / nsecs, 0, 'f', 1 )
+             .arg( static_cast<double>( nsecs ) / parsedBytes, 0, 'f', 3 );
+  }
+
+  qDebug() << "BenchMerginApi::benchMultipartParser FINISHED";
+}
+
+void BenchMerginApi::benchHashing()
+{
+  qDebug() << "BenchMerginApi::benchHashing START";
+
+  // synthetic project of 10k small files and a few large files
+  const int smallFilesCount = static_cast<int>( maxSize( "BENCH_SMALL_FILES_COUNT", 10000 ) );
+  const qint64 smallFileSize = 4 * 1024;
+  const int largeFilesCount = 3;
+  const qint64 largeFileSize = maxSize( "BENCH_LARGE_FILE_SIZE", 2LL * 1024 * 1024 * 1024 );
+
+  QTemporaryDir projectDir;
+  QByteArray block( 1024 * 1024, Qt::Uninitialized );
+  qsrand( 1 );
+  for ( int i = 0; i < block.size(); ++i )
+    block[i] = static_cast<char>( qrand() % 256 );
+
+  QStringList filePaths;
+  qint64 totalSize = 0;
+  for ( int i = 0; i < smallFilesCount; ++i )
+  {
+    QString filePath = projectDir.path() + QStringLiteral( "/small/%1/%2.csv" ).arg( i / 1000 ).arg( i );
+    QDir().mkpath( QFileInfo( filePath ).absolutePath() );
+    QFile file( filePath );
+    if ( !file.open( QIODevice::WriteOnly ) )
+    {
+      qDebug() << "BenchMerginApi::benchHashing FAILED: cannot write" << filePath;
+      return;
+    }
+    file.write( block.constData() + ( i * smallFileSize ) % ( block.size() - smallFileSize ), smallFileSize );
+    filePaths << filePath;
+    totalSize += smallFileSize;
+  }
+  for ( int i = 0; i < largeFilesCount; ++i )
+  {
+    QString filePath = projectDir.path() + QStringLiteral( "/large%1.tif" ).arg( i );
+    QFile file( filePath );
+    if ( !file.open( QIODevice::WriteOnly ) )
+    {
+      qDebug() << "BenchMerginApi::benchHashing FAILED: cannot write" << filePath;
+      return;
+    }
+    for ( qint64 written = 0; written < largeFileSize; written += block.size() )
+      file.write( block.constData(), qMin<qint64>( block.size(), largeFileSize - written ) );
+    filePaths << filePath;
+    totalSize += largeFileSize;
+  }
+
+  // files are read once before measurements, so all runs hash from page cache
+  FileHasher hasher;
+  const int maxThreads = hasher.maxThreadCount();
+  QVector<QByteArray> expected;
+  for ( int threads = 0; threads <= maxThreads; threads = threads ? threads * 2 : 1 )
+  {
+    hasher.setMaxThreadCount( threads ? threads : maxThreads );
+    QVector<QByteArray> checksums;
+    QEventLoop loop;
+    QElapsedTimer timer;
+    timer.start();
+    hasher.hash( filePaths, [&]( const QVector<QByteArray> &results )
+    {
+      checksums = results;
+      loop.quit();
+    } );
+    loop.exec();
+    qint64 nsecs = qMax<qint64>( 1, timer.nsecsElapsed() );
+
+    if ( threads == 0 )
+    {
+      expected = checksums; // warm-up
+      continue;
+    }
+    if ( checksums != expected )
+    {
+      qDebug() << "BenchMerginApi::benchHashing FAILED: checksums differ with" << threads << "threads";
+      return;
+    }
+
+    qDebug() << QStringLiteral( "%1 files, %2 MB, threads %3: %4 ms, %5 MB/s" )
+             .arg( filePaths.size() )
+             .arg( totalSize / ( 1024 * 1024 ) )
+             .arg( threads )
+             .arg( nsecs / 1000000 )
+             .arg( totalSize * 1000.0 / nsecs, 0, 'f', 1 );
+  }
+
+  qDebug() << "BenchMerginApi::benchHashing FINISHED";
+}
+
+void BenchMerginApi::benchSha1()
+{
+  qDebug() << "BenchMerginApi::benchSha1 START";
+
+  const qint64 dataSize = maxSize( "BENCH_SHA1_SIZE", 1024LL * 1024 * 1024 );
+  QByteArray block( 16 * 1024 * 1024, Qt::Uninitialized );
+  qsrand( 1 );
+  for ( int i = 0; i < block.size(); ++i )
+    block[i] = static_cast<char>( qrand() % 256 );
+
+  auto report = [dataSize]( const QString &name, qint64 nsecs )
+  {
+    nsecs = qMax<qint64>( 1, nsecs );
+    qDebug() << QStringLiteral( "%1: %2 MB/s, %3 ns/B" )
+             .arg( name )
+             .arg( dataSize * 1000.0 / nsecs, 0, 'f', 1 )
+             .arg( static_cast<double>( nsecs ) / dataSize, 0, 'f', 3 );
+  };
+
+  // hashing of data in memory
+  QElapsedTimer timer;
+  timer.start();
+  QCryptographicHash qtHash( QCryptographicHash::Sha1 );
+  for ( qint64 hashed = 0; hashed < dataSize; hashed += block.size() )
+    qtHash.addData( block.constData(), static_cast<int>( qMin<qint64>( block.size(), dataSize - hashed ) ) );
+  QByteArray expected = qtHash.result();
+  report( QStringLiteral( "memory, QCryptographicHash" ), timer.nsecsElapsed() );
+
+  for ( Sha1::Backend backend : QList<Sha1::Backend>() << Sha1::Generic << Sha1::ShaNi )
+  {
+    if ( !Sha1::isSupported( backend ) )
+    {
+      qDebug() << "Sha1 backend" << Sha1::backendName( backend ) << "is not supported by the CPU";
+      continue;
+    }
+
+    timer.restart();
+    Sha1 hash( backend );
+    for ( qint64 hashed = 0; hashed < dataSize; hashed += block.size() )
+      hash.addData( block.constData(), qMin<qint64>( block.size(), dataSize - hashed ) );
+    qint64 nsecs = timer.nsecsElapsed();
+    if ( hash.result() != expected )
+    {
+      qDebug() << "BenchMerginApi::benchSha1 FAILED: wrong digest of" << Sha1::backendName( backend ) << "backend";
+      return;
+    }
+    report( QStringLiteral( "memory, Sha1 %1" ).arg( Sha1::backendName( backend ) ), nsecs );
+  }
+
+  // hashing of a file, previous implementation read it by 64 KB chunks to new arrays
+  QTemporaryDir dir;
+  QString filePath = dir.path() + QStringLiteral( "/data.gpkg" );
+  QFile file( filePath );
+  if ( !file.open( QIODevice::WriteOnly ) )
+  {
+    qDebug() << "BenchMerginApi::benchSha1 FAILED: cannot write" << filePath;
+    return;
+  }
+  for ( qint64 written = 0; written < dataSize; written += block.size() )
+    file.write( block.constData(), qMin<qint64>( block.size(), dataSize - written ) );
+  file.close();
+
+  for ( int run = 0; run < 2; ++run ) // the first run reads the file to page cache
+  {
+    timer.restart();
+    QFile f( filePath );
+    f.open( QFile::ReadOnly );
+    QCryptographicHash readHash( QCryptographicHash::Sha1 );
+    QByteArray chunk = f.read( 65536 );
+    while ( !chunk.isEmpty() )
+    {
+      readHash.addData( chunk );
+      chunk = f.read( 65536 );
+    }
+    f.close();
+    QByteArray readChecksum = readHash.result().toHex();
+    if ( run > 0 )
+      report( QStringLiteral( "file, QFile::read + QCryptographicHash" ), timer.nsecsElapsed() );
+
+    timer.restart();
+    QByteArray checksum = Sha1::fileChecksum( filePath );
+    if ( run > 0 )
+      report( QStringLiteral( "file, Sha1::fileChecksum (%1)" ).arg( Sha1::backendName( Sha1::bestBackend() ) ), timer.nsecsElapsed() );
+
+    if ( checksum != readChecksum )
+    {
+      qDebug() << "BenchMerginApi::benchSha1 FAILED: checksums of file differ";
+      return;
+    }
+  }
+
+  qDebug() << "BenchMerginApi::benchSha1 FINISHED";
+}
+
+void BenchMerginApi::benchDeltaTransfer()
+{
+  qDebug() << "BenchMerginApi::benchDeltaTransfer START";
+
+  const qint64 fileSize = maxSize( "BENCH_DELTA_FILE_SIZE", 1024LL * 1024 * 1024 );
+  const QString projectName = QStringLiteral( "BENCH_DELTA_PROJECT" );
+  QTemporaryDir serverDir;
+  LocalMerginServer server( serverDir.path() );
+  if ( !server.listen() )
+  {
+    qDebug() << "BenchMerginApi::benchDeltaTransfer FAILED: cannot start local server";
+    return;
+  }
+
+  // parallel download of a separate data dir, delta transfer is not used by a single request download
+  QTemporaryDir dataDir;
+  QString apiRoot = mApi->apiRoot();
+  MerginApi api( dataDir.path() );
+  api.setApiRoot( server.url() );
+  api.setSyncConcurrency( 4 );
+  if ( !api.hasAuthData() )
+    api.authorize( QStringLiteral( "bench" ), QStringLiteral( "bench" ) ); // local server accepts any credentials
+
+  QByteArray block( 1024 * 1024, Qt::Uninitialized );
+  qsrand( 1 );
+  for ( int i = 0; i < block.size(); ++i )
+    block[i] = static_cast<char>( qrand() % 256 );
+
+  // the same pseudo-random content on both sides, every megabyte differs by its index
+  QString localDir = dataDir.path() + '/' + projectName;
+  QString localFilePath = localDir + QStringLiteral( "/raster.tif" );
+  QString serverFilePath = server.projectDir( projectName ) + QStringLiteral( "/raster.tif" );
+  auto writeFile = [&]( const QString & filePath )
+  {
+    QDir().mkpath( QFileInfo( filePath ).absolutePath() );
+    QFile file( filePath );
+    if ( !file.open( QIODevice::WriteOnly ) )
+      return false;
+    for ( qint64 written = 0; written < fileSize; written += block.size() )
+    {
+      QByteArray data = block.left( static_cast<int>( qMin<qint64>( block.size(), fileSize - written ) ) );
+      qint64 index = written / block.size();
+      memcpy( data.data(), &index, qMin<int>( data.size(), sizeof( index ) ) );
+      file.write( data );
+    }
+    return true;
+  };
+
+  // number of places changed on the server, 100 bytes each, and an insertion shifting the following 16 MB
+  for ( int changes : QList<int>() << 0 << 10 << 1000 )
+  {
+    if ( !writeFile( serverFilePath ) || ( changes > 0 && !writeFile( localFilePath ) ) )
+    {
+      qDebug() << "BenchMerginApi::benchDeltaTransfer FAILED: cannot write files";
+      break;
+    }
+    if ( changes > 0 )
+    {
+      QFile serverFile( serverFilePath );
+      serverFile.open( QIODevice::ReadWrite );
+      for ( int i = 0; i < changes; ++i )
+      {
+        serverFile.seek( ( static_cast<qint64>( qrand() ) * qrand() ) % qMax<qint64>( 1, fileSize - 100 ) );
+        serverFile.write( QByteArray( 100, static_cast<char>( i ) ) );
+      }
+      serverFile.seek( fileSize / 2 );
+      QByteArray rest = serverFile.read( 16 * 1024 * 1024 );
+      serverFile.seek( fileSize / 2 );
+      serverFile.write( "inserted" + rest );
+      serverFile.close();
+    }
+    QByteArray serverChecksum = Sha1::fileChecksum( serverFilePath );
+
+    qint64 deltaBytes = server.deltaBytes();
+    QElapsedTimer timer;
+    timer.start();
+    QSignalSpy spy( &api, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+    api.updateProject( projectName );
+    if ( !spy.wait( 3600 * 1000 ) || !spy.first().at( 2 ).toBool() || Sha1::fileChecksum( localFilePath ) != serverChecksum )
+    {
+      qDebug() << "BenchMerginApi::benchDeltaTransfer FAILED: sync with" << changes << "changes";
+      break;
+    }
+    qint64 msecs = qMax<qint64>( 1, timer.elapsed() );
+
+    if ( changes == 0 )
+    {
+      qDebug() << QStringLiteral( "%1 MB, no local file: whole file in %2 ms, %3 MB/s" )
+               .arg( fileSize / ( 1024 * 1024 ) ).arg( msecs ).arg( fileSize / 1024.0 / 1024 * 1000 / msecs, 0, 'f', 1 );
+    }
+    else
+    {
+      qDebug() << QStringLiteral( "%1 MB, %2 changes: delta %3 KB in %4 ms" )
+               .arg( fileSize / ( 1024 * 1024 ) ).arg( changes ).arg( ( server.deltaBytes() - deltaBytes ) / 1024 ).arg( msecs );
+    }
+  }
+
+  // API root is saved to settings
+  mApi->setApiRoot( apiRoot );
+  qDebug() << "BenchMerginApi::benchDeltaTransfer FINISHED";
+}
+
+void BenchMerginApi::benchProjectsCache()
+{
+  qDebug() << "BenchMerginApi::benchProjectsCache START";
+
+  const int projectsCount = static_cast<int>( maxSize( "BENCH_PROJECTS_COUNT", 10000 ) );
+  QTemporaryDir dir;
+  QString filePath = dir.path() + "/.projectsCache.bin";
+  QDateTime now = QDateTime::currentDateTime();
+  QList<ProjectsCache::Entry> entries;
+  for ( int i = 0; i < projectsCount; ++i )
+  {
+    ProjectsCache::Entry entry;
+    entry.name = QStringLiteral( "project-%1" ).arg( i );
+    entry.updated = now.addSecs( -i ).toUTC();
+    entry.lastSync = now.addSecs( -i );
+    entries << entry;
+  }
+
+  {
+    ProjectsCache cache( filePath );
+    cache.update( entries );
+    if ( !cache.flush() )
+    {
+      qDebug() << "BenchMerginApi::benchProjectsCache FAILED: cannot write" << filePath;
+      return;
+    }
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  ProjectsCache cache( filePath );
+  qint64 loadNsecs = timer.nsecsElapsed();
+  if ( cache.count() != projectsCount )
+  {
+    qDebug() << "BenchMerginApi::benchProjectsCache FAILED: loaded" << cache.count() << "projects";
+    return;
+  }
+
+  // a single synced project
+  entries[projectsCount / 2].lastSync = now.addSecs( 1 );
+  timer.restart();
+  cache.update( entries );
+  cache.flush();
+  qint64 updateNsecs = timer.nsecsElapsed();
+
+  qDebug() << QStringLiteral( "%1 projects, %2 KB: load %3 us, update of a project %4 us" )
+           .arg( projectsCount )
+           .arg( QFileInfo( filePath ).size() / 1024 )
+           .arg( loadNsecs / 1000 )
+           .arg( updateNsecs / 1000 );
+  qDebug() << "BenchMerginApi::benchProjectsCache FINISHED";
+}
+
+void BenchMerginApi::benchJsonParsing()
+{
+  qDebug() << "BenchMerginApi::benchJsonParsing START";
+
+  const int projectsCount = static_cast<int>( maxSize( "BENCH_PROJECTS_COUNT", 10000 ) );
+  const int filesCount = static_cast<int>( maxSize( "BENCH_JSON_FILES_COUNT", 100000 ) );
+
+  // timestamps in the form the server sends them
+  const QString timestampFormat = QStringLiteral( "yyyy-MM-dd'T'HH:mm:ss.zzz'000Z'" );
+  QDateTime now = QDateTime::currentDateTimeUtc();
+  QByteArray projectsData = "[";
+  for ( int i = 0; i < projectsCount; ++i )
+  {
+    projectsData += QStringLiteral( "%1{\"name\": \"project-%2\", \"namespace\": \"bench\", \"tags\": [\"valid_qgis\", \"input_use\"], "
+                                    "\"created\": \"%3\", \"updated\": \"%4\", \"version\": \"v%2\"}" )
+                    .arg( i ? "," : "" ).arg( i )
+                    .arg( now.addSecs( -2 * i ).toString( timestampFormat ) )
+                    .arg( now.addSecs( -i ).toString( timestampFormat ) ).toUtf8();
+  }
+  projectsData += "]";
+
+  QByteArray filesData = "{\"name\": \"bench\", \"version\": \"v1\", \"files\": [";
+  for ( int i = 0; i < filesCount; ++i )
+  {
+    filesData += QStringLiteral( "%1{\"path\": \"data/folder-%2/file-%3.jpg\", \"checksum\": \"%4\", \"size\": %5, \"mtime\": \"%6\"}" )
+                 .arg( i ? "," : "" ).arg( i / 100 ).arg( i )
+                 .arg( QString::fromLatin1( QCryptographicHash::hash( QByteArray::number( i ), QCryptographicHash::Sha1 ).toHex() ) )
+                 .arg( 1000 + i )
+                 .arg( now.addSecs( -i ).toString( timestampFormat ) ).toUtf8();
+  }
+  filesData += "]}";
+
+  // the former document tree path of MerginApi::parseProjectsData and parseAndCompareProjectFiles
+  QElapsedTimer timer;
+  timer.start();
+  int domProjects = 0;
+  for ( const QJsonValue &value : QJsonDocument::fromJson( projectsData ).array() )
+  {
+    QJsonObject projectMap = value.toObject();
+    MerginProject p;
+    p.name = projectMap.value( QStringLiteral( "name" ) ).toString();
+    for ( const QJsonValue &tag : projectMap.value( QStringLiteral( "tags" ) ).toArray() )
+      p.tags.append( tag.toString() );
+    p.created = QDateTime::fromString( projectMap.value( QStringLiteral( "created" ) ).toString(), Qt::ISODateWithMs ).toUTC();
+    p.serverUpdated = QDateTime::fromString( projectMap.value( QStringLiteral( "updated" ) ).toString(), Qt::ISODateWithMs ).toUTC();
+    domProjects++;
+  }
+  qint64 domProjectsNsecs = timer.nsecsElapsed();
+
+  timer.restart();
+  int domFiles = 0;
+  for ( const QJsonValue &value : QJsonDocument::fromJson( filesData ).object().value( QStringLiteral( "files" ) ).toArray() )
+  {
+    QJsonObject fileMap = value.toObject();
+    MerginFile file;
+    file.path = fileMap.value( QStringLiteral( "path" ) ).toString();
+    file.checksum = fileMap.value( QStringLiteral( "checksum" ) ).toString();
+    file.size = static_cast<qint64>( fileMap.value( QStringLiteral( "size" ) ).toDouble() );
+    domFiles++;
+  }
+  qint64 domFilesNsecs = timer.nsecsElapsed();
+
+  timer.restart();
+  int projectsRead = 0;
+  MerginApi::readProjects( projectsData, true, [&projectsRead]( const MerginProject & ) { projectsRead++; } );
+  qint64 readerProjectsNsecs = timer.nsecsElapsed();
+
+  timer.restart();
+  int filesRead = 0;
+  MerginApi::readProjectFiles( filesData, [&filesRead]( const MerginFile & ) { filesRead++; } );
+  qint64 readerFilesNsecs = timer.nsecsElapsed();
+
+  if ( domProjects != projectsCount || projectsRead != projectsCount || domFiles != filesCount || filesRead != filesCount )
+  {
+    qDebug() << "BenchMerginApi::benchJsonParsing FAILED: read" << projectsRead << "projects," << filesRead << "files";
+    return;
+  }
+
+  // timestamps alone
+  QByteArray timestamp = now.toString( timestampFormat ).toLatin1();
+  const int timestampsCount = 100000;
+  timer.restart();
+  for ( int i = 0; i < timestampsCount; ++i )
+    QDateTime::fromString( QString::fromLatin1( timestamp ), Qt::ISODateWithMs );
+  qint64 genericDateNsecs = timer.nsecsElapsed();
+  timer.restart();
+  for ( int i = 0; i < timestampsCount; ++i )
+    JsonReader::parseDateTime( timestamp.constData(), timestamp.size() );
+  qint64 fixedDateNsecs = timer.nsecsElapsed();
+
+  qDebug() << QStringLiteral( "%1 projects, %2 KB: document %3 ms, JsonReader %4 ms" )
+           .arg( projectsCount ).arg( projectsData.size() / 1024 )
+           .arg( domProjectsNsecs / 1e6, 0, 'f', 1 ).arg( readerProjectsNsecs / 1e6, 0, 'f', 1 );
+  qDebug() << QStringLiteral( "%1 files, %2 KB: document %3 ms, JsonReader %4 ms" )
+           .arg( filesCount ).arg( filesData.size() / 1024 )
+           .arg( domFilesNsecs / 1e6, 0, 'f', 1 ).arg( readerFilesNsecs / 1e6, 0, 'f', 1 );
+  qDebug() << QStringLiteral( "timestamp: QDateTime::fromString %1 ns, JsonReader::parseDateTime %2 ns" )
+           .arg( genericDateNsecs / timestampsCount ).arg( fixedDateNsecs / timestampsCount );
+  qDebug() << "BenchMerginApi::benchJsonParsing FINISHED";
+}
+
+void BenchMerginApi::benchSyncThroughput()
+{
+  qDebug() << "BenchMerginApi::benchSyncThroughput START";
+
+  struct NetworkProfile
+  {
+    QString name;
+    int latency; // msecs
+    qint64 bandwidth; // bytes per second, 0 means no limit
+    int dropInterval; // every n-th file transfer request is dropped
+  };
+  const QList<NetworkProfile> profiles = QList<NetworkProfile>()
+                                         << NetworkProfile { QStringLiteral( "loopback" ), 0, 0, 0 }
+                                         << NetworkProfile { QStringLiteral( "wifi" ), 5, 50 * 1024 * 1024, 0 }
+                                         << NetworkProfile { QStringLiteral( "mobile" ), 80, 5 * 1024 * 1024, 0 }
+                                         << NetworkProfile { QStringLiteral( "lossy mobile" ), 80, 5 * 1024 * 1024, 20 };
+  const qint64 projectSize = maxSize( "BENCH_SYNC_PROJECT_SIZE", 64LL * 1024 * 1024 );
+  const int maxFilesCount = static_cast<int>( maxSize( "BENCH_SYNC_FILES_COUNT", 1000 ) );
+  const QString projectName = QStringLiteral( "BENCH_SYNC_PROJECT" );
+  const QString apiRoot = mApi->apiRoot();
+
+  QByteArray block( 1024 * 1024, Qt::Uninitialized );
+  qsrand( 1 );
+  for ( int i = 0; i < block.size(); ++i )
+    block[i] = static_cast<char>( qrand() % 256 );
+
+  // files of a synthetic project, the content differs by the seed of each version
+  auto writeProject = [&]( const QString & dir, int filesCount, int seed )
+  {
+    qint64 fileSize = projectSize / filesCount;
+    for ( int i = 0; i < filesCount; ++i )
+    {
+      QString filePath = dir + QStringLiteral( "/data/%1/%2.bin" ).arg( i / 100 ).arg( i );
+      QDir().mkpath( QFileInfo( filePath ).absolutePath() );
+      QFile file( filePath );
+      if ( !file.open( QIODevice::WriteOnly ) )
+        return false;
+      for ( qint64 written = 0; written < fileSize; written += block.size() )
+      {
+        QByteArray data = block.left( static_cast<int>( qMin<qint64>( block.size(), fileSize - written ) ) );
+        qint64 tag = ( static_cast<qint64>( seed ) << 32 ) + i;
+        memcpy( data.data(), &tag, qMin<int>( data.size(), sizeof( tag ) ) );
+        file.write( data );
+      }
+    }
+    return true;
+  };
+
+  auto syncProject = [&]( MerginApi & api, bool upload, QJsonObject & stats )
+  {
+    QSignalSpy spy( &api, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+    QSignalSpy statsSpy( &api, SIGNAL( syncStatsRecorded( QString, QJsonObject ) ) );
+    if ( upload )
+      api.uploadProject( projectName );
+    else
+      api.updateProject( projectName );
+    if ( !spy.wait( 3600 * 1000 ) || !spy.first().at( 2 ).toBool() || statsSpy.isEmpty() )
+      return false;
+    stats = statsSpy.first().at( 1 ).toJsonObject();
+    return true;
+  };
+
+  auto report = []( const QString & direction, const QJsonObject & stats, qint64 bytes )
+  {
+    double msecs = qMax( 1.0, stats.value( QStringLiteral( "wall" ) ).toDouble() );
+    QJsonObject phases = stats.value( QStringLiteral( "phases" ) ).toObject();
+    qDebug() << QStringLiteral( "  %1: %2 ms, %3 MB/s, %4 requests, %5 retries, project info %6 ms" )
+             .arg( direction )
+             .arg( msecs, 0, 'f', 0 )
+             .arg( bytes / 1024.0 / 1024 * 1000 / msecs, 0, 'f', 1 )
+             .arg( stats.value( QStringLiteral( "requests" ) ).toInt() )
+             .arg( stats.value( QStringLiteral( "retries" ) ).toInt() )
+             .arg( phases.value( QStringLiteral( "projectInfo" ) ).toObject().value( QStringLiteral( "wall" ) ).toDouble(), 0, 'f', 1 );
+  };
+
+  for ( const NetworkProfile &profile : profiles )
+  {
+    for ( int filesCount : QList<int>() << 1 << qMin( 100, maxFilesCount ) << maxFilesCount )
+    {
+      QTemporaryDir serverDir;
+      LocalMerginServer server( serverDir.path() );
+      if ( !server.listen() || !writeProject( server.projectDir( projectName ), filesCount, 0 ) )
+      {
+        qDebug() << "BenchMerginApi::benchSyncThroughput FAILED: cannot start local server";
+        return;
+      }
+      server.setLatency( profile.latency );
+      server.setBandwidthLimit( profile.bandwidth );
+      server.setDropInterval( profile.dropInterval );
+
+      QTemporaryDir dataDir;
+      MerginApi api( dataDir.path() );
+      api.setApiRoot( server.url() );
+      api.setSyncConcurrency( 4 );
+      api.authorize( QStringLiteral( "bench" ), QStringLiteral( "bench" ) );
+
+      qDebug() << QStringLiteral( "%1 (latency %2 ms, %3 KB/s, every %4. request dropped), %5 files, %6 MB" )
+               .arg( profile.name ).arg( profile.latency ).arg( profile.bandwidth / 1024 ).arg( profile.dropInterval )
+               .arg( filesCount ).arg( projectSize / ( 1024 * 1024 ) );
+
+      QJsonObject stats;
+      if ( !syncProject( api, false, stats ) )
+      {
+        qDebug() << "BenchMerginApi::benchSyncThroughput FAILED: download of" << filesCount << "files";
+        return;
+      }
+      report( QStringLiteral( "download" ), stats, projectSize );
+
+      // every file changed locally
+      if ( !writeProject( dataDir.path() + '/' + projectName, filesCount, 1 ) || !syncProject( api, true, stats ) )
+      {
+        qDebug() << "BenchMerginApi::benchSyncThroughput FAILED: upload of" << filesCount << "files";
+        return;
+      }
+      report( QStringLiteral( "upload" ), stats, projectSize );
+    }
+  }
+
+  // API root is saved to settings
+  mApi->setApiRoot( apiRoot );
+  qDebug() << "BenchMerginApi::benchSyncThroughput FINISHED";
+}
+
+qint64 BenchMerginApi::maxSize( const char *envVariable, qint64 defaultValue ) const
+{
+  if ( ::getenv( envVariable ) )
+  {
+    bool ok = false;
+    qint64 value = QByteArray( ::getenv( envVariable ) ).toLongLong( &ok );
+    if ( ok )
+      return value;
+  }
+  return defaultValue;
+}
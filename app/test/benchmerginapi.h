@@ -0,0 +1,35 @@
+#ifndef BENCHMERGINAPI_H
+#define BENCHMERGINAPI_H
+
+#include <QObject>
+
+#include <merginapi.h>
+
+/**
+ * Performance benchmarks of sync internals. Run with --bench command line argument,
+ * results are printed to debug output.
+ */
+class BenchMerginApi: public QObject
+{
+    Q_OBJECT
+  public:
+    explicit BenchMerginApi( MerginApi *api, QObject *parent = nullptr );
+    ~BenchMerginApi() = default;
+
+  public slots:
+    void benchMultipartParser();
+    void benchHashing();
+    void benchSha1();
+    void benchDeltaTransfer();
+    void benchProjectsCache();
+    void benchJsonParsing();
+    void benchSyncThroughput();
+
+  private:
+    MerginApi *mApi;
+
+    //! Reads size limit of synthetic data from an environment variable
+    qint64 maxSize( const char *envVariable, qint64 defaultValue ) const;
+};
+
+# endif // BENCHMERGINAPI_H
@@ -0,0 +1,885 @@
+#include "localmerginserver.h"
+
+#include <QTcpSocket>
+#include <QTimer>
+#include <QBuffer>
+#include <QFile>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QUrlQuery>
+#include <QUuid>
+
+#include "geopackagediff.h"
+#include "blockdelta.h"
+#include "compression.h"
+#include "multipartparser.h"
+
+static QString fileChecksum( const QString &filePath )
+{
+  QFile file( filePath );
+  QCryptographicHash hash( QCryptographicHash::Sha1 );
+  if ( file.open( QIODevice::ReadOnly ) )
+    hash.addData( &file );
+  return QString::fromLatin1( hash.result().toHex() );
+}
+
+LocalMerginServer::LocalMerginServer( const QString &dataDir, QObject *parent )
+  : QObject( parent )
+  , mDataDir( dataDir + '/' )
+{
+  connect( &mServer, &QTcpServer::newConnection, this, &LocalMerginServer::onNewConnection );
+  mBandwidthClock.start();
+}
+
+bool LocalMerginServer::listen( quint16 port )
+{
+  return mServer.listen( QHostAddress::LocalHost, port );
+}
+
+QString LocalMerginServer::url() const
+{
+  return QStringLiteral( "http://127.0.0.1:%1" ).arg( mServer.serverPort() );
+}
+
+QString LocalMerginServer::projectDir( const QString &projectName ) const
+{
+  return mDataDir + projectName;
+}
+
+void LocalMerginServer::setDropAfterBytes( qint64 bytes )
+{
+  mDropAfterBytes = bytes;
+}
+
+QList<QByteArray> LocalMerginServer::rangeRequests() const
+{
+  return mRangeRequests;
+}
+
+void LocalMerginServer::setAcceptedChunkUploads( int count )
+{
+  mAcceptedChunkUploads = count;
+}
+
+QStringList LocalMerginServer::uploadedChunks() const
+{
+  return mUploadedChunks;
+}
+
+qint64 LocalMerginServer::deltaBytes() const
+{
+  return mDeltaBytes;
+}
+
+int LocalMerginServer::deltaRequests() const
+{
+  return mDeltaRequests;
+}
+
+void LocalMerginServer::setCompressionEnabled( bool enabled )
+{
+  mCompressionEnabled = enabled;
+}
+
+int LocalMerginServer::compressedRequests() const
+{
+  return mCompressedRequests;
+}
+
+int LocalMerginServer::compressedResponses() const
+{
+  return mCompressedResponses;
+}
+
+int LocalMerginServer::notModifiedResponses() const
+{
+  return mNotModifiedResponses;
+}
+
+void LocalMerginServer::setCredentials( const QString &username, const QString &password )
+{
+  mUsername = username;
+  mPassword = password;
+}
+
+void LocalMerginServer::setLatency( int msecs )
+{
+  mLatency = qMax( 0, msecs );
+}
+
+void LocalMerginServer::setBandwidthLimit( qint64 bytesPerSecond )
+{
+  mBandwidthLimit = qMax<qint64>( 0, bytesPerSecond );
+  mBandwidthTokens = 0;
+  mLastRefill = mBandwidthClock.elapsed();
+}
+
+void LocalMerginServer::setDropInterval( int requests )
+{
+  mDropInterval = qMax( 0, requests );
+  mTransferRequests = 0;
+}
+
+int LocalMerginServer::requestCount() const
+{
+  return mRequestCount;
+}
+
+int LocalMerginServer::droppedRequests() const
+{
+  return mDroppedRequests;
+}
+
+int LocalMerginServer::projectDownloads() const
+{
+  return mProjectDownloads;
+}
+
+int LocalMerginServer::fileRequests() const
+{
+  return mFileRequests;
+}
+
+void LocalMerginServer::setCapabilities( const QStringList &capabilities )
+{
+  mCapabilities = capabilities;
+}
+
+int LocalMerginServer::dataSyncRequests() const
+{
+  return mDataSyncRequests;
+}
+
+int LocalMerginServer::appliedChangesets() const
+{
+  return mAppliedChangesets;
+}
+
+void LocalMerginServer::onNewConnection()
+{
+  while ( mServer.hasPendingConnections() )
+  {
+    QTcpSocket *socket = mServer.nextPendingConnection();
+    mConnections.insert( socket, std::make_shared<Connection>() );
+    connect( socket, &QTcpSocket::readyRead, this, &LocalMerginServer::onReadyRead );
+    connect( socket, &QTcpSocket::bytesWritten, this, &LocalMerginServer::onBytesWritten );
+    connect( socket, &QTcpSocket::disconnected, this, &LocalMerginServer::onDisconnected );
+  }
+}
+
+void LocalMerginServer::onReadyRead()
+{
+  QTcpSocket *socket = qobject_cast<QTcpSocket *>( sender() );
+  std::shared_ptr<Connection> connection = mConnections.value( socket );
+  if ( !connection || connection->body )
+    return;
+
+  connection->buffer.append( socket->readAll() );
+  int headerEnd = connection->buffer.indexOf( "\r\n\r\n" );
+  if ( headerEnd < 0 )
+    return;
+
+  Request request;
+  QList<QByteArray> lines = connection->buffer.left( headerEnd ).split( '\n' );
+  QList<QByteArray> requestLine = lines.takeFirst().trimmed().split( ' ' );
+  if ( requestLine.size() < 2 )
+  {
+    sendResponse( socket, 400, QByteArray() );
+    return;
+  }
+  request.method = requestLine.at( 0 );
+  request.url = QUrl( QString::fromUtf8( requestLine.at( 1 ) ) );
+  for ( const QByteArray &line : lines )
+  {
+    int colon = line.indexOf( ':' );
+    if ( colon > 0 )
+      request.headers.insert( line.left( colon ).trimmed().toLower(), line.mid( colon + 1 ).trimmed() );
+  }
+
+  int contentLength = request.headers.value( "content-length" ).toInt();
+  if ( connection->buffer.size() - headerEnd - 4 < contentLength )
+    return; // wait for the rest of body
+
+  request.body = connection->buffer.mid( headerEnd + 4, contentLength );
+  connection->buffer.clear();
+
+  QByteArray encoding = request.headers.value( "content-encoding" ).toLower();
+  if ( encoding == "deflate" || encoding == "gzip" )
+  {
+    QByteArray body;
+    if ( !Compression::inflate( request.body, body ) )
+    {
+      sendResponse( socket, 400, QByteArray( "{\"detail\": \"Invalid request body encoding\"}" ) );
+      return;
+    }
+    request.body = body;
+    mCompressedRequests++;
+  }
+
+  // the request body has taken its time on a limited link, the response is delayed by the latency then
+  mRequestCount++;
+  int delay = mLatency + consumeBandwidth( headerEnd + 4 + contentLength );
+  if ( delay <= 0 )
+  {
+    handleRequest( socket, request );
+    return;
+  }
+  QTimer::singleShot( delay, socket, [this, socket, request]
+  {
+    handleRequest( socket, request );
+  } );
+}
+
+void LocalMerginServer::onBytesWritten()
+{
+  writeBody( qobject_cast<QTcpSocket *>( sender() ) );
+}
+
+void LocalMerginServer::onDisconnected()
+{
+  QTcpSocket *socket = qobject_cast<QTcpSocket *>( sender() );
+  mConnections.remove( socket );
+  socket->deleteLater();
+}
+
+void LocalMerginServer::handleRequest( QTcpSocket *socket, const Request &request )
+{
+  if ( !isAuthorized( request ) )
+  {
+    sendResponse( socket, 401, QByteArray( "{\"detail\": \"Invalid credentials\"}" ) );
+    return;
+  }
+
+  QStringList path = request.url.path().split( '/', QString::SkipEmptyParts );
+  if ( request.method == "GET" && path.size() == 3 && path.at( 0 ) == QStringLiteral( "auth" ) && path.at( 1 ) == QStringLiteral( "user" ) )
+  {
+    QJsonObject user;
+    user.insert( QStringLiteral( "username" ), path.at( 2 ) );
+    sendResponse( socket, 200, QJsonDocument( user ).toJson( QJsonDocument::Compact ) );
+    return;
+  }
+
+  if ( path == QStringList( { QStringLiteral( "v1" ), QStringLiteral( "project" ) } ) )
+  {
+    if ( request.method == "GET" )
+      sendProjectList( socket, request );
+    else if ( request.method == "POST" )
+      createProject( socket, request );
+    else
+      sendResponse( socket, 404, QByteArray() );
+    return;
+  }
+
+  if ( path.size() < 3 || path.at( 0 ) != QStringLiteral( "v1" ) || path.at( 1 ) != QStringLiteral( "project" ) )
+  {
+    sendResponse( socket, 404, QByteArray() );
+    return;
+  }
+
+  if ( isDropped( path ) )
+  {
+    socket->abort();
+    return;
+  }
+
+  QString endpoint = path.size() > 3 ? path.at( 2 ) : QString();
+  if ( request.method == "POST" && endpoint == QStringLiteral( "push" ) && mCapabilities.contains( QStringLiteral( "push" ) ) )
+  {
+    handlePush( socket, path, request );
+    return;
+  }
+
+  QString projectName = path.last();
+  if ( !QDir( projectDir( projectName ) ).exists() )
+  {
+    sendResponse( socket, 404, QByteArray( "{\"detail\": \"Project not found\"}" ) );
+    return;
+  }
+
+  if ( request.method == "GET" && endpoint.isEmpty() )
+  {
+    sendProjectInfo( socket, projectName, request );
+  }
+  else if ( request.method == "DELETE" && endpoint.isEmpty() )
+  {
+    deleteProject( socket, projectName );
+  }
+  else if ( request.method == "GET" && endpoint == QStringLiteral( "raw" ) )
+  {
+    mFileRequests++;
+    sendRawFile( socket, projectName, request );
+  }
+  else if ( request.method == "GET" && endpoint == QStringLiteral( "download" ) )
+  {
+    mProjectDownloads++;
+    sendMultipart( socket, projectName, projectFiles( projectName ), request );
+  }
+  else if ( request.method == "POST" && endpoint == QStringLiteral( "delta" ) && mCapabilities.contains( QStringLiteral( "block-delta" ) ) )
+  {
+    mDeltaRequests++;
+    sendDelta( socket, projectName, request );
+  }
+  else if ( request.method == "POST" && endpoint == QStringLiteral( "data_sync" ) )
+  {
+    handleDataSync( socket, projectName, request );
+  }
+  else if ( request.method == "POST" && endpoint == QStringLiteral( "fetch" ) )
+  {
+    mFileRequests++;
+    QStringList files;
+    for ( const QJsonValue &file : QJsonDocument::fromJson( request.body ).array() )
+    {
+      files << file.toObject().value( QStringLiteral( "path" ) ).toString();
+    }
+    sendMultipart( socket, projectName, files, request );
+  }
+  else
+  {
+    sendResponse( socket, 404, QByteArray() );
+  }
+}
+
+bool LocalMerginServer::isAuthorized( const Request &request ) const
+{
+  if ( mUsername.isEmpty() )
+    return true;
+
+  QByteArray token = QString( mUsername + ':' + mPassword ).toUtf8().toBase64();
+  return request.headers.value( "authorization" ) == "Basic " + token;
+}
+
+bool LocalMerginServer::isDropped( const QStringList &path )
+{
+  // /v1/project/<endpoint>/<project> or /v1/project/push/chunk/<transaction>/<chunk>
+  QString endpoint = path.size() > 3 ? path.at( 2 ) : QString();
+  bool transfersFiles = QStringList( { QStringLiteral( "raw" ), QStringLiteral( "fetch" ), QStringLiteral( "delta" ), QStringLiteral( "download" ), QStringLiteral( "data_sync" ) } ).contains( endpoint )
+                        || ( endpoint == QStringLiteral( "push" ) && path.at( 3 ) == QStringLiteral( "chunk" ) );
+  if ( mDropInterval <= 0 || !transfersFiles )
+    return false;
+
+  if ( ++mTransferRequests % mDropInterval != 0 )
+    return false;
+
+  mDroppedRequests++;
+  return true;
+}
+
+void LocalMerginServer::createProject( QTcpSocket *socket, const Request &request )
+{
+  QString projectName = QJsonDocument::fromJson( request.body ).object().value( QStringLiteral( "name" ) ).toString();
+  if ( projectName.isEmpty() || projectName.contains( '/' ) )
+  {
+    sendResponse( socket, 400, QByteArray( "{\"detail\": \"Invalid project name\"}" ) );
+    return;
+  }
+  if ( QDir( projectDir( projectName ) ).exists() )
+  {
+    sendResponse( socket, 409, QByteArray( "{\"detail\": \"Project already exists\"}" ) );
+    return;
+  }
+
+  QDir().mkpath( projectDir( projectName ) );
+  sendResponse( socket, 200, QJsonDocument( projectInfo( projectName ) ).toJson( QJsonDocument::Compact ) );
+}
+
+void LocalMerginServer::deleteProject( QTcpSocket *socket, const QString &projectName )
+{
+  QDir( projectDir( projectName ) ).removeRecursively();
+  for ( const QString &key : mAppliedDiffs.keys() )
+  {
+    if ( key.startsWith( projectName + '/' ) )
+      mAppliedDiffs.remove( key );
+  }
+  sendResponse( socket, 200, QByteArray() );
+}
+
+void LocalMerginServer::handlePush( QTcpSocket *socket, const QStringList &path, const Request &request )
+{
+  // /v1/project/push/<project>, /v1/project/push/chunk/<transaction>/<chunk>,
+  // /v1/project/push/finish/<transaction> or /v1/project/push/cancel/<transaction>
+  QString action = path.size() > 4 ? path.at( 3 ) : QString();
+  if ( action.isEmpty() )
+  {
+    QString projectName = path.at( 3 );
+    if ( !QDir( projectDir( projectName ) ).exists() )
+    {
+      sendResponse( socket, 404, QByteArray( "{\"detail\": \"Project not found\"}" ) );
+      return;
+    }
+
+    QJsonObject changes = QJsonDocument::fromJson( request.body ).object().value( QStringLiteral( "changes" ) ).toObject();
+    if ( changes.value( QStringLiteral( "added" ) ).toArray().isEmpty() && changes.value( QStringLiteral( "updated" ) ).toArray().isEmpty() )
+    {
+      applyChanges( projectName, changes, QHash<QString, QByteArray>() );
+      sendProjectInfo( socket, projectName, request );
+      return;
+    }
+
+    QString transactionId = QUuid::createUuid().toString().mid( 1, 36 );
+    Transaction transaction;
+    transaction.projectName = projectName;
+    transaction.changes = changes;
+    mTransactions.insert( transactionId, transaction );
+
+    QJsonObject data;
+    data.insert( QStringLiteral( "transaction" ), transactionId );
+    sendResponse( socket, 200, QJsonDocument( data ).toJson( QJsonDocument::Compact ) );
+    return;
+  }
+
+  QString transactionId = path.at( 4 );
+  if ( !mTransactions.contains( transactionId ) )
+  {
+    sendResponse( socket, 404, QByteArray( "{\"detail\": \"Upload transaction not found\"}" ) );
+    return;
+  }
+
+  if ( action == QStringLiteral( "chunk" ) && path.size() == 6 )
+  {
+    if ( mAcceptedChunkUploads == 0 )
+    {
+      socket->abort();
+      return;
+    }
+    if ( mAcceptedChunkUploads > 0 )
+      mAcceptedChunkUploads--;
+
+    mTransactions[transactionId].chunks.insert( path.at( 5 ), request.body );
+    mUploadedChunks << path.at( 5 );
+
+    QJsonObject data;
+    data.insert( QStringLiteral( "checksum" ), QString::fromLatin1( QCryptographicHash::hash( request.body, QCryptographicHash::Sha1 ).toHex() ) );
+    data.insert( QStringLiteral( "size" ), request.body.size() );
+    sendResponse( socket, 200, QJsonDocument( data ).toJson( QJsonDocument::Compact ) );
+  }
+  else if ( action == QStringLiteral( "finish" ) )
+  {
+    Transaction transaction = mTransactions.take( transactionId );
+    if ( !applyChanges( transaction.projectName, transaction.changes, transaction.chunks ) )
+    {
+      sendResponse( socket, 400, QByteArray( "{\"detail\": \"Missing chunks\"}" ) );
+      return;
+    }
+    sendProjectInfo( socket, transaction.projectName, request );
+  }
+  else if ( action == QStringLiteral( "cancel" ) )
+  {
+    mTransactions.remove( transactionId );
+    sendResponse( socket, 200, QByteArray( "{}" ) );
+  }
+  else
+  {
+    sendResponse( socket, 404, QByteArray() );
+  }
+}
+
+void LocalMerginServer::handleDataSync( QTcpSocket *socket, const QString &projectName, const Request &request )
+{
+  // part "changes" lists the changes, each added or updated file is a part named by its path
+  MultipartParser parser( MultipartParser::boundaryFromContentType( request.headers.value( "content-type" ) ) );
+  QHash<QString, QByteArray> parts;
+  QString name;
+  int written = 0;
+  MultipartParser::Event event = MultipartParser::NeedMoreData;
+  while ( event != MultipartParser::Finished && event != MultipartParser::Error )
+  {
+    event = parser.next();
+    if ( event == MultipartParser::NeedMoreData )
+    {
+      if ( written == request.body.size() )
+        parser.finish();
+      else
+        written += parser.write( request.body.constData() + written, request.body.size() - written );
+    }
+    else if ( event == MultipartParser::PartBegin )
+    {
+      name = parser.name();
+      parts.insert( name, QByteArray() );
+    }
+    else if ( event == MultipartParser::PartData )
+    {
+      parts[name].append( parser.data(), parser.dataSize() );
+    }
+  }
+  if ( event == MultipartParser::Error )
+  {
+    sendResponse( socket, 400, QByteArray( "{\"detail\": \"Invalid form data\"}" ) );
+    return;
+  }
+
+  // each file is applied as a single chunk named by its path
+  QJsonObject changes = QJsonDocument::fromJson( parts.take( QStringLiteral( "changes" ) ) ).object();
+  for ( const QString &key : QStringList() << QStringLiteral( "added" ) << QStringLiteral( "updated" ) )
+  {
+    QJsonArray fileArray = changes.value( key ).toArray();
+    for ( int i = 0; i < fileArray.size(); ++i )
+    {
+      QJsonObject fileObject = fileArray.at( i ).toObject();
+      fileObject.insert( QStringLiteral( "chunks" ), QJsonArray( { fileObject.value( QStringLiteral( "path" ) ) } ) );
+      fileArray.replace( i, fileObject );
+    }
+    changes.insert( key, fileArray );
+  }
+  if ( !applyChanges( projectName, changes, parts ) )
+  {
+    sendResponse( socket, 400, QByteArray( "{\"detail\": \"Missing files\"}" ) );
+    return;
+  }
+  mDataSyncRequests++;
+  sendProjectInfo( socket, projectName, request );
+}
+
+bool LocalMerginServer::applyChanges( const QString &projectName, const QJsonObject &changes, const QHash<QString, QByteArray> &chunks )
+{
+  QString dir = projectDir( projectName ) + '/';
+  for ( const QString &key : QStringList() << QStringLiteral( "added" ) << QStringLiteral( "updated" ) )
+  {
+    for ( const QJsonValue &fileValue : changes.value( key ).toArray() )
+    {
+      QJsonObject fileObject = fileValue.toObject();
+      QByteArray data;
+      for ( const QJsonValue &chunkId : fileObject.value( QStringLiteral( "chunks" ) ).toArray() )
+      {
+        if ( !chunks.contains( chunkId.toString() ) )
+          return false;
+        data += chunks.value( chunkId.toString() );
+      }
+
+      QString path = fileObject.value( QStringLiteral( "path" ) ).toString();
+      QString filePath = dir + path;
+      QString diffKey = projectName + '/' + path;
+      QJsonObject diff = fileObject.value( QStringLiteral( "diff" ) ).toObject();
+      if ( !diff.isEmpty() && mCapabilities.contains( QStringLiteral( "geodiff" ) ) )
+      {
+        // chunks contain a changeset of a GeoPackage, it is kept for clients having the same base version
+        AppliedDiff appliedDiff;
+        appliedDiff.path = QStringLiteral( ".diffs/%1-%2" ).arg( path, diff.value( QStringLiteral( "checksum" ) ).toString() );
+        appliedDiff.base = fileChecksum( filePath );
+        if ( appliedDiff.base != diff.value( QStringLiteral( "base" ) ).toString() )
+          return false;
+
+        QDir().mkpath( QFileInfo( dir + appliedDiff.path ).absolutePath() );
+        QFile diffFile( dir + appliedDiff.path );
+        if ( !diffFile.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+          return false;
+        diffFile.write( data );
+        diffFile.close();
+        if ( !GeoPackageDiff::applyChangeset( filePath, diffFile.fileName() ) )
+          return false;
+
+        appliedDiff.result = fileChecksum( filePath );
+        mAppliedDiffs.insert( diffKey, appliedDiff );
+        mAppliedChangesets++;
+        continue;
+      }
+
+      mAppliedDiffs.remove( diffKey );
+      QDir().mkpath( QFileInfo( filePath ).absolutePath() );
+      QFile file( filePath );
+      if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+        return false;
+      file.write( data );
+    }
+  }
+
+  for ( const QJsonValue &fileValue : changes.value( QStringLiteral( "removed" ) ).toArray() )
+  {
+    QFile::remove( dir + fileValue.toObject().value( QStringLiteral( "path" ) ).toString() );
+  }
+  return true;
+}
+
+void LocalMerginServer::sendProjectList( QTcpSocket *socket, const Request &request )
+{
+  QJsonArray projects;
+  for ( const QString &projectName : QDir( mDataDir ).entryList( QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name ) )
+  {
+    QJsonObject project = projectInfo( projectName );
+    project.remove( QStringLiteral( "files" ) );
+    project.insert( QStringLiteral( "tags" ), QJsonArray( { QStringLiteral( "input_use" ) } ) );
+    projects.append( project );
+  }
+  sendCacheableResponse( socket, request, QJsonDocument( projects ).toJson( QJsonDocument::Compact ) );
+}
+
+void LocalMerginServer::sendProjectInfo( QTcpSocket *socket, const QString &projectName, const Request &request )
+{
+  sendCacheableResponse( socket, request, QJsonDocument( projectInfo( projectName ) ).toJson( QJsonDocument::Compact ) );
+}
+
+void LocalMerginServer::sendRawFile( QTcpSocket *socket, const QString &projectName, const Request &request )
+{
+  QString filePath = QUrlQuery( request.url ).queryItemValue( QStringLiteral( "file" ), QUrl::FullyDecoded );
+  QFile *file = new QFile( projectDir( projectName ) + '/' + filePath );
+  if ( filePath.isEmpty() || !file->open( QIODevice::ReadOnly ) )
+  {
+    delete file;
+    sendResponse( socket, 404, QByteArray() );
+    return;
+  }
+
+  qint64 size = file->size();
+  QByteArray range = request.headers.value( "range" );
+  if ( range.isEmpty() && mCompressionEnabled && size <= MAX_COMPRESSED_SIZE && Compression::isCompressible( file->fileName() ) )
+  {
+    sendEncodedResponse( socket, request, 200, file->readAll(), "application/octet-stream" );
+    delete file;
+    return;
+  }
+  if ( range.isEmpty() )
+  {
+    sendBody( socket, 200, file, size, "application/octet-stream" );
+    return;
+  }
+
+  // only "bytes=<first>-" form is used by MerginApi
+  mRangeRequests << range;
+  qint64 first = range.mid( 6 ).split( '-' ).first().toLongLong();
+  if ( !range.startsWith( "bytes=" ) || first >= size )
+  {
+    delete file;
+    sendResponse( socket, 416, QByteArray() );
+    return;
+  }
+
+  file->seek( first );
+  QByteArray contentRange = QStringLiteral( "Content-Range: bytes %1-%2/%3\r\n" ).arg( first ).arg( size - 1 ).arg( size ).toLatin1();
+  sendBody( socket, 206, file, size - first, "application/octet-stream", contentRange );
+}
+
+void LocalMerginServer::sendDelta( QTcpSocket *socket, const QString &projectName, const Request &request )
+{
+  // request body is a signature of the client's version of the file
+  QString filePath = QUrlQuery( request.url ).queryItemValue( QStringLiteral( "file" ), QUrl::FullyDecoded );
+  QBuffer *delta = new QBuffer;
+  delta->open( QIODevice::ReadWrite );
+  if ( filePath.isEmpty() || !BlockDelta::createDelta( projectDir( projectName ) + '/' + filePath, request.body, delta ) )
+  {
+    delete delta;
+    sendResponse( socket, 400, QByteArray( "{\"detail\": \"Invalid signature\"}" ) );
+    return;
+  }
+
+  mDeltaBytes += delta->size();
+  if ( delta->size() <= MAX_COMPRESSED_SIZE )
+  {
+    sendEncodedResponse( socket, request, 200, delta->data(), "application/octet-stream" );
+    delete delta;
+    return;
+  }
+  delta->seek( 0 );
+  sendBody( socket, 200, delta, delta->size(), "application/octet-stream" );
+}
+
+void LocalMerginServer::sendMultipart( QTcpSocket *socket, const QString &projectName, const QStringList &files, const Request &request )
+{
+  QByteArray boundary = QCryptographicHash::hash( QDateTime::currentDateTime().toString().toLatin1(), QCryptographicHash::Md5 ).toHex();
+  QByteArray body;
+  for ( const QString &path : files )
+  {
+    QFile file( projectDir( projectName ) + '/' + path );
+    if ( !file.open( QIODevice::ReadOnly ) )
+      continue;
+
+    body += "--" + boundary + "\r\n";
+    body += "Content-Disposition: form-data; name=\"" + path.toUtf8() + "\"; filename=\"" + path.toUtf8() + "\"\r\n\r\n";
+    body += file.readAll();
+    body += "\r\n";
+  }
+  body += "--" + boundary + "--\r\n";
+
+  sendEncodedResponse( socket, request, 200, body, "multipart/form-data; boundary=" + boundary );
+}
+
+void LocalMerginServer::sendResponse( QTcpSocket *socket, int status, const QByteArray &body, const QByteArray &contentType, const QByteArray &extraHeaders )
+{
+  QBuffer *buffer = new QBuffer();
+  buffer->setData( body );
+  buffer->open( QIODevice::ReadOnly );
+  sendBody( socket, status, buffer, body.size(), contentType, extraHeaders );
+}
+
+void LocalMerginServer::sendCacheableResponse( QTcpSocket *socket, const Request &request, const QByteArray &body )
+{
+  QByteArray etag = '"' + QCryptographicHash::hash( body, QCryptographicHash::Sha1 ).toHex() + '"';
+  QByteArray etagHeader = "ETag: " + etag + "\r\n";
+  if ( request.headers.value( "if-none-match" ) == etag )
+  {
+    mNotModifiedResponses++;
+    sendResponse( socket, 304, QByteArray(), "application/json", etagHeader );
+    return;
+  }
+  sendEncodedResponse( socket, request, 200, body, "application/json", etagHeader );
+}
+
+void LocalMerginServer::sendEncodedResponse( QTcpSocket *socket, const Request &request, int status, const QByteArray &body, const QByteArray &contentType,
+    const QByteArray &extraHeaders )
+{
+  QByteArray acceptEncoding = request.headers.value( "accept-encoding" ).toLower();
+  if ( mCompressionEnabled && body.size() <= MAX_COMPRESSED_SIZE && acceptEncoding.contains( "deflate" ) )
+  {
+    QByteArray compressed = Compression::deflate( body );
+    if ( !compressed.isEmpty() && Compression::isWorthIt( body.size(), compressed.size() ) )
+    {
+      mCompressedResponses++;
+      sendResponse( socket, status, compressed, contentType, "Content-Encoding: deflate\r\n" + extraHeaders );
+      return;
+    }
+  }
+  sendResponse( socket, status, body, contentType, extraHeaders );
+}
+
+void LocalMerginServer::sendBody( QTcpSocket *socket, int status, QIODevice *body, qint64 size, const QByteArray &contentType, const QByteArray &extraHeaders )
+{
+  std::shared_ptr<Connection> connection = mConnections.value( socket );
+  if ( !connection )
+  {
+    delete body;
+    return;
+  }
+
+  QByteArray reason;
+  switch ( status )
+  {
+    case 200: reason = "OK"; break;
+    case 206: reason = "Partial Content"; break;
+    case 304: reason = "Not Modified"; break;
+    case 400: reason = "Bad Request"; break;
+    case 401: reason = "Unauthorized"; break;
+    case 409: reason = "Conflict"; break;
+    case 416: reason = "Range Not Satisfiable"; break;
+    default: reason = "Not Found"; break;
+  }
+
+  QByteArray header = "HTTP/1.1 " + QByteArray::number( status ) + ' ' + reason + "\r\n";
+  header += "Content-Type: " + contentType + "\r\n";
+  header += "Content-Length: " + QByteArray::number( size ) + "\r\n";
+  header += extraHeaders;
+  if ( mCompressionEnabled )
+    header += "Accept-Encoding: deflate, gzip\r\n"; // content codings accepted in request bodies (RFC 7694)
+  if ( !mCapabilities.isEmpty() )
+    header += "X-Mergin-Capabilities: " + mCapabilities.join( QStringLiteral( ", " ) ).toLatin1() + "\r\n";
+  header += "Connection: close\r\n\r\n";
+  socket->write( header );
+
+  connection->body.reset( body );
+  connection->bodyRemaining = size;
+  connection->bodySent = 0;
+  writeBody( socket );
+}
+
+void LocalMerginServer::writeBody( QTcpSocket *socket )
+{
+  std::shared_ptr<Connection> connection = mConnections.value( socket );
+  if ( !connection || !connection->body || connection->writeScheduled )
+    return;
+
+  while ( connection->bodyRemaining > 0 && socket->bytesToWrite() < 4 * CHUNK_SIZE )
+  {
+    qint64 size = qMin( CHUNK_SIZE, connection->bodyRemaining );
+    if ( mDropAfterBytes >= 0 )
+      size = qMin( size, mDropAfterBytes - connection->bodySent );
+    if ( size <= 0 )
+      break;
+
+    if ( mBandwidthLimit > 0 )
+    {
+      int delay = consumeBandwidth( 0 );
+      if ( delay == 0 && mBandwidthTokens < 1 )
+        delay = 1;
+      if ( delay > 0 )
+      {
+        connection->writeScheduled = true;
+        QTimer::singleShot( delay, socket, [this, socket, connection]
+        {
+          connection->writeScheduled = false;
+          writeBody( socket );
+        } );
+        return;
+      }
+      size = qMin( size, qMax<qint64>( 1, static_cast<qint64>( mBandwidthTokens ) ) );
+    }
+
+    QByteArray chunk = connection->body->read( size );
+    if ( chunk.isEmpty() )
+      break;
+    consumeBandwidth( chunk.size() );
+    socket->write( chunk );
+    connection->bodySent += chunk.size();
+    connection->bodyRemaining -= chunk.size();
+  }
+
+  bool dropped = mDropAfterBytes >= 0 && connection->bodySent >= mDropAfterBytes;
+  if ( connection->bodyRemaining == 0 || dropped )
+  {
+    connection->body.reset();
+    socket->disconnectFromHost();
+  }
+}
+
+int LocalMerginServer::consumeBandwidth( qint64 bytes )
+{
+  if ( mBandwidthLimit <= 0 )
+    return 0;
+
+  // up to 100 ms of unused bandwidth may be used at once
+  qint64 now = mBandwidthClock.elapsed();
+  mBandwidthTokens = qMin( mBandwidthLimit / 10.0, mBandwidthTokens + static_cast<double>( now - mLastRefill ) * mBandwidthLimit / 1000 );
+  mLastRefill = now;
+  mBandwidthTokens -= bytes;
+  return mBandwidthTokens >= 0 ? 0 : static_cast<int>( -mBandwidthTokens * 1000 / mBandwidthLimit ) + 1;
+}
+
+QJsonObject LocalMerginServer::projectInfo( const QString &projectName ) const
+{
+  QString dir = projectDir( projectName ) + '/';
+  QDateTime updated = QFileInfo( dir ).lastModified();
+  QJsonArray files;
+  for ( const QString &path : projectFiles( projectName ) )
+  {
+    QFileInfo info( dir + path );
+    updated = qMax( updated, info.lastModified() );
+
+    QJsonObject fileObject;
+    QString checksum = fileChecksum( dir + path );
+    fileObject.insert( QStringLiteral( "path" ), path );
+    fileObject.insert( QStringLiteral( "checksum" ), checksum );
+    fileObject.insert( QStringLiteral( "size" ), info.size() );
+
+    AppliedDiff appliedDiff = mAppliedDiffs.value( projectName + '/' + path );
+    if ( !appliedDiff.path.isEmpty() && appliedDiff.result == checksum && mCapabilities.contains( QStringLiteral( "geodiff" ) ) )
+    {
+      QJsonObject diff;
+      diff.insert( QStringLiteral( "path" ), appliedDiff.path );
+      diff.insert( QStringLiteral( "checksum" ), fileChecksum( dir + appliedDiff.path ) );
+      diff.insert( QStringLiteral( "size" ), QFileInfo( dir + appliedDiff.path ).size() );
+      diff.insert( QStringLiteral( "base" ), appliedDiff.base );
+      fileObject.insert( QStringLiteral( "diff" ), diff );
+    }
+    files.append( fileObject );
+  }
+
+  QJsonObject info;
+  info.insert( QStringLiteral( "name" ), projectName );
+  info.insert( QStringLiteral( "created" ), QFileInfo( dir ).created().toUTC().toString( Qt::ISODateWithMs ) );
+  info.insert( QStringLiteral( "updated" ), updated.toUTC().toString( Qt::ISODateWithMs ) );
+  info.insert( QStringLiteral( "files" ), files );
+  return info;
+}
+
+QStringList LocalMerginServer::projectFiles( const QString &projectName ) const
+{
+  QString dir = projectDir( projectName ) + '/';
+  QStringList files;
+  QDirIterator it( dir, QDir::Files, QDirIterator::Subdirectories );
+  while ( it.hasNext() )
+  {
+    files << it.next().mid( dir.length() );
+  }
+  return files;
+}
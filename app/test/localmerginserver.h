@@ -0,0 +1,225 @@
+#ifndef LOCALMERGINSERVER_H
+#define LOCALMERGINSERVER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QUrl>
+#include <QJsonObject>
+#include <memory>
+
+class QTcpSocket;
+class QIODevice;
+
+/**
+ * Minimal HTTP server implementing Mergin API endpoints used by MerginApi, so sync can be
+ * tested without a live Mergin server. Projects are folders in server's data directory.
+ * Faults of a poor connection can be injected, see setDropAfterBytes() and setAcceptedChunkUploads().
+ * Compressed request bodies are accepted and replies are compressed if the client asks for it, see setCompressionEnabled().
+ * Optional features, e.g. changesets of GeoPackages, are announced to clients, see setCapabilities().
+ * Project listing and info have an ETag, conditional requests are answered by 304 Not Modified if they have not changed.
+ * Conditions of a slow network are simulated by setLatency(), setBandwidthLimit() and setDropInterval().
+ * Any credentials are accepted unless they are set by setCredentials().
+ * Each connection serves a single request and is closed afterwards.
+ */
+class LocalMerginServer: public QObject
+{
+    Q_OBJECT
+  public:
+    explicit LocalMerginServer( const QString &dataDir, QObject *parent = nullptr );
+
+    //! Starts listening on a port of localhost, a random one by default
+    bool listen( quint16 port = 0 );
+    QString url() const;
+    QString projectDir( const QString &projectName ) const;
+
+    /**
+     * Connection is closed after sending given number of bytes of a response body.
+     * Negative value (default) disables dropping of connections.
+     */
+    void setDropAfterBytes( qint64 bytes );
+
+    //! Values of Range headers of all received requests
+    QList<QByteArray> rangeRequests() const;
+
+    /**
+     * Requests uploading chunks are dropped without a response after accepting given number of chunks.
+     * Negative value (default) accepts all chunks.
+     */
+    void setAcceptedChunkUploads( int count );
+
+    //! Ids of all accepted chunks of push transactions
+    QStringList uploadedChunks() const;
+
+    //! Total size of deltas of files sent to clients
+    qint64 deltaBytes() const;
+
+    //! Number of requests of deltas of files (delta endpoint)
+    int deltaRequests() const;
+
+    /**
+     * If enabled (default), server announces it accepts compressed request bodies and compresses
+     * replies for clients which accept it. Compressed requests are decompressed in any case.
+     */
+    void setCompressionEnabled( bool enabled );
+
+    //! Number of received requests with a compressed body
+    int compressedRequests() const;
+
+    //! Number of replies sent with a compressed body
+    int compressedResponses() const;
+
+    //! Number of 304 Not Modified replies to conditional requests of project listing and info
+    int notModifiedResponses() const;
+
+    //! Requests with other credentials are answered by 401 Unauthorized, empty username accepts any credentials (default)
+    void setCredentials( const QString &username, const QString &password );
+
+    //! Each response is delayed by given msecs after its request has been received
+    void setLatency( int msecs );
+
+    /**
+     * Limits bytes per second shared by all connections, 0 (default) means no limit. Response bodies are sent
+     * no faster than the limit, a received request is handled only when the time its body would take has passed.
+     */
+    void setBandwidthLimit( qint64 bytesPerSecond );
+
+    /**
+     * Every n-th request transferring files (raw, fetch, delta, download and chunk upload) is dropped
+     * without a response. Zero (default) disables dropping of requests.
+     */
+    void setDropInterval( int requests );
+
+    //! Number of all received requests
+    int requestCount() const;
+
+    //! Number of requests dropped by setDropInterval()
+    int droppedRequests() const;
+
+    //! Number of requests of whole projects (download endpoint)
+    int projectDownloads() const;
+
+    /**
+     * Optional features announced to clients by X-Mergin-Capabilities header, "geodiff", "block-delta" and "push" by default. Without "geodiff"
+     * changesets of GeoPackages are neither offered nor recognized in pushes, uploaded data replace the file then.
+     * Without "block-delta" the delta endpoint is not found, without "push" the push endpoints are not found.
+     */
+    void setCapabilities( const QStringList &capabilities );
+
+    //! Number of uploads by the data_sync endpoint, used by clients if the server does not announce "push"
+    int dataSyncRequests() const;
+
+    //! Number of GeoPackage changesets applied by pushes
+    int appliedChangesets() const;
+
+    //! Number of requests of selected files (raw and fetch endpoints)
+    int fileRequests() const;
+
+  private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onBytesWritten();
+    void onDisconnected();
+
+  private:
+    struct Request
+    {
+      QByteArray method;
+      QUrl url;
+      QHash<QByteArray, QByteArray> headers; // lower case names
+      QByteArray body;
+    };
+
+    struct Connection
+    {
+      QByteArray buffer; // received data of a request
+      std::unique_ptr<QIODevice> body; // body of a response being sent
+      qint64 bodyRemaining = 0;
+      qint64 bodySent = 0;
+      bool writeScheduled = false; // writing waits for the bandwidth limit
+    };
+
+    //! Push transaction of an upload, files are put together from chunks when it is finished
+    struct Transaction
+    {
+      QString projectName;
+      QJsonObject changes;
+      QHash<QString, QByteArray> chunks; // chunk id -> data
+    };
+
+    //! Changeset applied to a GeoPackage by the last push, offered to clients having the base version
+    struct AppliedDiff
+    {
+      QString path; // relative to the project dir
+      QString base; // checksum of the file before the changeset was applied
+      QString result; // checksum of the file after the changeset was applied
+    };
+
+    void handleRequest( QTcpSocket *socket, const Request &request );
+    bool isAuthorized( const Request &request ) const;
+    bool isDropped( const QStringList &path );
+    void createProject( QTcpSocket *socket, const Request &request );
+    void deleteProject( QTcpSocket *socket, const QString &projectName );
+    void handlePush( QTcpSocket *socket, const QStringList &path, const Request &request );
+    //! Applies changes uploaded whole in a multipart form by the data_sync endpoint
+    void handleDataSync( QTcpSocket *socket, const QString &projectName, const Request &request );
+    bool applyChanges( const QString &projectName, const QJsonObject &changes, const QHash<QString, QByteArray> &chunks );
+    void sendProjectList( QTcpSocket *socket, const Request &request );
+    void sendProjectInfo( QTcpSocket *socket, const QString &projectName, const Request &request );
+    void sendRawFile( QTcpSocket *socket, const QString &projectName, const Request &request );
+    void sendDelta( QTcpSocket *socket, const QString &projectName, const Request &request );
+    void sendMultipart( QTcpSocket *socket, const QString &projectName, const QStringList &files, const Request &request );
+    void sendResponse( QTcpSocket *socket, int status, const QByteArray &body, const QByteArray &contentType = "application/json",
+                       const QByteArray &extraHeaders = QByteArray() );
+    //! Sends body compressed if the client accepts it and it makes the body smaller
+    void sendEncodedResponse( QTcpSocket *socket, const Request &request, int status, const QByteArray &body, const QByteArray &contentType,
+                              const QByteArray &extraHeaders = QByteArray() );
+    //! Sends JSON body with ETag of its content or 304 Not Modified if the client has it already (If-None-Match)
+    void sendCacheableResponse( QTcpSocket *socket, const Request &request, const QByteArray &body );
+    void sendBody( QTcpSocket *socket, int status, QIODevice *body, qint64 size, const QByteArray &contentType, const QByteArray &extraHeaders = QByteArray() );
+    void writeBody( QTcpSocket *socket );
+    //! Consumes bytes of the bandwidth limit, returns msecs until all consumed bytes are within the limit
+    int consumeBandwidth( qint64 bytes );
+
+    QJsonObject projectInfo( const QString &projectName ) const;
+    QStringList projectFiles( const QString &projectName ) const;
+
+    QTcpServer mServer;
+    QString mDataDir;
+    qint64 mDropAfterBytes = -1;
+    QHash<QTcpSocket *, std::shared_ptr<Connection>> mConnections;
+    QList<QByteArray> mRangeRequests;
+    QHash<QString, Transaction> mTransactions;
+    int mAcceptedChunkUploads = -1;
+    QStringList mUploadedChunks;
+    qint64 mDeltaBytes = 0;
+    int mDeltaRequests = 0;
+    bool mCompressionEnabled = true;
+    int mCompressedRequests = 0;
+    int mCompressedResponses = 0;
+    int mNotModifiedResponses = 0;
+    QHash<QString, AppliedDiff> mAppliedDiffs; // project name + '/' + file path -> changeset
+    QString mUsername;
+    QString mPassword;
+    int mLatency = 0;
+    qint64 mBandwidthLimit = 0;
+    double mBandwidthTokens = 0; // bytes which may be sent now, negative when the limit has been exceeded
+    QElapsedTimer mBandwidthClock;
+    qint64 mLastRefill = 0;
+    int mDropInterval = 0;
+    int mTransferRequests = 0;
+    int mRequestCount = 0;
+    int mDroppedRequests = 0;
+    int mProjectDownloads = 0;
+    QStringList mCapabilities = QStringList() << QStringLiteral( "geodiff" ) << QStringLiteral( "block-delta" ) << QStringLiteral( "push" );
+    int mDataSyncRequests = 0;
+    int mAppliedChangesets = 0;
+    int mFileRequests = 0;
+
+    const qint64 CHUNK_SIZE = 65536;
+    // Larger replies are sent uncompressed, they would be compressed in memory
+    const qint64 MAX_COMPRESSED_SIZE = 64 * 1024 * 1024;
+};
+
+#endif // LOCALMERGINSERVER_H
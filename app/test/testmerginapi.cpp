@@ -6,6 +6,60 @@
 #define STR(x)  STR1(x)
 
 #include "testmerginapi.h"
+#include "localmerginserver.h"
+#include "multipartparser.h"
+#include "checksumcache.h"
+#include "sha1.h"
+#include "geopackagediff.h"
+#include "compression.h"
+#include "changejournal.h"
+#include "projectscache.h"
+#include "blobstore.h"
+#include "diskwriter.h"
+#include "syncfilters.h"
+#include "jsonreader.h"
+#include "syncmanifest.h"
+
+#include <QJsonDocument>
+#include <QTimer>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+
+LocalServerScope::LocalServerScope( MerginApi *api )
+  : mApi( api )
+  , mApiRoot( api->apiRoot() )
+  , mSyncConcurrency( api->syncConcurrency() )
+  , mServer( mServerDir.path() )
+{
+  mListening = mServer.listen();
+  if ( mListening )
+    mApi->setApiRoot( mServer.url() );
+}
+
+LocalServerScope::~LocalServerScope()
+{
+  mApi->setApiRoot( mApiRoot );
+  mApi->setSyncConcurrency( mSyncConcurrency );
+}
+
+//! Returns random bytes of given size, which do not compress, e.g. content of a raster or a photo
+static QByteArray randomData( int size )
+{
+  QByteArray data;
+  data.resize( size );
+  for ( int i = 0; i < size; ++i )
+    data[i] = static_cast<char>( qrand() % 256 );
+  return data;
+}
+
+//! Writes a file of a project on the local server together with its folders, returns false if it cannot be written
+static bool writeServerFile( LocalMerginServer &server, const QString &projectName, const QString &path, const QByteArray &data )
+{
+  QString filePath = server.projectDir( projectName ) + '/' + path;
+  QDir().mkpath( QFileInfo( filePath ).absolutePath() );
+  QFile file( filePath );
+  return file.open( QIODevice::WriteOnly ) && file.write( data ) == data.size();
+}
 
 TestMerginApi::TestMerginApi( MerginApi *api, MerginProjectModel *mpm, ProjectModel *pm, QObject *parent )
 {
@@ -17,9 +71,33 @@ TestMerginApi::TestMerginApi( MerginApi *api, MerginProjectModel *mpm, ProjectMo
 
   testListProject();
   testDownloadProject();
+  testParallelDownload();
   testCreateProjectTwice();
   testDeleteNonExistingProject();
   testCreateDeleteProject();
+  testResumeDownload();
+  testResumeUpload();
+  testDeltaDownload();
+  testCompression();
+  testSyncScheduler();
+  testBandwidthLimit();
+  testCachedProjectList();
+  testChecksumCache();
+  testChangeJournal();
+  testProjectsCache();
+  testBlobStore();
+  testSyncTelemetry();
+  testNetworkConditions();
+  testSyncProjects();
+  testSyncFilter();
+  testSyncManifest();
+  testMultipartParser();
+  testDiskWriter();
+  testJsonReader();
+  testSha1();
+  testGeoPackageDiff();
+  testGeoPackageMerge();
+  testGeoPackageSync();
 
   cleanupTestCase();
   qDebug() << "TestMerginApi - ALL TESTS PASSED";
@@ -32,6 +110,23 @@ void TestMerginApi::initTestCase()
     {
       mApiRoot = ::getenv( "TEST_MERGIN_URL" );
     }
+    else
+    {
+      // offline run against a local server with the demo project the tests expect
+      mServer.reset( new LocalMerginServer( mServerDir.path() ) );
+      QVERIFY( mServer->listen() );
+      QString demoDir = mServer->projectDir( "mobile_demo_mod" );
+      QDir().mkpath( demoDir + "/data" );
+      QFile projectFile( demoDir + "/project.qgs" );
+      QVERIFY( projectFile.open( QIODevice::WriteOnly ) );
+      projectFile.write( "<!DOCTYPE qgis PUBLIC 'http://mrcc.com/qgis.dtd' 'SYSTEM'>\n<qgis projectname=\"mobile_demo_mod\" version=\"3.4.0\"/>\n" );
+      projectFile.close();
+      QFile dataFile( demoDir + "/data/trees.csv" );
+      QVERIFY( dataFile.open( QIODevice::WriteOnly ) );
+      dataFile.write( "id,species,x,y\n1,oak,17.1,48.1\n2,beech,17.2,48.2\n" );
+      dataFile.close();
+      mApiRoot = mServer->url();
+    }
     if ( ::getenv( "TEST_API_USERNAME" ) )
     {
       mUsername = ::getenv( "TEST_API_USERNAME" );
@@ -40,6 +135,8 @@ void TestMerginApi::initTestCase()
     {
       mPassword = ::getenv( "TEST_API_PASSWORD" );
     }
+    if ( mServer )
+      mServer->setCredentials( mUsername, mPassword );
     mApi->setApiRoot( mApiRoot );
     QSignalSpy spy( mApi, SIGNAL( authChanged() ) );
     mApi->authorize( mUsername, mPassword );
@@ -54,8 +151,9 @@ void TestMerginApi::testListProject()
   QSignalSpy spy( mApi, SIGNAL( listProjectsFinished( ProjectList ) ) );
   mApi->listProjects( QString() );
 
+  // listing cached by a previous run is emitted right away, before the reply
   QVERIFY( spy.wait( SHORT_REPLY ) );
-  QCOMPARE( spy.count(), 1 );
+  QVERIFY( spy.count() >= 1 );
 
   ProjectList projects = mMerginProjectModel->projects();
   Q_ASSERT( !mMerginProjectModel->projects().isEmpty() );
@@ -66,7 +164,7 @@ void TestMerginApi::testDownloadProject()
 {
   qDebug() << "TestMerginApi::testDownloadProject START";
   QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
-  QString projectName = "mobile_demo_mod"; // TODO depends on mergin test server, unless a project is created beforehand
+  QString projectName = "mobile_demo_mod"; // on the local server, it is created by initTestCase
   mApi->downloadProject( projectName );
 
   QVERIFY( spy.wait( 5000 ) );
@@ -78,6 +176,57 @@ void TestMerginApi::testDownloadProject()
   qDebug() << "TestMerginApi::testDownloadProject PASSED";
 }
 
+void TestMerginApi::testParallelDownload()
+{
+  qDebug() << "TestMerginApi::testParallelDownload START";
+  QString projectName = "TEMPORARY_PARALLEL_PROJECT";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+
+  // A large file split to several batches and small files fetched together
+  QHash<QString, QByteArray> contents;
+  contents.insert( QStringLiteral( "raster.tif" ), randomData( 6 * 1024 * 1024 ) );
+  for ( int i = 0; i < 5; ++i )
+    contents.insert( QStringLiteral( "notes/note%1.txt" ).arg( i ), QByteArray( "note " ) + QByteArray::number( i ) );
+  for ( auto it = contents.constBegin(); it != contents.constEnd(); ++it )
+    QVERIFY( writeServerFile( server, projectName, it.key(), it.value() ) );
+
+  // Single request of the whole project by default
+  QCOMPARE( mApi->syncConcurrency(), 1 );
+  QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  mApi->downloadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QCOMPARE( server.projectDownloads(), 1 );
+  QCOMPARE( server.fileRequests(), 0 );
+  // concurrency is not adapted above the default setting
+  QCOMPARE( mApi->transferController()->maxConcurrency(), 1 );
+  QCOMPARE( mApi->transferController()->concurrency(), 1 );
+
+  // Opted in parallel download fetches files by several requests instead
+  QString localDir = mProjectModel->dataDir() + "/" + projectName;
+  QDir( localDir ).removeRecursively();
+  mApi->setSyncConcurrency( 3 );
+  mApi->downloadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QCOMPARE( server.projectDownloads(), 1 );
+  QVERIFY( server.fileRequests() > 1 );
+  QCOMPARE( mApi->transferController()->maxConcurrency(), 3 );
+  QVERIFY( mApi->transferController()->concurrency() <= 3 );
+
+  for ( auto it = contents.constBegin(); it != contents.constEnd(); ++it )
+  {
+    QFile file( localDir + "/" + it.key() );
+    QVERIFY( file.open( QIODevice::ReadOnly ) );
+    QVERIFY( file.readAll() == it.value() );
+  }
+
+  QDir( localDir ).removeRecursively();
+  qDebug() << "TestMerginApi::testParallelDownload PASSED";
+}
+
 void TestMerginApi::testCreateProjectTwice()
 {
   qDebug() << "TestMerginApi::testCreateProjectTwice START";
@@ -168,6 +317,1566 @@ void TestMerginApi::testCreateDeleteProject()
   qDebug() << "TestMerginApi::testCreateDeleteProject PASSED";
 }
 
+void TestMerginApi::testResumeDownload()
+{
+  qDebug() << "TestMerginApi::testResumeDownload START";
+  QString projectName = "TEMPORARY_RESUME_PROJECT";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+
+  // Connection drops after each 512 KB, 12 MB file cannot be downloaded within retries of a single sync.
+  // The file is large enough to be requested alone by default, not within the single request of the whole project.
+  QByteArray content = randomData( 12 * 1024 * 1024 );
+  QVERIFY( writeServerFile( server, projectName, "raster.tif", content ) );
+  server.setDropAfterBytes( 512 * 1024 );
+
+  QCOMPARE( mApi->syncConcurrency(), 1 );
+  QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  mApi->downloadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), false );
+  QCOMPARE( server.projectDownloads(), 0 );
+
+  // Next sync continues with the partial file
+  server.setDropAfterBytes( -1 );
+  mApi->downloadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QVERIFY( !server.rangeRequests().isEmpty() );
+  QVERIFY( server.rangeRequests().last() != QByteArray( "bytes=0-" ) );
+
+  QFile localFile( mProjectModel->dataDir() + "/" + projectName + "/raster.tif" );
+  QVERIFY( localFile.open( QIODevice::ReadOnly ) );
+  QVERIFY( localFile.readAll() == content );
+  localFile.close();
+
+  QDir( mProjectModel->dataDir() + "/" + projectName ).removeRecursively();
+  qDebug() << "TestMerginApi::testResumeDownload PASSED";
+}
+
+void TestMerginApi::testResumeUpload()
+{
+  qDebug() << "TestMerginApi::testResumeUpload START";
+  QString projectName = "TEMPORARY_UPLOAD_PROJECT";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+  QDir().mkpath( server.projectDir( projectName ) );
+
+  // 25 MB file is uploaded in 3 chunks, server accepts only the first one
+  QByteArray content = randomData( 25 * 1024 * 1024 );
+  QString localDir = mProjectModel->dataDir() + "/" + projectName;
+  QDir().mkpath( localDir );
+  QFile localFile( localDir + "/data.gpkg" );
+  QVERIFY( localFile.open( QIODevice::WriteOnly ) );
+  localFile.write( content );
+  localFile.close();
+  server.setAcceptedChunkUploads( 1 );
+
+  mApi->setSyncConcurrency( 1 );
+
+  QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  mApi->uploadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), false );
+  QCOMPARE( server.uploadedChunks().size(), 1 );
+
+  // Next upload continues the transaction without sending the first chunk again
+  server.setAcceptedChunkUploads( -1 );
+  mApi->uploadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QStringList chunks = server.uploadedChunks();
+  QCOMPARE( chunks.size(), 3 );
+  QCOMPARE( chunks.removeDuplicates(), 0 );
+
+  QFile serverFile( server.projectDir( projectName ) + "/data.gpkg" );
+  QVERIFY( serverFile.open( QIODevice::ReadOnly ) );
+  QVERIFY( serverFile.readAll() == content );
+  serverFile.close();
+  QCOMPARE( server.dataSyncRequests(), 0 );
+
+  // Server which does not announce push transactions receives the changed file by data_sync
+  server.setCapabilities( QStringList() << QStringLiteral( "geodiff" ) << QStringLiteral( "block-delta" ) );
+  content.replace( 0, 100, QByteArray( 100, 'x' ) );
+  QVERIFY( localFile.open( QIODevice::WriteOnly ) );
+  localFile.write( content );
+  localFile.close();
+  mApi->uploadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QCOMPARE( server.dataSyncRequests(), 1 );
+  QCOMPARE( server.uploadedChunks().size(), 3 );
+  QVERIFY( serverFile.open( QIODevice::ReadOnly ) );
+  QVERIFY( serverFile.readAll() == content );
+  serverFile.close();
+
+  QDir( localDir ).removeRecursively();
+  qDebug() << "TestMerginApi::testResumeUpload PASSED";
+}
+
+void TestMerginApi::testDeltaDownload()
+{
+  qDebug() << "TestMerginApi::testDeltaDownload START";
+  QString projectName = "TEMPORARY_DELTA_PROJECT";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+
+  // 8 MB file is changed on the server in a few places, including inserted and removed bytes
+  QByteArray content = randomData( 8 * 1024 * 1024 );
+  QString localDir = mProjectModel->dataDir() + "/" + projectName;
+  QDir().mkpath( localDir );
+  QFile localFile( localDir + "/raster.tif" );
+  QVERIFY( localFile.open( QIODevice::WriteOnly ) );
+  localFile.write( content );
+  localFile.close();
+
+  content.replace( 1000, 100, QByteArray( 100, 'x' ) );
+  content.insert( 3 * 1024 * 1024, QByteArray( 5000, 'y' ) );
+  content.remove( 6 * 1024 * 1024, 3000 );
+  content.append( "end" );
+  QVERIFY( writeServerFile( server, projectName, "raster.tif", content ) );
+
+  // deltas do not depend on parallel requests
+  QCOMPARE( mApi->syncConcurrency(), 1 );
+  QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  mApi->updateProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QVERIFY( server.deltaBytes() > 0 );
+  QVERIFY( server.deltaBytes() < 256 * 1024 );
+  QCOMPARE( server.deltaRequests(), 1 );
+
+  QVERIFY( localFile.open( QIODevice::ReadOnly ) );
+  QVERIFY( localFile.readAll() == content );
+  localFile.close();
+
+  // server which does not announce deltas is not asked for them, the changed file is downloaded whole
+  server.setCapabilities( QStringList() << QStringLiteral( "geodiff" ) );
+  content.replace( 2000, 100, QByteArray( 100, 'z' ) );
+  QVERIFY( writeServerFile( server, projectName, "raster.tif", content ) );
+
+  mApi->updateProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QCOMPARE( server.deltaRequests(), 1 );
+
+  QVERIFY( localFile.open( QIODevice::ReadOnly ) );
+  QVERIFY( localFile.readAll() == content );
+  localFile.close();
+
+  QDir( localDir ).removeRecursively();
+  qDebug() << "TestMerginApi::testDeltaDownload PASSED";
+}
+
+void TestMerginApi::testCompression()
+{
+  qDebug() << "TestMerginApi::testCompression START";
+  QString projectName = "TEMPORARY_COMPRESSION_PROJECT";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+  QDir().mkpath( server.projectDir( projectName ) );
+
+  // TIFF with LZW compression is not compressed again, uncompressed TIFF is
+  QString localDir = mProjectModel->dataDir() + "/" + projectName;
+  QDir().mkpath( localDir );
+  QByteArray tiff = QByteArray::fromHex( "49492a00080000000100030103000100000005000000" "00000000" );
+  QFile tiffFile( localDir + "/lzw.tif" );
+  QVERIFY( tiffFile.open( QIODevice::WriteOnly ) );
+  tiffFile.write( tiff );
+  tiffFile.close();
+  QVERIFY( !Compression::isCompressible( tiffFile.fileName() ) );
+  tiff.replace( 18, 1, QByteArray( 1, 1 ) );
+  QVERIFY( tiffFile.open( QIODevice::WriteOnly ) );
+  tiffFile.write( tiff );
+  tiffFile.close();
+  QVERIFY( Compression::isCompressible( tiffFile.fileName() ) );
+  QVERIFY( tiffFile.remove() );
+
+  // CSV compresses well, content of JPEG is random
+  QHash<QString, QByteArray> contents;
+  QByteArray csv = "id,name,value\n";
+  for ( int i = 0; csv.size() < 3 * 1024 * 1024; ++i )
+    csv += QByteArray::number( i ) + ",feature " + QByteArray::number( i % 100 ) + "," + QByteArray::number( i * 7 % 1000 ) + "\n";
+  contents.insert( "data.csv", csv );
+  contents.insert( "photo.jpg", randomData( 1024 * 1024 ) );
+  for ( int i = 0; i < 3; ++i )
+    contents.insert( QStringLiteral( "notes%1.txt" ).arg( i ), QByteArray( "Note text " ).repeated( 200 ) );
+  for ( const QString &path : contents.keys() )
+  {
+    QFile file( localDir + "/" + path );
+    QVERIFY( file.open( QIODevice::WriteOnly ) );
+    file.write( contents.value( path ) );
+    file.close();
+  }
+
+  mApi->setSyncConcurrency( 2 );
+
+  // Chunks of the CSV and the text files are compressed, the JPEG is sent as it is
+  QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  mApi->uploadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QCOMPARE( server.compressedRequests(), 4 );
+  for ( const QString &path : contents.keys() )
+  {
+    QFile file( server.projectDir( projectName ) + "/" + path );
+    QVERIFY( file.open( QIODevice::ReadOnly ) );
+    QVERIFY( file.readAll() == contents.value( path ) );
+  }
+
+  // Fresh download gets the CSV and the batch of text files compressed
+  QDir( localDir ).removeRecursively();
+  mApi->updateProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QVERIFY( server.compressedResponses() >= 2 );
+  for ( const QString &path : contents.keys() )
+  {
+    QFile file( localDir + "/" + path );
+    QVERIFY( file.open( QIODevice::ReadOnly ) );
+    QVERIFY( file.readAll() == contents.value( path ) );
+  }
+
+  // Whole project downloaded in a single request at the default concurrency is compressed too and decompressed
+  // by pieces, received bytes are the compressed ones. The changed CSV is not cloned from the blob store.
+  QDir( localDir ).removeRecursively();
+  QDir( server.projectDir( projectName ) ).removeRecursively();
+  csv += "extra,feature 0,0\n";
+  QVERIFY( writeServerFile( server, projectName, "data.csv", csv ) );
+  mApi->setSyncConcurrency( 1 );
+  int compressedResponses = server.compressedResponses();
+  QSignalSpy statsSpy( mApi, SIGNAL( syncStatsRecorded( QString, QJsonObject ) ) );
+  mApi->downloadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QCOMPARE( server.projectDownloads(), 1 );
+  QVERIFY( server.compressedResponses() > compressedResponses );
+  QCOMPARE( statsSpy.count(), 1 );
+  QVERIFY( statsSpy.first().at( 1 ).toJsonObject().value( "bytesReceived" ).toDouble() < csv.size() / 2 );
+  QFile localCsv( localDir + "/data.csv" );
+  QVERIFY( localCsv.open( QIODevice::ReadOnly ) );
+  QVERIFY( localCsv.readAll() == csv );
+  localCsv.close();
+
+  QDir( localDir ).removeRecursively();
+  qDebug() << "TestMerginApi::testCompression PASSED";
+}
+
+void TestMerginApi::testSyncScheduler()
+{
+  qDebug() << "TestMerginApi::testSyncScheduler START";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+
+  QStringList projectNames;
+  for ( int i = 0; i < 5; ++i )
+  {
+    QString projectName = QStringLiteral( "TEMPORARY_SCHEDULER_PROJECT_%1" ).arg( i );
+    projectNames << projectName;
+    QVERIFY( writeServerFile( server, projectName, "data.txt", projectName.toUtf8() ) );
+  }
+
+  SyncScheduler *scheduler = mApi->syncScheduler();
+  int maxRunningJobs = scheduler->maxRunningJobs();
+  scheduler->setMaxRunningJobs( 2 );
+
+  QStringList startedJobs;
+  QSet<QString> runningJobs;
+  int maxObservedJobs = 0;
+  QMetaObject::Connection startedConnection = connect( scheduler, &SyncScheduler::jobStarted, [&startedJobs]( const QString & projectName )
+  {
+    startedJobs << projectName;
+  } );
+  QMetaObject::Connection stateConnection = connect( scheduler, &SyncScheduler::jobStateChanged, [&runningJobs, &maxObservedJobs]( const QString & projectName, SyncJob::State state )
+  {
+    if ( state == SyncJob::Running )
+      runningJobs << projectName;
+    else
+      runningJobs.remove( projectName );
+    maxObservedJobs = qMax( maxObservedJobs, runningJobs.size() );
+  } );
+
+  // Two background jobs start at once, the interactive one overtakes the queued background jobs
+  QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  for ( int i = 0; i < 4; ++i )
+    QVERIFY( mApi->scheduleSync( projectNames.at( i ), SyncJob::Update, SyncJob::Background ) );
+  mApi->updateProject( projectNames.at( 4 ) );
+  QCOMPARE( startedJobs, QStringList() << projectNames.at( 0 ) << projectNames.at( 1 ) );
+  QVERIFY( !mApi->scheduleSync( projectNames.at( 0 ), SyncJob::Update, SyncJob::Interactive ) );
+
+  // Interactive request of a project being synced already is refused as unsuccessful
+  mApi->uploadProject( projectNames.at( 0 ) );
+  QCOMPARE( spy.count(), 1 );
+  QCOMPARE( spy.at( 0 ).at( 1 ).toString(), projectNames.at( 0 ) );
+  QCOMPARE( spy.at( 0 ).at( 2 ).toBool(), false );
+  spy.clear();
+
+  // Queued job is cancelled right away
+  mApi->cancelSync( projectNames.at( 3 ) );
+  QCOMPARE( spy.count(), 1 );
+  QCOMPARE( spy.at( 0 ).at( 1 ).toString(), projectNames.at( 3 ) );
+  QCOMPARE( spy.at( 0 ).at( 2 ).toBool(), false );
+
+  while ( spy.count() < 5 )
+    QVERIFY( spy.wait( LONG_REPLY ) );
+  for ( int i = 1; i < spy.count(); ++i )
+    QCOMPARE( spy.at( i ).at( 2 ).toBool(), true );
+  QCOMPARE( startedJobs, QStringList() << projectNames.at( 0 ) << projectNames.at( 1 ) << projectNames.at( 4 ) << projectNames.at( 2 ) );
+  QCOMPARE( maxObservedJobs, 2 );
+  QVERIFY( scheduler->jobs().isEmpty() );
+
+  for ( const QString &projectName : startedJobs )
+  {
+    QFile file( mProjectModel->dataDir() + "/" + projectName + "/data.txt" );
+    QVERIFY( file.open( QIODevice::ReadOnly ) );
+    QCOMPARE( file.readAll(), projectName.toUtf8() );
+  }
+
+  disconnect( startedConnection );
+  disconnect( stateConnection );
+  scheduler->setMaxRunningJobs( maxRunningJobs );
+  for ( const QString &projectName : projectNames )
+    QDir( mProjectModel->dataDir() + "/" + projectName ).removeRecursively();
+  qDebug() << "TestMerginApi::testSyncScheduler PASSED";
+}
+
+void TestMerginApi::testBandwidthLimit()
+{
+  qDebug() << "TestMerginApi::testBandwidthLimit START";
+  QString projectName = "TEMPORARY_BANDWIDTH_PROJECT";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+
+  // 1 MB of two files at 512 KB/s takes about 2 s, less the initial burst and data left in read buffers
+  QByteArray content;
+  for ( const QString &fileName : QStringList() << "a.tif" << "b.tif" )
+  {
+    content = randomData( 512 * 1024 );
+    QVERIFY( writeServerFile( server, projectName, fileName, content ) );
+  }
+
+  TransferController *controller = mApi->transferController();
+  mApi->setSyncConcurrency( 2 );
+  controller->setBandwidthLimit( 512 * 1024 );
+  // higher limit is reached only by probing while a transfer runs
+  QCOMPARE( controller->maxConcurrency(), 2 );
+  QCOMPARE( controller->concurrency(), 1 );
+  QVERIFY( controller->readBufferSize() <= 128 * 1024 );
+
+  QSignalSpy ratesSpy( controller, SIGNAL( ratesChanged() ) );
+  QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  QElapsedTimer timer;
+  timer.start();
+  mApi->updateProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  qint64 elapsed = timer.elapsed();
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QVERIFY( elapsed >= 1000 );
+  QVERIFY( ratesSpy.count() > 0 );
+  QVERIFY( controller->concurrency() <= 2 );
+  QFile localFile( mProjectModel->dataDir() + "/" + projectName + "/b.tif" );
+  QVERIFY( localFile.open( QIODevice::ReadOnly ) );
+  QVERIFY( localFile.readAll() == content );
+  localFile.close();
+
+  // Transfers are not delayed without the limit
+  controller->setBandwidthLimit( 0 );
+  QCOMPARE( controller->throttleDelay(), 0 );
+  controller->consume( 1024 * 1024 );
+  QCOMPARE( controller->throttleDelay(), 0 );
+
+  QDir( mProjectModel->dataDir() + "/" + projectName ).removeRecursively();
+  qDebug() << "TestMerginApi::testBandwidthLimit PASSED";
+}
+
+void TestMerginApi::testCachedProjectList()
+{
+  qDebug() << "TestMerginApi::testCachedProjectList START";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+  QStringList projectNames;
+  projectNames << "TEMPORARY_CACHED_PROJECT_1" << "TEMPORARY_CACHED_PROJECT_2";
+  QDir().mkpath( server.projectDir( projectNames.at( 0 ) ) );
+
+  // First listing is downloaded and parsed
+  QSignalSpy spy( mApi, SIGNAL( listProjectsFinished( ProjectList ) ) );
+  mApi->listProjects( QString() );
+  QCOMPARE( spy.count(), 0 );
+  QVERIFY( spy.wait( SHORT_REPLY ) );
+  QVERIFY( hasProject( projectNames.at( 0 ), mApi->projects() ) );
+  QCOMPARE( server.notModifiedResponses(), 0 );
+
+  // Listing is emitted right away, the server confirms it has not changed
+  spy.clear();
+  mApi->listProjects( QString() );
+  QCOMPARE( spy.count(), 1 );
+  QVERIFY( spy.wait( SHORT_REPLY ) );
+  QCOMPARE( server.notModifiedResponses(), 1 );
+  QVERIFY( hasProject( projectNames.at( 0 ), mApi->projects() ) );
+
+  // Changed listing is downloaded again
+  QDir().mkpath( server.projectDir( projectNames.at( 1 ) ) );
+  spy.clear();
+  mApi->listProjects( QString() );
+  QCOMPARE( spy.count(), 1 );
+  QVERIFY( !hasProject( projectNames.at( 1 ), mApi->projects() ) );
+  QVERIFY( spy.wait( SHORT_REPLY ) );
+  QCOMPARE( server.notModifiedResponses(), 1 );
+  QVERIFY( hasProject( projectNames.at( 1 ), mApi->projects() ) );
+
+  // Project info is validated the same way, update of an unchanged project gets it from the cache
+  QVERIFY( writeServerFile( server, projectNames.at( 0 ), "data.txt", "data" ) );
+  QSignalSpy syncSpy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  mApi->updateProject( projectNames.at( 0 ) );
+  QVERIFY( syncSpy.wait( LONG_REPLY ) );
+  QCOMPARE( syncSpy.takeFirst().at( 2 ).toBool(), true );
+  mApi->updateProject( projectNames.at( 0 ) );
+  QVERIFY( syncSpy.wait( LONG_REPLY ) );
+  QCOMPARE( syncSpy.takeFirst().at( 2 ).toBool(), true );
+  QCOMPARE( server.notModifiedResponses(), 2 );
+  QVERIFY( QFile::exists( mProjectModel->dataDir() + "/" + projectNames.at( 0 ) + "/data.txt" ) );
+
+  // listing and project info are stored each in its own file
+  QVERIFY( QDir( mProjectModel->dataDir() + "/.responseCache" ).entryList( QDir::Files ).size() >= 2 );
+
+  for ( const QString &projectName : projectNames )
+    QDir( mProjectModel->dataDir() + "/" + projectName ).removeRecursively();
+  qDebug() << "TestMerginApi::testCachedProjectList PASSED";
+}
+
+void TestMerginApi::testChecksumCache()
+{
+  qDebug() << "TestMerginApi::testChecksumCache START";
+  QTemporaryDir projectDir;
+  QString filePath = projectDir.path() + "/data.csv";
+  QFile file( filePath );
+  QVERIFY( file.open( QIODevice::WriteOnly ) );
+  file.write( "id,name\n1,a\n" );
+  file.close();
+  // file has not been modified recently, so its checksum can be cached
+  QDateTime modified = QDateTime::currentDateTime().addSecs( -60 );
+  QVERIFY( file.open( QIODevice::ReadWrite ) );
+  QVERIFY( file.setFileTime( modified, QFileDevice::FileModificationTime ) );
+  file.close();
+
+  QByteArray checksum = ChecksumCache::fileChecksum( filePath );
+  ChecksumCache cache( projectDir.path() );
+  QCOMPARE( cache.checksum( "data.csv" ), checksum );
+  cache.save();
+  QVERIFY( QFile::exists( ChecksumCache::cacheFilePath( projectDir.path() ) ) );
+
+  // Content of the same size with unchanged mtime is not hashed again
+  QVERIFY( file.open( QIODevice::ReadWrite ) );
+  file.write( "id,name\n1,b\n" );
+  file.flush();
+  QVERIFY( file.setFileTime( modified, QFileDevice::FileModificationTime ) );
+  file.close();
+  ChecksumCache cachedCache( projectDir.path() );
+  QCOMPARE( cachedCache.checksum( "data.csv" ), checksum );
+
+  // Changed mtime results in a new checksum
+  QVERIFY( file.open( QIODevice::ReadWrite ) );
+  QVERIFY( file.setFileTime( modified.addSecs( 1 ), QFileDevice::FileModificationTime ) );
+  file.close();
+  QByteArray newChecksum = cachedCache.checksum( "data.csv" );
+  QVERIFY( newChecksum != checksum );
+  QCOMPARE( newChecksum, ChecksumCache::fileChecksum( filePath ) );
+  qDebug() << "TestMerginApi::testChecksumCache PASSED";
+}
+
+void TestMerginApi::testChangeJournal()
+{
+  qDebug() << "TestMerginApi::testChangeJournal START";
+  QTemporaryDir projectDir;
+  QString dir = projectDir.path() + "/";
+  auto writeFile = [dir]( const QString & path, const QByteArray & data )
+  {
+    QDir().mkpath( QFileInfo( dir + path ).absolutePath() );
+    QFile file( dir + path );
+    if ( file.open( QIODevice::WriteOnly ) )
+      file.write( data );
+  };
+  writeFile( "a.txt", "a" );
+  writeFile( "sub/b.txt", "b" );
+
+  ChangeJournal journal;
+  journal.setIgnoredSuffixes( QSet<QString>() << "gpkg-wal" );
+  QSet<QString> changedFiles;
+  QVERIFY( !journal.changedFiles( dir, changedFiles ) );
+  QCOMPARE( journal.lastModified( dir ), qMax( QFileInfo( dir ).lastModified(), QFileInfo( dir + "sub/b.txt" ).lastModified() ) );
+  if ( !journal.usesInotify() )
+  {
+    qDebug() << "TestMerginApi::testChangeJournal SKIPPED - inotify is not available";
+    return;
+  }
+
+  // Changes are recorded since the journal has been marked clean
+  journal.markClean( dir, journal.generation() );
+  QVERIFY( journal.changedFiles( dir, changedFiles ) );
+  QVERIFY( changedFiles.isEmpty() );
+
+  writeFile( "a.txt", "modified" );
+  QVERIFY( QFile::remove( dir + "sub/b.txt" ) );
+  writeFile( "sub/new/c.txt", "c" ); // file of a new dir may be created before the dir is watched
+  writeFile( ".mergin/state.json", "{}" );
+  writeFile( "data.gpkg-wal", "wal" );
+  QVERIFY( journal.changedFiles( dir, changedFiles ) );
+  QCOMPARE( changedFiles, QSet<QString>() << "a.txt" << "sub/b.txt" << "sub/new/c.txt" );
+  QVERIFY( journal.lastModified( dir ) >= QFileInfo( dir + "sub/new/c.txt" ).lastModified() );
+
+  // Changes made after the generation passed to markClean() are kept
+  quint64 generation = journal.generation();
+  writeFile( "sub/new/c.txt", "changed again" );
+  QVERIFY( journal.changedFiles( dir, changedFiles ) );
+  journal.markClean( dir, generation );
+  QVERIFY( journal.changedFiles( dir, changedFiles ) );
+  QCOMPARE( changedFiles, QSet<QString>() << "sub/new/c.txt" );
+
+  // A change is still known to unchangedSince() once it has been marked clean
+  quint64 checkedGeneration = journal.generation();
+  QVERIFY( journal.unchangedSince( dir, checkedGeneration ) );
+  writeFile( "a.txt", "modified again" );
+  journal.markClean( dir, journal.generation() );
+  QVERIFY( journal.changedFiles( dir, changedFiles ) );
+  QVERIFY( changedFiles.isEmpty() );
+  QVERIFY( !journal.unchangedSince( dir, checkedGeneration ) );
+
+  // Files of a dir moved away are not known, the journal cannot be trusted until it is marked clean again
+  QVERIFY( QDir().rename( dir + "sub", projectDir.path() + "-moved" ) );
+  QVERIFY( !journal.changedFiles( dir, changedFiles ) );
+  QDir( projectDir.path() + "-moved" ).removeRecursively();
+  qDebug() << "TestMerginApi::testChangeJournal PASSED";
+}
+
+void TestMerginApi::testProjectsCache()
+{
+  qDebug() << "TestMerginApi::testProjectsCache START";
+  QTemporaryDir dir;
+  QString filePath = dir.path() + "/.projectsCache.bin";
+  QDateTime updated = QDateTime::fromMSecsSinceEpoch( 1546300800000, Qt::UTC );
+  QDateTime lastSync = QDateTime::currentDateTime();
+  auto makeEntry = []( const QString & name, const QDateTime & updated, const QDateTime & lastSync )
+  {
+    ProjectsCache::Entry entry;
+    entry.name = name;
+    entry.updated = updated;
+    entry.lastSync = lastSync;
+    return entry;
+  };
+
+  {
+    ProjectsCache cache( filePath );
+    QCOMPARE( cache.count(), 0 );
+    cache.update( QList<ProjectsCache::Entry>() << makeEntry( "a", updated, lastSync ) << makeEntry( "b", QDateTime(), QDateTime() ) );
+    QVERIFY( !QFile::exists( filePath ) ); // written with a delay
+    QVERIFY( cache.flush() );
+  }
+  qint64 fileSize = QFileInfo( filePath ).size();
+
+  ProjectsCache::Entry entry;
+  {
+    ProjectsCache cache( filePath );
+    QCOMPARE( cache.count(), 2 );
+    QVERIFY( cache.entry( "a", entry ) );
+    QCOMPARE( entry.updated, updated );
+    QCOMPARE( entry.lastSync, lastSync );
+    QVERIFY( cache.entry( "b", entry ) );
+    QVERIFY( !entry.updated.isValid() );
+    QVERIFY( !cache.entry( "c", entry ) );
+
+    // Times of a known project are rewritten in place
+    cache.update( QList<ProjectsCache::Entry>() << makeEntry( "a", updated.addSecs( 1 ), lastSync ) << makeEntry( "b", updated, lastSync ) );
+    QVERIFY( cache.flush() );
+    QCOMPARE( QFileInfo( filePath ).size(), fileSize );
+
+    // Record of a removed project is reused by a new one
+    cache.update( QList<ProjectsCache::Entry>() << makeEntry( "a", updated.addSecs( 1 ), lastSync ) );
+    QVERIFY( cache.flush() );
+    cache.update( QList<ProjectsCache::Entry>() << makeEntry( "a", updated.addSecs( 1 ), lastSync ) << makeEntry( "c", updated, lastSync ) );
+    QVERIFY( cache.flush() );
+    QCOMPARE( QFileInfo( filePath ).size(), fileSize );
+  }
+
+  ProjectsCache cache( filePath );
+  QCOMPARE( cache.count(), 2 );
+  QVERIFY( cache.entry( "a", entry ) );
+  QCOMPARE( entry.updated, updated.addSecs( 1 ) );
+  QVERIFY( !cache.entry( "b", entry ) );
+  QVERIFY( cache.entry( "c", entry ) );
+  QCOMPARE( entry.lastSync, lastSync );
+
+  // File of another version is ignored and replaced
+  QFile file( filePath );
+  QVERIFY( file.open( QIODevice::WriteOnly ) );
+  file.write( "[{\"name\": \"a\"}]" );
+  file.close();
+  ProjectsCache replacedCache( filePath );
+  QCOMPARE( replacedCache.count(), 0 );
+  replacedCache.update( QList<ProjectsCache::Entry>() << makeEntry( "d", updated, lastSync ) );
+  QVERIFY( replacedCache.flush() );
+  QCOMPARE( ProjectsCache( filePath ).count(), 1 );
+  qDebug() << "TestMerginApi::testProjectsCache PASSED";
+}
+
+void TestMerginApi::testBlobStore()
+{
+  qDebug() << "TestMerginApi::testBlobStore START";
+  QStringList projectNames = QStringList() << "TEMPORARY_BLOB_PROJECT_A" << "TEMPORARY_BLOB_PROJECT_B";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+
+  // both projects have the same basemap and lookup table
+  QByteArray raster = randomData( 600 * 1024 );
+  QByteArray table( "id,name\n1,oak\n2,beech\n" );
+  for ( const QString &projectName : projectNames )
+  {
+    QVERIFY( writeServerFile( server, projectName, "basemap.tif", raster ) );
+    QVERIFY( writeServerFile( server, projectName, "lookup.csv", table ) );
+  }
+
+  mApi->setSyncConcurrency( 2 );
+
+  QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  QSignalSpy progressSpy( mApi, SIGNAL( downloadProgress( QString, qint64, qint64, double ) ) );
+  mApi->updateProject( projectNames.at( 0 ) );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QCOMPARE( progressSpy.last().at( 2 ).toLongLong(), static_cast<qint64>( raster.size() + table.size() ) );
+
+  // Files of the second project are cloned from the first one, nothing is downloaded
+  progressSpy.clear();
+  mApi->updateProject( projectNames.at( 1 ) );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QCOMPARE( progressSpy.last().at( 2 ).toLongLong(), static_cast<qint64>( 0 ) );
+
+  QString projectDir = mProjectModel->dataDir() + "/" + projectNames.at( 1 );
+  QFile rasterFile( projectDir + "/basemap.tif" );
+  QVERIFY( rasterFile.open( QIODevice::ReadWrite ) ); // files are clones, they can be edited
+  QVERIFY( rasterFile.readAll() == raster );
+  rasterFile.close();
+  QFile tableFile( projectDir + "/lookup.csv" );
+  QVERIFY( tableFile.open( QIODevice::ReadWrite ) );
+  QVERIFY( tableFile.readAll() == table );
+  tableFile.close();
+  // project files of the source keep their permissions
+  QFile firstRasterFile( mProjectModel->dataDir() + "/" + projectNames.at( 0 ) + "/basemap.tif" );
+  QVERIFY( firstRasterFile.permissions() & QFileDevice::WriteOwner );
+
+  // an edit of a clone does not change the other project
+  QVERIFY( rasterFile.open( QIODevice::ReadWrite ) );
+  rasterFile.write( "edited" );
+  rasterFile.close();
+  QVERIFY( firstRasterFile.open( QIODevice::ReadOnly ) );
+  QVERIFY( firstRasterFile.readAll() == raster );
+  firstRasterFile.close();
+
+  // Changed file is not offered anymore
+  BlobStore store( mProjectModel->dataDir() );
+  QString tableChecksum = QString::fromLatin1( ChecksumCache::fileChecksum( tableFile.fileName() ) );
+  QVERIFY( store.contains( tableChecksum, table.size() ) );
+  QVERIFY( tableFile.open( QIODevice::WriteOnly ) );
+  tableFile.write( "id,name\n" );
+  tableFile.close();
+  QFile firstTableFile( mProjectModel->dataDir() + "/" + projectNames.at( 0 ) + "/lookup.csv" );
+  QVERIFY( firstTableFile.open( QIODevice::WriteOnly ) );
+  firstTableFile.write( "id,name\n" );
+  firstTableFile.close();
+  QVERIFY( !store.contains( tableChecksum, table.size() ) );
+
+  // Content changed within the granularity of mtime, keeping size and mtime, is found when the clone is verified
+  QString notePath = mProjectModel->dataDir() + "/" + projectNames.at( 0 ) + "/note.txt";
+  QFile noteFile( notePath );
+  QVERIFY( noteFile.open( QIODevice::WriteOnly ) );
+  noteFile.write( "first" );
+  noteFile.close();
+  QString noteChecksum = QString::fromLatin1( ChecksumCache::fileChecksum( notePath ) );
+  QDateTime noteModified = QFileInfo( notePath ).lastModified();
+  store.add( noteChecksum, notePath );
+  QVERIFY( store.link( noteChecksum, 5, notePath + "_clone" ) );
+  QVERIFY( noteFile.open( QIODevice::WriteOnly ) );
+  noteFile.write( "other" );
+  noteFile.flush();
+  QVERIFY( noteFile.setFileTime( noteModified, QFileDevice::FileModificationTime ) );
+  noteFile.close();
+  QCOMPARE( QFileInfo( notePath ).lastModified(), noteModified );
+  QVERIFY( !store.link( noteChecksum, 5, notePath + "_clone" ) );
+  QVERIFY( !QFile::exists( notePath + "_clone" ) );
+  QVERIFY( !store.contains( noteChecksum, 5 ) );
+
+  // Content of deleted projects is not offered anymore
+  QString rasterChecksum = QString::fromLatin1( ChecksumCache::fileChecksum( server.projectDir( projectNames.at( 0 ) ) + "/basemap.tif" ) );
+  for ( const QString &projectName : projectNames )
+  {
+    QDir( mProjectModel->dataDir() + "/" + projectName ).removeRecursively();
+    mApi->projectDeleted( projectName );
+  }
+  QVERIFY( !BlobStore( mProjectModel->dataDir() ).contains( rasterChecksum, raster.size() ) );
+
+  qDebug() << "TestMerginApi::testBlobStore PASSED";
+}
+
+void TestMerginApi::testSyncTelemetry()
+{
+  qDebug() << "TestMerginApi::testSyncTelemetry START";
+  QString projectName = "TEMPORARY_TELEMETRY_PROJECT";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+
+  QByteArray data = randomData( 300 * 1024 );
+  for ( const QString &path : QStringList() << "photos/a.jpg" << "photos/b.jpg" )
+    QVERIFY( writeServerFile( server, projectName, path, data ) );
+
+  QTemporaryDir logDir;
+  QString logFile = logDir.path() + "/syncLog.jsonl";
+  mApi->setSyncConcurrency( 2 );
+  mApi->setSyncLogFile( logFile );
+
+  QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  QSignalSpy statsSpy( mApi, SIGNAL( syncStatsRecorded( QString, QJsonObject ) ) );
+  mApi->updateProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+
+  // stats are recorded before the sync is reported as finished
+  QCOMPARE( statsSpy.count(), 1 );
+  QCOMPARE( statsSpy.first().at( 0 ).toString(), projectName );
+  QJsonObject stats = statsSpy.first().at( 1 ).toJsonObject();
+  QCOMPARE( stats.value( "project" ).toString(), projectName );
+  QCOMPARE( stats.value( "type" ).toString(), QStringLiteral( "update" ) );
+  QVERIFY( stats.value( "successful" ).toBool() );
+  QCOMPARE( static_cast<qint64>( stats.value( "bytesWritten" ).toDouble() ), static_cast<qint64>( 2 * data.size() ) );
+  QVERIFY( stats.value( "bytesReceived" ).toDouble() >= 2 * data.size() );
+  QCOMPARE( stats.value( "bytesSent" ).toDouble(), 0.0 );
+  QVERIFY( stats.value( "requests" ).toInt() >= 2 ); // project info and files
+  QCOMPARE( stats.value( "retries" ).toInt(), 0 );
+
+  QJsonObject phases = stats.value( "phases" ).toObject();
+  for ( const QString &phase : QStringList() << "projectInfo" << "hashing" << "diffing" << "transfer" )
+    QCOMPARE( phases.value( phase ).toObject().value( "count" ).toInt(), 1 );
+  QVERIFY( phases.value( "parsing" ).toObject().value( "count" ).toInt() > 0 );
+  QVERIFY( phases.value( "diskWrite" ).toObject().value( "count" ).toInt() > 0 );
+  double phasesTime = 0;
+  for ( const QString &phase : QStringList() << "diffing" << "parsing" << "diskWrite" )
+    phasesTime += phases.value( phase ).toObject().value( "wall" ).toDouble();
+  // synchronous phases do not overlap
+  QVERIFY( phasesTime <= stats.value( "wall" ).toDouble() );
+
+  // a line of the log per sync
+  QFile log( logFile );
+  QVERIFY( log.open( QIODevice::ReadOnly ) );
+  QList<QByteArray> lines = log.readAll().trimmed().split( '\n' );
+  QCOMPARE( lines.size(), 1 );
+  QCOMPARE( QJsonDocument::fromJson( lines.first() ).object().value( "project" ).toString(), projectName );
+  log.close();
+
+  QDir( mProjectModel->dataDir() + "/" + projectName ).removeRecursively();
+  mApi->projectDeleted( projectName );
+  mApi->setSyncLogFile( QString() );
+  qDebug() << "TestMerginApi::testSyncTelemetry PASSED";
+}
+
+void TestMerginApi::testNetworkConditions()
+{
+  qDebug() << "TestMerginApi::testNetworkConditions START";
+  QString projectName = "TEMPORARY_NETWORK_PROJECT";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+  server.setCredentials( "network_user", "network_password" );
+
+  QByteArray data = randomData( 256 * 1024 );
+  for ( const QString &path : QStringList() << "a.bin" << "b.bin" )
+    QVERIFY( writeServerFile( server, projectName, path, data ) );
+
+  mApi->setSyncConcurrency( 2 );
+
+  // wrong credentials are refused
+  QSignalSpy authFailedSpy( mApi, SIGNAL( authFailed() ) );
+  mApi->authorize( "network_user", "wrong_password" );
+  QVERIFY( authFailedSpy.wait( SHORT_REPLY ) );
+  QSignalSpy authSpy( mApi, SIGNAL( authChanged() ) );
+  mApi->authorize( "network_user", "network_password" );
+  QVERIFY( authSpy.wait( SHORT_REPLY ) );
+
+  // the sync is slowed down by latency and bandwidth, a dropped request is retried
+  server.setLatency( 100 );
+  server.setBandwidthLimit( 512 * 1024 );
+  server.setDropInterval( 2 );
+  QElapsedTimer timer;
+  timer.start();
+  QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  mApi->updateProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QVERIFY( timer.elapsed() >= 800 ); // 512 KB at 512 KB/s, less a burst of unused bandwidth
+  QCOMPARE( server.droppedRequests(), 1 );
+
+  QString projectDir = mProjectModel->dataDir() + "/" + projectName;
+  for ( const QString &path : QStringList() << "/a.bin" << "/b.bin" )
+  {
+    QFile file( projectDir + path );
+    QVERIFY( file.open( QIODevice::ReadOnly ) );
+    QVERIFY( file.readAll() == data );
+  }
+
+  // the project is deleted on the server
+  server.setDropInterval( 0 );
+  QSignalSpy deletedSpy( mApi, SIGNAL( serverProjectDeleted( QString ) ) );
+  mApi->deleteProject( projectName );
+  QVERIFY( deletedSpy.wait( SHORT_REPLY ) );
+  QVERIFY( !QDir( server.projectDir( projectName ) ).exists() );
+
+  QDir( projectDir ).removeRecursively();
+  mApi->projectDeleted( projectName );
+  mApi->authorize( mUsername, mPassword );
+  QVERIFY( authSpy.wait( SHORT_REPLY ) );
+  qDebug() << "TestMerginApi::testNetworkConditions PASSED";
+}
+
+void TestMerginApi::testSyncProjects()
+{
+  qDebug() << "TestMerginApi::testSyncProjects START";
+  QStringList projectNames = QStringList() << "TEMPORARY_BATCH_PROJECT_A" << "TEMPORARY_BATCH_PROJECT_B" << "TEMPORARY_BATCH_PROJECT_C";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+  for ( const QString &projectName : projectNames )
+    QVERIFY( writeServerFile( server, projectName, "data.txt", projectName.toUtf8() ) );
+
+  // projects which have not been downloaded yet are downloaded by jobs of the batch
+  QSignalSpy finishedSpy( mApi, SIGNAL( batchSyncFinished( QStringList ) ) );
+  QSignalSpy progressSpy( mApi, SIGNAL( batchSyncProgress( qint64, qint64, int, int ) ) );
+  QSignalSpy projectSpy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  mApi->syncProjects( projectNames );
+  QVERIFY( finishedSpy.wait( LONG_REPLY ) );
+  QVERIFY( finishedSpy.first().at( 0 ).toStringList().isEmpty() );
+  QCOMPARE( projectSpy.count(), projectNames.size() );
+  QCOMPARE( progressSpy.last().at( 2 ).toInt(), projectNames.size() );
+  QCOMPARE( progressSpy.last().at( 3 ).toInt(), projectNames.size() );
+
+  for ( const QString &projectName : projectNames )
+  {
+    QString projectDir = mProjectModel->dataDir() + "/" + projectName;
+    QFile file( projectDir + "/data.txt" );
+    QVERIFY( file.open( QIODevice::ReadOnly ) );
+    QCOMPARE( file.readAll(), projectName.toUtf8() );
+    file.close();
+    QDir( projectDir ).removeRecursively();
+    mApi->projectDeleted( projectName );
+  }
+
+  qDebug() << "TestMerginApi::testSyncProjects PASSED";
+}
+
+void TestMerginApi::testSyncFilter()
+{
+  qDebug() << "TestMerginApi::testSyncFilter START";
+  QString projectName = "TEMPORARY_FILTER_PROJECT";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+  for ( const QString &path : QStringList() << "project.qgs" << "survey.csv" << "rasters/basemap.tif" << "forms/photo.jpg" )
+    QVERIFY( writeServerFile( server, projectName, path, path.toUtf8() ) );
+
+  mApi->setSyncFilter( projectName, QStringList() << "*.csv" << "forms/" );
+  QCOMPARE( mApi->syncFilter( projectName ), QStringList() << "*.csv" << "forms/" );
+  QCOMPARE( SyncFilters( mProjectModel->dataDir() + "/.syncFilters.json" ).filter( projectName ), mApi->syncFilter( projectName ) );
+
+  // only selected files and the QGIS project are downloaded
+  QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  mApi->downloadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QString projectDir = mProjectModel->dataDir() + "/" + projectName;
+  QVERIFY( QFile::exists( projectDir + "/project.qgs" ) );
+  QVERIFY( QFile::exists( projectDir + "/survey.csv" ) );
+  QVERIFY( QFile::exists( projectDir + "/forms/photo.jpg" ) );
+  QVERIFY( !QFile::exists( projectDir + "/rasters/basemap.tif" ) );
+
+  // excluded file missing locally is not removed from the server by an upload, excluded local file is not uploaded
+  QFile file( projectDir + "/survey.csv" );
+  QVERIFY( file.open( QIODevice::Append ) );
+  file.write( "changed" );
+  file.close();
+  QVERIFY( file.open( QIODevice::ReadOnly ) );
+  QByteArray content = file.readAll();
+  file.close();
+  QFile notes( projectDir + "/notes.txt" );
+  QVERIFY( notes.open( QIODevice::WriteOnly ) );
+  notes.write( "local only" );
+  notes.close();
+  mApi->uploadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QVERIFY( QFile::exists( server.projectDir( projectName ) + "/rasters/basemap.tif" ) );
+  QVERIFY( !QFile::exists( server.projectDir( projectName ) + "/notes.txt" ) );
+  QFile serverFile( server.projectDir( projectName ) + "/survey.csv" );
+  QVERIFY( serverFile.open( QIODevice::ReadOnly ) );
+  QCOMPARE( serverFile.readAll(), content );
+  serverFile.close();
+
+  // excluded local file is listed in the checksum cache without checksum, so the cache covers all files
+  QByteArray notesChecksum = "-";
+  ChecksumCache cache( projectDir );
+  QVERIFY( cache.storedChecksum( "notes.txt", notesChecksum ) );
+  QVERIFY( notesChecksum.isEmpty() );
+
+  // patterns match regardless of case
+  QTemporaryDir filtersDir;
+  SyncFilters filters( filtersDir.path() + "/filters.json" );
+  filters.setFilter( projectName, QStringList() << "Rasters/" << "SURVEY.csv" << "*.JPG" );
+  QVERIFY( filters.isIncluded( projectName, "rasters/basemap.tif" ) );
+  QVERIFY( filters.isIncluded( projectName, "survey.csv" ) );
+  QVERIFY( filters.isIncluded( projectName, "forms/photo.jpg" ) );
+  QVERIFY( !filters.isIncluded( projectName, "notes.txt" ) );
+
+  mApi->setSyncFilter( projectName, QStringList() );
+  QVERIFY( mApi->syncFilter( projectName ).isEmpty() );
+  QDir( projectDir ).removeRecursively();
+  mApi->projectDeleted( projectName );
+  qDebug() << "TestMerginApi::testSyncFilter PASSED";
+}
+
+void TestMerginApi::testSyncManifest()
+{
+  qDebug() << "TestMerginApi::testSyncManifest START";
+  QString projectName = "TEMPORARY_MANIFEST_PROJECT";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+  for ( const QString &path : QStringList() << "data.txt" << "notes.txt" )
+    QVERIFY( writeServerFile( server, projectName, path, path.toUtf8() ) );
+
+  // the manifest is saved from the server version the project has been synced to
+  QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  mApi->updateProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QString projectDir = mProjectModel->dataDir() + "/" + projectName;
+  SyncManifest manifest( projectDir );
+  QVERIFY( manifest.isValid() );
+  QVERIFY( manifest.updated().isValid() );
+  QStringList manifestFiles;
+  QVERIFY( MerginApi::readProjectFiles( manifest.data(), [&manifestFiles]( const MerginFile &file ) { manifestFiles << file.path; } ) );
+  manifestFiles.sort();
+  QCOMPARE( manifestFiles, QStringList() << "data.txt" << "notes.txt" );
+
+  // local changes are found without the server
+  auto findLocalChanges = [this, projectName]( QHash<QString, QList<MerginFile>> &changes )
+  {
+    QEventLoop loop;
+    QTimer::singleShot( LONG_REPLY, &loop, &QEventLoop::quit );
+    bool started = mApi->localChanges( projectName, [&changes, &loop]( const QHash<QString, QList<MerginFile>> &result )
+    {
+      changes = result;
+      loop.quit();
+    } );
+    if ( started )
+      loop.exec();
+    return started;
+  };
+  mApi->setApiRoot( QStringLiteral( "http://127.0.0.1:1" ) );
+  QHash<QString, QList<MerginFile>> changes;
+  QVERIFY( findLocalChanges( changes ) );
+  QVERIFY( changes.value( "added" ).isEmpty() && changes.value( "updated" ).isEmpty() && changes.value( "removed" ).isEmpty() );
+
+  QFile dataFile( projectDir + "/data.txt" );
+  QVERIFY( dataFile.open( QIODevice::Append ) );
+  dataFile.write( " changed" );
+  dataFile.close();
+  QVERIFY( QFile::remove( projectDir + "/notes.txt" ) );
+  QFile newFile( projectDir + "/new.txt" );
+  QVERIFY( newFile.open( QIODevice::WriteOnly ) );
+  newFile.write( "new" );
+  newFile.close();
+  QVERIFY( findLocalChanges( changes ) );
+  QCOMPARE( changes.value( "updated" ).size(), 1 );
+  QCOMPARE( changes.value( "updated" ).first().path, QStringLiteral( "data.txt" ) );
+  QCOMPARE( changes.value( "added" ).size(), 1 );
+  QCOMPARE( changes.value( "added" ).first().path, QStringLiteral( "new.txt" ) );
+  QCOMPARE( changes.value( "removed" ).size(), 1 );
+  QCOMPARE( changes.value( "removed" ).first().path, QStringLiteral( "notes.txt" ) );
+  mApi->setApiRoot( server.url() );
+
+  // project info of another version than the manifest makes the upload update the project first,
+  // files changed or removed only locally are not fetched from the server
+  QVERIFY( writeServerFile( server, projectName, "server.txt", "server" ) );
+  mApi->uploadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QVERIFY( QFile::exists( projectDir + "/server.txt" ) );
+  QVERIFY( QFile::exists( server.projectDir( projectName ) + "/new.txt" ) );
+  QVERIFY( !QFile::exists( server.projectDir( projectName ) + "/notes.txt" ) );
+  QVERIFY( QFile::exists( server.projectDir( projectName ) + "/server.txt" ) );
+  QVERIFY( !QFile::exists( projectDir + "/data.txt_conflict_copy0" ) );
+  QFile uploadedFile( server.projectDir( projectName ) + "/data.txt" );
+  QVERIFY( uploadedFile.open( QIODevice::ReadOnly ) );
+  QCOMPARE( uploadedFile.readAll(), QByteArray( "data.txt changed" ) );
+  uploadedFile.close();
+
+  // the manifest follows the uploaded version, nothing is left to upload
+  QVERIFY( SyncManifest( projectDir ).updated() > manifest.updated() );
+  QVERIFY( findLocalChanges( changes ) );
+  QVERIFY( changes.value( "added" ).isEmpty() && changes.value( "updated" ).isEmpty() && changes.value( "removed" ).isEmpty() );
+
+  QDir( projectDir ).removeRecursively();
+  mApi->projectDeleted( projectName );
+  qDebug() << "TestMerginApi::testSyncManifest PASSED";
+}
+
+//! Feeds a multipart stream to MultipartParser in chunks ending at given positions, returns "filename=data" of parsed parts
+static QStringList parseMultipart( const QByteArray &stream, const QList<int> &splits, MultipartParser::Event &lastEvent )
+{
+  MultipartParser parser( "boundary" );
+  QStringList parts;
+  QByteArray data;
+  int pos = 0;
+  int chunk = 0;
+  while ( true )
+  {
+    MultipartParser::Event event = parser.next();
+    switch ( event )
+    {
+      case MultipartParser::NeedMoreData:
+        if ( pos == stream.size() )
+          parser.finish();
+        else
+          pos += parser.write( stream.constData() + pos, ( chunk < splits.size() ? splits.at( chunk++ ) : stream.size() ) - pos );
+        break;
+      case MultipartParser::PartBegin:
+        data.clear();
+        break;
+      case MultipartParser::PartData:
+        data.append( parser.data(), parser.dataSize() );
+        break;
+      case MultipartParser::PartEnd:
+        parts << parser.filename() + '=' + QString::fromLatin1( data );
+        break;
+      case MultipartParser::Finished:
+      case MultipartParser::Error:
+        lastEvent = event;
+        return parts;
+    }
+  }
+}
+
+void TestMerginApi::testMultipartParser()
+{
+  qDebug() << "TestMerginApi::testMultipartParser START";
+  QByteArray stream( "preamble\r\n--boundary\r\nContent-Disposition: form-data; name=\"file\"; filename=\"a.txt\"\r\n\r\n"
+                     "first\r\n--bound! not a delimiter\r\n"
+                     "--boundary\r\nContent-Disposition: form-data; filename=\"empty.txt\"\r\n\r\n"
+                     "\r\n--boundary\r\nContent-Type: text/plain\r\nContent-Disposition: form-data; filename=\"b.bin\"\r\n\r\n"
+                     "second\r\n--boundary--\r\nepilogue" );
+  QStringList expected = QStringList() << QStringLiteral( "a.txt=first\r\n--bound! not a delimiter" ) << QStringLiteral( "empty.txt=" ) << QStringLiteral( "b.bin=second" );
+  MultipartParser::Event lastEvent = MultipartParser::Error;
+
+  // Whole stream at once, empty part has no data
+  QCOMPARE( parseMultipart( stream, QList<int>(), lastEvent ), expected );
+  QCOMPARE( lastEvent, MultipartParser::Finished );
+
+  // Delimiter and part headers split across chunks
+  int delimiterSplit = stream.indexOf( "\r\n--boundary\r\nContent-Disposition: form-data; filename=\"empty.txt\"" ) + 6;
+  int headerSplit = stream.indexOf( "filename=\"b.bin\"" ) + 4;
+  QCOMPARE( parseMultipart( stream, QList<int>() << delimiterSplit << headerSplit, lastEvent ), expected );
+  QCOMPARE( lastEvent, MultipartParser::Finished );
+
+  // Any split point and a byte per chunk
+  QList<int> byteSplits;
+  for ( int split = 1; split < stream.size(); ++split )
+  {
+    QCOMPARE( parseMultipart( stream, QList<int>() << split, lastEvent ), expected );
+    QCOMPARE( lastEvent, MultipartParser::Finished );
+    byteSplits << split;
+  }
+  QCOMPARE( parseMultipart( stream, byteSplits, lastEvent ), expected );
+  QCOMPARE( lastEvent, MultipartParser::Finished );
+
+  // Truncated body in data, headers or the closing delimiter is an error
+  int closingDelimiter = stream.indexOf( "\r\n--boundary--" );
+  for ( int size : QList<int>() << 0 << stream.indexOf( "not a delimiter" ) << headerSplit << closingDelimiter << closingDelimiter + 13 )
+  {
+    parseMultipart( stream.left( size ), QList<int>(), lastEvent );
+    QCOMPARE( lastEvent, MultipartParser::Error );
+  }
+  qDebug() << "TestMerginApi::testMultipartParser PASSED";
+}
+
+//! Runs the event loop until queued operations on a file have completed, returns false if any of them has failed
+static bool finishFile( DiskWriter &writer, const QString &filePath )
+{
+  QEventLoop loop;
+  bool written = false;
+  writer.finish( QStringList() << filePath, &loop, [&loop, &written]( bool result )
+  {
+    written = result;
+    loop.quit();
+  } );
+  loop.exec();
+  return written;
+}
+
+void TestMerginApi::testDiskWriter()
+{
+  qDebug() << "TestMerginApi::testDiskWriter START";
+  QTemporaryDir dir;
+  QString filePath = dir.path() + "/data.bin";
+  QByteArray chunk( 256 * 1024, 'x' );
+  DiskWriter writer;
+
+  // Preallocated file has the size of written data
+  writer.open( filePath, false, 4 * DiskWriter::MIN_PREALLOCATED_SIZE );
+  for ( int i = 0; i < 6; ++i )
+    QVERIFY( writer.write( filePath, chunk ) );
+  writer.close( filePath );
+  QVERIFY( finishFile( writer, filePath ) );
+  QCOMPARE( QFileInfo( filePath ).size(), static_cast<qint64>( 6 * chunk.size() ) );
+
+  // Appended data follow the existing content, truncated content is discarded
+  writer.open( filePath, true );
+  QVERIFY( writer.write( filePath, QByteArray( "tail" ) ) );
+  QVERIFY( finishFile( writer, filePath ) );
+  QCOMPARE( QFileInfo( filePath ).size(), static_cast<qint64>( 6 * chunk.size() + 4 ) );
+  writer.open( filePath, true );
+  writer.truncate( filePath );
+  QVERIFY( writer.write( filePath, QByteArray( "head" ) ) );
+  QVERIFY( finishFile( writer, filePath ) );
+  QFile file( filePath );
+  QVERIFY( file.open( QIODevice::ReadOnly ) );
+  QCOMPARE( file.readAll(), QByteArray( "head" ) );
+  file.close();
+
+  // Failure is reported once for the file
+  QString missingPath = dir.path() + "/missing/data.bin";
+  writer.open( missingPath, false );
+  writer.write( missingPath, chunk );
+  QVERIFY( !finishFile( writer, missingPath ) );
+  writer.open( filePath, false );
+  QVERIFY( finishFile( writer, filePath ) );
+
+  // Completion is reported from the event loop, the caller does not wait for the storage
+  bool finished = false;
+  writer.open( filePath, false );
+  for ( int i = 0; i < 4; ++i )
+    QVERIFY( writer.write( filePath, chunk ) );
+  writer.finish( QStringList() << filePath, this, [&finished]( bool ) { finished = true; } );
+  QVERIFY( !finished );
+  QTRY_VERIFY( finished );
+
+  qDebug() << "TestMerginApi::testDiskWriter PASSED";
+}
+
+void TestMerginApi::testJsonReader()
+{
+  qDebug() << "TestMerginApi::testJsonReader START";
+
+  // Tokens in document order, escapes are decoded and skipped values do not disturb the rest
+  QByteArray data( "{ \"a\\\"b\": [1, -2.5e1, true, null], \"skip\": {\"x\": [[]]}, \"s\": \"\\u017e\\n\\ud83d\\ude00\", \"e\": {} }" );
+  JsonReader reader( data );
+  QCOMPARE( reader.next(), JsonReader::BeginObject );
+  QCOMPARE( reader.next(), JsonReader::Key );
+  QCOMPARE( reader.string(), QStringLiteral( "a\"b" ) );
+  QCOMPARE( reader.next(), JsonReader::BeginArray );
+  QCOMPARE( reader.next(), JsonReader::Number );
+  QCOMPARE( reader.number(), 1.0 );
+  QCOMPARE( reader.next(), JsonReader::Number );
+  QCOMPARE( reader.number(), -25.0 );
+  QCOMPARE( reader.next(), JsonReader::True );
+  QCOMPARE( reader.next(), JsonReader::Null );
+  QCOMPARE( reader.next(), JsonReader::EndArray );
+  QCOMPARE( reader.next(), JsonReader::Key );
+  QCOMPARE( reader.rawString(), QByteArray( "skip" ) );
+  QCOMPARE( reader.next(), JsonReader::BeginObject );
+  reader.skipValue();
+  QCOMPARE( reader.next(), JsonReader::Key );
+  QCOMPARE( reader.next(), JsonReader::String );
+  QCOMPARE( reader.string(), QString::fromUtf8( "\xc5\xbe\n\xf0\x9f\x98\x80" ) );
+  QCOMPARE( reader.next(), JsonReader::Key );
+  QCOMPARE( reader.next(), JsonReader::BeginObject );
+  QCOMPARE( reader.next(), JsonReader::EndObject );
+  QCOMPARE( reader.next(), JsonReader::EndObject );
+  QCOMPARE( reader.next(), JsonReader::End );
+
+  // Malformed data
+  for ( const QByteArray &malformedData : QList<QByteArray>() << "" << "[1,]" << "{\"a\" 1}" << "[1 2]" << "[\"abc" << "{}}" << "[tru]" )
+  {
+    JsonReader malformed( malformedData );
+    JsonReader::Token token = malformed.next();
+    while ( token != JsonReader::End && token != JsonReader::Error )
+      token = malformed.next();
+    QCOMPARE( token, JsonReader::Error );
+  }
+
+  // Timestamps are parsed like QDateTime::fromString, including the fallback
+  for ( const QByteArray &text : QList<QByteArray>()
+        << "2019-04-01T09:35:55.803245Z" << "2019-04-01T09:35:55Z" << "2019-04-01T09:35:55.8Z" << "2019-04-01T09:35:55.99999Z"
+        << "2019-04-01T09:35:55.123" << "2019-04-01T09:35:55+02:00" << "2019-04-01T09:35:55.1-05:30" << "2019-04-01T24:00:00Z"
+        << "2019-02-30T09:35:55Z" << "2019-04-01" << "not a date" << "" )
+  {
+    QDateTime expected = QDateTime::fromString( QString::fromLatin1( text ), Qt::ISODateWithMs );
+    QDateTime parsed = JsonReader::parseDateTime( text.constData(), text.size() );
+    QCOMPARE( parsed.isValid(), expected.isValid() );
+    if ( expected.isValid() )
+    {
+      QCOMPARE( parsed, expected );
+      QCOMPARE( parsed.timeSpec(), expected.timeSpec() );
+    }
+  }
+
+  // Records of project lists and project info
+  QByteArray projectsData( "[{\"name\": \"a\", \"tags\": [\"input_use\", 1], \"created\": \"2019-04-01T09:35:55.803245Z\", \"extra\": {\"x\": []}},"
+                           " {\"name\": \"b\", \"created\": \"2019-04-01T09:35:55Z\", \"updated\": \"2019-04-02T10:00:00+01:00\"}]" );
+  QList<MerginProject> projects;
+  QVERIFY( MerginApi::readProjects( projectsData, true, [&projects]( const MerginProject &project ) { projects << project; } ) );
+  QCOMPARE( projects.size(), 2 );
+  QCOMPARE( projects[0].name, QStringLiteral( "a" ) );
+  QCOMPARE( projects[0].tags, QStringList() << QStringLiteral( "input_use" ) << QString() );
+  QCOMPARE( projects[0].serverUpdated, QDateTime( QDate( 2019, 4, 1 ), QTime( 9, 35, 55, 803 ), Qt::UTC ) );
+  QCOMPARE( projects[1].serverUpdated, QDateTime( QDate( 2019, 4, 2 ), QTime( 9, 0 ), Qt::UTC ) );
+  QVERIFY( !MerginApi::readProjects( projectsData.left( projectsData.size() - 1 ), true, []( const MerginProject & ) {} ) );
+
+  QByteArray filesData( "{\"name\": \"p\", \"files\": [{\"path\": \"data.gpkg\", \"checksum\": \"c1\", \"size\": 4096, \"mtime\": \"2019-04-01T09:35:55Z\","
+                        " \"diff\": {\"path\": \"data.gpkg-diff-1\", \"checksum\": \"c2\", \"size\": 12, \"base\": \"c0\"}}, {\"path\": \"a.txt\", \"size\": 3}], \"version\": \"v2\"}" );
+  QList<MerginFile> files;
+  QVERIFY( MerginApi::readProjectFiles( filesData, [&files]( const MerginFile &file ) { files << file; } ) );
+  QCOMPARE( files.size(), 2 );
+  QCOMPARE( files[0].path, QStringLiteral( "data.gpkg" ) );
+  QCOMPARE( files[0].checksum, QStringLiteral( "c1" ) );
+  QCOMPARE( files[0].size, static_cast<qint64>( 4096 ) );
+  QCOMPARE( files[0].diffPath, QStringLiteral( "data.gpkg-diff-1" ) );
+  QCOMPARE( files[0].diffChecksum, QStringLiteral( "c2" ) );
+  QCOMPARE( files[0].diffSize, static_cast<qint64>( 12 ) );
+  QCOMPARE( files[0].diffBase, QStringLiteral( "c0" ) );
+  QCOMPARE( files[1].path, QStringLiteral( "a.txt" ) );
+  QVERIFY( files[1].diffPath.isEmpty() );
+
+  qDebug() << "TestMerginApi::testJsonReader PASSED";
+}
+
+void TestMerginApi::testSha1()
+{
+  qDebug() << "TestMerginApi::testSha1 START";
+  QByteArray data = randomData( 1000 );
+
+  for ( Sha1::Backend backend : QList<Sha1::Backend>() << Sha1::Generic << Sha1::ShaNi )
+  {
+    if ( !Sha1::isSupported( backend ) )
+      continue;
+
+    Sha1 abc( backend );
+    abc.addData( QByteArray( "abc" ) );
+    QCOMPARE( abc.result().toHex(), QByteArray( "a9993e364706816aba3e25717850c26c9cd0d89d" ) );
+
+    // lengths around block and padding boundaries, added in pieces
+    for ( int size : QList<int>() << 0 << 1 << 55 << 56 << 63 << 64 << 65 << 119 << 120 << 1000 )
+    {
+      Sha1 hash( backend );
+      hash.addData( data.constData(), size / 3 );
+      hash.addData( data.constData() + size / 3, size - size / 3 );
+      QCOMPARE( hash.result(), QCryptographicHash::hash( data.left( size ), QCryptographicHash::Sha1 ) );
+    }
+  }
+
+  QTemporaryDir dir;
+  QFile file( dir.path() + "/data.bin" );
+  QVERIFY( file.open( QIODevice::WriteOnly ) );
+  file.write( data );
+  file.close();
+  QCOMPARE( Sha1::fileChecksum( file.fileName() ), QCryptographicHash::hash( data, QCryptographicHash::Sha1 ).toHex() );
+  qDebug() << "TestMerginApi::testSha1 PASSED";
+}
+
+//! GeoPackage geometry blob of a point with an envelope
+static QByteArray gpkgPoint( double x, double y )
+{
+  QByteArray blob( "GP" );
+  QDataStream stream( &blob, QIODevice::Append );
+  stream.setByteOrder( QDataStream::LittleEndian );
+  stream << quint8( 0 ) << quint8( 0x03 ) << qint32( 4326 ) << x << x << y << y;
+  stream << quint8( 1 ) << quint32( 1 ) << x << y;
+  return blob;
+}
+
+//! Creates a GeoPackage like database with a spatial index of "points" table maintained by triggers
+static bool createGeoPackage( const QString &path, const QList<QVariantList> &rows )
+{
+  bool ok = true;
+  {
+    QSqlDatabase db = QSqlDatabase::addDatabase( "QSQLITE", path );
+    db.setDatabaseName( path );
+    ok = db.open();
+    QSqlQuery query( db );
+    ok = ok && query.exec( "CREATE TABLE gpkg_geometry_columns (table_name TEXT, column_name TEXT)" );
+    ok = ok && query.exec( "INSERT INTO gpkg_geometry_columns VALUES ('points', 'geom')" );
+    ok = ok && query.exec( "CREATE TABLE points (fid INTEGER PRIMARY KEY, name TEXT, geom BLOB)" );
+    ok = ok && query.exec( "CREATE TABLE rtree_points_geom (id INTEGER PRIMARY KEY, minx REAL, maxx REAL, miny REAL, maxy REAL)" );
+    for ( const QVariantList &row : rows )
+    {
+      QByteArray geom = row.at( 2 ).toByteArray();
+      ok = ok && query.prepare( "INSERT INTO points VALUES (?, ?, ?)" );
+      query.addBindValue( row.at( 0 ) );
+      query.addBindValue( row.at( 1 ) );
+      query.addBindValue( geom );
+      ok = ok && query.exec();
+      ok = ok && query.prepare( "INSERT INTO rtree_points_geom VALUES (?, ?, ?, ?, ?)" );
+      query.addBindValue( row.at( 0 ) );
+      for ( double value : QList<double>() << row.at( 3 ).toDouble() << row.at( 3 ).toDouble() << row.at( 4 ).toDouble() << row.at( 4 ).toDouble() )
+        query.addBindValue( value );
+      ok = ok && query.exec();
+    }
+    // as in GeoPackages, the trigger calls a function which is not available in plain SQLite
+    ok = ok && query.exec( "CREATE TRIGGER rtree_points_geom_insert AFTER INSERT ON points WHEN NOT ST_IsEmpty(NEW.geom) "
+                           "BEGIN INSERT OR REPLACE INTO rtree_points_geom VALUES (NEW.fid, ST_MinX(NEW.geom), ST_MaxX(NEW.geom), "
+                           "ST_MinY(NEW.geom), ST_MaxY(NEW.geom)); END" );
+    db.close();
+  }
+  QSqlDatabase::removeDatabase( path );
+  return ok;
+}
+
+static bool execSql( const QString &path, const QString &sql )
+{
+  bool ok;
+  {
+    QSqlDatabase db = QSqlDatabase::addDatabase( "QSQLITE", path );
+    db.setDatabaseName( path );
+    QSqlQuery query( db );
+    ok = db.open() && query.exec( sql );
+    db.close();
+  }
+  QSqlDatabase::removeDatabase( path );
+  return ok;
+}
+
+static QStringList geoPackageContent( const QString &path )
+{
+  QStringList content;
+  {
+    QSqlDatabase db = QSqlDatabase::addDatabase( "QSQLITE", path );
+    db.setDatabaseName( path );
+    db.open();
+    QSqlQuery query( db );
+    query.exec( "SELECT fid, name, hex(geom) FROM points ORDER BY fid" );
+    while ( query.next() )
+      content << QStringLiteral( "%1 %2 %3" ).arg( query.value( 0 ).toString(), query.value( 1 ).toString(), query.value( 2 ).toString() );
+    query.exec( "SELECT id, minx, maxy FROM rtree_points_geom ORDER BY id" );
+    while ( query.next() )
+      content << QStringLiteral( "rtree %1 %2 %3" ).arg( query.value( 0 ).toString(), query.value( 1 ).toString(), query.value( 2 ).toString() );
+    query.exec( "SELECT name FROM sqlite_master WHERE type = 'trigger'" );
+    while ( query.next() )
+      content << query.value( 0 ).toString();
+    db.close();
+  }
+  QSqlDatabase::removeDatabase( path );
+  return content;
+}
+
+void TestMerginApi::testGeoPackageDiff()
+{
+  qDebug() << "TestMerginApi::testGeoPackageDiff START";
+  QTemporaryDir dir;
+  QString basePath = dir.path() + "/base.gpkg";
+  QString modifiedPath = dir.path() + "/modified.gpkg";
+  QString changesetPath = dir.path() + "/changeset";
+  QVERIFY( GeoPackageDiff::isGeoPackage( basePath ) );
+
+  QList<QVariantList> rows;
+  rows << ( QVariantList() << 1 << "a" << gpkgPoint( 1, 1 ) << 1 << 1 );
+  rows << ( QVariantList() << 2 << "b" << gpkgPoint( 2, 2 ) << 2 << 2 );
+  rows << ( QVariantList() << 3 << QVariant() << QVariant( QByteArray() ) << 0 << 0 );
+  QVERIFY( createGeoPackage( basePath, rows ) );
+
+  // deleted, updated and inserted feature
+  rows.removeFirst();
+  rows[0] = QVariantList() << 2 << "b2" << gpkgPoint( 5, 6 ) << 5 << 6;
+  rows << ( QVariantList() << 4 << "d" << gpkgPoint( 7, 8 ) << 7 << 8 );
+  QVERIFY( createGeoPackage( modifiedPath, rows ) );
+
+  QString error;
+  QVERIFY( GeoPackageDiff::createChangeset( basePath, modifiedPath, changesetPath, &error ) );
+  QVERIFY( QFileInfo( changesetPath ).size() < QFileInfo( modifiedPath ).size() );
+
+  // spatial index is updated without the triggers, which are kept
+  QVERIFY( GeoPackageDiff::applyChangeset( basePath, changesetPath, &error ) );
+  QCOMPARE( geoPackageContent( basePath ), geoPackageContent( modifiedPath ) );
+
+  // changeset cannot be applied twice, the database is not changed then
+  QVERIFY( !GeoPackageDiff::applyChangeset( basePath, changesetPath, &error ) );
+  QCOMPARE( geoPackageContent( basePath ), geoPackageContent( modifiedPath ) );
+
+  // changed schema requires the whole file
+  {
+    QSqlDatabase db = QSqlDatabase::addDatabase( "QSQLITE", modifiedPath );
+    db.setDatabaseName( modifiedPath );
+    QVERIFY( db.open() );
+    QSqlQuery query( db );
+    QVERIFY( query.exec( "ALTER TABLE points ADD COLUMN description TEXT" ) );
+    db.close();
+  }
+  QSqlDatabase::removeDatabase( modifiedPath );
+  QVERIFY( !GeoPackageDiff::createChangeset( basePath, modifiedPath, changesetPath, &error ) );
+  qDebug() << "TestMerginApi::testGeoPackageDiff PASSED";
+}
+
+void TestMerginApi::testGeoPackageMerge()
+{
+  qDebug() << "TestMerginApi::testGeoPackageMerge START";
+  QTemporaryDir dir;
+  QString basePath = dir.path() + "/base.gpkg";
+  QString localPath = dir.path() + "/local.gpkg";
+  QString serverPath = dir.path() + "/server.gpkg";
+  QString mergedPath = dir.path() + "/merged.gpkg";
+  QString expectedPath = dir.path() + "/expected.gpkg";
+
+  QList<QVariantList> rows;
+  rows << ( QVariantList() << 1 << "a" << gpkgPoint( 1, 1 ) << 1 << 1 );
+  rows << ( QVariantList() << 2 << "b" << gpkgPoint( 2, 2 ) << 2 << 2 );
+  rows << ( QVariantList() << 3 << "c" << gpkgPoint( 3, 3 ) << 3 << 3 );
+  QVERIFY( createGeoPackage( basePath, rows ) );
+
+  QList<QVariantList> localRows = rows;
+  localRows[0] = QVariantList() << 1 << "a-local" << gpkgPoint( 1, 1 ) << 1 << 1;
+  localRows[2] = QVariantList() << 3 << "c-local" << gpkgPoint( 3, 3 ) << 3 << 3;
+  localRows.removeAt( 1 );
+  localRows << ( QVariantList() << 4 << "d-local" << gpkgPoint( 5, 5 ) << 5 << 5 );
+  QVERIFY( createGeoPackage( localPath, localRows ) );
+
+  QList<QVariantList> serverRows = rows;
+  serverRows[0] = QVariantList() << 1 << "a" << gpkgPoint( 6, 6 ) << 6 << 6;
+  serverRows[1] = QVariantList() << 2 << "b-server" << gpkgPoint( 2, 2 ) << 2 << 2;
+  serverRows[2] = QVariantList() << 3 << "c-server" << gpkgPoint( 3, 3 ) << 3 << 3;
+  serverRows << ( QVariantList() << 4 << "d-server" << gpkgPoint( 4, 4 ) << 4 << 4 );
+  QVERIFY( createGeoPackage( serverPath, serverRows ) );
+
+  // note of the feature added locally refers to it by a foreign key
+  for ( const QString &path : QStringList() << basePath << localPath << serverPath )
+    QVERIFY( execSql( path, "CREATE TABLE notes (id INTEGER PRIMARY KEY, point_fid INTEGER REFERENCES points(fid), text TEXT)" ) );
+  QVERIFY( execSql( localPath, "INSERT INTO notes VALUES (1, 4, 'note of d-local')" ) );
+
+  // Edits of different rows and of different columns of a row are merged, feature added on both sides gets a new id
+  // and its note refers to it, column edited on both sides keeps the local value and edited row is not deleted
+  QJsonArray conflicts;
+  QString error;
+  QVERIFY( GeoPackageDiff::merge( basePath, localPath, serverPath, mergedPath, conflicts, &error ) );
+  QList<QVariantList> expectedRows;
+  expectedRows << ( QVariantList() << 1 << "a-local" << gpkgPoint( 6, 6 ) << 6 << 6 );
+  expectedRows << ( QVariantList() << 2 << "b-server" << gpkgPoint( 2, 2 ) << 2 << 2 );
+  expectedRows << ( QVariantList() << 3 << "c-local" << gpkgPoint( 3, 3 ) << 3 << 3 );
+  expectedRows << ( QVariantList() << 4 << "d-server" << gpkgPoint( 4, 4 ) << 4 << 4 );
+  expectedRows << ( QVariantList() << 5 << "d-local" << gpkgPoint( 5, 5 ) << 5 << 5 );
+  QVERIFY( createGeoPackage( expectedPath, expectedRows ) );
+  QCOMPARE( geoPackageContent( mergedPath ), geoPackageContent( expectedPath ) );
+
+  QCOMPARE( conflicts.size(), 2 );
+  QCOMPARE( conflicts.at( 0 ).toObject().value( "type" ).toString(), QStringLiteral( "delete_update" ) );
+  QCOMPARE( conflicts.at( 0 ).toObject().value( "key" ).toArray().first().toInt(), 2 );
+  QCOMPARE( conflicts.at( 1 ).toObject().value( "type" ).toString(), QStringLiteral( "update_update" ) );
+  QCOMPARE( conflicts.at( 1 ).toObject().value( "server" ).toArray().at( 1 ).toString(), QStringLiteral( "c-server" ) );
+  {
+    QSqlDatabase db = QSqlDatabase::addDatabase( "QSQLITE", mergedPath );
+    db.setDatabaseName( mergedPath );
+    QVERIFY( db.open() );
+    QSqlQuery query( db );
+    QVERIFY( query.exec( "SELECT point_fid FROM notes WHERE id = 1" ) && query.next() );
+    QCOMPARE( query.value( 0 ).toInt(), 5 );
+    db.close();
+  }
+  QSqlDatabase::removeDatabase( mergedPath );
+
+  // changed schema cannot be merged
+  {
+    QSqlDatabase db = QSqlDatabase::addDatabase( "QSQLITE", serverPath );
+    db.setDatabaseName( serverPath );
+    QVERIFY( db.open() );
+    QSqlQuery query( db );
+    QVERIFY( query.exec( "ALTER TABLE points ADD COLUMN description TEXT" ) );
+    db.close();
+  }
+  QSqlDatabase::removeDatabase( serverPath );
+  conflicts = QJsonArray();
+  QVERIFY( !GeoPackageDiff::merge( basePath, localPath, serverPath, mergedPath, conflicts, &error ) );
+  qDebug() << "TestMerginApi::testGeoPackageMerge PASSED";
+}
+
+void TestMerginApi::testGeoPackageSync()
+{
+  qDebug() << "TestMerginApi::testGeoPackageSync START";
+  QString projectName = "TEMPORARY_GEOPACKAGE_PROJECT";
+  LocalServerScope serverScope( mApi );
+  QVERIFY( serverScope.isListening() );
+  LocalMerginServer &server = serverScope.server();
+  QDir().mkpath( server.projectDir( projectName ) );
+  QString serverPath = server.projectDir( projectName ) + "/data.gpkg";
+  QString localPath = mProjectModel->dataDir() + "/" + projectName + "/data.gpkg";
+
+  QList<QVariantList> rows;
+  rows << ( QVariantList() << 1 << "a" << gpkgPoint( 1, 1 ) << 1 << 1 );
+  rows << ( QVariantList() << 2 << "b" << gpkgPoint( 2, 2 ) << 2 << 2 );
+  rows << ( QVariantList() << 3 << "c" << gpkgPoint( 3, 3 ) << 3 << 3 );
+  QVERIFY( createGeoPackage( serverPath, rows ) );
+
+  // A server which has not announced changesets gets the whole file
+  server.setCapabilities( QStringList() );
+  QSignalSpy spy( mApi, SIGNAL( syncProjectFinished( QString, QString, bool ) ) );
+  mApi->updateProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QVERIFY( execSql( localPath, "UPDATE points SET name = 'a-local' WHERE fid = 1" ) );
+  mApi->uploadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QCOMPARE( server.appliedChangesets(), 0 );
+  QFile serverFile( serverPath );
+  QFile localFile( localPath );
+  QVERIFY( serverFile.open( QIODevice::ReadOnly ) && localFile.open( QIODevice::ReadOnly ) );
+  QVERIFY( serverFile.readAll() == localFile.readAll() );
+  serverFile.close();
+  localFile.close();
+
+  // Once announced, local changes are uploaded as a changeset. The deletion is still in the write-ahead log
+  // of an open connection, the base saved after the upload must contain it.
+  server.setCapabilities( QStringList() << "geodiff" << "push" );
+  {
+    QSqlDatabase db = QSqlDatabase::addDatabase( "QSQLITE", "wal" );
+    db.setDatabaseName( localPath );
+    QVERIFY( db.open() );
+    QSqlQuery query( db );
+    QVERIFY( query.exec( "PRAGMA wal_autocheckpoint = 0" ) );
+    QVERIFY( query.exec( "PRAGMA journal_mode = WAL" ) );
+    QVERIFY( query.exec( "DELETE FROM points WHERE fid = 2" ) );
+    QVERIFY( QFileInfo( localPath + "-wal" ).size() > 0 );
+
+    mApi->uploadProject( projectName );
+    QVERIFY( spy.wait( LONG_REPLY ) );
+    QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+    QCOMPARE( server.appliedChangesets(), 1 );
+    db.close();
+  }
+  QSqlDatabase::removeDatabase( "wal" );
+  QCOMPARE( geoPackageContent( serverPath ), geoPackageContent( localPath ) );
+
+  // the next changeset has only the new change, the deletion would not apply again
+  QVERIFY( execSql( localPath, "UPDATE points SET name = 'c-local' WHERE fid = 3" ) );
+  mApi->uploadProject( projectName );
+  QVERIFY( spy.wait( LONG_REPLY ) );
+  QCOMPARE( spy.takeFirst().at( 2 ).toBool(), true );
+  QCOMPARE( server.appliedChangesets(), 2 );
+  QCOMPARE( geoPackageContent( serverPath ), geoPackageContent( localPath ) );
+
+  QDir( mProjectModel->dataDir() + "/" + projectName ).removeRecursively();
+  qDebug() << "TestMerginApi::testGeoPackageSync PASSED";
+}
+
 void TestMerginApi::cleanupTestCase()
 {
   QDir testDir( mProjectModel->dataDir() );
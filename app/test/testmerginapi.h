@@ -2,14 +2,39 @@
 #define TESTMERGINAPI_H
 
 #include <QObject>
+#include <QTemporaryDir>
+#include <memory>
 
 #include <qgsvectorlayer.h>
 #include <merginapi.h>
 #include <projectsmodel.h>
 #include <merginprojectmodel.h>
+#include "localmerginserver.h"
 
 #include <qgsapplication.h>
 
+/**
+ * Local server of a single test, used as the API root of MerginApi while the scope lasts. The API root and sync
+ * concurrency of MerginApi are restored when the scope ends, also when a failed check returns from the test early.
+ */
+class LocalServerScope
+{
+  public:
+    explicit LocalServerScope( MerginApi *api );
+    ~LocalServerScope();
+
+    bool isListening() const { return mListening; }
+    LocalMerginServer &server() { return mServer; }
+
+  private:
+    MerginApi *mApi;
+    QString mApiRoot;
+    int mSyncConcurrency;
+    QTemporaryDir mServerDir;
+    LocalMerginServer mServer;
+    bool mListening = false;
+};
+
 class TestMerginApi: public QObject
 {
     Q_OBJECT
@@ -21,21 +46,49 @@ class TestMerginApi: public QObject
     void initTestCase();
     void testListProject();
     void testDownloadProject();
+    void testParallelDownload();
     void testCreateProjectTwice();
     void testDeleteNonExistingProject();
     void testCreateDeleteProject();
+    void testResumeDownload();
+    void testResumeUpload();
+    void testDeltaDownload();
+    void testCompression();
+    void testSyncScheduler();
+    void testBandwidthLimit();
+    void testCachedProjectList();
+    void testChecksumCache();
+    void testChangeJournal();
+    void testProjectsCache();
+    void testBlobStore();
+    void testSyncTelemetry();
+    void testNetworkConditions();
+    void testSyncProjects();
+    void testSyncFilter();
+    void testSyncManifest();
+    void testMultipartParser();
+    void testDiskWriter();
+    void testJsonReader();
+    void testSha1();
+    void testGeoPackageDiff();
+    void testGeoPackageMerge();
+    void testGeoPackageSync();
 
     void cleanupTestCase();
 
   private:
     int SHORT_REPLY = 1000;
+    int LONG_REPLY = 30000;
 
     MerginApi *mApi;
     MerginProjectModel *mMerginProjectModel;
     ProjectModel *mProjectModel;
     QString mApiRoot;
-    QString mUsername;
-    QString mPassword;
+    QString mUsername = QStringLiteral( "test_user" );
+    QString mPassword = QStringLiteral( "test_password" );
+    // stands in for a Mergin server unless TEST_MERGIN_URL is set
+    QTemporaryDir mServerDir;
+    std::unique_ptr<LocalMerginServer> mServer;
 
     ProjectList getProjectList();
     bool hasProject( QString projectName, ProjectList projects );
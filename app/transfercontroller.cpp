@@ -0,0 +1,292 @@
+#include "transfercontroller.h"
+
+#include <QDebug>
+#include <QIODevice>
+#include <QNetworkReply>
+#include <QPointer>
+#include <cstring>
+
+namespace
+{
+  //! Request body read by the network stack no faster than the bandwidth limit allows
+  class ShapedUploadDevice: public QIODevice
+  {
+    public:
+      ShapedUploadDevice( const QByteArray &data, TransferController *controller )
+        : mData( data )
+        , mController( controller )
+      {
+      }
+
+      qint64 size() const override
+      {
+        return mData.size();
+      }
+
+    protected:
+      qint64 readData( char *data, qint64 maxSize ) override
+      {
+        qint64 size = qMin( maxSize, mData.size() - pos() );
+        if ( size <= 0 )
+          return 0;
+
+        if ( mController )
+        {
+          int delay = mController->throttleDelay();
+          if ( delay > 0 )
+          {
+            // the network stack reads again on readyRead
+            if ( !mReadyReadScheduled )
+            {
+              mReadyReadScheduled = true;
+              QTimer::singleShot( delay, this, [this]
+              {
+                mReadyReadScheduled = false;
+                emit readyRead();
+              } );
+            }
+            return 0;
+          }
+          size = qMin( size, qMax<qint64>( 1, mController->bandwidthLimit() / 8 ) );
+          mController->consume( size );
+        }
+
+        memcpy( data, mData.constData() + pos(), static_cast<size_t>( size ) );
+        return size;
+      }
+
+      qint64 writeData( const char *, qint64 ) override
+      {
+        return -1;
+      }
+
+    private:
+      QByteArray mData;
+      QPointer<TransferController> mController;
+      bool mReadyReadScheduled = false;
+  };
+}
+
+const qint64 TransferController::MIN_READ_BUFFER_SIZE;
+const qint64 TransferController::MAX_READ_BUFFER_SIZE;
+
+TransferController::TransferController( QObject *parent )
+  : QObject( parent )
+{
+  mClock.start();
+  mSampleTimer.setInterval( SAMPLE_INTERVAL );
+  connect( &mSampleTimer, &QTimer::timeout, this, &TransferController::sample );
+}
+
+int TransferController::maxConcurrency() const
+{
+  return mMaxConcurrency;
+}
+
+void TransferController::setMaxConcurrency( int maxConcurrency )
+{
+  // concurrency grows to a higher limit by adjustConcurrency() only while the network keeps up
+  mMaxConcurrency = qMax( 1, maxConcurrency );
+  mConcurrency = qMin( mConcurrency, mMaxConcurrency );
+  emit ratesChanged();
+}
+
+int TransferController::concurrency() const
+{
+  return mConcurrency;
+}
+
+qint64 TransferController::readBufferSize() const
+{
+  qint64 size = DEFAULT_READ_BUFFER_SIZE;
+  int receivingRequests = 0;
+  for ( const RequestStats &stats : mRequests )
+  {
+    if ( stats.responded )
+      ++receivingRequests;
+  }
+  if ( mDownloadRate > 0 && receivingRequests > 0 )
+    size = static_cast<qint64>( mDownloadRate / receivingRequests * READ_INTERVAL / 1000 );
+  if ( mBandwidthLimit > 0 )
+    size = qMin( size, mBandwidthLimit * READ_INTERVAL / 1000 );
+
+  return qBound( MIN_READ_BUFFER_SIZE, size, MAX_READ_BUFFER_SIZE );
+}
+
+qint64 TransferController::bandwidthLimit() const
+{
+  return mBandwidthLimit;
+}
+
+void TransferController::setBandwidthLimit( qint64 bytesPerSecond )
+{
+  bytesPerSecond = qMax<qint64>( 0, bytesPerSecond );
+  if ( mBandwidthLimit == bytesPerSecond )
+    return;
+
+  mBandwidthLimit = bytesPerSecond;
+  mTokens = 0;
+  mLastRefill = mClock.elapsed();
+  emit bandwidthLimitChanged();
+}
+
+double TransferController::downloadRate() const
+{
+  return mDownloadRate;
+}
+
+double TransferController::uploadRate() const
+{
+  return mUploadRate;
+}
+
+int TransferController::roundTripTime() const
+{
+  return static_cast<int>( mRoundTripTime );
+}
+
+void TransferController::track( QNetworkReply *reply )
+{
+  RequestStats stats;
+  stats.started = mClock.elapsed();
+  mRequests.insert( reply, stats );
+  if ( !mSampleTimer.isActive() )
+  {
+    mLastSample = mClock.elapsed();
+    mSampleTimer.start();
+  }
+
+  connect( reply, &QNetworkReply::uploadProgress, this, [this, reply]( qint64 bytesSent, qint64 bytesTotal )
+  {
+    auto it = mRequests.find( reply );
+    if ( it == mRequests.end() )
+      return;
+
+    mBytesSent += bytesSent - it->bytesSent;
+    it->bytesSent = bytesSent;
+    if ( bytesSent == bytesTotal && it->bodySent < 0 )
+      it->bodySent = mClock.elapsed();
+  } );
+  connect( reply, &QNetworkReply::metaDataChanged, this, [this, reply]
+  {
+    auto it = mRequests.find( reply );
+    if ( it == mRequests.end() || it->responded )
+      return;
+
+    // time from the end of the request to the response headers
+    it->responded = true;
+    addRoundTripTime( mClock.elapsed() - qMax( it->started, it->bodySent ) );
+  } );
+  connect( reply, &QNetworkReply::downloadProgress, this, [this, reply]( qint64 bytesReceived, qint64 )
+  {
+    auto it = mRequests.find( reply );
+    if ( it == mRequests.end() )
+      return;
+
+    mBytesReceived += bytesReceived - it->bytesReceived;
+    it->bytesReceived = bytesReceived;
+  } );
+  connect( reply, &QNetworkReply::finished, this, [this, reply]
+  {
+    mRequests.remove( reply );
+    // errors of the network layer, not replies with an error status or cancelled requests
+    QNetworkReply::NetworkError error = reply->error();
+    if ( error != QNetworkReply::NoError && error != QNetworkReply::OperationCanceledError && error < QNetworkReply::ProxyConnectionRefusedError )
+      ++mFailedRequests;
+  } );
+}
+
+int TransferController::throttleDelay()
+{
+  if ( mBandwidthLimit <= 0 )
+    return 0;
+
+  refillTokens();
+  return mTokens >= 0 ? 0 : static_cast<int>( -mTokens * 1000 / mBandwidthLimit ) + 1;
+}
+
+void TransferController::consume( qint64 bytes )
+{
+  if ( mBandwidthLimit <= 0 )
+    return;
+
+  refillTokens();
+  mTokens -= bytes;
+}
+
+QIODevice *TransferController::shapedUploadData( const QByteArray &data )
+{
+  QIODevice *device = new ShapedUploadDevice( data, this );
+  device->open( QIODevice::ReadOnly | QIODevice::Unbuffered );
+  return device;
+}
+
+void TransferController::sample()
+{
+  qint64 now = mClock.elapsed();
+  qint64 elapsed = qMax<qint64>( 1, now - mLastSample );
+  mLastSample = now;
+  mDownloadRate = mBytesReceived * 1000.0 / elapsed;
+  mUploadRate = mBytesSent * 1000.0 / elapsed;
+  mBytesReceived = 0;
+  mBytesSent = 0;
+
+  if ( mRequests.isEmpty() )
+  {
+    // idle, the next transfer starts with the last concurrency
+    mSampleTimer.stop();
+    mFailedRequests = 0;
+    mLastThroughput = 0;
+  }
+  else
+  {
+    adjustConcurrency( mDownloadRate + mUploadRate );
+  }
+  emit ratesChanged();
+}
+
+void TransferController::addRoundTripTime( qint64 msecs )
+{
+  msecs = qMax<qint64>( 1, msecs );
+  if ( mMinRoundTripTime == 0 || msecs < mMinRoundTripTime )
+    mMinRoundTripTime = msecs;
+  // smoothed as in TCP (RFC 6298)
+  mRoundTripTime = mRoundTripTime == 0 ? msecs : ( 7 * mRoundTripTime + msecs ) / 8;
+}
+
+void TransferController::adjustConcurrency( double throughput )
+{
+  if ( mHoldSamples > 0 )
+  {
+    --mHoldSamples;
+    mFailedRequests = 0;
+    mLastThroughput = throughput;
+    return;
+  }
+
+  bool congested = mFailedRequests > 0 || ( mMinRoundTripTime > 0 && mRoundTripTime > 2 * mMinRoundTripTime + RTT_TOLERANCE );
+  bool limited = mBandwidthLimit > 0 && throughput >= 0.9 * mBandwidthLimit;
+  if ( congested && mConcurrency > 1 )
+  {
+    mConcurrency = qMax( 1, mConcurrency / 2 );
+    mHoldSamples = 2;
+    qDebug() << "Transfer congested (RTT" << mRoundTripTime << "ms, min" << mMinRoundTripTime << "ms,"
+             << mFailedRequests << "failed requests), concurrency decreased to" << mConcurrency;
+  }
+  else if ( !congested && !limited && mConcurrency < mMaxConcurrency && mRequests.size() >= mConcurrency
+            && throughput >= 0.95 * mLastThroughput )
+  {
+    ++mConcurrency;
+  }
+  mFailedRequests = 0;
+  mLastThroughput = throughput;
+}
+
+void TransferController::refillTokens()
+{
+  qint64 now = mClock.elapsed();
+  // up to READ_INTERVAL of unused bandwidth may be used at once
+  double burst = static_cast<double>( mBandwidthLimit ) * READ_INTERVAL / 1000;
+  mTokens = qMin( burst, mTokens + static_cast<double>( now - mLastRefill ) * mBandwidthLimit / 1000 );
+  mLastRefill = now;
+}
@@ -0,0 +1,123 @@
+#ifndef TRANSFERCONTROLLER_H
+#define TRANSFERCONTROLLER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QTimer>
+
+class QIODevice;
+class QNetworkReply;
+
+/**
+ * Shapes network traffic of sync. Throughput and round-trip time of tracked requests are measured and the number
+ * of parallel requests is adapted AIMD-style: it grows by one while the requests keep the link busy and throughput
+ * does not drop, and it is halved when a request fails on a network error or round-trip time grows well above
+ * the lowest one seen (requests queue up somewhere). It starts at one request and probes upward, a higher limit
+ * set by setMaxConcurrency() does not raise it at once. The limit is the user's sync concurrency setting
+ * (MerginApi::syncConcurrency), 1 by default, so requests run one at a time and concurrency is adapted only
+ * once the setting has been raised. Size of read buffers follows throughput of a request in any case.
+ *
+ * One controller serves transfers of all projects, as they share the link: throughput, round-trip time and
+ * the bandwidth limit are measured over requests of all of them, and each running transfer uses concurrency() requests.
+ *
+ * Optional bandwidth limit is enforced by a token bucket shared by downloads and uploads: downloaded data are
+ * left in the read buffer of a reply, so network reading pauses, and upload data are handed to the network
+ * stack through shapedUploadData().
+ */
+class TransferController: public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY( double downloadRate READ downloadRate NOTIFY ratesChanged )
+    Q_PROPERTY( double uploadRate READ uploadRate NOTIFY ratesChanged )
+    Q_PROPERTY( int roundTripTime READ roundTripTime NOTIFY ratesChanged )
+    Q_PROPERTY( int concurrency READ concurrency NOTIFY ratesChanged )
+    Q_PROPERTY( qint64 bandwidthLimit READ bandwidthLimit WRITE setBandwidthLimit NOTIFY bandwidthLimitChanged )
+
+  public:
+    explicit TransferController( QObject *parent = nullptr );
+
+    //! Upper bound of concurrency(), current concurrency is lowered to it if it is above
+    int maxConcurrency() const;
+    void setMaxConcurrency( int maxConcurrency );
+
+    //! Number of parallel requests each running transfer should use now
+    int concurrency() const;
+
+    //! Size of read buffer of a reply, it holds data received by a request in about READ_INTERVAL
+    qint64 readBufferSize() const;
+
+    //! Max bytes per second of all transfers, 0 if not limited
+    qint64 bandwidthLimit() const;
+    void setBandwidthLimit( qint64 bytesPerSecond );
+
+    //! Bytes per second received / sent by tracked requests in the last sample
+    double downloadRate() const;
+    double uploadRate() const;
+    //! Smoothed round-trip time of requests in msecs, 0 if not measured yet
+    int roundTripTime() const;
+
+    //! Measures throughput and round-trip time of a request until it finishes
+    void track( QNetworkReply *reply );
+
+    //! Msecs to wait before more data are transferred, so the bandwidth limit is kept
+    int throttleDelay();
+    //! Takes transferred bytes from the bandwidth allowance
+    void consume( qint64 bytes );
+
+    //! Device with request body which is read no faster than the bandwidth limit allows, it is owned by the caller
+    QIODevice *shapedUploadData( const QByteArray &data );
+
+  signals:
+    void ratesChanged();
+    void bandwidthLimitChanged();
+
+  private slots:
+    void sample();
+
+  private:
+    struct RequestStats
+    {
+      qint64 started = 0; // msecs of mClock
+      qint64 bodySent = -1; // msecs of mClock when the whole request body has been sent
+      bool responded = false;
+      qint64 bytesReceived = 0;
+      qint64 bytesSent = 0;
+    };
+
+    void addRoundTripTime( qint64 msecs );
+    void adjustConcurrency( double throughput );
+    void refillTokens();
+
+    QHash<QNetworkReply *, RequestStats> mRequests;
+    QElapsedTimer mClock;
+    QTimer mSampleTimer;
+    qint64 mLastSample = 0; // msecs of mClock
+    qint64 mBytesReceived = 0; // since the last sample
+    qint64 mBytesSent = 0;
+    int mFailedRequests = 0; // since the last sample
+    double mDownloadRate = 0;
+    double mUploadRate = 0;
+    double mLastThroughput = 0;
+    qint64 mRoundTripTime = 0;
+    qint64 mMinRoundTripTime = 0;
+    int mMaxConcurrency = 1;
+    int mConcurrency = 1;
+    int mHoldSamples = 0; // samples to skip after concurrency has been decreased, until the change takes effect
+
+    qint64 mBandwidthLimit = 0;
+    double mTokens = 0; // bytes which may be transferred now, negative when in debt
+    qint64 mLastRefill = 0; // msecs of mClock
+
+    static const int SAMPLE_INTERVAL = 1000; // msecs
+    static const int READ_INTERVAL = 250; // msecs
+    static const qint64 MIN_READ_BUFFER_SIZE = 16 * 1024;
+    static const qint64 MAX_READ_BUFFER_SIZE = 4 * 1024 * 1024;
+    // Read buffer size until throughput is measured
+    static const qint64 DEFAULT_READ_BUFFER_SIZE = 1024 * 1024;
+    // Round-trip time is considered inflated above 2 * min + this, in msecs
+    static const qint64 RTT_TOLERANCE = 50;
+};
+
+#endif // TRANSFERCONTROLLER_H